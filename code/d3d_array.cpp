@@ -26,6 +26,9 @@
 #include "d3d_array.hpp"
 #include "d3d_matrix_stack.hpp"
 #include "d3d_helpers.hpp"
+#include "d3d_texgen_batch.hpp"
+#include "d3d_lists.hpp"
+#include "d3d_feedback.hpp"
 
 //!DO NOT UNCOMMENT THIS UNLESS YOU MAKE PERFORMANCE TESTS!
 //#define VA_USE_IMMEDIATE_MODE
@@ -151,6 +154,28 @@ static void D3DVA_CopyArrayToUBytes( const D3DVAInfo *pVAInfo, int index, GLubyt
 	}
 }
 
+static void D3DVA_FetchPosition( int elemIndex, int numVertexCoords, GLfloat *out )
+{
+	out[2] = 0.0f;
+	out[3] = 1.0f;
+	if (elemIndex >= D3DState.ClientVertexArrayState.vertexInfo._internal.compiledFirst &&
+		elemIndex <= D3DState.ClientVertexArrayState.vertexInfo._internal.compiledLast) {
+		memcpy( out, D3DGlobal.compiledVertexArray.compiledVertexData + elemIndex*numVertexCoords, sizeof(GLfloat)*numVertexCoords );
+	} else {
+		D3DVA_CopyArrayToFloats( &D3DState.ClientVertexArrayState.vertexInfo, elemIndex, out );
+	}
+}
+
+static void D3DVA_FetchNormal( int elemIndex, GLfloat *out )
+{
+	if (elemIndex >= D3DState.ClientVertexArrayState.normalInfo._internal.compiledFirst &&
+		elemIndex <= D3DState.ClientVertexArrayState.normalInfo._internal.compiledLast) {
+		memcpy( out, D3DGlobal.compiledVertexArray.compiledNormalData + elemIndex*3, sizeof(GLfloat)*3 );
+	} else {
+		D3DVA_CopyArrayToFloats( &D3DState.ClientVertexArrayState.normalInfo, elemIndex, out );
+	}
+}
+
 //---------------------------------------------------
 // VA buffer uses a concept of "swap frames"
 // This means that each time we unlock a buffer,
@@ -173,6 +198,8 @@ D3DVABuffer :: D3DVABuffer()
 	m_lockFirst = 0;
 	m_lockCount = 0;
 	m_swapFrame = 0;
+	m_pTexGenScratch = nullptr;
+	m_texGenScratchSize = 0;
 	for (int i = 0; i < c_MaxSwapFrame; ++i) {
 		m_pVertexBuffer[i] = nullptr;
 		m_pIndexBuffer[0][i] = nullptr;
@@ -203,6 +230,8 @@ D3DVABuffer :: ~D3DVABuffer()
 		}
 	}
 
+	UTIL_Free( m_pTexGenScratch );
+
 	logPrintf("D3DVABuffer: %.2f kb vertex data, %.2f kb index data [%i swap frames]\n", vbSize / 1024.0f, ibSize / 1024.0f, c_MaxSwapFrame );
 }
 
@@ -249,33 +278,37 @@ int D3DVABuffer :: SetMinimumIndexBufferSize( int numIndices )
 	return currentIndexBuffer;
 }
 
-void D3DVABuffer :: SetupTexCoords( const float *texcoords, int num_coords, const float *position, const float *normal, int stage, float *out_texcoords )
+GLfloat *D3DVABuffer :: GetTexGenScratch( GLsizei numFloats )
+{
+	if (m_texGenScratchSize < numFloats) {
+		GLfloat *pScratch = (GLfloat*)UTIL_Realloc( m_pTexGenScratch, numFloats * sizeof(GLfloat) );
+		if (!pScratch) {
+			D3DGlobal.lastError = E_OUTOFMEMORY;
+			return nullptr;
+		}
+		m_pTexGenScratch = pScratch;
+		m_texGenScratchSize = numFloats;
+	}
+	return m_pTexGenScratch;
+}
+
+//---------------------------------------------------
+// Texgen is done for the whole locked range before
+// the vertex buffer is filled (see D3DTexGen_Batch),
+// here we only pick generated or given coordinates.
+//---------------------------------------------------
+void D3DVABuffer :: SetupTexCoords( const float *texcoords, int num_coords, const float *generated, int stage, float *out_texcoords )
 {
-	if (!D3DState.EnableState.texGenEnabled[stage]) {
+	if (!D3DState.EnableState.texGenEnabled[stage] || !generated) {
 		memcpy( out_texcoords, texcoords, sizeof(float)*num_coords );
 		return;
 	}
 
-	const float *in_coords = texcoords;
-	float *out_coords = out_texcoords;
-
-	GLenum currentGen( ~0u );
-	float tr_position[4];
-	float tr_normal[3];
-
-	for (int i = 0; i < num_coords; ++i, ++in_coords, ++out_coords) {
-		if (!(D3DState.EnableState.texGenEnabled[stage] & (1 << i))) {
-			*out_coords = *in_coords;
-		} else {
-			if (currentGen != D3DState.TextureState.TexGen[stage][i].mode) {
-				if (D3DState.TextureState.TexGen[stage][i].trVertex)
-					D3DState.TextureState.TexGen[stage][i].trVertex( position, tr_position );
-				if (D3DState.TextureState.TexGen[stage][i].trNormal)
-					D3DState.TextureState.TexGen[stage][i].trNormal( normal, tr_normal );
-				currentGen = D3DState.TextureState.TexGen[stage][i].mode;
-			}
-			D3DState.TextureState.TexGen[stage][i].func( stage, i, tr_position, tr_normal, out_coords );
-		}
+	for (int i = 0; i < num_coords; ++i) {
+		if (D3DState.EnableState.texGenEnabled[stage] & (1 << i))
+			out_texcoords[i] = generated[i];
+		else
+			out_texcoords[i] = texcoords[i];
 	}
 }
 
@@ -536,18 +569,56 @@ FAST_PATH_CHECK_ABORT:
 			D3DXMatrixTranslation( &scratch, mvmat->m[3][0], mvmat->m[3][1], mvmat->m[3][2] );
 			D3DXMatrixMultiply( &shiftmat, &shiftmat, &scratch );
 		}
+
+		//Generate texcoords for all texgen stages in one pass over the range,
+		//so every vertex is fetched and transformed only once
+		const GLfloat *texGenPositions = nullptr;
+		const GLfloat *texGenNormals = nullptr;
+		const GLfloat *texGenOutput[MAX_D3D_TMU] = { nullptr };
+		int numTexGenStages = 0;
+		for ( int j = 0; j < D3DGlobal.maxActiveTMU; ++j ) {
+			if (D3DState.EnableState.textureEnabled[j] && D3DState.EnableState.texGenEnabled[j])
+				++numTexGenStages;
+		}
+		if (numTexGenStages) {
+			GLfloat *pScratch = GetTexGenScratch( count * (4 + 3 + numTexGenStages * 4) );
+			if (pScratch) {
+				GLfloat *pPositions = pScratch;
+				GLfloat *pNormals = pPositions + count * 4;
+				GLfloat *pOutput = pNormals + count * 3;
+
+				for (int i = 0; i < count; ++i) {
+					D3DVA_FetchPosition( first + i, numVertexCoords, pPositions + i*4 );
+					if (fvf & D3DFVF_NORMAL)
+						D3DVA_FetchNormal( first + i, pNormals + i*3 );
+					else
+						memcpy( pNormals + i*3, defaultNormal, sizeof(defaultNormal) );
+				}
+
+				D3DTexGenBatch texGenBatch;
+				D3DTexGen_SetupBatch( &texGenBatch );
+				for ( int j = 0; j < D3DGlobal.maxActiveTMU; ++j ) {
+					if (D3DState.EnableState.textureEnabled[j] && D3DState.EnableState.texGenEnabled[j]) {
+						D3DTexGen_AddBatchStage( &texGenBatch, j, pOutput );
+						texGenOutput[j] = pOutput;
+						pOutput += count * 4;
+					}
+				}
+				D3DTexGen_Batch( &texGenBatch, pPositions, pNormals, count );
+
+				texGenPositions = pPositions;
+				texGenNormals = pNormals;
+			}
+		}
+
 		//Fill vertex buffer with data
 		for (int i = 0; i < count; ++i) {
 			const int elemIndex = first + i;
-			vertexData[2] = 0.0f;
-			vertexData[3] = 1.0f;
 
-			if (elemIndex >= D3DState.ClientVertexArrayState.vertexInfo._internal.compiledFirst &&
-				elemIndex <= D3DState.ClientVertexArrayState.vertexInfo._internal.compiledLast) {
-				memcpy( vertexData, D3DGlobal.compiledVertexArray.compiledVertexData + elemIndex*numVertexCoords, sizeof(GLfloat)*numVertexCoords );
-			} else {
-				D3DVA_CopyArrayToFloats( &D3DState.ClientVertexArrayState.vertexInfo, elemIndex, vertexData );
-			}
+			if (texGenPositions)
+				memcpy( vertexData, texGenPositions + i*4, sizeof(vertexData) );
+			else
+				D3DVA_FetchPosition( elemIndex, numVertexCoords, vertexData );
 			if ( homogenousCoords )
 			{
 				D3DXVECTOR4 vtrx;
@@ -567,16 +638,12 @@ FAST_PATH_CHECK_ABORT:
 			pLockedVertices += numVertexCoords;
 
 			if (fvf & D3DFVF_NORMAL) {
-				if (elemIndex >= D3DState.ClientVertexArrayState.normalInfo._internal.compiledFirst &&
-					elemIndex <= D3DState.ClientVertexArrayState.normalInfo._internal.compiledLast) {
-					memcpy( normalData, D3DGlobal.compiledVertexArray.compiledNormalData + elemIndex*3, sizeof(GLfloat)*3 );
-				} else {
-					D3DVA_CopyArrayToFloats( &D3DState.ClientVertexArrayState.normalInfo, elemIndex, normalData );
-				}
+				if (texGenNormals)
+					memcpy( normalData, texGenNormals + i*3, sizeof(normalData) );
+				else
+					D3DVA_FetchNormal( elemIndex, normalData );
 				memcpy(pLockedVertices, normalData, sizeof(normalData));
 				pLockedVertices += 3;
-			} else {
-				memcpy(normalData, defaultNormal, sizeof(defaultNormal));
 			}
 
 			if (D3DState.ClientVertexArrayState.vertexArrayEnable & VA_ENABLE_COLOR_BIT) {
@@ -607,6 +674,7 @@ FAST_PATH_CHECK_ABORT:
 
 			for ( int j = 0; j < D3DGlobal.maxActiveTMU; ++j ) {
 				if (D3DState.EnableState.textureEnabled[j]) {
+					const GLfloat *generated = texGenOutput[j] ? texGenOutput[j] + i*4 : nullptr;
 					int numCoords = D3DState.ClientVertexArrayState.texCoordInfo[j].elementCount;
 					if ( D3DState.TextureState.transformEnabled )
 					{
@@ -615,7 +683,7 @@ FAST_PATH_CHECK_ABORT:
 					if (VA_TEXTURE_BIT_IS_SET(D3DState.ClientVertexArrayState.vertexArrayEnable, j)) {
 						if (elemIndex >= D3DState.ClientVertexArrayState.texCoordInfo[j]._internal.compiledFirst &&
 							elemIndex <= D3DState.ClientVertexArrayState.texCoordInfo[j]._internal.compiledLast) {
-							SetupTexCoords( D3DGlobal.compiledVertexArray.compiledTexCoordData[j] + elemIndex*4, numCoords, vertexData, normalData, j, pLockedVertices );
+							SetupTexCoords( D3DGlobal.compiledVertexArray.compiledTexCoordData[j] + elemIndex*4, numCoords, generated, j, pLockedVertices );
 						} else {
 							GLfloat texcoord[4] = { 0, 0, 0, 1 };
 							D3DVA_CopyArrayToFloats( &D3DState.ClientVertexArrayState.texCoordInfo[j], elemIndex, texcoord );
@@ -623,7 +691,7 @@ FAST_PATH_CHECK_ABORT:
 								texcoord[0] += D3DState.TransformState.texcoordFix[0];
 								texcoord[1] += D3DState.TransformState.texcoordFix[1];
 							}
-							SetupTexCoords( texcoord, numCoords, vertexData, normalData, j, pLockedVertices );
+							SetupTexCoords( texcoord, numCoords, generated, j, pLockedVertices );
 						}
 						pLockedVertices += numCoords;
 					} else if (D3DState.EnableState.texGenEnabled[j]) {
@@ -632,7 +700,7 @@ FAST_PATH_CHECK_ABORT:
 							texcoord[0] += D3DState.TransformState.texcoordFix[0];
 							texcoord[1] += D3DState.TransformState.texcoordFix[1];
 						}
-						SetupTexCoords( texcoord, numCoords, vertexData, normalData, j, pLockedVertices );
+						SetupTexCoords( texcoord, numCoords, generated, j, pLockedVertices );
 						pLockedVertices += numCoords;
 					}
 				}
@@ -1228,6 +1296,60 @@ OPENGL_API void WINAPI glArrayElement( GLint i )
 		D3DGlobal.pIMBuffer->AddVertex( vertex[0], vertex[1], vertex[2] );
 }
 
+// Array draws compiled into a display list are dereferenced element by element
+// through the immediate mode buffer. glArrayElement doesn't mark attributes as
+// set, so mark the enabled arrays for the list to pick up the right layout.
+static void D3DVA_MarkArraysSet()
+{
+	const DWORD enable = D3DState.ClientVertexArrayState.vertexArrayEnable;
+	if (enable & VA_ENABLE_NORMAL_BIT)
+		D3DState.CurrentState.isSet.bits.norm = 1;
+	if (enable & VA_ENABLE_COLOR_BIT)
+		D3DState.CurrentState.isSet.bits.color = 1;
+	if (enable & VA_ENABLE_COLOR2_BIT)
+		D3DState.CurrentState.isSet.bits.color2 = 1;
+	if (enable & VA_ENABLE_FOG_BIT)
+		D3DState.CurrentState.isSet.bits.fog = 1;
+	for (int j = 0; j < D3DGlobal.maxActiveTMU; ++j) {
+		if (VA_TEXTURE_BIT_IS_SET(enable, j)) {
+			DWORD numCoords = QINDIEGL_MAX( 1, QINDIEGL_MIN( D3DState.ClientVertexArrayState.texCoordInfo[j].elementCount, 4 ) );
+			DWORD bits = D3DState.CurrentState.isSet.bits.texcoord;
+			bits &= ~(0x3 << (j * 2));
+			bits |= (numCoords - 1) << (j * 2);
+			D3DState.CurrentState.isSet.bits.texcoord = bits;
+		}
+	}
+}
+
+// Selection and feedback go through the immediate mode buffer element by element,
+// so a draw is dropped first if the box of its float positions is outside the view
+template<typename T>
+static void D3DVA_IndexRange( const T *indices, GLsizei count, GLuint *start, GLuint *end )
+{
+	GLuint lo = ~0u, hi = 0;
+	for (GLsizei i = 0; i < count; ++i) {
+		lo = QINDIEGL_MIN( lo, (GLuint)indices[i] );
+		hi = QINDIEGL_MAX( hi, (GLuint)indices[i] );
+	}
+	*start = lo;
+	*end = hi;
+}
+
+static bool D3DVA_FeedbackCulled( GLuint start, GLuint end )
+{
+	const D3DVAInfo *pVAInfo = &D3DState.ClientVertexArrayState.vertexInfo;
+	if ( !( D3DState.ClientVertexArrayState.vertexArrayEnable & VA_ENABLE_VERTEX_BIT ) || !pVAInfo->data )
+		return false;
+	if ( pVAInfo->elementType != GL_FLOAT || pVAInfo->elementCount > 3 || start > end )
+		return false;
+
+	GLsizei stride = pVAInfo->stride;
+	if (!stride) stride = sizeof(GLfloat) * pVAInfo->elementCount;
+	float mins[3], maxs[3];
+	D3DFeedback_Bounds( reinterpret_cast<const GLfloat*>( pVAInfo->data + start * stride ), pVAInfo->elementCount, stride, (int)( end - start + 1 ), mins, maxs );
+	return D3DFeedback_CullBounds( mins, maxs );
+}
+
 static void internal_DrawArrays( GLenum mode, GLint first, GLsizei count )
 {
 #if defined(VA_USE_IMMEDIATE_MODE)
@@ -1239,14 +1361,23 @@ static void internal_DrawArrays( GLenum mode, GLint first, GLsizei count )
 
 	D3DGlobal.pIMBuffer->End();
 #else
-	if ( mode == GL_POINTS ) {
+	if ( D3DFeedback_IsActive() && !D3DList_IsCompiling() && D3DVA_FeedbackCulled( first, first + count - 1 ) )
+		return;
+
+	if ( mode == GL_POINTS || D3DList_IsCompiling() || D3DFeedback_IsActive() ) {
 		//points are not supported within DIP, so use immediate mode
+		//display lists take a copy of the elements, so use immediate mode as well
+		//selection and feedback read the vertices from the immediate mode buffer
 		assert( D3DGlobal.pIMBuffer != nullptr );
+		const DWORD isSet = D3DState.CurrentState.isSet.all;
+		if ( D3DList_IsCompiling() )
+			D3DVA_MarkArraysSet();
 		D3DGlobal.pIMBuffer->Begin( mode );
 		for (int i = 0; i < count; ++i) {
 			glArrayElement( first + i );
 		}
 		D3DGlobal.pIMBuffer->End();
+		D3DState.CurrentState.isSet.all = isSet;
 	} else {
 		//skip drawcall if untextured ortho
 		if ( D3DGlobal.settings.game.orthoskipuntextureddraws && !D3DState.TextureState.currentSamplerCount )
@@ -1299,9 +1430,32 @@ static void internal_DrawElements( GLenum mode, GLuint start, GLuint end, GLsize
 
 	D3DGlobal.pIMBuffer->End();
 #else
-	if ( mode == GL_POINTS ) {
+	if ( D3DFeedback_IsActive() && !D3DList_IsCompiling() ) {
+		if ( start == ~0u || end < start ) {
+			switch (type) {
+			case GL_UNSIGNED_BYTE:
+				D3DVA_IndexRange( reinterpret_cast<const GLubyte*>(indices), count, &start, &end );
+				break;
+			case GL_UNSIGNED_SHORT:
+				D3DVA_IndexRange( reinterpret_cast<const GLushort*>(indices), count, &start, &end );
+				break;
+			case GL_UNSIGNED_INT:
+				D3DVA_IndexRange( reinterpret_cast<const GLuint*>(indices), count, &start, &end );
+				break;
+			}
+		}
+		if ( D3DVA_FeedbackCulled( start, end ) )
+			return;
+	}
+
+	if ( mode == GL_POINTS || D3DList_IsCompiling() || D3DFeedback_IsActive() ) {
 		//points are not supported within DIP, so use immediate mode
+		//display lists take a copy of the elements, so use immediate mode as well
+		//selection and feedback read the vertices from the immediate mode buffer
 		assert( D3DGlobal.pIMBuffer != nullptr );
+		const DWORD isSet = D3DState.CurrentState.isSet.all;
+		if ( D3DList_IsCompiling() )
+			D3DVA_MarkArraysSet();
 		D3DGlobal.pIMBuffer->Begin( mode );
 
 		switch (type) {
@@ -1332,6 +1486,7 @@ static void internal_DrawElements( GLenum mode, GLuint start, GLuint end, GLsize
 		}
 
 		D3DGlobal.pIMBuffer->End();
+		D3DState.CurrentState.isSet.all = isSet;
 	} else {
 		//skip drawcall if untextured ortho
 		if ( D3DGlobal.settings.game.orthoskipuntextureddraws && !D3DState.TextureState.currentSamplerCount )
@@ -39,7 +39,8 @@ public:
 protected:
 	void SetMinimumVertexBufferSize( GLsizei numVerts );
 	int  SetMinimumIndexBufferSize( GLsizei numIndices );
-	void SetupTexCoords( const float *texcoords, int num_coords, const float *position, const float *normal, int stage, float *out_texcoords );
+	void SetupTexCoords( const float *texcoords, int num_coords, const float *generated, int stage, float *out_texcoords );
+	GLfloat *GetTexGenScratch( GLsizei numFloats );
 
 	inline void SetIndex( void *pDest, GLuint dstIndex, GLsizei srcIndex )
 	{
@@ -69,6 +70,8 @@ private:
 	GLenum						m_primitiveType;
 	GLsizei						m_primitiveIndexCount;
 	GLint						m_swapFrame;
+	GLfloat						*m_pTexGenScratch;
+	GLsizei						m_texGenScratchSize;
 };
 
 #endif //QINDIEGL_D3D_ARRAY_H
\ No newline at end of file
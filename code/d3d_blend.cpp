@@ -22,6 +22,7 @@
 #include "d3d_global.hpp"
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
+#include "d3d_lists.hpp"
 
 //==================================================================================
 // Blending states
@@ -32,6 +33,8 @@
 
 OPENGL_API void WINAPI glAlphaFunc( GLenum func, GLclampf ref )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_ALPHA_FUNC, func, ref );
+
 	DWORD dfunc = UTIL_GLtoD3DCmpFunc(func);
 	if (dfunc != D3DState.ColorBufferState.alphaTestFunc) {
 		D3DState.ColorBufferState.alphaTestFunc = dfunc;
@@ -47,6 +50,8 @@ OPENGL_API void WINAPI glAlphaFunc( GLenum func, GLclampf ref )
 
 OPENGL_API void WINAPI glBlendFunc( GLenum sfactor, GLenum dfactor )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_BLEND_FUNC, sfactor, dfactor );
+
 	if (D3DState.ColorBufferState.glBlendSrc != sfactor) {
 		D3DState.ColorBufferState.glBlendSrc = sfactor;
 		DWORD sfunc = UTIL_GLtoD3DBlendFunc(sfactor);
@@ -117,6 +122,9 @@ OPENGL_API void WINAPI glLogicOp( GLenum )
 
 OPENGL_API void WINAPI glFogfv( GLenum pname, const GLfloat *params )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_FOGFV, pname, 0, params, (pname == GL_FOG_COLOR) ? 4 : 1 ))
+		return;
+
 	switch (pname) {
 	case GL_FOG_MODE:
 		switch ((GLenum)params[0]) {
@@ -23,6 +23,7 @@
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
 #include "d3d_matrix_stack.hpp"
+#include "d3d_matrix_math.hpp"
 
 //==================================================================================
 // CPU features detect
@@ -122,4 +123,6 @@ void D3DGlobal_CPU_Detect()
 	logPrintf("WARNING: SSE is not supported, all SSE optimizations disabled\n");
 	D3DGlobal.settings.useSSE = false;
 #endif
+
+	D3DMatrix_UseSSE( D3DGlobal.settings.useSSE != 0 );
 }
\ No newline at end of file
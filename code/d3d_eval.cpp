@@ -21,124 +21,848 @@
 #include "d3d_wrapper.hpp"
 #include "d3d_global.hpp"
 #include "d3d_state.hpp"
+#include "d3d_immediate.hpp"
+#include "d3d_lists.hpp"
+#include "d3d_eval.hpp"
+#include "d3d_eval_batch.hpp"
 
 //==================================================================================
 // Evaluators
 //----------------------------------------------------------------------------------
-// TODO: implement them like in Mesa lib?
+// glEvalCoord and glEvalPoint evaluate the enabled maps at one point and pass the
+// vertex to the immediate mode buffer. glEvalMesh evaluates whole grid rows with
+// the cached basis tables of d3d_eval_batch and adds them to the buffer at once;
+// lines and triangles are drawn indexed, so every grid point is evaluated once.
+// Display lists record glMap, glMapGrid and glEvalMesh as calls and evaluate
+// them on execution; glEvalCoord and glEvalPoint are part of a glBegin/glEnd
+// and are evaluated into the list geometry (see d3d_eval.hpp).
 //==================================================================================
 
-OPENGL_API void WINAPI glEvalCoord1d( GLdouble )
+#define EVAL_NUM_MAPS		9
+#define EVAL_MAP_COLOR4		0
+#define EVAL_MAP_INDEX		1
+#define EVAL_MAP_NORMAL		2
+#define EVAL_MAP_TEXCOORD1	3
+#define EVAL_MAP_VERTEX3	7
+#define EVAL_MAP_VERTEX4	8
+#define EVAL_MAP2_BIT		16		// same layout as EnableState.evalMapEnableMask
+
+// grid rows that have more points are evaluated point by point
+#define EVAL_MAX_ROW_POINTS	32767
+
+static const int s_evalMapSize[EVAL_NUM_MAPS] = { 4, 1, 3, 1, 2, 3, 4, 3, 4 };
+static const float s_evalMapDefault[EVAL_NUM_MAPS][4] = {
+	{ 1.0f, 1.0f, 1.0f, 1.0f },		// color
+	{ 1.0f, 0.0f, 0.0f, 1.0f },		// index
+	{ 0.0f, 0.0f, 1.0f, 1.0f },		// normal
+	{ 0.0f, 0.0f, 0.0f, 1.0f },		// texture coords
+	{ 0.0f, 0.0f, 0.0f, 1.0f },
+	{ 0.0f, 0.0f, 0.0f, 1.0f },
+	{ 0.0f, 0.0f, 0.0f, 1.0f },
+	{ 0.0f, 0.0f, 0.0f, 1.0f },		// vertex
+	{ 0.0f, 0.0f, 0.0f, 1.0f },
+};
+
+static D3DEvalMap s_evalMaps1[EVAL_NUM_MAPS];
+static D3DEvalMap s_evalMaps2[EVAL_NUM_MAPS];
+static D3DEvalBasisCache s_evalBasisCache;
+
+// scratch space of glEvalMesh, kept between calls
+static std::vector<float> s_evalPositions;
+static std::vector<float> s_evalDu;
+static std::vector<float> s_evalDv;
+static std::vector<float> s_evalNormals;
+static std::vector<float> s_evalAttribs;
+static std::vector<float> s_evalTexCoords;
+static std::vector<DWORD> s_evalColors;
+static std::vector<WORD> s_evalIndices;
+
+// maps and grids from before the list compiled with GL_COMPILE that changed them
+static bool s_evalSaved;
+static D3DEvalMap s_savedMaps1[EVAL_NUM_MAPS];
+static D3DEvalMap s_savedMaps2[EVAL_NUM_MAPS];
+static decltype( D3DState.EvalState ) s_savedGrids;
+static std::vector<DWORD> s_evalListArgs;
+
+// The maps that make up a vertex
+typedef struct D3DEvalSetup_s
+{
+	const D3DEvalMap	*vertex;
+	const D3DEvalMap	*normal;
+	const D3DEvalMap	*color;
+	const D3DEvalMap	*texCoord;
+	bool				xyzw;
+	bool				autoNormal;
+	int					texCoordSize;
+} D3DEvalSetup;
+
+// Points i1 .. i1 + count - 1 of rows j1 .. j1 + rows - 1 of a map grid
+typedef struct D3DEvalGrid_s
+{
+	bool				twoD;
+	float				u1, du;
+	float				v1, dv;
+	int					i1, count;
+	int					j1, rows;
+} D3DEvalGrid;
+
+// Basis tables of one map on a grid
+typedef struct D3DEvalGridBasis_s
+{
+	const D3DEvalBasis	*u;
+	const D3DEvalBasis	*v;
+} D3DEvalGridBasis;
+
+static int D3DEval_MapBit( GLenum target )
 {
-	logPrintf("WARNING: glEvalCoord1d: evaluators are not supported\n");
+	if (target >= GL_MAP1_COLOR_4 && target <= GL_MAP1_VERTEX_4)
+		return target - GL_MAP1_COLOR_4;
+	if (target >= GL_MAP2_COLOR_4 && target <= GL_MAP2_VERTEX_4)
+		return EVAL_MAP2_BIT + target - GL_MAP2_COLOR_4;
+	return -1;
 }
 
-OPENGL_API void WINAPI glEvalCoord1dv( const GLdouble* )
+static D3DEvalMap *D3DEval_GetMap( int bit )
 {
-	logPrintf("WARNING: glEvalCoord1dv: evaluators are not supported\n");
+	D3DEvalMap *map = (bit & EVAL_MAP2_BIT) ? &s_evalMaps2[bit & ~EVAL_MAP2_BIT] : &s_evalMaps1[bit];
+	if (!map->uorder) {
+		// a map that was never specified evaluates to the default value
+		map->uorder = 1;
+		map->vorder = 1;
+		map->u1 = map->v1 = 0.0f;
+		map->u2 = map->v2 = 1.0f;
+		map->points.assign( s_evalMapDefault[bit & ~EVAL_MAP2_BIT], s_evalMapDefault[bit & ~EVAL_MAP2_BIT] + 4 );
+	}
+	return map;
 }
 
-OPENGL_API void WINAPI glEvalCoord1f( GLfloat )
+template<typename T> static void D3DEval_CopyPoint( float *dst, const T *src, int size )
 {
-	logPrintf("WARNING: glEvalCoord1f: evaluators are not supported\n");
+	for (int c = 0; c < 4; ++c)
+		dst[c] = (c < size) ? (float)src[c] : ((c == 3) ? 1.0f : 0.0f);
 }
 
-OPENGL_API void WINAPI glEvalCoord1fv( const GLfloat* )
+static bool D3DEval_Setup( bool twoD, D3DEvalSetup *setup )
 {
-	logPrintf("WARNING: glEvalCoord1fv: evaluators are not supported\n");
+	const int base = twoD ? EVAL_MAP2_BIT : 0;
+	const DWORD mask = D3DState.EnableState.evalMapEnableMask >> base;
+
+	memset( setup, 0, sizeof(*setup) );
+	if (mask & (1 << EVAL_MAP_VERTEX4)) {
+		setup->vertex = D3DEval_GetMap( base + EVAL_MAP_VERTEX4 );
+		setup->xyzw = true;
+	} else if (mask & (1 << EVAL_MAP_VERTEX3)) {
+		setup->vertex = D3DEval_GetMap( base + EVAL_MAP_VERTEX3 );
+	} else {
+		// no vertex map, no vertex
+		return false;
+	}
+
+	if (twoD && D3DState.EnableState.autoNormalEnabled)
+		setup->autoNormal = true;
+	else if (mask & (1 << EVAL_MAP_NORMAL))
+		setup->normal = D3DEval_GetMap( base + EVAL_MAP_NORMAL );
+
+	if (mask & (1 << EVAL_MAP_COLOR4))
+		setup->color = D3DEval_GetMap( base + EVAL_MAP_COLOR4 );
+
+	// the map with most coordinates wins; the index map is ignored, there is no color index mode
+	for (int k = 3; k >= 0; --k) {
+		if (mask & (1 << (EVAL_MAP_TEXCOORD1 + k))) {
+			setup->texCoord = D3DEval_GetMap( base + EVAL_MAP_TEXCOORD1 + k );
+			setup->texCoordSize = k + 1;
+			break;
+		}
+	}
+	return true;
 }
 
-OPENGL_API void WINAPI glEvalCoord2d( GLdouble,  GLdouble )
+// Tells the vertex format of the immediate buffer (and of a display list) about the evaluated attributes
+static void D3DEval_MarkSet( const D3DEvalSetup *setup )
 {
-	logPrintf("WARNING: glEvalCoord2d: evaluators are not supported\n");
+	if (setup->autoNormal || setup->normal)
+		D3DState.CurrentState.isSet.bits.norm = 1;
+	if (setup->color)
+		D3DState.CurrentState.isSet.bits.color = 1;
+	if (setup->texCoord)
+		D3DState.CurrentState.isSet.bits.texcoord |= DWORD( setup->texCoordSize - 1 );
 }
 
-OPENGL_API void WINAPI glEvalCoord2dv( const GLdouble* )
+static DWORD D3DEval_Color( const float *color )
 {
-	logPrintf("WARNING: glEvalCoord2dv: evaluators are not supported\n");
+	return D3DCOLOR_ARGB( QINDIEGL_CLAMP( color[3] * 255.0f ),
+						  QINDIEGL_CLAMP( color[0] * 255.0f ),
+						  QINDIEGL_CLAMP( color[1] * 255.0f ),
+						  QINDIEGL_CLAMP( color[2] * 255.0f ) );
 }
 
-OPENGL_API void WINAPI glEvalCoord2f( GLfloat,  GLfloat )
+static void D3DEval_FixTexCoords( float *texCoords, int count )
 {
-	logPrintf("WARNING: glEvalCoord2f: evaluators are not supported\n");
+	if (!D3DState.TransformState.texcoordFixEnabled)
+		return;
+	for (int k = 0; k < count; ++k, texCoords += 4) {
+		texCoords[0] += D3DState.TransformState.texcoordFix[0];
+		texCoords[1] += D3DState.TransformState.texcoordFix[1];
+	}
 }
 
-OPENGL_API void WINAPI glEvalCoord2fv( const GLfloat* )
+//==================================================================================
+// Single points
+//==================================================================================
+static void D3DEval_MapAt( const D3DEvalMap *map, bool twoD, float u, float v, float *out, float *du, float *dv )
 {
-	logPrintf("WARNING: glEvalCoord2fv: evaluators are not supported\n");
+	float uWeights[QINDIEGL_EVAL_MAX_ORDER], uDerivs[QINDIEGL_EVAL_MAX_ORDER];
+	float vWeights[QINDIEGL_EVAL_MAX_ORDER], vDerivs[QINDIEGL_EVAL_MAX_ORDER];
+
+	const float uScale = 1.0f / (map->u2 - map->u1);
+	D3DEval_Basis( map->uorder, (u - map->u1) * uScale, uScale, uWeights, uDerivs );
+	if (!twoD) {
+		D3DEval_Row( map, uWeights, uDerivs, 1, nullptr, nullptr, out, du, nullptr );
+		return;
+	}
+	const float vScale = 1.0f / (map->v2 - map->v1);
+	D3DEval_Basis( map->vorder, (v - map->v1) * vScale, vScale, vWeights, vDerivs );
+	D3DEval_Row( map, uWeights, uDerivs, 1, vWeights, vDerivs, out, du, dv );
 }
 
-OPENGL_API void WINAPI glEvalMesh1( GLenum, GLint, GLint )
+static void D3DEval_Vertex( const D3DEvalSetup *setup, bool twoD, float u, float v )
 {
-	logPrintf("WARNING: glEvalMesh1: evaluators are not supported\n");
+	float position[4], du[4], dv[4], attrib[4];
+
+	// the evaluated attributes belong to this vertex only, the current values are kept
+	const DWORD savedColor = D3DState.CurrentState.currentColor;
+	FLOAT savedNormal[3], savedTexCoord[4];
+	memcpy( savedNormal, D3DState.CurrentState.currentNormal, sizeof(savedNormal) );
+	memcpy( savedTexCoord, D3DState.CurrentState.currentTexCoord[0], sizeof(savedTexCoord) );
+
+	D3DEval_MapAt( setup->vertex, twoD, u, v, position, setup->autoNormal ? du : nullptr, setup->autoNormal ? dv : nullptr );
+	if (setup->autoNormal) {
+		D3DEval_Normals( position, du, dv, 1, setup->xyzw, D3DState.CurrentState.currentNormal );
+	} else if (setup->normal) {
+		D3DEval_MapAt( setup->normal, twoD, u, v, attrib, nullptr, nullptr );
+		memcpy( D3DState.CurrentState.currentNormal, attrib, sizeof(FLOAT) * 3 );
+	}
+	if (setup->color) {
+		D3DEval_MapAt( setup->color, twoD, u, v, attrib, nullptr, nullptr );
+		D3DState.CurrentState.currentColor = D3DEval_Color( attrib );
+	}
+	if (setup->texCoord) {
+		D3DEval_MapAt( setup->texCoord, twoD, u, v, attrib, nullptr, nullptr );
+		D3DEval_FixTexCoords( attrib, 1 );
+		memcpy( D3DState.CurrentState.currentTexCoord[0], attrib, sizeof(FLOAT) * 4 );
+	}
+	D3DEval_MarkSet( setup );
+
+	assert( D3DGlobal.pIMBuffer != NULL );
+	if (setup->xyzw)
+		D3DGlobal.pIMBuffer->AddVertex( position[0], position[1], position[2], position[3] );
+	else
+		D3DGlobal.pIMBuffer->AddVertex( position[0], position[1], position[2] );
+
+	D3DState.CurrentState.currentColor = savedColor;
+	memcpy( D3DState.CurrentState.currentNormal, savedNormal, sizeof(savedNormal) );
+	memcpy( D3DState.CurrentState.currentTexCoord[0], savedTexCoord, sizeof(savedTexCoord) );
 }
 
-OPENGL_API void WINAPI glEvalMesh2( GLenum, GLint, GLint, GLint, GLint )
+static void D3DEval_Coord( bool twoD, float u, float v )
 {
-	logPrintf("WARNING: glEvalMesh2: evaluators are not supported\n");
+	D3DEvalSetup setup;
+	if (D3DEval_Setup( twoD, &setup ))
+		D3DEval_Vertex( &setup, twoD, u, v );
 }
 
-OPENGL_API void WINAPI glEvalPoint1( GLint )
+static inline float D3DEval_GridU( const D3DEvalGrid *grid, int i )
 {
-	logPrintf("WARNING: glEvalPoint1: evaluators are not supported\n");
+	return grid->u1 + (float)(grid->i1 + i) * grid->du;
+}
+static inline float D3DEval_GridV( const D3DEvalGrid *grid, int j )
+{
+	return grid->v1 + (float)(grid->j1 + j) * grid->dv;
 }
 
-OPENGL_API void WINAPI glEvalPoint2( GLint, GLint )
+//==================================================================================
+// Meshes
+//==================================================================================
+static void D3DEval_MeshPoints( GLenum mode, const D3DEvalSetup *setup, const D3DEvalGrid *grid )
 {
-	logPrintf("WARNING: glEvalPoint2: evaluators are not supported\n");
+	D3DIMBuffer *buffer = D3DGlobal.pIMBuffer;
+	const bool twoD = grid->twoD;
+
+	if (mode == GL_POINT) {
+		buffer->Begin( GL_POINTS );
+		for (int j = 0; j < grid->rows; ++j) {
+			for (int i = 0; i < grid->count; ++i)
+				D3DEval_Vertex( setup, twoD, D3DEval_GridU( grid, i ), D3DEval_GridV( grid, j ) );
+		}
+		buffer->End();
+		return;
+	}
+
+	if (mode == GL_FILL) {
+		for (int j = 0; j + 1 < grid->rows; ++j) {
+			buffer->Begin( GL_QUAD_STRIP );
+			for (int i = 0; i < grid->count; ++i) {
+				D3DEval_Vertex( setup, twoD, D3DEval_GridU( grid, i ), D3DEval_GridV( grid, j ) );
+				D3DEval_Vertex( setup, twoD, D3DEval_GridU( grid, i ), D3DEval_GridV( grid, j + 1 ) );
+			}
+			buffer->End();
+		}
+		return;
+	}
+
+	if (grid->count > 1) {
+		for (int j = 0; j < grid->rows; ++j) {
+			buffer->Begin( GL_LINE_STRIP );
+			for (int i = 0; i < grid->count; ++i)
+				D3DEval_Vertex( setup, twoD, D3DEval_GridU( grid, i ), D3DEval_GridV( grid, j ) );
+			buffer->End();
+		}
+	}
+	if (grid->rows > 1) {
+		for (int i = 0; i < grid->count; ++i) {
+			buffer->Begin( GL_LINE_STRIP );
+			for (int j = 0; j < grid->rows; ++j)
+				D3DEval_Vertex( setup, twoD, D3DEval_GridU( grid, i ), D3DEval_GridV( grid, j ) );
+			buffer->End();
+		}
+	}
 }
 
-OPENGL_API void WINAPI glGetMapdv( GLenum, GLenum, GLdouble* )
+static void D3DEval_GetGridBasis( const D3DEvalMap *map, const D3DEvalGrid *grid, D3DEvalGridBasis *basis )
 {
-	logPrintf("WARNING: glGetMapdv: evaluators are not supported\n");
+	const float uRange = map->u2 - map->u1;
+	basis->u = s_evalBasisCache.Get( map->uorder, grid->count, (D3DEval_GridU( grid, 0 ) - map->u1) / uRange,
+									 grid->du / uRange, 1.0f / uRange );
+	basis->v = nullptr;
+	if (grid->twoD) {
+		const float vRange = map->v2 - map->v1;
+		basis->v = s_evalBasisCache.Get( map->vorder, grid->rows, (D3DEval_GridV( grid, 0 ) - map->v1) / vRange,
+										 grid->dv / vRange, 1.0f / vRange );
+	}
 }
 
-OPENGL_API void WINAPI glGetMapfv( GLenum, GLenum, GLfloat* )
+static void D3DEval_GridMapRow( const D3DEvalMap *map, const D3DEvalGridBasis *basis, int count, int row,
+								float *out, float *du, float *dv )
 {
-	logPrintf("WARNING: glGetMapfv: evaluators are not supported\n");
+	const float *vWeights = basis->v ? &basis->v->weights[row * map->vorder] : nullptr;
+	const float *vDerivs = basis->v ? &basis->v->derivs[row * map->vorder] : nullptr;
+	D3DEval_Row( map, &basis->u->weights[0], &basis->u->derivs[0], count, vWeights, vDerivs, out, du, dv );
 }
 
-OPENGL_API void WINAPI glGetMapiv( GLenum, GLenum, GLint* )
+// Evaluates a grid row and adds it to the immediate buffer, returns the index of its first vertex
+static int D3DEval_AddGridRow( const D3DEvalSetup *setup, const D3DEvalGridBasis *basis, const D3DEvalGrid *grid, int row )
 {
-	logPrintf("WARNING: glGetMapiv: evaluators are not supported\n");
+	const int count = grid->count;
+	D3DIMVertexStreams streams;
+	memset( &streams, 0, sizeof(streams) );
+
+	float *positions = &s_evalPositions[0];
+	if (setup->autoNormal) {
+		D3DEval_GridMapRow( setup->vertex, &basis[0], count, row, positions, &s_evalDu[0], &s_evalDv[0] );
+		D3DEval_Normals( positions, &s_evalDu[0], &s_evalDv[0], count, setup->xyzw, &s_evalNormals[0] );
+		streams.normal = &s_evalNormals[0];
+	} else {
+		D3DEval_GridMapRow( setup->vertex, &basis[0], count, row, positions, nullptr, nullptr );
+		if (setup->normal) {
+			D3DEval_GridMapRow( setup->normal, &basis[1], count, row, &s_evalAttribs[0], nullptr, nullptr );
+			for (int k = 0; k < count; ++k)
+				memcpy( &s_evalNormals[k * 3], &s_evalAttribs[k * 4], sizeof(float) * 3 );
+			streams.normal = &s_evalNormals[0];
+		}
+	}
+	streams.position = positions;
+	streams.xyzw = setup->xyzw;
+
+	if (setup->color) {
+		D3DEval_GridMapRow( setup->color, &basis[2], count, row, &s_evalAttribs[0], nullptr, nullptr );
+		for (int k = 0; k < count; ++k)
+			s_evalColors[k] = D3DEval_Color( &s_evalAttribs[k * 4] );
+		streams.color = &s_evalColors[0];
+	}
+	if (setup->texCoord) {
+		D3DEval_GridMapRow( setup->texCoord, &basis[3], count, row, &s_evalTexCoords[0], nullptr, nullptr );
+		D3DEval_FixTexCoords( &s_evalTexCoords[0], count );
+		streams.texCoord0 = &s_evalTexCoords[0];
+	}
+
+	return D3DGlobal.pIMBuffer->AddVertices( count, &streams );
 }
 
-OPENGL_API void WINAPI glMap1d( GLenum, GLdouble, GLdouble, GLint, GLint, const GLdouble* )
+static void D3DEval_AddQuads( int a, int b, int count )
 {
-	logPrintf("WARNING: glMap1d: evaluators are not supported\n");
+	if (count < 2)
+		return;
+	s_evalIndices.resize( (count - 1) * 6 );
+	WORD *idx = &s_evalIndices[0];
+	// same triangles and winding as the GL_QUAD_STRIP of the spec
+	for (int i = 0; i + 1 < count; ++i, idx += 6) {
+		idx[0] = (WORD)(a + i);
+		idx[1] = (WORD)(b + i);
+		idx[2] = (WORD)(a + i + 1);
+		idx[3] = (WORD)(a + i + 1);
+		idx[4] = (WORD)(b + i);
+		idx[5] = (WORD)(b + i + 1);
+	}
+	D3DGlobal.pIMBuffer->AddIndices( &s_evalIndices[0], (int)s_evalIndices.size() );
 }
 
-OPENGL_API void WINAPI glMap1f( GLenum, GLfloat, GLfloat, GLint, GLint, const GLfloat* )
+static void D3DEval_AddRowLines( int a, int count )
 {
-	logPrintf("WARNING: glMap1f: evaluators are not supported\n");
+	if (count < 2)
+		return;
+	s_evalIndices.resize( (count - 1) * 2 );
+	WORD *idx = &s_evalIndices[0];
+	for (int i = 0; i + 1 < count; ++i, idx += 2) {
+		idx[0] = (WORD)(a + i);
+		idx[1] = (WORD)(a + i + 1);
+	}
+	D3DGlobal.pIMBuffer->AddIndices( &s_evalIndices[0], (int)s_evalIndices.size() );
 }
 
-OPENGL_API void WINAPI glMap2d( GLenum, GLdouble, GLdouble, GLint, GLint, GLdouble, GLdouble, GLint, GLint, const GLdouble* )
+static void D3DEval_AddColumnLines( int a, int b, int count )
 {
-	logPrintf("WARNING: glMap2d: evaluators are not supported\n");
+	s_evalIndices.resize( count * 2 );
+	WORD *idx = &s_evalIndices[0];
+	for (int i = 0; i < count; ++i, idx += 2) {
+		idx[0] = (WORD)(a + i);
+		idx[1] = (WORD)(b + i);
+	}
+	D3DGlobal.pIMBuffer->AddIndices( &s_evalIndices[0], (int)s_evalIndices.size() );
 }
 
-OPENGL_API void WINAPI glMap2f( GLenum, GLfloat, GLfloat, GLint, GLint, GLfloat, GLfloat, GLint, GLint, const GLfloat* )
+static void D3DEval_Mesh( GLenum mode, const D3DEvalGrid *grid )
 {
-	logPrintf("WARNING: glMap2f: evaluators are not supported\n");
+	if (D3DList_IsCompiling()) {
+		// GL_COMPILE_AND_EXECUTE: the list has the call, the mesh is only drawn
+		D3DList_SuspendCompile();
+		D3DEval_Mesh( mode, grid );
+		D3DList_ResumeCompile();
+		return;
+	}
+
+	D3DEvalSetup setup;
+	if (!D3DEval_Setup( grid->twoD, &setup ))
+		return;
+
+	D3DState_Check( );
+	D3DState_AssureBeginScene( );
+	assert( D3DGlobal.pIMBuffer != NULL );
+	D3DIMBuffer *buffer = D3DGlobal.pIMBuffer;
+
+	const DWORD savedIsSet = D3DState.CurrentState.isSet.all;
+	D3DEval_MarkSet( &setup );
+
+	if (grid->count > EVAL_MAX_ROW_POINTS) {
+		D3DEval_MeshPoints( mode, &setup, grid );
+		D3DState.CurrentState.isSet.all = savedIsSet;
+		return;
+	}
+
+	const int count = grid->count;
+	s_evalPositions.resize( count * 4 );
+	s_evalDu.resize( count * 4 );
+	s_evalDv.resize( count * 4 );
+	s_evalNormals.resize( count * 3 );
+	s_evalAttribs.resize( count * 4 );
+	s_evalTexCoords.resize( count * 4 );
+	s_evalColors.resize( count );
+
+	// the cache keeps the tables of the last lookups, enough for all maps of a mesh
+	D3DEvalGridBasis basis[4];
+	const D3DEvalMap *maps[4] = { setup.vertex, setup.normal, setup.color, setup.texCoord };
+	for (int k = 0; k < 4; ++k) {
+		if (maps[k])
+			D3DEval_GetGridBasis( maps[k], grid, &basis[k] );
+	}
+
+	if (!grid->twoD || mode == GL_POINT) {
+		buffer->Begin( (mode == GL_POINT) ? GL_POINTS : GL_LINE_STRIP );
+		for (int j = 0; j < grid->rows; ++j)
+			D3DEval_AddGridRow( &setup, basis, grid, j );
+		buffer->End();
+		D3DState.CurrentState.isSet.all = savedIsSet;
+		return;
+	}
+
+	// rows are drawn in bands that fit 16-bit indices, the last row of a band
+	// is evaluated again as the first row of the next one
+	const int maxRows = 65535 / count;
+	int row = 0;
+	do {
+		const int bandStart = row;
+		buffer->BeginIndexed( (mode == GL_FILL) ? GL_TRIANGLES : GL_LINES );
+		int prev = D3DEval_AddGridRow( &setup, basis, grid, row );
+		if (mode == GL_LINE && !bandStart)
+			D3DEval_AddRowLines( prev, count );
+		while (row + 1 < grid->rows && row + 2 - bandStart <= maxRows) {
+			const int next = D3DEval_AddGridRow( &setup, basis, grid, row + 1 );
+			if (mode == GL_FILL) {
+				D3DEval_AddQuads( prev, next, count );
+			} else {
+				D3DEval_AddRowLines( next, count );
+				D3DEval_AddColumnLines( prev, next, count );
+			}
+			prev = next;
+			++row;
+		}
+		buffer->End();
+	} while (row + 1 < grid->rows);
+
+	D3DState.CurrentState.isSet.all = savedIsSet;
+}
+
+//==================================================================================
+// Map specification
+//==================================================================================
+static void D3DEval_SaveForList()
+{
+	if (s_evalSaved)
+		return;
+	for (int k = 0; k < EVAL_NUM_MAPS; ++k) {
+		s_savedMaps1[k] = s_evalMaps1[k];
+		s_savedMaps2[k] = s_evalMaps2[k];
+	}
+	s_savedGrids = D3DState.EvalState;
+	s_evalSaved = true;
 }
 
-OPENGL_API void WINAPI glMapGrid1d( GLint, GLdouble, GLdouble )
+void D3DEval_EndList()
 {
-	logPrintf("WARNING: glMapGrid1d: evaluators are not supported\n");
+	if (!s_evalSaved)
+		return;
+	for (int k = 0; k < EVAL_NUM_MAPS; ++k) {
+		s_evalMaps1[k] = s_savedMaps1[k];
+		s_evalMaps2[k] = s_savedMaps2[k];
+	}
+	D3DState.EvalState = s_savedGrids;
+	s_evalSaved = false;
 }
 
-OPENGL_API void WINAPI glMapGrid1f( GLint, GLfloat, GLfloat )
+template<typename T> static void D3DEval_Map1( GLenum target, T u1, T u2, GLint stride, GLint order, const T *points )
 {
-	logPrintf("WARNING: glMapGrid1f: evaluators are not supported\n");
+	const int bit = D3DEval_MapBit( target );
+	if (bit < 0 || (bit & EVAL_MAP2_BIT)) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+	const int size = s_evalMapSize[bit];
+	if (u1 == u2 || stride < size || order < 1 || order > QINDIEGL_EVAL_MAX_ORDER || !points) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+
+	if (D3DList_IsCompiling()) {
+		// the points are recorded packed, stride is the map size
+		s_evalListArgs.resize( 5 + order * size );
+		DWORD *args = &s_evalListArgs[0];
+		args[0] = target;
+		args[1] = D3DList_Arg( u1 );
+		args[2] = D3DList_Arg( u2 );
+		args[3] = size;
+		args[4] = order;
+		for (int i = 0; i < order; ++i) {
+			for (int c = 0; c < size; ++c)
+				args[5 + i * size + c] = D3DList_Arg( points[i * stride + c] );
+		}
+		if (D3DList_Compile( D3DLIST_OP_MAP1, args, (int)s_evalListArgs.size() ))
+			D3DEval_SaveForList();
+	}
+
+	D3DEvalMap *map = &s_evalMaps1[bit];
+	map->uorder = order;
+	map->vorder = 1;
+	map->u1 = (float)u1;
+	map->u2 = (float)u2;
+	map->v1 = 0.0f;
+	map->v2 = 1.0f;
+	map->points.resize( order * 4 );
+	for (int i = 0; i < order; ++i)
+		D3DEval_CopyPoint( &map->points[i * 4], points + i * stride, size );
+	D3DGlobal.lastError = S_OK;
 }
 
-OPENGL_API void WINAPI glMapGrid2d( GLint, GLdouble, GLdouble, GLint,  GLdouble, GLdouble )
+template<typename T> static void D3DEval_Map2( GLenum target, T u1, T u2, GLint ustride, GLint uorder,
+											   T v1, T v2, GLint vstride, GLint vorder, const T *points )
 {
-	logPrintf("WARNING: glMapGrid2d: evaluators are not supported\n");
+	const int bit = D3DEval_MapBit( target );
+	if (bit < 0 || !(bit & EVAL_MAP2_BIT)) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+	const int size = s_evalMapSize[bit & ~EVAL_MAP2_BIT];
+	if (u1 == u2 || v1 == v2 || ustride < size || vstride < size ||
+		uorder < 1 || uorder > QINDIEGL_EVAL_MAX_ORDER || vorder < 1 || vorder > QINDIEGL_EVAL_MAX_ORDER || !points) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+
+	if (D3DList_IsCompiling()) {
+		s_evalListArgs.resize( 9 + uorder * vorder * size );
+		DWORD *args = &s_evalListArgs[0];
+		args[0] = target;
+		args[1] = D3DList_Arg( u1 );
+		args[2] = D3DList_Arg( u2 );
+		args[3] = vorder * size;
+		args[4] = uorder;
+		args[5] = D3DList_Arg( v1 );
+		args[6] = D3DList_Arg( v2 );
+		args[7] = size;
+		args[8] = vorder;
+		for (int i = 0; i < uorder; ++i) {
+			for (int j = 0; j < vorder; ++j) {
+				for (int c = 0; c < size; ++c)
+					args[9 + (i * vorder + j) * size + c] = D3DList_Arg( points[i * ustride + j * vstride + c] );
+			}
+		}
+		if (D3DList_Compile( D3DLIST_OP_MAP2, args, (int)s_evalListArgs.size() ))
+			D3DEval_SaveForList();
+	}
+
+	D3DEvalMap *map = &s_evalMaps2[bit & ~EVAL_MAP2_BIT];
+	map->uorder = uorder;
+	map->vorder = vorder;
+	map->u1 = (float)u1;
+	map->u2 = (float)u2;
+	map->v1 = (float)v1;
+	map->v2 = (float)v2;
+	map->points.resize( uorder * vorder * 4 );
+	for (int i = 0; i < uorder; ++i) {
+		for (int j = 0; j < vorder; ++j)
+			D3DEval_CopyPoint( &map->points[(i * vorder + j) * 4], points + i * ustride + j * vstride, size );
+	}
+	D3DGlobal.lastError = S_OK;
 }
 
-OPENGL_API void WINAPI glMapGrid2f( GLint, GLfloat, GLfloat, GLint, GLfloat, GLfloat )
+template<typename T> static void D3DEval_GetMap( GLenum target, GLenum query, T *v )
 {
-	logPrintf("WARNING: glMapGrid2f: evaluators are not supported\n");
-}
\ No newline at end of file
+	const int bit = D3DEval_MapBit( target );
+	if (bit < 0) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+	const D3DEvalMap *map = D3DEval_GetMap( bit );
+	const bool twoD = (bit & EVAL_MAP2_BIT) != 0;
+	const int size = s_evalMapSize[bit & ~EVAL_MAP2_BIT];
+
+	switch (query) {
+	case GL_COEFF:
+		for (int n = 0; n < map->uorder * map->vorder; ++n) {
+			for (int c = 0; c < size; ++c)
+				*v++ = (T)map->points[n * 4 + c];
+		}
+		break;
+	case GL_ORDER:
+		v[0] = (T)map->uorder;
+		if (twoD) v[1] = (T)map->vorder;
+		break;
+	case GL_DOMAIN:
+		v[0] = (T)map->u1;
+		v[1] = (T)map->u2;
+		if (twoD) {
+			v[2] = (T)map->v1;
+			v[3] = (T)map->v2;
+		}
+		break;
+	default:
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		break;
+	}
+}
+
+static void D3DEval_MapGrid1( GLint un, GLfloat u1, GLfloat u2 )
+{
+	if (un <= 0) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+	if (D3DList_IsCompiling() && D3DList_Record( D3DLIST_OP_MAP_GRID1, un, u1, u2 ))
+		D3DEval_SaveForList();
+	D3DState.EvalState.grid1Segments = un;
+	D3DState.EvalState.grid1Domain[0] = u1;
+	D3DState.EvalState.grid1Domain[1] = u2;
+}
+
+static void D3DEval_MapGrid2( GLint un, GLfloat u1, GLfloat u2, GLint vn, GLfloat v1, GLfloat v2 )
+{
+	if (un <= 0 || vn <= 0) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+	if (D3DList_IsCompiling() && D3DList_Record( D3DLIST_OP_MAP_GRID2, un, u1, u2, vn, v1, v2 ))
+		D3DEval_SaveForList();
+	D3DState.EvalState.grid2Segments[0] = un;
+	D3DState.EvalState.grid2Segments[1] = vn;
+	D3DState.EvalState.grid2Domain[0] = u1;
+	D3DState.EvalState.grid2Domain[1] = u2;
+	D3DState.EvalState.grid2Domain[2] = v1;
+	D3DState.EvalState.grid2Domain[3] = v2;
+}
+
+static void D3DEval_Grid1( D3DEvalGrid *grid )
+{
+	memset( grid, 0, sizeof(*grid) );
+	grid->u1 = D3DState.EvalState.grid1Domain[0];
+	grid->du = (D3DState.EvalState.grid1Domain[1] - D3DState.EvalState.grid1Domain[0]) / (float)D3DState.EvalState.grid1Segments;
+	grid->rows = 1;
+}
+
+static void D3DEval_Grid2( D3DEvalGrid *grid )
+{
+	memset( grid, 0, sizeof(*grid) );
+	grid->twoD = true;
+	grid->u1 = D3DState.EvalState.grid2Domain[0];
+	grid->du = (D3DState.EvalState.grid2Domain[1] - D3DState.EvalState.grid2Domain[0]) / (float)D3DState.EvalState.grid2Segments[0];
+	grid->v1 = D3DState.EvalState.grid2Domain[2];
+	grid->dv = (D3DState.EvalState.grid2Domain[3] - D3DState.EvalState.grid2Domain[2]) / (float)D3DState.EvalState.grid2Segments[1];
+}
+
+//==================================================================================
+// GL entry points
+//==================================================================================
+
+OPENGL_API void WINAPI glEvalCoord1d( GLdouble u )
+{
+	D3DEval_Coord( false, (float)u, 0.0f );
+}
+
+OPENGL_API void WINAPI glEvalCoord1dv( const GLdouble *u )
+{
+	D3DEval_Coord( false, (float)u[0], 0.0f );
+}
+
+OPENGL_API void WINAPI glEvalCoord1f( GLfloat u )
+{
+	D3DEval_Coord( false, u, 0.0f );
+}
+
+OPENGL_API void WINAPI glEvalCoord1fv( const GLfloat *u )
+{
+	D3DEval_Coord( false, u[0], 0.0f );
+}
+
+OPENGL_API void WINAPI glEvalCoord2d( GLdouble u, GLdouble v )
+{
+	D3DEval_Coord( true, (float)u, (float)v );
+}
+
+OPENGL_API void WINAPI glEvalCoord2dv( const GLdouble *u )
+{
+	D3DEval_Coord( true, (float)u[0], (float)u[1] );
+}
+
+OPENGL_API void WINAPI glEvalCoord2f( GLfloat u, GLfloat v )
+{
+	D3DEval_Coord( true, u, v );
+}
+
+OPENGL_API void WINAPI glEvalCoord2fv( const GLfloat *u )
+{
+	D3DEval_Coord( true, u[0], u[1] );
+}
+
+OPENGL_API void WINAPI glEvalMesh1( GLenum mode, GLint i1, GLint i2 )
+{
+	D3DLIST_COMPILE( D3DLIST_OP_EVAL_MESH1, mode, i1, i2 );
+
+	if (mode != GL_POINT && mode != GL_LINE) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+	if (i2 < i1 || (mode == GL_LINE && i2 == i1))
+		return;
+
+	D3DEvalGrid grid;
+	D3DEval_Grid1( &grid );
+	grid.i1 = i1;
+	grid.count = i2 - i1 + 1;
+	D3DEval_Mesh( mode, &grid );
+}
+
+OPENGL_API void WINAPI glEvalMesh2( GLenum mode, GLint i1, GLint i2, GLint j1, GLint j2 )
+{
+	D3DLIST_COMPILE( D3DLIST_OP_EVAL_MESH2, mode, i1, i2, j1, j2 );
+
+	if (mode != GL_POINT && mode != GL_LINE && mode != GL_FILL) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+	if (i2 < i1 || j2 < j1)
+		return;
+
+	D3DEvalGrid grid;
+	D3DEval_Grid2( &grid );
+	grid.i1 = i1;
+	grid.count = i2 - i1 + 1;
+	grid.j1 = j1;
+	grid.rows = j2 - j1 + 1;
+	D3DEval_Mesh( mode, &grid );
+}
+
+OPENGL_API void WINAPI glEvalPoint1( GLint i )
+{
+	D3DEvalGrid grid;
+	D3DEval_Grid1( &grid );
+	D3DEval_Coord( false, D3DEval_GridU( &grid, i ), 0.0f );
+}
+
+OPENGL_API void WINAPI glEvalPoint2( GLint i, GLint j )
+{
+	D3DEvalGrid grid;
+	D3DEval_Grid2( &grid );
+	D3DEval_Coord( true, D3DEval_GridU( &grid, i ), D3DEval_GridV( &grid, j ) );
+}
+
+OPENGL_API void WINAPI glGetMapdv( GLenum target, GLenum query, GLdouble *v )
+{
+	D3DEval_GetMap( target, query, v );
+}
+
+OPENGL_API void WINAPI glGetMapfv( GLenum target, GLenum query, GLfloat *v )
+{
+	D3DEval_GetMap( target, query, v );
+}
+
+OPENGL_API void WINAPI glGetMapiv( GLenum target, GLenum query, GLint *v )
+{
+	D3DEval_GetMap( target, query, v );
+}
+
+OPENGL_API void WINAPI glMap1d( GLenum target, GLdouble u1, GLdouble u2, GLint stride, GLint order, const GLdouble *points )
+{
+	D3DEval_Map1( target, u1, u2, stride, order, points );
+}
+
+OPENGL_API void WINAPI glMap1f( GLenum target, GLfloat u1, GLfloat u2, GLint stride, GLint order, const GLfloat *points )
+{
+	D3DEval_Map1( target, u1, u2, stride, order, points );
+}
+
+OPENGL_API void WINAPI glMap2d( GLenum target, GLdouble u1, GLdouble u2, GLint ustride, GLint uorder, GLdouble v1, GLdouble v2, GLint vstride, GLint vorder, const GLdouble *points )
+{
+	D3DEval_Map2( target, u1, u2, ustride, uorder, v1, v2, vstride, vorder, points );
+}
+
+OPENGL_API void WINAPI glMap2f( GLenum target, GLfloat u1, GLfloat u2, GLint ustride, GLint uorder, GLfloat v1, GLfloat v2, GLint vstride, GLint vorder, const GLfloat *points )
+{
+	D3DEval_Map2( target, u1, u2, ustride, uorder, v1, v2, vstride, vorder, points );
+}
+
+OPENGL_API void WINAPI glMapGrid1d( GLint un, GLdouble u1, GLdouble u2 )
+{
+	D3DEval_MapGrid1( un, (GLfloat)u1, (GLfloat)u2 );
+}
+
+OPENGL_API void WINAPI glMapGrid1f( GLint un, GLfloat u1, GLfloat u2 )
+{
+	D3DEval_MapGrid1( un, u1, u2 );
+}
+
+OPENGL_API void WINAPI glMapGrid2d( GLint un, GLdouble u1, GLdouble u2, GLint vn, GLdouble v1, GLdouble v2 )
+{
+	D3DEval_MapGrid2( un, (GLfloat)u1, (GLfloat)u2, vn, (GLfloat)v1, (GLfloat)v2 );
+}
+
+OPENGL_API void WINAPI glMapGrid2f( GLint un, GLfloat u1, GLfloat u2, GLint vn, GLfloat v1, GLfloat v2 )
+{
+	D3DEval_MapGrid2( un, u1, u2, vn, v1, v2 );
+}
@@ -0,0 +1,35 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_EVAL_H
+#define QINDIEGL_D3D_EVAL_H
+
+//==================================================================================
+// Evaluators
+//----------------------------------------------------------------------------------
+// glMap and glMapGrid are recorded into display lists. With GL_COMPILE they
+// also take effect until glEndList, so that the glEvalCoord and glEvalPoint
+// calls baked into the list use the maps of the list; D3DEval_EndList puts
+// back the maps and grids from before the list.
+//==================================================================================
+
+extern void D3DEval_EndList();
+
+#endif //QINDIEGL_D3D_EVAL_H
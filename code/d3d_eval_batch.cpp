@@ -0,0 +1,277 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "d3d_eval_batch.hpp"
+
+#if QINDIEGL_MATRIX_SSE
+#include <xmmintrin.h>
+#endif
+
+//==================================================================================
+// Bernstein basis
+//----------------------------------------------------------------------------------
+// The weights of degree n are built up from degree 0 with the recurrence
+// B(i,d) = (1-t) B(i,d-1) + t B(i-1,d-1), which stays accurate at high orders.
+// The derivative weights come from degree n-1: B'(i,n) = n (B(i-1,n-1) - B(i,n-1)).
+//==================================================================================
+static void EvalBasis_Raise( float *b, int degree, float t )
+{
+	const float s = 1.0f - t;
+	float carry = 0.0f;
+	for (int i = 0; i < degree; ++i) {
+		const float w = b[i];
+		b[i] = carry + s * w;
+		carry = t * w;
+	}
+	b[degree] = carry;
+}
+
+void D3DEval_Basis( int order, float t, float scale, float *weights, float *derivs )
+{
+	const int degree = order - 1;
+
+	weights[0] = 1.0f;
+	for (int d = 1; d < degree; ++d)
+		EvalBasis_Raise( weights, d, t );
+
+	if (derivs) {
+		if (degree == 0) {
+			derivs[0] = 0.0f;
+		} else {
+			const float n = (float)degree * scale;
+			derivs[0] = -n * weights[0];
+			for (int i = 1; i < degree; ++i)
+				derivs[i] = n * (weights[i-1] - weights[i]);
+			derivs[degree] = n * weights[degree-1];
+		}
+	}
+
+	if (degree > 0)
+		EvalBasis_Raise( weights, degree, t );
+}
+
+//==================================================================================
+// Basis cache
+//==================================================================================
+D3DEvalBasisCache :: D3DEvalBasisCache()
+{
+	Clear();
+}
+
+void D3DEvalBasisCache :: Clear()
+{
+	for (int i = 0; i < c_NumEntries; ++i) {
+		m_entries[i].order = 0;
+		m_entries[i].count = 0;
+		m_lastUse[i] = 0;
+	}
+	m_useCount = 0;
+}
+
+const D3DEvalBasis *D3DEvalBasisCache :: Get( int order, int count, float t0, float dt, float scale )
+{
+	int victim = 0;
+	for (int i = 0; i < c_NumEntries; ++i) {
+		D3DEvalBasis *entry = &m_entries[i];
+		if (entry->order == order && entry->count == count &&
+			entry->t0 == t0 && entry->dt == dt && entry->scale == scale) {
+			m_lastUse[i] = ++m_useCount;
+			return entry;
+		}
+		if (m_lastUse[i] < m_lastUse[victim])
+			victim = i;
+	}
+
+	D3DEvalBasis *entry = &m_entries[victim];
+	entry->order = order;
+	entry->count = count;
+	entry->t0 = t0;
+	entry->dt = dt;
+	entry->scale = scale;
+	entry->weights.resize( count * order );
+	entry->derivs.resize( count * order );
+	for (int k = 0; k < count; ++k)
+		D3DEval_Basis( order, t0 + (float)k * dt, scale, &entry->weights[k * order], &entry->derivs[k * order] );
+
+	m_lastUse[victim] = ++m_useCount;
+	return entry;
+}
+
+//==================================================================================
+// Reference version, one component at a time
+//==================================================================================
+void D3DEval_Row_Ref( const D3DEvalMap *map, const float *uWeights, const float *uDerivs, int count,
+					  const float *vWeights, const float *vDerivs, float *out, float *du, float *dv )
+{
+	const int uorder = map->uorder;
+	const int vorder = map->vorder;
+	float row[QINDIEGL_EVAL_MAX_ORDER][4];
+	float rowDv[QINDIEGL_EVAL_MAX_ORDER][4];
+
+	// fold the control points along v
+	if (vWeights) {
+		for (int i = 0; i < uorder; ++i) {
+			const float *p = &map->points[i * vorder * 4];
+			for (int c = 0; c < 4; ++c) {
+				float sum = 0.0f, sumDv = 0.0f;
+				for (int j = 0; j < vorder; ++j) {
+					sum += vWeights[j] * p[j*4+c];
+					if (dv)
+						sumDv += vDerivs[j] * p[j*4+c];
+				}
+				row[i][c] = sum;
+				rowDv[i][c] = sumDv;
+			}
+		}
+	} else {
+		memcpy( row, &map->points[0], uorder * sizeof(row[0]) );
+		dv = nullptr;
+	}
+
+	for (int k = 0; k < count; ++k, uWeights += uorder) {
+		for (int c = 0; c < 4; ++c) {
+			float sum = 0.0f;
+			for (int i = 0; i < uorder; ++i)
+				sum += uWeights[i] * row[i][c];
+			out[k*4+c] = sum;
+		}
+		if (du) {
+			const float *w = uDerivs + k * uorder;
+			for (int c = 0; c < 4; ++c) {
+				float sum = 0.0f;
+				for (int i = 0; i < uorder; ++i)
+					sum += w[i] * row[i][c];
+				du[k*4+c] = sum;
+			}
+		}
+		if (dv) {
+			for (int c = 0; c < 4; ++c) {
+				float sum = 0.0f;
+				for (int i = 0; i < uorder; ++i)
+					sum += uWeights[i] * rowDv[i][c];
+				dv[k*4+c] = sum;
+			}
+		}
+	}
+}
+
+//==================================================================================
+// SSE version, the 4 components of a point at once
+//==================================================================================
+#if QINDIEGL_MATRIX_SSE
+
+void D3DEval_Row_SSE( const D3DEvalMap *map, const float *uWeights, const float *uDerivs, int count,
+					  const float *vWeights, const float *vDerivs, float *out, float *du, float *dv )
+{
+	const int uorder = map->uorder;
+	const int vorder = map->vorder;
+	__m128 row[QINDIEGL_EVAL_MAX_ORDER];
+	__m128 rowDv[QINDIEGL_EVAL_MAX_ORDER];
+
+	if (vWeights) {
+		for (int i = 0; i < uorder; ++i) {
+			const float *p = &map->points[i * vorder * 4];
+			__m128 sum = _mm_setzero_ps();
+			__m128 sumDv = _mm_setzero_ps();
+			for (int j = 0; j < vorder; ++j, p += 4) {
+				const __m128 point = _mm_loadu_ps( p );
+				sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( vWeights[j] ), point ) );
+				if (dv)
+					sumDv = _mm_add_ps( sumDv, _mm_mul_ps( _mm_set1_ps( vDerivs[j] ), point ) );
+			}
+			row[i] = sum;
+			rowDv[i] = sumDv;
+		}
+	} else {
+		for (int i = 0; i < uorder; ++i)
+			row[i] = _mm_loadu_ps( &map->points[i * 4] );
+		dv = nullptr;
+	}
+
+	for (int k = 0; k < count; ++k, uWeights += uorder) {
+		__m128 sum = _mm_setzero_ps();
+		for (int i = 0; i < uorder; ++i)
+			sum = _mm_add_ps( sum, _mm_mul_ps( _mm_set1_ps( uWeights[i] ), row[i] ) );
+		_mm_storeu_ps( out + k*4, sum );
+
+		if (du) {
+			const float *w = uDerivs + k * uorder;
+			__m128 sumDu = _mm_setzero_ps();
+			for (int i = 0; i < uorder; ++i)
+				sumDu = _mm_add_ps( sumDu, _mm_mul_ps( _mm_set1_ps( w[i] ), row[i] ) );
+			_mm_storeu_ps( du + k*4, sumDu );
+		}
+		if (dv) {
+			__m128 sumDv = _mm_setzero_ps();
+			for (int i = 0; i < uorder; ++i)
+				sumDv = _mm_add_ps( sumDv, _mm_mul_ps( _mm_set1_ps( uWeights[i] ), rowDv[i] ) );
+			_mm_storeu_ps( dv + k*4, sumDv );
+		}
+	}
+}
+
+#endif //QINDIEGL_MATRIX_SSE
+
+void D3DEval_Row( const D3DEvalMap *map, const float *uWeights, const float *uDerivs, int count,
+				  const float *vWeights, const float *vDerivs, float *out, float *du, float *dv )
+{
+	if (count <= 0)
+		return;
+#if QINDIEGL_MATRIX_SSE
+	if (D3DMatrix_IsUsingSSE()) {
+		D3DEval_Row_SSE( map, uWeights, uDerivs, count, vWeights, vDerivs, out, du, dv );
+		return;
+	}
+#endif
+	D3DEval_Row_Ref( map, uWeights, uDerivs, count, vWeights, vDerivs, out, du, dv );
+}
+
+//==================================================================================
+// Auto normals
+//==================================================================================
+void D3DEval_Normals( const float *positions, const float *du, const float *dv, int count, bool rational, float *normals )
+{
+	for (int k = 0; k < count; ++k, positions += 4, du += 4, dv += 4, normals += 3) {
+		float a[3], b[3];
+		if (rational && positions[3] != 0.0f) {
+			// the derivatives of p/w, up to the positive factor 1/w^2
+			for (int c = 0; c < 3; ++c) {
+				a[c] = du[c] * positions[3] - positions[c] * du[3];
+				b[c] = dv[c] * positions[3] - positions[c] * dv[3];
+			}
+		} else {
+			memcpy( a, du, sizeof(a) );
+			memcpy( b, dv, sizeof(b) );
+		}
+
+		float n[3];
+		n[0] = a[1] * b[2] - a[2] * b[1];
+		n[1] = a[2] * b[0] - a[0] * b[2];
+		n[2] = a[0] * b[1] - a[1] * b[0];
+
+		const float len2 = n[0]*n[0] + n[1]*n[1] + n[2]*n[2];
+		const float scale = (len2 > 0.0f) ? (1.0f / sqrtf( len2 )) : 0.0f;
+		normals[0] = n[0] * scale;
+		normals[1] = n[1] * scale;
+		normals[2] = n[2] * scale;
+	}
+}
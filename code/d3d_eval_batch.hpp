@@ -0,0 +1,104 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_EVAL_BATCH_H
+#define QINDIEGL_D3D_EVAL_BATCH_H
+
+#include <vector>
+#include "d3d_matrix_math.hpp"
+
+//==================================================================================
+// Evaluator math
+//----------------------------------------------------------------------------------
+// Maps are evaluated in Bernstein form. The basis weights of a grid depend only
+// on the map order and the grid parameters, so D3DEvalBasisCache keeps them per
+// (order, grid) and a mesh reuses them for every row and every frame. A 2D map
+// row is evaluated by first folding the control points along v with the weights
+// of the row, which leaves a 1D map in u that is then evaluated at every point
+// of the row. Points are 4 floats, so the SSE version evaluates all components
+// of a point at once; D3DEval_Row picks a version depending on D3DMatrix_UseSSE().
+//
+// Like d3d_matrix_math, the module knows nothing about the GL state, so it can
+// be compiled into the tests. d3d_eval.cpp keeps the maps and draws the results.
+//==================================================================================
+
+#define QINDIEGL_EVAL_MAX_ORDER		30
+
+// Control points of a 1D or 2D map, always 4 floats each. Components the map
+// doesn't have are padded with 0,0,0,1, which evaluates to the same defaults.
+typedef struct D3DEvalMap_s
+{
+	int					uorder;
+	int					vorder;		// 1 for 1D maps
+	float				u1, u2;
+	float				v1, v2;
+	std::vector<float>	points;		// point (i,j) at ( i * vorder + j ) * 4
+} D3DEvalMap;
+
+// Weights of the points t0, t0 + dt, ... of a map parameter normalized to 0..1;
+// derivatives are multiplied by scale, 1 / (u2 - u1) for derivatives in u
+typedef struct D3DEvalBasis_s
+{
+	int					order;
+	int					count;
+	float				t0, dt, scale;
+	std::vector<float>	weights;	// count * order
+	std::vector<float>	derivs;		// count * order
+} D3DEvalBasis;
+
+class D3DEvalBasisCache
+{
+	static const int c_NumEntries = 16;
+public:
+	D3DEvalBasisCache();
+	// The least recently used entry is replaced, so the tables returned by the
+	// last c_NumEntries calls stay valid, enough for the u and v tables of all
+	// maps of a mesh
+	const D3DEvalBasis *Get( int order, int count, float t0, float dt, float scale );
+	void Clear();
+
+private:
+	D3DEvalBasis	m_entries[c_NumEntries];
+	unsigned int	m_lastUse[c_NumEntries];
+	unsigned int	m_useCount;
+};
+
+// Bernstein weights and their derivatives at one parameter t
+void D3DEval_Basis( int order, float t, float scale, float *weights, float *derivs );
+
+// Evaluates count points of a map along u at one v. uWeights and uDerivs hold
+// uorder weights per point, vWeights and vDerivs vorder weights and are not
+// used for 1D maps (nullptr). out, du and dv get 4 floats per point; du and dv
+// may be nullptr when no derivatives are needed.
+void D3DEval_Row( const D3DEvalMap *map, const float *uWeights, const float *uDerivs, int count,
+				  const float *vWeights, const float *vDerivs, float *out, float *du, float *dv );
+
+void D3DEval_Row_Ref( const D3DEvalMap *map, const float *uWeights, const float *uDerivs, int count,
+					  const float *vWeights, const float *vDerivs, float *out, float *du, float *dv );
+#if QINDIEGL_MATRIX_SSE
+void D3DEval_Row_SSE( const D3DEvalMap *map, const float *uWeights, const float *uDerivs, int count,
+					  const float *vWeights, const float *vDerivs, float *out, float *du, float *dv );
+#endif
+
+// Normalized dP/du x dP/dv, 3 floats per point. With rational set the
+// derivatives are taken of the projected position, as for GL_MAP2_VERTEX_4.
+void D3DEval_Normals( const float *positions, const float *du, const float *dv, int count, bool rational, float *normals );
+
+#endif //QINDIEGL_D3D_EVAL_BATCH_H
@@ -22,55 +22,566 @@
 #include "d3d_global.hpp"
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
+#include "d3d_matrix_stack.hpp"
+#include "d3d_lists.hpp"
+#include "d3d_feedback.hpp"
+#include <vector>
 
 //==================================================================================
 // Select & Feedback modes
+//==================================================================================
+
+// A vertex of the pipeline is the clip position followed by the attributes the
+// feedback type reports: the color as 4 floats and the texture coordinates
+#define FEEDBACK_COLOR			4
+#define FEEDBACK_TEXCOORD		8
+
+D3DFeedbackContext_t D3DFeedbackContext = { GL_RENDER };
+
+static std::vector<float>			s_feedbackClip;		// s_feedbackVertexSize floats per vertex
+static std::vector<unsigned char>	s_feedbackCodes;
+static std::vector<float>			s_feedbackPolygon;
+static std::vector<float>			s_feedbackTemp;
+static std::vector<float>			s_feedbackWindow;	// 4 floats per vertex
+static std::vector<int>				s_feedbackIndices;
+static int							s_feedbackVertexSize;
+static float						s_viewportScale[4];
+static float						s_viewportOffset[4];
+
+static void D3DFeedback_ModelViewProjection( float *m )
+{
+	D3DMatrix_Multiply( m, D3DGlobal.modelviewMatrixStack->top().data(), D3DGlobal.projectionMatrixStack->top().data() );
+}
+
+//==================================================================================
+// Hit records
 //----------------------------------------------------------------------------------
-// TODO: emulate them in software
+// A record is the number of names, the smallest and largest window z of the
+// hits scaled to 0..2^32-1, and the names. The values that don't fit in the
+// buffer are counted but not written, so glRenderMode can report the overflow.
 //==================================================================================
+static void D3DFeedback_WriteSelect( GLuint value )
+{
+	if (D3DFeedbackContext.selectCount < D3DFeedbackContext.selectBufferSize)
+		D3DFeedbackContext.selectBuffer[D3DFeedbackContext.selectCount] = value;
+	++D3DFeedbackContext.selectCount;
+}
 
-OPENGL_API GLint WINAPI glRenderMode( GLenum mode )
+static void D3DFeedback_ResetHit()
+{
+	D3DFeedbackContext.hit = false;
+	D3DFeedbackContext.hitMinZ = 1.0f;
+	D3DFeedbackContext.hitMaxZ = 0.0f;
+}
+
+static void D3DFeedback_WriteHitRecord()
+{
+	D3DFeedback_WriteSelect( (GLuint)D3DFeedbackContext.nameStackDepth );
+	D3DFeedback_WriteSelect( (GLuint)( (double)D3DFeedbackContext.hitMinZ * 4294967295.0 ) );
+	D3DFeedback_WriteSelect( (GLuint)( (double)D3DFeedbackContext.hitMaxZ * 4294967295.0 ) );
+	for (int i = 0; i < D3DFeedbackContext.nameStackDepth; ++i)
+		D3DFeedback_WriteSelect( D3DFeedbackContext.nameStack[i] );
+
+	++D3DFeedbackContext.hitCount;
+	D3DFeedback_ResetHit();
+}
+
+// Called before the name stack changes
+static void D3DFeedback_FlushHit()
+{
+	if (D3DFeedbackContext.hit)
+		D3DFeedback_WriteHitRecord();
+}
+
+static void D3DFeedback_Hit( const float *verts, int count, int vertexSize )
+{
+	float minZ, maxZ;
+	D3DFeedback_DepthRange( verts, count, vertexSize, &minZ, &maxZ );
+
+	// glDepthRange may map the near plane farther than the far plane
+	const float depthScale = D3DState.viewport.MaxZ - D3DState.viewport.MinZ;
+	const float nearZ = D3DState.viewport.MinZ + minZ * depthScale;
+	const float farZ = D3DState.viewport.MinZ + maxZ * depthScale;
+	minZ = QINDIEGL_MIN( nearZ, farZ );
+	maxZ = QINDIEGL_MAX( nearZ, farZ );
+
+	D3DFeedbackContext.hit = true;
+	if (minZ < D3DFeedbackContext.hitMinZ)
+		D3DFeedbackContext.hitMinZ = minZ;
+	if (maxZ > D3DFeedbackContext.hitMaxZ)
+		D3DFeedbackContext.hitMaxZ = maxZ;
+}
+
+//==================================================================================
+// Feedback records
+//----------------------------------------------------------------------------------
+// A record is a token followed by the window coordinates of the vertices, with
+// the color and texture coordinates the buffer type asks for. As with hit
+// records, the values past the end of the buffer are only counted.
+//==================================================================================
+static void D3DFeedback_WriteFeedback( GLfloat value )
 {
-	switch (mode) {
+	if (D3DFeedbackContext.feedbackCount < D3DFeedbackContext.feedbackBufferSize)
+		D3DFeedbackContext.feedbackBuffer[D3DFeedbackContext.feedbackCount] = value;
+	++D3DFeedbackContext.feedbackCount;
+}
+
+static int D3DFeedback_TypeVertexSize( GLenum type )
+{
+	switch (type) {
+	case GL_3D_COLOR:
+		return FEEDBACK_TEXCOORD;
+	case GL_3D_COLOR_TEXTURE:
+	case GL_4D_COLOR_TEXTURE:
+		return FEEDBACK_TEXCOORD + 4;
 	default:
-	case GL_RENDER:
-		return 0;
-	case GL_SELECT:
-		logPrintf("WARNING: glRenderMode: GL_SELECT is not supported\n");
+		return FEEDBACK_COLOR;
+	}
+}
+
+static void D3DFeedback_SetupViewport()
+{
+	// D3D viewports start at the top of the window, GL viewports at the bottom
+	const D3DVIEWPORT9 &vp = D3DState.viewport;
+	const float halfWidth = vp.Width * 0.5f;
+	const float halfHeight = vp.Height * 0.5f;
+	s_viewportScale[0] = halfWidth;
+	s_viewportScale[1] = halfHeight;
+	s_viewportScale[2] = vp.MaxZ - vp.MinZ;
+	s_viewportScale[3] = 0.0f;
+	s_viewportOffset[0] = vp.X + halfWidth;
+	s_viewportOffset[1] = (float)D3DGlobal.hCurrentMode.Height - (float)( vp.Height + vp.Y ) + halfHeight;
+	s_viewportOffset[2] = vp.MinZ;
+	s_viewportOffset[3] = 0.0f;
+}
+
+static void D3DFeedback_WriteVertices( const float *verts, int count )
+{
+	if ((int)s_feedbackWindow.size() < count * 4)
+		s_feedbackWindow.resize( count * 4 );
+	D3DFeedback_ViewportMap( verts, count, s_feedbackVertexSize, s_viewportScale, s_viewportOffset, &s_feedbackWindow[0] );
+
+	const GLenum type = D3DFeedbackContext.feedbackType;
+	const float *window = &s_feedbackWindow[0];
+	for (int i = 0; i < count; ++i, verts += s_feedbackVertexSize, window += 4) {
+		D3DFeedback_WriteFeedback( window[0] );
+		D3DFeedback_WriteFeedback( window[1] );
+		if (type != GL_2D)
+			D3DFeedback_WriteFeedback( window[2] );
+		if (type == GL_4D_COLOR_TEXTURE)
+			D3DFeedback_WriteFeedback( window[3] );
+		for (int j = FEEDBACK_COLOR; j < s_feedbackVertexSize; ++j)
+			D3DFeedback_WriteFeedback( verts[j] );
+	}
+}
+
+//==================================================================================
+// Primitive pipeline
+//----------------------------------------------------------------------------------
+// All vertices of a call are transformed and classified at once. A batch that is
+// outside one of the planes is dropped and a selected batch inside all of them
+// hits as a whole; otherwise the primitives are assembled one by one, and only
+// those that cross the view volume are clipped. Polygons are culled and drawn
+// as points or edges the way glPolygonMode asks before they are selected or
+// written to the feedback buffer.
+//==================================================================================
+static void D3DFeedback_SetupAttributes( const D3DFeedbackVertices_t *vertices )
+{
+	float *out = &s_feedbackClip[0];
+
+	if (s_feedbackVertexSize > FEEDBACK_COLOR) {
+		if (D3DState.EnableState.lightingEnabled)
+			PRINT_ONCE("WARNING: glRenderMode: GL_FEEDBACK reports colors without lighting\n");
+
+		const BYTE *color = (const BYTE*)vertices->color;
+		for (int i = 0; i < vertices->count; ++i, color += vertices->stride) {
+			const DWORD c = *(const DWORD*)color;
+			float *v = out + i * s_feedbackVertexSize + FEEDBACK_COLOR;
+			v[0] = ( ( c >> 16 ) & 0xFF ) * ( 1.0f / 255.0f );
+			v[1] = ( ( c >> 8 ) & 0xFF ) * ( 1.0f / 255.0f );
+			v[2] = ( c & 0xFF ) * ( 1.0f / 255.0f );
+			v[3] = ( c >> 24 ) * ( 1.0f / 255.0f );
+		}
+	}
+
+	if (s_feedbackVertexSize > FEEDBACK_TEXCOORD) {
+		D3DStateMatrix &m = D3DGlobal.textureMatrixStack[0]->top();
+		const BYTE *texCoord = (const BYTE*)vertices->texCoord;
+		for (int i = 0; i < vertices->count; ++i) {
+			const float *t = texCoord ? (const float*)( texCoord + i * vertices->stride ) : D3DState.CurrentState.currentTexCoord[0];
+			float *v = out + i * s_feedbackVertexSize + FEEDBACK_TEXCOORD;
+			if (m.is_identity())
+				memcpy( v, t, sizeof(float) * 4 );
+			else
+				D3DMatrix_TransformVec4( v, m.data(), t );
+		}
+	}
+}
+
+static bool D3DFeedback_IsCulled( const float *verts, int count, int vertexSize )
+{
+	if (!D3DState.EnableState.cullEnabled)
+		return false;
+	if (D3DState.PolygonState.cullMode == GL_FRONT_AND_BACK)
+		return true;
+
+	const float area = D3DFeedback_PolygonArea( verts, count, vertexSize );
+	const bool front = ( D3DState.PolygonState.frontFace == GL_CCW ) ? ( area > 0.0f ) : ( area < 0.0f );
+	return front == ( D3DState.PolygonState.cullMode == GL_FRONT );
+}
+
+static void D3DFeedback_Point( int a )
+{
+	if (s_feedbackCodes[a])
+		return;
+
+	const float *v = &s_feedbackClip[a * s_feedbackVertexSize];
+	if (D3DFeedbackContext.renderMode == GL_SELECT) {
+		D3DFeedback_Hit( v, 1, s_feedbackVertexSize );
+		return;
+	}
+	D3DFeedback_WriteFeedback( GL_POINT_TOKEN );
+	D3DFeedback_WriteVertices( v, 1 );
+}
+
+// reset is set for the first line of a strip and cleared once a line is written
+static void D3DFeedback_Line( int a, int b, bool *reset )
+{
+	const unsigned int codeA = s_feedbackCodes[a];
+	const unsigned int codeB = s_feedbackCodes[b];
+	if (codeA & codeB)
+		return;
+
+	const int vertexSize = s_feedbackVertexSize;
+	float verts[2][QINDIEGL_FEEDBACK_MAX_VERTEX_SIZE];
+	memcpy( verts[0], &s_feedbackClip[a * vertexSize], sizeof(float) * vertexSize );
+	memcpy( verts[1], &s_feedbackClip[b * vertexSize], sizeof(float) * vertexSize );
+	if (( codeA | codeB ) && !D3DFeedback_ClipLine( verts[0], verts[1], vertexSize, codeA | codeB ))
+		return;
+
+	if (D3DFeedbackContext.renderMode == GL_SELECT) {
+		D3DFeedback_Hit( verts[0], 2, QINDIEGL_FEEDBACK_MAX_VERTEX_SIZE );
+		return;
+	}
+	D3DFeedback_WriteFeedback( *reset ? GL_LINE_RESET_TOKEN : GL_LINE_TOKEN );
+	D3DFeedback_WriteVertices( verts[0], 1 );
+	D3DFeedback_WriteVertices( verts[1], 1 );
+	*reset = false;
+}
+
+static void D3DFeedback_Polygon( const int *indices, int count )
+{
+	unsigned int clipAnd = 0xFF, clipOr = 0;
+	for (int i = 0; i < count; ++i) {
+		clipAnd &= s_feedbackCodes[indices[i]];
+		clipOr |= s_feedbackCodes[indices[i]];
+	}
+	if (clipAnd)
+		return;
+
+	const int vertexSize = s_feedbackVertexSize;
+	const DWORD fillMode = D3DState.PolygonState.fillMode;
+	float *verts = nullptr;
+	int numVerts = count;
+
+	if (fillMode == D3DFILL_SOLID || D3DState.EnableState.cullEnabled) {
+		const size_t size = ( count + QINDIEGL_FEEDBACK_CLIP_PLANES ) * vertexSize;
+		if (s_feedbackPolygon.size() < size) {
+			s_feedbackPolygon.resize( size );
+			s_feedbackTemp.resize( size );
+		}
+		verts = &s_feedbackPolygon[0];
+		for (int i = 0; i < count; ++i)
+			memcpy( verts + i * vertexSize, &s_feedbackClip[indices[i] * vertexSize], sizeof(float) * vertexSize );
+		if (clipOr) {
+			numVerts = D3DFeedback_ClipPolygon( verts, count, vertexSize, clipOr, verts, &s_feedbackTemp[0] );
+			if (!numVerts)
+				return;
+		}
+		if (D3DFeedback_IsCulled( verts, numVerts, vertexSize ))
+			return;
+	}
+
+	if (fillMode == D3DFILL_POINT) {
+		for (int i = 0; i < count; ++i)
+			D3DFeedback_Point( indices[i] );
+	} else if (fillMode == D3DFILL_WIREFRAME) {
+		bool reset = true;
+		for (int i = 0; i < count; ++i)
+			D3DFeedback_Line( indices[i], indices[( i + 1 ) % count], &reset );
+	} else if (D3DFeedbackContext.renderMode == GL_SELECT) {
+		D3DFeedback_Hit( verts, numVerts, vertexSize );
+	} else {
+		D3DFeedback_WriteFeedback( GL_POLYGON_TOKEN );
+		D3DFeedback_WriteFeedback( (GLfloat)numVerts );
+		D3DFeedback_WriteVertices( verts, numVerts );
+	}
+}
+
+static void D3DFeedback_Triangle( int a, int b, int c )
+{
+	const int indices[3] = { a, b, c };
+	D3DFeedback_Polygon( indices, 3 );
+}
+
+// Number of vertices that make whole primitives
+static int D3DFeedback_UsedVertices( GLenum primType, int numVertices )
+{
+	switch (primType) {
+	case GL_POINTS:
+		return numVertices;
+	case GL_LINES:
+		return numVertices & ~1;
+	case GL_LINE_STRIP:
+	case GL_LINE_LOOP:
+		return numVertices >= 2 ? numVertices : 0;
+	case GL_TRIANGLES:
+		return numVertices - numVertices % 3;
+	case GL_QUADS:
+		// each quad is stored as two triangles
+		return numVertices - numVertices % 6;
+	case GL_QUAD_STRIP:
+		return numVertices >= 4 ? ( numVertices & ~1 ) : 0;
+	default:
+		return numVertices >= 3 ? numVertices : 0;
+	}
+}
+
+static void D3DFeedback_AssemblePrimitives( GLenum primType, int numVertices, const WORD *indices, int numIndices )
+{
+	bool reset = true;
+
+	if (indices) {
+		if (primType == GL_LINES) {
+			for (int i = 0; i + 1 < numIndices; i += 2, reset = true)
+				D3DFeedback_Line( indices[i], indices[i+1], &reset );
+		} else {
+			for (int i = 0; i + 2 < numIndices; i += 3)
+				D3DFeedback_Triangle( indices[i], indices[i+1], indices[i+2] );
+		}
+		return;
+	}
+
+	switch (primType) {
+	case GL_POINTS:
+		for (int i = 0; i < numVertices; ++i)
+			D3DFeedback_Point( i );
+		break;
+	case GL_LINES:
+		for (int i = 0; i < numVertices; i += 2, reset = true)
+			D3DFeedback_Line( i, i + 1, &reset );
+		break;
+	case GL_LINE_STRIP:
+	case GL_LINE_LOOP:
+		for (int i = 0; i + 1 < numVertices; ++i)
+			D3DFeedback_Line( i, i + 1, &reset );
+		if (primType == GL_LINE_LOOP)
+			D3DFeedback_Line( numVertices - 1, 0, &reset );
+		break;
+	case GL_TRIANGLES:
+		for (int i = 0; i < numVertices; i += 3)
+			D3DFeedback_Triangle( i, i + 1, i + 2 );
+		break;
+	case GL_QUADS:
+		// quads are converted to triangles 0 1 2 and 0 2 3 while specifying vertices
+		for (int i = 0; i < numVertices; i += 6) {
+			const int quad[4] = { i, i + 1, i + 2, i + 5 };
+			D3DFeedback_Polygon( quad, 4 );
+		}
+		break;
+	case GL_QUAD_STRIP:
+		for (int i = 0; i + 3 < numVertices; i += 2) {
+			const int quad[4] = { i, i + 1, i + 3, i + 2 };
+			D3DFeedback_Polygon( quad, 4 );
+		}
+		break;
+	case GL_TRIANGLE_STRIP:
+		for (int i = 0; i + 2 < numVertices; ++i) {
+			if (i & 1)
+				D3DFeedback_Triangle( i + 1, i, i + 2 );
+			else
+				D3DFeedback_Triangle( i, i + 1, i + 2 );
+		}
+		break;
+	case GL_TRIANGLE_FAN:
+		for (int i = 1; i + 1 < numVertices; ++i)
+			D3DFeedback_Triangle( 0, i, i + 1 );
+		break;
+	case GL_POLYGON:
+		if ((int)s_feedbackIndices.size() < numVertices)
+			s_feedbackIndices.resize( numVertices );
+		for (int i = 0; i < numVertices; ++i)
+			s_feedbackIndices[i] = i;
+		D3DFeedback_Polygon( &s_feedbackIndices[0], numVertices );
+		break;
+	default:
+		break;
+	}
+}
+
+void D3DFeedback_Primitives( GLenum primType, const D3DFeedbackVertices_t *vertices, const WORD *indices, int numIndices )
+{
+	int numVertices = vertices->count;
+	if (!indices)
+		numVertices = D3DFeedback_UsedVertices( primType, numVertices );
+	if (numVertices <= 0)
+		return;
+
+	const bool select = ( D3DFeedbackContext.renderMode == GL_SELECT );
+	s_feedbackVertexSize = select ? FEEDBACK_COLOR : D3DFeedback_TypeVertexSize( D3DFeedbackContext.feedbackType );
+	if ((int)s_feedbackCodes.size() < numVertices)
+		s_feedbackCodes.resize( numVertices );
+	if ((int)s_feedbackClip.size() < numVertices * s_feedbackVertexSize)
+		s_feedbackClip.resize( numVertices * s_feedbackVertexSize );
+
+	float m[16];
+	unsigned int clipAnd, clipOr;
+	D3DFeedback_ModelViewProjection( m );
+	D3DFeedback_Transform( m, vertices->position, vertices->size, vertices->stride, numVertices,
+						   &s_feedbackClip[0], s_feedbackVertexSize, &s_feedbackCodes[0], &clipAnd, &clipOr );
+
+	if (clipAnd)
+		return;
+
+	if (select) {
+		const bool polygons = ( primType != GL_POINTS && primType != GL_LINES && primType != GL_LINE_STRIP && primType != GL_LINE_LOOP );
+		if (!clipOr && !( polygons && D3DState.EnableState.cullEnabled )) {
+			D3DFeedback_Hit( &s_feedbackClip[0], numVertices, s_feedbackVertexSize );
+			return;
+		}
+	} else {
+		D3DFeedbackVertices_t used = *vertices;
+		used.count = numVertices;
+		D3DFeedback_SetupAttributes( &used );
+		D3DFeedback_SetupViewport();
+	}
+
+	D3DFeedback_AssemblePrimitives( primType, numVertices, indices, numIndices );
+}
+
+bool D3DFeedback_CullBounds( const float *mins, const float *maxs )
+{
+	float m[16];
+	D3DFeedback_ModelViewProjection( m );
+	return D3DFeedback_CullBox( m, mins, maxs );
+}
+
+//==================================================================================
+// Entry points
+//==================================================================================
+OPENGL_API GLint WINAPI glRenderMode( GLenum mode )
+{
+	if (mode != GL_RENDER && mode != GL_SELECT && mode != GL_FEEDBACK) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
 		return 0;
-	case GL_FEEDBACK:
-		logPrintf("WARNING: glRenderMode: GL_FEEDBACK is not supported\n");
+	}
+	if (( mode == GL_SELECT && !D3DFeedbackContext.selectBufferSize ) ||
+		( mode == GL_FEEDBACK && !D3DFeedbackContext.feedbackBufferSize )) {
+		D3DGlobal.lastError = E_INVALID_OPERATION;
 		return 0;
 	}
+
+	GLint result = 0;
+	if (D3DFeedbackContext.renderMode == GL_SELECT) {
+		D3DFeedback_FlushHit();
+		result = ( D3DFeedbackContext.selectCount > D3DFeedbackContext.selectBufferSize ) ? -1 : D3DFeedbackContext.hitCount;
+		D3DFeedbackContext.selectCount = 0;
+		D3DFeedbackContext.hitCount = 0;
+		D3DFeedbackContext.nameStackDepth = 0;
+	} else if (D3DFeedbackContext.renderMode == GL_FEEDBACK) {
+		result = ( D3DFeedbackContext.feedbackCount > D3DFeedbackContext.feedbackBufferSize ) ? -1 : D3DFeedbackContext.feedbackCount;
+		D3DFeedbackContext.feedbackCount = 0;
+	}
+
+	D3DFeedbackContext.renderMode = mode;
+	return result;
 }
 
-OPENGL_API void WINAPI glFeedbackBuffer( GLsizei, GLenum, GLfloat* )
+OPENGL_API void WINAPI glFeedbackBuffer( GLsizei size, GLenum type, GLfloat *buffer )
 {
-	logPrintf("WARNING: unimplemented function - glFeedbackBuffer\n");
+	if (type != GL_2D && type != GL_3D && type != GL_3D_COLOR && type != GL_3D_COLOR_TEXTURE && type != GL_4D_COLOR_TEXTURE) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+	if (size < 0) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+	if (D3DFeedbackContext.renderMode == GL_FEEDBACK) {
+		D3DGlobal.lastError = E_INVALID_OPERATION;
+		return;
+	}
+	D3DFeedbackContext.feedbackBuffer = buffer;
+	D3DFeedbackContext.feedbackBufferSize = buffer ? size : 0;
+	D3DFeedbackContext.feedbackType = type;
+	D3DFeedbackContext.feedbackCount = 0;
 }
-OPENGL_API void WINAPI glPassThrough( GLfloat )
+OPENGL_API void WINAPI glPassThrough( GLfloat token )
 {
-	logPrintf("WARNING: unimplemented function - glPassThrough\n");
+	D3DLIST_COMPILE( D3DLIST_OP_PASS_THROUGH, token );
+	if (D3DFeedbackContext.renderMode != GL_FEEDBACK)
+		return;
+	D3DFeedback_WriteFeedback( GL_PASS_THROUGH_TOKEN );
+	D3DFeedback_WriteFeedback( token );
 }
 
-OPENGL_API void WINAPI glSelectBuffer( GLsizei, GLuint* )
+OPENGL_API void WINAPI glSelectBuffer( GLsizei size, GLuint *buffer )
 {
-	logPrintf("WARNING: unimplemented function - glSelectBuffer\n");
+	if (size < 0) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+	if (D3DFeedbackContext.renderMode == GL_SELECT) {
+		D3DGlobal.lastError = E_INVALID_OPERATION;
+		return;
+	}
+	D3DFeedbackContext.selectBuffer = buffer;
+	D3DFeedbackContext.selectBufferSize = buffer ? size : 0;
+	D3DFeedbackContext.selectCount = 0;
+	D3DFeedbackContext.hitCount = 0;
+	D3DFeedback_ResetHit();
 }
 OPENGL_API void WINAPI glInitNames()
 {
-	logPrintf("WARNING: unimplemented function - glInitNames\n");
+	D3DLIST_COMPILE( D3DLIST_OP_INIT_NAMES );
+	if (D3DFeedbackContext.renderMode == GL_SELECT)
+		D3DFeedback_FlushHit();
+	D3DFeedbackContext.nameStackDepth = 0;
+	D3DFeedback_ResetHit();
 }
-OPENGL_API void WINAPI glLoadName( GLuint )
+OPENGL_API void WINAPI glLoadName( GLuint name )
 {
-	logPrintf("WARNING: unimplemented function - glLoadName\n");
+	D3DLIST_COMPILE( D3DLIST_OP_LOAD_NAME, name );
+	if (D3DFeedbackContext.renderMode != GL_SELECT)
+		return;
+	if (!D3DFeedbackContext.nameStackDepth) {
+		D3DGlobal.lastError = E_INVALID_OPERATION;
+		return;
+	}
+	D3DFeedback_FlushHit();
+	D3DFeedbackContext.nameStack[D3DFeedbackContext.nameStackDepth - 1] = name;
 }
-OPENGL_API void WINAPI glPushName( GLuint )
+OPENGL_API void WINAPI glPushName( GLuint name )
 {
-	logPrintf("WARNING: unimplemented function - glPushName\n");
+	D3DLIST_COMPILE( D3DLIST_OP_PUSH_NAME, name );
+	if (D3DFeedbackContext.renderMode != GL_SELECT)
+		return;
+	D3DFeedback_FlushHit();
+	if (D3DFeedbackContext.nameStackDepth >= D3D_MAX_NAME_STACK_DEPTH) {
+		D3DGlobal.lastError = E_STACK_OVERFLOW;
+		return;
+	}
+	D3DFeedbackContext.nameStack[D3DFeedbackContext.nameStackDepth++] = name;
 }
 OPENGL_API void WINAPI glPopName()
 {
-	logPrintf("WARNING: unimplemented function - glPopName\n");
+	D3DLIST_COMPILE( D3DLIST_OP_POP_NAME );
+	if (D3DFeedbackContext.renderMode != GL_SELECT)
+		return;
+	D3DFeedback_FlushHit();
+	if (!D3DFeedbackContext.nameStackDepth) {
+		D3DGlobal.lastError = E_STACK_UNDERFLOW;
+		return;
+	}
+	--D3DFeedbackContext.nameStackDepth;
 }
-
@@ -0,0 +1,81 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_FEEDBACK_H
+#define QINDIEGL_D3D_FEEDBACK_H
+
+#include "d3d_feedback_batch.hpp"
+
+//==================================================================================
+// Selection and feedback modes
+//----------------------------------------------------------------------------------
+// Nothing is drawn in GL_SELECT and GL_FEEDBACK modes. D3DIMBuffer, display lists
+// and array draws pass their primitives to D3DFeedback_Primitives instead, which
+// transforms and clips them on the CPU (see d3d_feedback_batch.hpp). Selection
+// keeps the depth range of those that hit the view volume until the name stack
+// changes; feedback maps them to the window and writes them to the buffer.
+//==================================================================================
+
+#define D3D_MAX_NAME_STACK_DEPTH	64
+
+typedef struct D3DFeedbackContext_s
+{
+	GLenum		renderMode;
+	GLuint		*selectBuffer;
+	GLsizei		selectBufferSize;
+	GLsizei		selectCount;		// values of the hit records, may exceed the buffer size
+	GLint		hitCount;
+	bool		hit;				// a primitive hit the view volume since the last record
+	float		hitMinZ;
+	float		hitMaxZ;
+	GLuint		nameStack[D3D_MAX_NAME_STACK_DEPTH];
+	int			nameStackDepth;
+	GLfloat		*feedbackBuffer;
+	GLsizei		feedbackBufferSize;
+	GLenum		feedbackType;
+	GLsizei		feedbackCount;		// values written, may exceed the buffer size
+} D3DFeedbackContext_t;
+
+extern D3DFeedbackContext_t D3DFeedbackContext;
+
+inline bool D3DFeedback_IsActive()
+{
+	return D3DFeedbackContext.renderMode != GL_RENDER;
+}
+
+// Vertices as D3DIMBuffer stores them: all attributes are read every stride bytes
+typedef struct D3DFeedbackVertices_s
+{
+	const float	*position;			// size floats
+	int			size;
+	const DWORD	*color;				// D3DCOLOR
+	const float	*texCoord;			// 4 floats of the first texture unit, nullptr for the current texture coordinates
+	int			stride;
+	int			count;
+} D3DFeedbackVertices_t;
+
+// With indices, primType is GL_TRIANGLES or GL_LINES and every vertex is
+// expected to be used by them
+extern void D3DFeedback_Primitives( GLenum primType, const D3DFeedbackVertices_t *vertices, const WORD *indices, int numIndices );
+
+// True if the primitives of an array draw within the box can't hit anything
+extern bool D3DFeedback_CullBounds( const float *mins, const float *maxs );
+
+#endif //QINDIEGL_D3D_FEEDBACK_H
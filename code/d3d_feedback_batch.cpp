@@ -0,0 +1,351 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include <assert.h>
+#include <string.h>
+#include "d3d_feedback_batch.hpp"
+
+#if QINDIEGL_MATRIX_SSE
+#include <xmmintrin.h>
+#endif
+
+// Planes in outcode bit order; a position is inside a plane when dot( plane, position ) >= 0
+static const float c_clipPlanes[QINDIEGL_FEEDBACK_CLIP_PLANES][4] =
+{
+	{  1.0f,  0.0f,  0.0f, 1.0f },	// LEFT
+	{  0.0f,  1.0f,  0.0f, 1.0f },	// BOTTOM
+	{  0.0f,  0.0f,  1.0f, 0.0f },	// NEAR
+	{ -1.0f,  0.0f,  0.0f, 1.0f },	// RIGHT
+	{  0.0f, -1.0f,  0.0f, 1.0f },	// TOP
+	{  0.0f,  0.0f, -1.0f, 1.0f },	// FAR
+};
+
+static inline float FeedbackBatch_PlaneDist( int plane, const float *v )
+{
+	const float *p = c_clipPlanes[plane];
+	return p[0] * v[0] + p[1] * v[1] + p[2] * v[2] + p[3] * v[3];
+}
+
+unsigned int D3DFeedback_ClipCode( const float *clip )
+{
+	const float w = clip[3];
+	unsigned int code = 0;
+	if (clip[0] < -w) code |= D3DFEEDBACK_CLIP_LEFT;
+	if (clip[1] < -w) code |= D3DFEEDBACK_CLIP_BOTTOM;
+	if (clip[2] < 0.0f) code |= D3DFEEDBACK_CLIP_NEAR;
+	if (clip[0] > w) code |= D3DFEEDBACK_CLIP_RIGHT;
+	if (clip[1] > w) code |= D3DFEEDBACK_CLIP_TOP;
+	if (clip[2] > w) code |= D3DFEEDBACK_CLIP_FAR;
+	return code;
+}
+
+//==================================================================================
+// Transform
+//==================================================================================
+void D3DFeedback_Transform_Ref( const float *m, const float *in, int size, int inStride, int count,
+								float *out, int outStride, unsigned char *codes, unsigned int *clipAnd, unsigned int *clipOr )
+{
+	unsigned int codesAnd = 0xFF;
+	unsigned int codesOr = 0;
+
+	for (int i = 0; i < count; ++i, out += outStride) {
+		const float *p = (const float*)( (const char*)in + i * inStride );
+		const float x = p[0];
+		const float y = p[1];
+		const float z = size > 2 ? p[2] : 0.0f;
+		const float w = size > 3 ? p[3] : 1.0f;
+		for (int j = 0; j < 4; ++j)
+			out[j] = x*m[j] + y*m[4+j] + z*m[8+j] + w*m[12+j];
+
+		const unsigned int code = D3DFeedback_ClipCode( out );
+		codes[i] = (unsigned char)code;
+		codesAnd &= code;
+		codesOr |= code;
+	}
+
+	*clipAnd = count ? codesAnd : 0;
+	*clipOr = codesOr;
+}
+
+#if QINDIEGL_MATRIX_SSE
+
+// Both compares give the x, y and z lanes in the low three bits of their
+// movemask, which is the order of the outcode bits
+void D3DFeedback_Transform_SSE( const float *m, const float *in, int size, int inStride, int count,
+								float *out, int outStride, unsigned char *codes, unsigned int *clipAnd, unsigned int *clipOr )
+{
+	const __m128 m0 = _mm_loadu_ps( m );
+	const __m128 m1 = _mm_loadu_ps( m + 4 );
+	const __m128 m2 = _mm_loadu_ps( m + 8 );
+	const __m128 m3 = _mm_loadu_ps( m + 12 );
+	const __m128 lowerScale = _mm_setr_ps( -1.0f, -1.0f, 0.0f, 0.0f );
+	unsigned int codesAnd = 0xFF;
+	unsigned int codesOr = 0;
+
+	for (int i = 0; i < count; ++i, out += outStride) {
+		const float *p = (const float*)( (const char*)in + i * inStride );
+		__m128 v = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( p[0] ), m0 ), _mm_mul_ps( _mm_set1_ps( p[1] ), m1 ) );
+		if (size > 2)
+			v = _mm_add_ps( v, _mm_mul_ps( _mm_set1_ps( p[2] ), m2 ) );
+		v = _mm_add_ps( v, size > 3 ? _mm_mul_ps( _mm_set1_ps( p[3] ), m3 ) : m3 );
+		_mm_storeu_ps( out, v );
+
+		const __m128 w = _mm_shuffle_ps( v, v, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+		const unsigned int below = (unsigned int)_mm_movemask_ps( _mm_cmplt_ps( v, _mm_mul_ps( w, lowerScale ) ) ) & 0x7;
+		const unsigned int above = (unsigned int)_mm_movemask_ps( _mm_cmpgt_ps( v, w ) ) & 0x7;
+		const unsigned int code = below | ( above << 3 );
+		codes[i] = (unsigned char)code;
+		codesAnd &= code;
+		codesOr |= code;
+	}
+
+	*clipAnd = count ? codesAnd : 0;
+	*clipOr = codesOr;
+}
+
+#endif //QINDIEGL_MATRIX_SSE
+
+void D3DFeedback_Transform( const float *m, const float *in, int size, int inStride, int count,
+							float *out, int outStride, unsigned char *codes, unsigned int *clipAnd, unsigned int *clipOr )
+{
+#if QINDIEGL_MATRIX_SSE
+	if (D3DMatrix_IsUsingSSE()) {
+		D3DFeedback_Transform_SSE( m, in, size, inStride, count, out, outStride, codes, clipAnd, clipOr );
+		return;
+	}
+#endif
+	D3DFeedback_Transform_Ref( m, in, size, inStride, count, out, outStride, codes, clipAnd, clipOr );
+}
+
+//==================================================================================
+// Bounding boxes
+//----------------------------------------------------------------------------------
+// A box is outside when all of its corners are outside the same plane. That
+// misses boxes that only touch the volume beyond its corners, which are left to
+// the per-primitive tests.
+//==================================================================================
+void D3DFeedback_Bounds( const float *in, int size, int stride, int count, float *mins, float *maxs )
+{
+	assert( count > 0 );
+	mins[0] = maxs[0] = in[0];
+	mins[1] = maxs[1] = in[1];
+	mins[2] = maxs[2] = size > 2 ? in[2] : 0.0f;
+
+	for (int i = 1; i < count; ++i) {
+		const float *p = (const float*)( (const char*)in + i * stride );
+		for (int j = 0; j < size && j < 3; ++j) {
+			if (p[j] < mins[j]) mins[j] = p[j];
+			else if (p[j] > maxs[j]) maxs[j] = p[j];
+		}
+	}
+}
+
+bool D3DFeedback_CullBox( const float *m, const float *mins, const float *maxs )
+{
+	float corners[8][3];
+	float clip[8][4];
+	unsigned char codes[8];
+	unsigned int clipAnd, clipOr;
+
+	for (int i = 0; i < 8; ++i) {
+		corners[i][0] = ( i & 1 ) ? maxs[0] : mins[0];
+		corners[i][1] = ( i & 2 ) ? maxs[1] : mins[1];
+		corners[i][2] = ( i & 4 ) ? maxs[2] : mins[2];
+	}
+	D3DFeedback_Transform( m, corners[0], 3, sizeof(corners[0]), 8, clip[0], 4, codes, &clipAnd, &clipOr );
+	return clipAnd != 0;
+}
+
+//==================================================================================
+// Clipping
+//----------------------------------------------------------------------------------
+// The intersection with a plane is always computed from the inside vertex, so
+// an edge shared by two primitives is split at exactly the same point.
+//==================================================================================
+static inline void FeedbackBatch_Lerp( float *out, const float *a, const float *b, float t, int vertexSize )
+{
+	for (int i = 0; i < vertexSize; ++i)
+		out[i] = a[i] + ( b[i] - a[i] ) * t;
+}
+
+static int FeedbackBatch_ClipToPlane( const float *in, int count, int vertexSize, int plane, float *out )
+{
+	int numOut = 0;
+	const float *a = in + ( count - 1 ) * vertexSize;
+	float da = FeedbackBatch_PlaneDist( plane, a );
+
+	for (int i = 0; i < count; ++i) {
+		const float *b = in + i * vertexSize;
+		const float db = FeedbackBatch_PlaneDist( plane, b );
+
+		if (( da >= 0.0f ) != ( db >= 0.0f )) {
+			if (da >= 0.0f)
+				FeedbackBatch_Lerp( out + numOut * vertexSize, a, b, da / ( da - db ), vertexSize );
+			else
+				FeedbackBatch_Lerp( out + numOut * vertexSize, b, a, db / ( db - da ), vertexSize );
+			++numOut;
+		}
+		if (db >= 0.0f) {
+			memcpy( out + numOut * vertexSize, b, vertexSize * sizeof(float) );
+			++numOut;
+		}
+		a = b;
+		da = db;
+	}
+	return numOut;
+}
+
+int D3DFeedback_ClipPolygon( const float *in, int count, int vertexSize, unsigned int clipOr, float *out, float *temp )
+{
+	const float *src = in;
+	float *dst = ( in == out ) ? temp : out;
+
+	for (int plane = 0; plane < QINDIEGL_FEEDBACK_CLIP_PLANES && count > 0; ++plane) {
+		if (!( clipOr & ( 1 << plane ) ))
+			continue;
+		count = FeedbackBatch_ClipToPlane( src, count, vertexSize, plane, dst );
+		src = dst;
+		dst = ( dst == out ) ? temp : out;
+	}
+
+	if (src != out && count > 0)
+		memcpy( out, src, count * vertexSize * sizeof(float) );
+	return count;
+}
+
+bool D3DFeedback_ClipLine( float *a, float *b, int vertexSize, unsigned int clipOr )
+{
+	assert( vertexSize <= QINDIEGL_FEEDBACK_MAX_VERTEX_SIZE );
+	float t0 = 0.0f;
+	float t1 = 1.0f;
+
+	for (int plane = 0; plane < QINDIEGL_FEEDBACK_CLIP_PLANES; ++plane) {
+		if (!( clipOr & ( 1 << plane ) ))
+			continue;
+		const float da = FeedbackBatch_PlaneDist( plane, a );
+		const float db = FeedbackBatch_PlaneDist( plane, b );
+		if (da < 0.0f && db < 0.0f)
+			return false;
+		if (da < 0.0f) {
+			const float t = da / ( da - db );
+			if (t > t0) t0 = t;
+		} else if (db < 0.0f) {
+			const float t = da / ( da - db );
+			if (t < t1) t1 = t;
+		}
+	}
+	if (t0 > t1)
+		return false;
+
+	float start[QINDIEGL_FEEDBACK_MAX_VERTEX_SIZE];
+	memcpy( start, a, vertexSize * sizeof(float) );
+	if (t0 > 0.0f)
+		FeedbackBatch_Lerp( a, start, b, t0, vertexSize );
+	if (t1 < 1.0f)
+		FeedbackBatch_Lerp( b, start, b, t1, vertexSize );
+	return true;
+}
+
+//==================================================================================
+// Viewport mapping
+//==================================================================================
+
+// Clipped vertices have w >= 0, and w = 0 only where x = y = z = 0
+static inline float FeedbackBatch_InvW( const float *v )
+{
+	return v[3] > 0.0f ? 1.0f / v[3] : 0.0f;
+}
+
+void D3DFeedback_ViewportMap_Ref( const float *verts, int count, int vertexSize, const float *scale, const float *offset, float *out )
+{
+	for (int i = 0; i < count; ++i, verts += vertexSize, out += 4) {
+		const float rw = FeedbackBatch_InvW( verts );
+		out[0] = verts[0] * rw * scale[0] + offset[0];
+		out[1] = verts[1] * rw * scale[1] + offset[1];
+		out[2] = verts[2] * rw * scale[2] + offset[2];
+		out[3] = verts[3];
+	}
+}
+
+#if QINDIEGL_MATRIX_SSE
+
+void D3DFeedback_ViewportMap_SSE( const float *verts, int count, int vertexSize, const float *scale, const float *offset, float *out )
+{
+	const __m128 s = _mm_loadu_ps( scale );
+	const __m128 o = _mm_loadu_ps( offset );
+	for (int i = 0; i < count; ++i, verts += vertexSize, out += 4) {
+		const __m128 v = _mm_mul_ps( _mm_loadu_ps( verts ), _mm_set1_ps( FeedbackBatch_InvW( verts ) ) );
+		_mm_storeu_ps( out, _mm_add_ps( _mm_mul_ps( v, s ), o ) );
+		out[3] = verts[3];
+	}
+}
+
+#endif //QINDIEGL_MATRIX_SSE
+
+void D3DFeedback_ViewportMap( const float *verts, int count, int vertexSize, const float *scale, const float *offset, float *out )
+{
+#if QINDIEGL_MATRIX_SSE
+	if (D3DMatrix_IsUsingSSE()) {
+		D3DFeedback_ViewportMap_SSE( verts, count, vertexSize, scale, offset, out );
+		return;
+	}
+#endif
+	D3DFeedback_ViewportMap_Ref( verts, count, vertexSize, scale, offset, out );
+}
+
+//==================================================================================
+// Clipped primitives
+//==================================================================================
+void D3DFeedback_DepthRange( const float *verts, int count, int vertexSize, float *minZ, float *maxZ )
+{
+	float zmin = 1.0f;
+	float zmax = 0.0f;
+	for (int i = 0; i < count; ++i, verts += vertexSize) {
+		float z = verts[3] > 0.0f ? verts[2] / verts[3] : 0.0f;
+		if (z < 0.0f) z = 0.0f;
+		else if (z > 1.0f) z = 1.0f;
+		if (z < zmin) zmin = z;
+		if (z > zmax) zmax = z;
+	}
+	*minZ = zmin;
+	*maxZ = zmax;
+}
+
+static inline void FeedbackBatch_Project( const float *v, float *x, float *y )
+{
+	const float rw = FeedbackBatch_InvW( v );
+	*x = v[0] * rw;
+	*y = v[1] * rw;
+}
+
+float D3DFeedback_PolygonArea( const float *verts, int count, int vertexSize )
+{
+	float area = 0.0f;
+	float ax, ay;
+	FeedbackBatch_Project( verts + ( count - 1 ) * vertexSize, &ax, &ay );
+	for (int i = 0; i < count; ++i) {
+		float bx, by;
+		FeedbackBatch_Project( verts + i * vertexSize, &bx, &by );
+		area += ax * by - bx * ay;
+		ax = bx;
+		ay = by;
+	}
+	return area;
+}
@@ -0,0 +1,106 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_FEEDBACK_BATCH_H
+#define QINDIEGL_D3D_FEEDBACK_BATCH_H
+
+#include "d3d_matrix_math.hpp"
+
+//==================================================================================
+// Selection and feedback geometry
+//----------------------------------------------------------------------------------
+// GL_SELECT and GL_FEEDBACK don't rasterize anything, so their primitives are
+// transformed and clipped on the CPU. D3DFeedback_Transform takes a batch of
+// positions to clip space and classifies them against the view volume in the
+// same pass; the outcodes let whole batches and most primitives be accepted or
+// rejected without clipping. Primitives that cross the volume are clipped to it
+// with their attributes, which follow the clip position in each vertex, and
+// mapped to the viewport when their window coordinates are needed.
+//
+// The view volume is the one D3D clips to: -w <= x, y <= w and 0 <= z <= w.
+// With ProjectionFix the projection matrix is converted to that z range, so it
+// is the GL volume; without it, it is what actually ends up on the screen.
+//
+// Like d3d_matrix_math, the module knows nothing about the GL state, so it can
+// be compiled into the tests. d3d_feedback.cpp assembles the primitives.
+//==================================================================================
+
+// Outcode bits, set when a vertex is on the outer side of a plane
+#define D3DFEEDBACK_CLIP_LEFT		0x01	// x < -w
+#define D3DFEEDBACK_CLIP_BOTTOM		0x02	// y < -w
+#define D3DFEEDBACK_CLIP_NEAR		0x04	// z < 0
+#define D3DFEEDBACK_CLIP_RIGHT		0x08	// x > w
+#define D3DFEEDBACK_CLIP_TOP		0x10	// y > w
+#define D3DFEEDBACK_CLIP_FAR		0x20	// z > w
+
+#define QINDIEGL_FEEDBACK_CLIP_PLANES		6
+// Floats per clipped vertex: the clip position and up to 12 attributes
+#define QINDIEGL_FEEDBACK_MAX_VERTEX_SIZE	16
+
+// Transforms count positions of size 2 to 4 floats (z defaults to 0 and w to 1),
+// read every inStride bytes, by m. out gets the clip position every outStride
+// floats and codes the outcode of each position. clipAnd and clipOr receive the
+// outcodes of the whole batch combined; all of them are outside when clipAnd
+// isn't 0, all of them are inside when clipOr is 0.
+void D3DFeedback_Transform( const float *m, const float *in, int size, int inStride, int count,
+							float *out, int outStride, unsigned char *codes, unsigned int *clipAnd, unsigned int *clipOr );
+
+void D3DFeedback_Transform_Ref( const float *m, const float *in, int size, int inStride, int count,
+								float *out, int outStride, unsigned char *codes, unsigned int *clipAnd, unsigned int *clipOr );
+#if QINDIEGL_MATRIX_SSE
+void D3DFeedback_Transform_SSE( const float *m, const float *in, int size, int inStride, int count,
+								float *out, int outStride, unsigned char *codes, unsigned int *clipAnd, unsigned int *clipOr );
+#endif
+
+unsigned int D3DFeedback_ClipCode( const float *clip );
+
+// Box of count positions of size 2 or 3 floats read every stride bytes
+void D3DFeedback_Bounds( const float *in, int size, int stride, int count, float *mins, float *maxs );
+
+// True if the box is completely outside the view volume after transforming by m
+bool D3DFeedback_CullBox( const float *m, const float *mins, const float *maxs );
+
+// Clips a convex polygon of count vertices of vertexSize floats, the first four
+// being the clip position, to the planes in clipOr. out and temp must have room
+// for count + QINDIEGL_FEEDBACK_CLIP_PLANES vertices; in may be either of them.
+// Returns the number of vertices written to out, 0 if nothing is left.
+int D3DFeedback_ClipPolygon( const float *in, int count, int vertexSize, unsigned int clipOr, float *out, float *temp );
+
+// Clips the line a-b in place; returns false if nothing is left
+bool D3DFeedback_ClipLine( float *a, float *b, int vertexSize, unsigned int clipOr );
+
+// Window coordinates of count clipped vertices of vertexSize floats: x, y and z
+// are divided by w, multiplied by scale and offset by offset; w is kept. out
+// gets 4 floats per vertex.
+void D3DFeedback_ViewportMap( const float *verts, int count, int vertexSize, const float *scale, const float *offset, float *out );
+
+void D3DFeedback_ViewportMap_Ref( const float *verts, int count, int vertexSize, const float *scale, const float *offset, float *out );
+#if QINDIEGL_MATRIX_SSE
+void D3DFeedback_ViewportMap_SSE( const float *verts, int count, int vertexSize, const float *scale, const float *offset, float *out );
+#endif
+
+// Smallest and largest normalized device z, 0..1, of clipped vertices
+void D3DFeedback_DepthRange( const float *verts, int count, int vertexSize, float *minZ, float *maxZ );
+
+// Twice the signed area of clipped vertices in normalized device x and y,
+// positive for counter-clockwise polygons
+float D3DFeedback_PolygonArea( const float *verts, int count, int vertexSize );
+
+#endif //QINDIEGL_D3D_FEEDBACK_BATCH_H
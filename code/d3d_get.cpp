@@ -25,6 +25,9 @@
 #include "d3d_matrix_stack.hpp"
 #include "d3d_texture.hpp"
 #include "d3d_matrix_detection.hpp"
+#include "d3d_lists.hpp"
+#include "d3d_eval_batch.hpp"
+#include "d3d_feedback.hpp"
 #include <map>
 
 //==================================================================================
@@ -156,6 +159,59 @@ template<typename T> static void glGet( GLenum pname, T *params )
 	case GL_MAX_CLIP_PLANES:
 		params[0] = (T)(QINDIEGL_MIN( D3DGlobal.hD3DCaps.MaxUserClipPlanes, IMPL_MAX_CLIP_PLANES ));
 		break;
+	case GL_MAX_LIST_NESTING:
+		params[0] = (T)D3D_MAX_LIST_NESTING;
+		break;
+	case GL_LIST_BASE:
+		params[0] = (T)D3DListContext.listBase;
+		break;
+	case GL_LIST_INDEX:
+		params[0] = (T)(D3DListContext.compiling ? D3DListContext.compilingName : 0);
+		break;
+	case GL_LIST_MODE:
+		params[0] = (T)(D3DListContext.compiling ? D3DListContext.compileMode : 0);
+		break;
+	case GL_RENDER_MODE:
+		params[0] = (T)D3DFeedbackContext.renderMode;
+		break;
+	case GL_NAME_STACK_DEPTH:
+		params[0] = (T)D3DFeedbackContext.nameStackDepth;
+		break;
+	case GL_MAX_NAME_STACK_DEPTH:
+		params[0] = (T)D3D_MAX_NAME_STACK_DEPTH;
+		break;
+	case GL_SELECTION_BUFFER_SIZE:
+		params[0] = (T)D3DFeedbackContext.selectBufferSize;
+		break;
+	case GL_FEEDBACK_BUFFER_SIZE:
+		params[0] = (T)D3DFeedbackContext.feedbackBufferSize;
+		break;
+	case GL_FEEDBACK_BUFFER_TYPE:
+		params[0] = (T)( D3DFeedbackContext.feedbackType ? D3DFeedbackContext.feedbackType : GL_2D );
+		break;
+	case GL_MAX_EVAL_ORDER:
+		params[0] = (T)QINDIEGL_EVAL_MAX_ORDER;
+		break;
+	case GL_MAP1_GRID_SEGMENTS:
+		params[0] = (T)D3DState.EvalState.grid1Segments;
+		break;
+	case GL_MAP1_GRID_DOMAIN:
+		params[0] = (T)D3DState.EvalState.grid1Domain[0];
+		params[1] = (T)D3DState.EvalState.grid1Domain[1];
+		break;
+	case GL_MAP2_GRID_SEGMENTS:
+		params[0] = (T)D3DState.EvalState.grid2Segments[0];
+		params[1] = (T)D3DState.EvalState.grid2Segments[1];
+		break;
+	case GL_MAP2_GRID_DOMAIN:
+		params[0] = (T)D3DState.EvalState.grid2Domain[0];
+		params[1] = (T)D3DState.EvalState.grid2Domain[1];
+		params[2] = (T)D3DState.EvalState.grid2Domain[2];
+		params[3] = (T)D3DState.EvalState.grid2Domain[3];
+		break;
+	case GL_AUTO_NORMAL:
+		params[0] = (T)(D3DState.EnableState.autoNormalEnabled ? 1 : 0);
+		break;
 
 	case GL_RED_BITS:
 		params[0] = (T)D3DGlobal.rgbaBits[0];
@@ -576,9 +632,10 @@ OPENGL_API void WINAPI glGetPointerv( GLenum pname, GLvoid* *params )
 {
 	switch (pname) {
 	case GL_SELECTION_BUFFER_POINTER:
+		*params = (GLvoid*)D3DFeedbackContext.selectBuffer;
+		break;
 	case GL_FEEDBACK_BUFFER_POINTER:
-		logPrintf("WARNING: glGetPointerv(0x%x): neither select nor feedback buffer is implemented\n", pname);
-		*params = NULL;
+		*params = (GLvoid*)D3DFeedbackContext.feedbackBuffer;
 		break;
 
 	case GL_VERTEX_ARRAY_POINTER:
@@ -24,9 +24,15 @@
 #include "d3d_utils.hpp"
 #include "d3d_immediate.hpp"
 #include "d3d_array.hpp"
+#include "d3d_lists.hpp"
 #include "d3d_object.hpp"
 #include "d3d_extension.hpp"
 #include "d3d_texture.hpp"
+#include "d3d_texture_manager.hpp"
+#include "d3d_texture_cache.hpp"
+#include "d3d_readback.hpp"
+#include "d3d_texture_dump.hpp"
+#include "d3d_pixels.hpp"
 #include "d3d_matrix_stack.hpp"
 #include "d3d_matrix_detection.hpp"
 #include "d3d_helpers.hpp"
@@ -74,6 +80,12 @@ void D3DGlobal_Init( bool clearGlobals )
 
 	if (!D3DGlobal.pObjectBuffer)
 		D3DGlobal.pObjectBuffer = new D3DObjectBuffer;
+	if (!D3DGlobal.pTextureManager)
+		D3DGlobal.pTextureManager = new D3DTextureManager;
+	if (!D3DGlobal.pReadback)
+		D3DGlobal.pReadback = new D3DReadbackQueue;
+	if (!D3DGlobal.pTextureDumper)
+		D3DGlobal.pTextureDumper = new D3DTextureDumper;
 
 	for (int i = 0; i < D3D_TEXTARGET_MAX; ++i) {
 		if (!D3DGlobal.defaultTexture[i])
@@ -113,6 +125,11 @@ void D3DGlobal_Reset()
 		D3DGlobal.pSystemMemFB->Release();
 		D3DGlobal.pSystemMemFB = nullptr;
 	}
+	if (D3DGlobal.pReadback)
+		D3DGlobal.pReadback->ReleaseSurfaces();
+	if (D3DGlobal.pTextureManager)
+		D3DGlobal.pTextureManager->ReleaseRenderTargets();
+	D3DPixels_InvalidateDepthCache();
 
 	Sleep( 20 );
 	D3DGlobal.pDevice->Reset(&D3DGlobal.hPresentParams);
@@ -216,6 +233,26 @@ void D3DGlobal_Cleanup( bool cleanupAll )
 		delete D3DGlobal.pObjectBuffer;
 		D3DGlobal.pObjectBuffer = nullptr;
 	}
+	//must go after the object buffer, deleted textures unregister themselves
+	if (D3DGlobal.pTextureManager) {
+		D3DGlobal.pTextureManager->LogStats();
+		delete D3DGlobal.pTextureManager;
+		D3DGlobal.pTextureManager = nullptr;
+	}
+	//textures are dumped as the object buffer deletes them
+	if (D3DGlobal.pTextureDumper) {
+		D3DGlobal.pTextureDumper->Flush();
+		D3DGlobal.pTextureDumper->LogStats();
+		delete D3DGlobal.pTextureDumper;
+		D3DGlobal.pTextureDumper = nullptr;
+	}
+	D3DTex_LogStats();
+	if (D3DGlobal.pTextureCache) {
+		D3DGlobal.pTextureCache->LogStats();
+		delete D3DGlobal.pTextureCache;
+		D3DGlobal.pTextureCache = nullptr;
+	}
+	D3DList_Cleanup();
 	if (D3DGlobal.pIMBuffer) {
 		delete D3DGlobal.pIMBuffer;
 		D3DGlobal.pIMBuffer = nullptr;
@@ -233,6 +270,12 @@ void D3DGlobal_Cleanup( bool cleanupAll )
 		D3DGlobal.pSystemMemFB->Release();
 		D3DGlobal.pSystemMemFB = nullptr;
 	}
+	if (D3DGlobal.pReadback) {
+		D3DGlobal.pReadback->LogStats();
+		delete D3DGlobal.pReadback;
+		D3DGlobal.pReadback = nullptr;
+	}
+	D3DPixels_FreeDepthCache();
 
 	if (D3DGlobal.pSwapChain) {
 		D3DGlobal.pSwapChain->Release();
@@ -509,6 +552,7 @@ static void D3DGlobal_SetupPixelFormatBits( D3DFORMAT fmtColor, D3DFORMAT fmtDep
     {
     case D3DFMT_D16_LOCKABLE:	D3DGlobal.depthBits = 16; D3DGlobal.stencilBits = 0; break;
 	case D3DFMT_D32_LOCKABLE:	D3DGlobal.depthBits = 32; D3DGlobal.stencilBits = 0; break;
+	case D3DFMT_D32F_LOCKABLE:	D3DGlobal.depthBits = 32; D3DGlobal.stencilBits = 0; break;
 	case D3DFMT_D32:			D3DGlobal.depthBits = 32; D3DGlobal.stencilBits = 0; break;
 	case D3DFMT_D15S1:			D3DGlobal.depthBits = 15; D3DGlobal.stencilBits = 1; break;
 	case D3DFMT_D24S8:			D3DGlobal.depthBits = 24; D3DGlobal.stencilBits = 8; break;
@@ -537,6 +581,21 @@ static D3DFORMAT D3DGlobal_GetDepthFormat( D3DFORMAT AdapterFormat )
 	// valid depth formats
 	// first try to create formats with depthstencil buffer, then depth-only
 	const D3DFORMAT d3d_DepthFormats[] = {D3DFMT_D24S8, D3DFMT_D24X4S4, D3DFMT_D32, D3DFMT_D24X8, D3DFMT_D16, D3DFMT_UNKNOWN};
+	// lockable formats for glReadPixels, these have no stencil and no multisampling
+	const D3DFORMAT d3d_LockableDepthFormats[] = {D3DFMT_D32F_LOCKABLE, D3DFMT_D16_LOCKABLE, D3DFMT_UNKNOWN};
+
+	if (D3DGlobal.settings.readableDepth && D3DGlobal.settings.multisample <= 1)
+	{
+		for (int i = 0; d3d_LockableDepthFormats[i] != D3DFMT_UNKNOWN; ++i)
+		{
+			HRESULT hr = D3DGlobal.pD3D->CheckDeviceFormat(	D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, AdapterFormat, D3DUSAGE_DEPTHSTENCIL, D3DRTYPE_SURFACE, d3d_LockableDepthFormats[i] );
+
+			logPrintf("GetDepthFormat: lockable format %s is %ssupported\n", D3DGlobal_FormatToString(d3d_LockableDepthFormats[i]), FAILED(hr) ? "not " : "");
+
+			if (SUCCEEDED(hr)) 
+				return d3d_LockableDepthFormats[i];
+		}
+	}
 
 	for (int i = 0; ; ++i)
 	{
@@ -976,6 +1035,28 @@ OPENGL_API HGLRC WINAPI wrap_wglCreateContext( HDC hdc )
 	D3DGlobal.settings.texcoordFix = D3DGlobal_GetRegistryValue( "TexCoordFix", "Settings", 0 );
 	D3DGlobal.settings.useSSE = D3DGlobal_GetRegistryValue( "UseSSE", "Settings", 0 );
 	D3DGlobal.settings.enableARBProgramsStub = D3DGlobal_GetRegistryValue( "EnableARBProgramsStub", "Settings", 0 );
+	D3DGlobal.settings.textureBudgetMB = D3DGlobal_GetRegistryValue( "TextureBudgetMB", "Settings", 0 );
+	D3DGlobal.settings.textureCacheMB = D3DGlobal_GetRegistryValue( "TextureCacheMB", "Settings", 0 );
+	D3DGlobal.settings.compressTextures = D3DGlobal_GetRegistryValue( "CompressTextures", "Settings", 0 );
+	D3DGlobal.settings.compressTexturesMinSize = D3DGlobal_GetRegistryValue( "CompressTexturesMinSize", "Settings", 512 );
+	D3DGlobal.settings.batchTexSubImage = D3DGlobal_GetRegistryValue( "BatchTexSubImage", "Settings", 0 );
+	D3DGlobal.settings.skipUnchangedTexSubImage = D3DGlobal_GetRegistryValue( "SkipUnchangedTexSubImage", "Settings", 0 );
+	D3DGlobal.settings.asyncReadPixels = D3DGlobal_GetRegistryValue( "AsyncReadPixels", "Settings", 0 );
+	D3DGlobal.settings.readableDepth = D3DGlobal_GetRegistryValue( "ReadableDepth", "Settings", 0 );
+	D3DGlobal.settings.gpuCopyTexImage = D3DGlobal_GetRegistryValue( "GPUCopyTexImage", "Settings", 0 );
+	D3DGlobal.settings.dumpTextures = D3DGlobal_GetRegistryValue( "DumpTextures", "Settings", 0 );
+	D3DGlobal.settings.optimizeDisplayLists = D3DGlobal_GetRegistryValue( "OptimizeDisplayLists", "Settings", 1 );
+	D3DGlobal.settings.dynamicLightSlots = D3DGlobal_GetRegistryValue( "DynamicLightSlots", "Settings", 256 );
+
+	D3DGlobal.pTextureManager->SetBudget( (UINT64)D3DGlobal.settings.textureBudgetMB * 1024 * 1024 );
+	D3DGlobal.pReadback->SetLatency( (int)D3DGlobal.settings.asyncReadPixels );
+	if (D3DGlobal.settings.textureCacheMB) {
+		D3DGlobal.pTextureCache = new D3DTextureCache;
+		if (!D3DGlobal.pTextureCache->Open( WRAPPER_GL_SHORT_NAME_STRING ".texcache", (UINT64)D3DGlobal.settings.textureCacheMB * 1024 * 1024 )) {
+			delete D3DGlobal.pTextureCache;
+			D3DGlobal.pTextureCache = nullptr;
+		}
+	}
 
 	//Note: remixapi also read in D3DGlobal_InitializeDirect3D above
 	D3DGlobal.settings.game.remixapi = D3DGlobal_ReadGameConf( "remixapi" );
@@ -1355,6 +1436,11 @@ OPENGL_API BOOL WINAPI wrap_wglMakeCurrent(HDC hdc, HGLRC hglrc)
 				return FALSE;
 			}
 
+			if (D3DGlobal.pReadback)
+				D3DGlobal.pReadback->ReleaseSurfaces();
+			if (D3DGlobal.pTextureManager)
+				D3DGlobal.pTextureManager->ReleaseRenderTargets();
+			D3DPixels_InvalidateDepthCache();
 			D3DGlobal.pDevice->Reset(&D3DGlobal.hPresentParams);
 
 			if (D3DGlobal.pSystemMemRT) {
@@ -1484,6 +1570,11 @@ OPENGL_API BOOL WINAPI wrap_wglSwapBuffers( HDC )
 		}
 
 		matrix_detect_frame_ended();
+		if (D3DGlobal.pTextureManager)
+			D3DGlobal.pTextureManager->EndFrame();
+		if (D3DGlobal.pReadback)
+			D3DGlobal.pReadback->EndFrame();
+		D3DPixels_InvalidateDepthCache();
 #ifndef QINDIEGLSRC_NO_REMIX
 		hook_frame_ended();
 #endif
@@ -106,6 +106,10 @@ class D3DIMBuffer;
 class D3DVABuffer;
 class D3DObjectBuffer;
 class D3DTextureObject;
+class D3DTextureManager;
+class D3DTextureCache;
+class D3DReadbackQueue;
+class D3DTextureDumper;
 class D3DMatrixStack;
 
 typedef struct D3DGlobal_s
@@ -148,6 +152,10 @@ typedef struct D3DGlobal_s
 	D3DIMBuffer				*pIMBuffer;
 	D3DVABuffer				*pVABuffer;
 	D3DObjectBuffer			*pObjectBuffer;
+	D3DTextureManager		*pTextureManager;
+	D3DTextureCache			*pTextureCache;
+	D3DReadbackQueue		*pReadback;
+	D3DTextureDumper		*pTextureDumper;
 	D3DTextureObject*		defaultTexture[D3D_TEXTARGET_MAX];
 	int						rgbaBits[4];
 	int						depthBits;
@@ -162,6 +170,18 @@ typedef struct D3DGlobal_s
 		DWORD				drawcallFastPath;
 		DWORD				useSSE;
 		DWORD				enableARBProgramsStub;
+		DWORD				textureBudgetMB;
+		DWORD				textureCacheMB;
+		DWORD				compressTextures;
+		DWORD				compressTexturesMinSize;
+		DWORD				batchTexSubImage;
+		DWORD				skipUnchangedTexSubImage;
+		DWORD				asyncReadPixels;
+		DWORD				readableDepth;
+		DWORD				gpuCopyTexImage;
+		DWORD				dumpTextures;
+		DWORD				optimizeDisplayLists;
+		DWORD				dynamicLightSlots;
 		struct {
 			DWORD               remixapi;
 			DWORD               orthovertexshader;
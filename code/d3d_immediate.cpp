@@ -23,6 +23,8 @@
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
 #include "d3d_immediate.hpp"
+#include "d3d_lists.hpp"
+#include "d3d_feedback.hpp"
 
 //==================================================================================
 // OpenGL Immediate Mode
@@ -32,11 +34,17 @@ D3DIMBuffer :: D3DIMBuffer( )
 {
 	m_maxVertexCount = c_IMBufferGrowSize;
 	m_pBuffer = ( D3DIMBufferVertex* )UTIL_Alloc( m_maxVertexCount * sizeof( D3DIMBufferVertex ) );
+	m_maxIndexCount = c_IMIndexGrowSize;
+	m_pIndices = ( WORD* )UTIL_Alloc( m_maxIndexCount * sizeof( WORD ) );
+	m_indexCount = 0;
 	m_bBegan = false;
 	m_bXYZW = false;
+	m_bIndexed = false;
 	for (int i = 0; i < c_MaxSwapFrame; ++i) {
 		m_pVertexBuffer[i] = nullptr;
 		m_vbAllocSize[i] = 0;
+		m_pIndexBuffer[i] = nullptr;
+		m_ibAllocSize[i] = 0;
 	}
 	m_swapFrame = 0;
 }
@@ -44,10 +52,14 @@ D3DIMBuffer :: D3DIMBuffer( )
 D3DIMBuffer :: ~D3DIMBuffer( )
 {
 	UTIL_Free( m_pBuffer );
+	UTIL_Free( m_pIndices );
 	for ( int i = 0; i < c_MaxSwapFrame; ++i ) {
 		if ( m_pVertexBuffer[i] ) {
 			m_pVertexBuffer[i]->Release();
 		}
+		if ( m_pIndexBuffer[i] ) {
+			m_pIndexBuffer[i]->Release();
+		}
 	}
 }
 
@@ -55,10 +67,18 @@ void D3DIMBuffer :: EnsureBufferSize( int numVerts )
 {
 	if ( m_maxVertexCount >= m_vertexCount + numVerts )
 		return;
-	m_maxVertexCount += c_IMBufferGrowSize;
+	m_maxVertexCount = QINDIEGL_MAX( m_maxVertexCount + (int)c_IMBufferGrowSize, m_vertexCount + numVerts );
 	m_pBuffer = ( D3DIMBufferVertex* )UTIL_Realloc( m_pBuffer, m_maxVertexCount * sizeof( D3DIMBufferVertex ) );
 }
 
+void D3DIMBuffer :: EnsureIndexSize( int numIndices )
+{
+	if ( m_maxIndexCount >= m_indexCount + numIndices )
+		return;
+	m_maxIndexCount = QINDIEGL_MAX( m_maxIndexCount + (int)c_IMIndexGrowSize, m_indexCount + numIndices );
+	m_pIndices = ( WORD* )UTIL_Realloc( m_pIndices, m_maxIndexCount * sizeof( WORD ) );
+}
+
 UINT D3DIMBuffer :: ReorderBufferToFVF( int fvf, int fvfsz )
 {
 	const D3DIMBufferVertex *src = m_pBuffer;
@@ -129,19 +149,103 @@ UINT D3DIMBuffer :: ReorderBufferToFVF( int fvf, int fvfsz )
 	return 1;
 }
 
+UINT D3DIMBuffer :: UploadIndices( )
+{
+	WORD *dst = nullptr;
+	HRESULT hr;
+
+	if ( m_ibAllocSize[m_swapFrame] < m_indexCount * (int)sizeof( WORD ) )
+	{
+		if ( m_pIndexBuffer[m_swapFrame] )
+			m_pIndexBuffer[m_swapFrame]->Release();
+
+		m_ibAllocSize[m_swapFrame] = QINDIEGL_MAX( (int)c_IMIndexGrowSize, m_indexCount ) * sizeof( WORD );
+		hr = D3DGlobal.pDevice->CreateIndexBuffer( m_ibAllocSize[m_swapFrame], D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY,
+			D3DFMT_INDEX16, D3DPOOL_DEFAULT, &m_pIndexBuffer[m_swapFrame], nullptr );
+		if ( FAILED( hr ) )
+		{
+			m_pIndexBuffer[m_swapFrame] = nullptr;
+			m_ibAllocSize[m_swapFrame] = 0;
+			D3DGlobal.lastError = hr;
+			return 0;
+		}
+	}
+
+	hr = m_pIndexBuffer[m_swapFrame]->Lock( 0, m_indexCount * sizeof( WORD ), (void**)&dst, D3DLOCK_DISCARD );
+	if ( FAILED( hr ) )
+	{
+		D3DGlobal.lastError = hr;
+		return 0;
+	}
+	memcpy( dst, m_pIndices, m_indexCount * sizeof( WORD ) );
+	m_pIndexBuffer[m_swapFrame]->Unlock();
+
+	hr = D3DGlobal.pDevice->SetIndices( m_pIndexBuffer[m_swapFrame] );
+	if ( FAILED( hr ) )
+	{
+		D3DGlobal.lastError = hr;
+		return 0;
+	}
+	return 1;
+}
+
 void D3DIMBuffer :: Begin( GLenum primType )
 {
+	if ( D3DList_IsCompiling() ) {
+		D3DList_Begin( primType );
+		if ( !D3DList_ExecutesWhileCompiling() ) {
+			m_bBegan = false;
+			return;
+		}
+	}
+
 	m_primitiveType = primType;
 	m_vertexCount = 0;
 	m_passedVertexCount = 0;
+	m_indexCount = 0;
 	m_bBegan = true;
 	m_bXYZW = false;
+	m_bIndexed = false;
+}
+
+void D3DIMBuffer :: BeginIndexed( GLenum primType )
+{
+	assert( !D3DList_IsCompiling() );
+	assert( primType == GL_TRIANGLES || primType == GL_LINES );
+
+	m_primitiveType = primType;
+	m_vertexCount = 0;
+	m_passedVertexCount = 0;
+	m_indexCount = 0;
+	m_bBegan = true;
+	m_bXYZW = false;
+	m_bIndexed = true;
 }
 
 void D3DIMBuffer :: End( )
 {
+	if ( D3DList_IsCompiling() )
+		D3DList_End();
+
 	if ( !m_vertexCount || !m_bBegan ) 
 		return;
+	if ( m_bIndexed && !m_indexCount ) {
+		m_bBegan = false;
+		return;
+	}
+
+	if ( D3DFeedback_IsActive() ) {
+		D3DFeedbackVertices_t vertices;
+		vertices.position = m_pBuffer[0].position;
+		vertices.size = m_bXYZW ? 4 : 3;
+		vertices.color = &m_pBuffer[0].color;
+		vertices.texCoord = D3DState.EnableState.textureEnabled[0] ? m_pBuffer[0].texCoord[0] : nullptr;
+		vertices.stride = sizeof( D3DIMBufferVertex );
+		vertices.count = m_vertexCount;
+		D3DFeedback_Primitives( m_primitiveType, &vertices, m_bIndexed ? m_pIndices : nullptr, m_indexCount );
+		m_bBegan = false;
+		return;
+	}
 
 	if ( D3DGlobal.settings.game.orthoskipuntextureddraws && !D3DState.TextureState.currentSamplerCount )
 	{
@@ -239,52 +343,63 @@ void D3DIMBuffer :: End( )
 			D3DGlobal.lastError = hr;
 		}
 
-		switch ( m_primitiveType )
-		{
-		case GL_POINTS:
-			hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_POINTLIST, 0, m_vertexCount );
-			//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_POINTLIST, m_vertexCount, m_pBuffer, vertexSize );
-			break;
-
-		case GL_LINES:
-			hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_LINELIST, 0, m_vertexCount / 2 );
-			//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_LINELIST, m_vertexCount / 2, m_pBuffer, vertexSize );
-			break;
-
-		case GL_LINE_STRIP:
-		case GL_LINE_LOOP:
-			hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_LINESTRIP, 0, m_vertexCount - 1 );
-			//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_LINESTRIP, m_vertexCount - 1, m_pBuffer, vertexSize );
-			break;
-
-		case GL_QUADS:
-			// quads are converted to triangles while specifying vertices
-		case GL_TRIANGLES:
-			// D3DPT_TRIANGLELIST models GL_TRIANGLES when used for either a single triangle or multiple triangles
-			hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_TRIANGLELIST, 0, m_vertexCount / 3 );
-			//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_TRIANGLELIST, m_vertexCount / 3, m_pBuffer, vertexSize );
-			break;
-
-		case GL_QUAD_STRIP:
-			// quadstrip is EXACT the same as tristrip
-		case GL_TRIANGLE_STRIP:
-			// regular tristrip
-			hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_TRIANGLESTRIP, 0, m_vertexCount - 2 );
-			//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_TRIANGLESTRIP, m_vertexCount - 2, m_pBuffer, vertexSize );
-			break;
-
-		case GL_POLYGON:
-			// a GL_POLYGON has the same vertex layout and order as a trifan, and can be used interchangably in OpenGL
-		case GL_TRIANGLE_FAN:
-			// regular trifan
-			hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_TRIANGLEFAN, 0, m_vertexCount - 2 );
-			//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_TRIANGLEFAN, m_vertexCount - 2, m_pBuffer, vertexSize );
-			break;
-
-		default:
-			// unsupported mode
-			logPrintf( "WARNING: glBegin - unsupported mode 0x%x\n", m_primitiveType );
-			break;
+		if ( m_bIndexed ) {
+			if ( UploadIndices() ) {
+				if ( m_primitiveType == GL_LINES )
+					hr = D3DGlobal.pDevice->DrawIndexedPrimitive( D3DPT_LINELIST, 0, 0, m_vertexCount, 0, m_indexCount / 2 );
+				else
+					hr = D3DGlobal.pDevice->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, m_vertexCount, 0, m_indexCount / 3 );
+				if (FAILED(hr))
+					D3DGlobal.lastError = hr;
+			}
+		} else {
+			switch ( m_primitiveType )
+			{
+			case GL_POINTS:
+				hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_POINTLIST, 0, m_vertexCount );
+				//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_POINTLIST, m_vertexCount, m_pBuffer, vertexSize );
+				break;
+
+			case GL_LINES:
+				hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_LINELIST, 0, m_vertexCount / 2 );
+				//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_LINELIST, m_vertexCount / 2, m_pBuffer, vertexSize );
+				break;
+
+			case GL_LINE_STRIP:
+			case GL_LINE_LOOP:
+				hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_LINESTRIP, 0, m_vertexCount - 1 );
+				//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_LINESTRIP, m_vertexCount - 1, m_pBuffer, vertexSize );
+				break;
+
+			case GL_QUADS:
+				// quads are converted to triangles while specifying vertices
+			case GL_TRIANGLES:
+				// D3DPT_TRIANGLELIST models GL_TRIANGLES when used for either a single triangle or multiple triangles
+				hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_TRIANGLELIST, 0, m_vertexCount / 3 );
+				//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_TRIANGLELIST, m_vertexCount / 3, m_pBuffer, vertexSize );
+				break;
+
+			case GL_QUAD_STRIP:
+				// quadstrip is EXACT the same as tristrip
+			case GL_TRIANGLE_STRIP:
+				// regular tristrip
+				hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_TRIANGLESTRIP, 0, m_vertexCount - 2 );
+				//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_TRIANGLESTRIP, m_vertexCount - 2, m_pBuffer, vertexSize );
+				break;
+
+			case GL_POLYGON:
+				// a GL_POLYGON has the same vertex layout and order as a trifan, and can be used interchangably in OpenGL
+			case GL_TRIANGLE_FAN:
+				// regular trifan
+				hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_TRIANGLEFAN, 0, m_vertexCount - 2 );
+				//hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_TRIANGLEFAN, m_vertexCount - 2, m_pBuffer, vertexSize );
+				break;
+
+			default:
+				// unsupported mode
+				logPrintf( "WARNING: glBegin - unsupported mode 0x%x\n", m_primitiveType );
+				break;
+			}
 		}
 	}
 
@@ -295,14 +410,14 @@ void D3DIMBuffer :: End( )
 	m_bBegan = false;
 }
 
-void D3DIMBuffer :: SetupTexCoords( D3DIMBufferVertex *pVertex, int stage )
+void D3DIMBuffer :: SetupTexCoords( D3DIMBufferVertex *pVertex, int stage, const float *texCoord )
 {
 	if ( !D3DState.EnableState.texGenEnabled[stage] ) {
-		memcpy( pVertex->texCoord[stage], D3DState.CurrentState.currentTexCoord[stage], sizeof(FLOAT)*4 );
+		memcpy( pVertex->texCoord[stage], texCoord, sizeof(FLOAT)*4 );
 		return;
 	}
 
-	const float *in_coords = D3DState.CurrentState.currentTexCoord[stage];
+	const float *in_coords = texCoord;
 	float *out_coords = pVertex->texCoord[stage];
 
 	GLenum currentGen( ~0u );
@@ -327,6 +442,8 @@ void D3DIMBuffer :: SetupTexCoords( D3DIMBufferVertex *pVertex, int stage )
 
 void D3DIMBuffer :: AddVertex( float x, float y, float z )
 {
+	if ( D3DList_IsCompiling() )
+		D3DList_Vertex( x, y, z, 1.0f, false );
 	if ( !m_bBegan ) return;
 
 	//if we finalize a quad, add two additional vertices so we will
@@ -353,7 +470,7 @@ void D3DIMBuffer :: AddVertex( float x, float y, float z )
 
 	for ( int i = 0; i < D3DGlobal.maxActiveTMU; ++i ) {
 		if ( D3DState.EnableState.textureEnabled[i] ) {
-			SetupTexCoords( pVertex, i );
+			SetupTexCoords( pVertex, i, D3DState.CurrentState.currentTexCoord[i] );
 		}
 	}
 
@@ -362,6 +479,8 @@ void D3DIMBuffer :: AddVertex( float x, float y, float z )
 
 void D3DIMBuffer :: AddVertex( float x, float y, float z, float w )
 {
+	if ( D3DList_IsCompiling() )
+		D3DList_Vertex( x, y, z, w, true );
 	if ( !m_bBegan ) return;
 
 	//if we finalize a quad, add two additional vertices so we will
@@ -389,13 +508,56 @@ void D3DIMBuffer :: AddVertex( float x, float y, float z, float w )
 
 	for ( int i = 0; i < D3DGlobal.maxActiveTMU; ++i ) {
 		if ( D3DState.EnableState.textureEnabled[i] ) {
-			SetupTexCoords( pVertex, i );
+			SetupTexCoords( pVertex, i, D3DState.CurrentState.currentTexCoord[i] );
 		}
 	}
 
 	++m_passedVertexCount;
 }
 
+int D3DIMBuffer :: AddVertices( int count, const D3DIMVertexStreams *streams )
+{
+	const int first = m_vertexCount;
+	if ( !m_bBegan || count <= 0 )
+		return first;
+
+	EnsureBufferSize( count );
+	if ( streams->xyzw )
+		m_bXYZW = true;
+
+	D3DIMBufferVertex *pVertex = &m_pBuffer[m_vertexCount];
+	for ( int v = 0; v < count; ++v, ++pVertex ) {
+		memcpy( pVertex->position, streams->position + v*4, sizeof( pVertex->position ) );
+		if ( streams->normal )
+			memcpy( pVertex->normal, streams->normal + v*3, sizeof( pVertex->normal ) );
+		else
+			memcpy( pVertex->normal, D3DState.CurrentState.currentNormal, sizeof( pVertex->normal ) );
+		pVertex->color = streams->color ? streams->color[v] : D3DState.CurrentState.currentColor;
+		pVertex->color2 = D3DState.CurrentState.currentColor2;
+
+		for ( int i = 0; i < D3DGlobal.maxActiveTMU; ++i ) {
+			if ( D3DState.EnableState.textureEnabled[i] ) {
+				const float *texCoord = ( i == 0 && streams->texCoord0 ) ? streams->texCoord0 + v*4 : D3DState.CurrentState.currentTexCoord[i];
+				SetupTexCoords( pVertex, i, texCoord );
+			}
+		}
+	}
+
+	m_vertexCount += count;
+	m_passedVertexCount += count;
+	return first;
+}
+
+void D3DIMBuffer :: AddIndices( const WORD *indices, int count )
+{
+	if ( !m_bBegan || !m_bIndexed || count <= 0 )
+		return;
+
+	EnsureIndexSize( count );
+	memcpy( m_pIndices + m_indexCount, indices, count * sizeof( WORD ) );
+	m_indexCount += count;
+}
+
 //=========================================
 // These immediate mode functions modify
 // current state and do not draw anything
@@ -21,9 +21,21 @@
 #ifndef QINDIEGL_D3D_IMMEDIATE_H
 #define QINDIEGL_D3D_IMMEDIATE_H
 
+// Vertex attributes for D3DIMBuffer::AddVertices, the ones left nullptr are
+// taken from the current state like glVertex does
+typedef struct D3DIMVertexStreams_s
+{
+	const float		*position;		// 4 floats per vertex
+	bool			xyzw;
+	const float		*normal;		// 3 floats per vertex
+	const DWORD		*color;
+	const float		*texCoord0;		// 4 floats per vertex, first texture unit
+} D3DIMVertexStreams;
+
 class D3DIMBuffer
 {
 	static const size_t c_IMBufferGrowSize = 256;
+	static const size_t c_IMIndexGrowSize = 1024;
 	static const GLsizei c_MaxSwapFrame = 2;
 	typedef struct
 	{
@@ -37,20 +49,33 @@ public:
 	D3DIMBuffer();
 	~D3DIMBuffer();
 	void Begin( GLenum primType );
+	// GL_TRIANGLES or GL_LINES drawn with indices into the vertices added since,
+	// not available while a display list is compiled
+	void BeginIndexed( GLenum primType );
 	void End();
 	void AddVertex( float x, float y, float z );
 	void AddVertex( float x, float y, float z, float w );
+	// Returns the index of the first vertex added, for AddIndices
+	int AddVertices( int count, const D3DIMVertexStreams *streams );
+	void AddIndices( const WORD *indices, int count );
 
 protected:
 	void EnsureBufferSize( int numVerts );
+	void EnsureIndexSize( int numIndices );
 	UINT ReorderBufferToFVF( int fvf, int fvfsz );
-	void SetupTexCoords( D3DIMBufferVertex *pVertex, int stage );
+	UINT UploadIndices();
+	void SetupTexCoords( D3DIMBufferVertex *pVertex, int stage, const float *texCoord );
 
 private:
 	D3DIMBufferVertex *m_pBuffer;
 	LPDIRECT3DVERTEXBUFFER9		m_pVertexBuffer[c_MaxSwapFrame];
 	GLsizei						m_vbAllocSize[c_MaxSwapFrame];
 	GLint						m_swapFrame;
+	WORD						*m_pIndices;
+	LPDIRECT3DINDEXBUFFER9		m_pIndexBuffer[c_MaxSwapFrame];
+	GLsizei						m_ibAllocSize[c_MaxSwapFrame];
+	int							m_maxIndexCount;
+	int							m_indexCount;
 	DWORD		m_samplerMask;
 	GLenum		m_primitiveType;
 	int			m_maxVertexCount;
@@ -58,6 +83,7 @@ private:
 	int			m_passedVertexCount;
 	bool		m_bBegan;
 	bool		m_bXYZW;
+	bool		m_bIndexed;
 };
 
 #endif //QINDIEGL_D3D_IMMEDIATE_H
\ No newline at end of file
@@ -23,6 +23,7 @@
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
 #include "d3d_matrix_stack.hpp"
+#include "d3d_lists.hpp"
 
 //==================================================================================
 // Light operations
@@ -101,6 +102,8 @@ OPENGL_API void WINAPI glGetLightiv( GLenum light, GLenum pname, GLint *params )
 
 OPENGL_API void WINAPI glLightModelf( GLenum pname, GLfloat param )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_LIGHT_MODELF, pname, param );
+
 	switch( pname ) {
 	case GL_LIGHT_MODEL_LOCAL_VIEWER:
 		D3DState.LightingState.lightModelLocalViewer =( param > 0 ) ? TRUE : FALSE;
@@ -117,6 +120,10 @@ OPENGL_API void WINAPI glLightModelf( GLenum pname, GLfloat param )
 }
 OPENGL_API void WINAPI glLightModelfv( GLenum pname, const GLfloat *params )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_LIGHT_MODELFV, pname, 0, params,
+		( pname == GL_LIGHT_MODEL_AMBIENT ) ? 4 : 1 ) )
+		return;
+
 	switch( pname ) {
 	case GL_LIGHT_MODEL_AMBIENT:
 		D3DState.LightingState.lightModelAmbient = D3DCOLOR_ARGB( QINDIEGL_CLAMP( params[3] * 255.0f ),
@@ -146,6 +153,9 @@ OPENGL_API void WINAPI glLightModeliv( GLenum pname, const GLint *params )
 }
 OPENGL_API void WINAPI glLightf( GLenum light, GLenum pname, GLfloat param )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_LIGHTFV, light, pname, &param, 1 ) )
+		return;
+
 	int lightIndex = light - GL_LIGHT0;
 	if( lightIndex < 0 || lightIndex >= IMPL_MAX_LIGHTS ) {
 		logPrintf( "WARNING: glLightf - bad light index %i\n", lightIndex );
@@ -177,6 +187,10 @@ OPENGL_API void WINAPI glLightf( GLenum light, GLenum pname, GLfloat param )
 }
 OPENGL_API void WINAPI glLightfv( GLenum light, GLenum pname, const GLfloat *params )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_LIGHTFV, light, pname, params,
+		( pname == GL_SPOT_DIRECTION ) ? 3 : ( ( pname == GL_AMBIENT || pname == GL_DIFFUSE || pname == GL_SPECULAR || pname == GL_POSITION ) ? 4 : 1 ) ) )
+		return;
+
 	int lightIndex = light - GL_LIGHT0;
 	if( lightIndex < 0 || lightIndex >= IMPL_MAX_LIGHTS ) {
 		logPrintf( "WARNING: glLightfv - bad light index %i\n", lightIndex );
@@ -0,0 +1,656 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include <string.h>
+#include <map>
+#include "d3d_matrix_math.hpp"
+#include "d3d_list_optimizer.hpp"
+
+//==================================================================================
+// Display list optimizer
+//----------------------------------------------------------------------------------
+// State calls are only dropped when that can't change what a later command
+// sees. The state left at the end of the list, and the state around nested
+// lists and glPush/PopAttrib, is kept as recorded. A call is redundant when
+// the same key was set to the same value earlier in the list, or dead when the
+// same key is set again before anything reads it (draws, glEvalMesh, glClear,
+// glTexParameter and glViewport read all state, matrix calls read the matrix mode, per-unit
+// calls the active texture). Lights and texgen eye planes are transformed by
+// the modelview when they are set, so setting them again is never redundant.
+//
+// Matrix calls between two other commands are folded into one glMultMatrix.
+// glMultMatrix also switches the texcoord fix of the projection matrix, so in
+// projection mode, or when the mode is not known, only calls of the same kind
+// are folded (translations are added, scales multiplied, rotations about the
+// same axis added).
+//
+// Draws with nothing left between them are merged when their runs have the
+// same layout, and the vertices of every indexed run are welded: bitwise
+// identical vertices are stored once, in the order the indices use them.
+//==================================================================================
+
+// How the optimizer treats an op
+#define D3DLISTOPT_STATE		0x1		// sets a state: key args, then the value
+#define D3DLISTOPT_UNIQUE		0x2		// no other key aliases the state, so setting the current value does nothing
+#define D3DLISTOPT_PER_UNIT		0x4		// applies to the active texture unit (glEnable: texture caps only)
+#define D3DLISTOPT_MATRIX		0x8		// reads the matrix mode and the active texture unit
+#define D3DLISTOPT_MULT			0x10	// multiplies the current matrix
+#define D3DLISTOPT_BARRIER		0x20	// may read and change any state
+#define D3DLISTOPT_READS		0x40	// reads the current state like a draw
+
+// The caps glEnable sets for the active texture unit
+#define D3DLIST_CAP_TEXTURE_1D		0x0DE0
+#define D3DLIST_CAP_TEXTURE_2D		0x0DE1
+#define D3DLIST_CAP_TEXTURE_3D		0x806F
+#define D3DLIST_CAP_TEXTURE_CUBE	0x8513
+#define D3DLIST_CAP_TEXTURE_GEN_S	0x0C60
+#define D3DLIST_CAP_TEXTURE_GEN_Q	0x0C63
+
+static bool D3DList_IsUnitCap( unsigned int cap )
+{
+	return cap == D3DLIST_CAP_TEXTURE_1D || cap == D3DLIST_CAP_TEXTURE_2D ||
+		cap == D3DLIST_CAP_TEXTURE_3D || cap == D3DLIST_CAP_TEXTURE_CUBE ||
+		( cap >= D3DLIST_CAP_TEXTURE_GEN_S && cap <= D3DLIST_CAP_TEXTURE_GEN_Q );
+}
+
+typedef struct D3DListOpInfo_s
+{
+	unsigned int	flags;
+	D3DListOp		stateClass;		// ops setting the same state share a class
+	int				numKeyArgs;
+} D3DListOpInfo;
+
+static const D3DListOpInfo c_opInfo[D3DLIST_OP_MAX] = 
+{
+	{ 0, D3DLIST_OP_NONE, 0 },																// NONE
+	{ 0, D3DLIST_OP_NONE, 0 },																// DRAW
+	{ 0, D3DLIST_OP_NONE, 0 },																// CURRENT
+	{ D3DLISTOPT_BARRIER, D3DLIST_OP_NONE, 0 },												// CALL_LIST
+	{ D3DLISTOPT_BARRIER, D3DLIST_OP_NONE, 0 },												// CALL_LISTS
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_LIST_BASE, 0 },						// LIST_BASE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE | D3DLISTOPT_PER_UNIT, D3DLIST_OP_ENABLE, 1 },	// ENABLE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE | D3DLISTOPT_PER_UNIT, D3DLIST_OP_ENABLE, 1 },	// DISABLE
+	{ D3DLISTOPT_BARRIER, D3DLIST_OP_NONE, 0 },												// PUSH_ATTRIB
+	{ D3DLISTOPT_BARRIER, D3DLIST_OP_NONE, 0 },												// POP_ATTRIB
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE | D3DLISTOPT_PER_UNIT, D3DLIST_OP_BIND_TEXTURE, 1 },// BIND_TEXTURE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_ACTIVE_TEXTURE, 0 },					// ACTIVE_TEXTURE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE | D3DLISTOPT_PER_UNIT, D3DLIST_OP_TEX_ENVFV, 2 },	// TEX_ENVFV
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE | D3DLISTOPT_PER_UNIT, D3DLIST_OP_TEX_ENVFV, 2 },	// TEX_ENVIV
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_ALPHA_FUNC, 0 },						// ALPHA_FUNC
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_BLEND_FUNC, 0 },						// BLEND_FUNC
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_COLOR_MASK, 0 },						// COLOR_MASK
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_CULL_FACE, 0 },						// CULL_FACE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_FRONT_FACE, 0 },						// FRONT_FACE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_DEPTH_FUNC, 0 },						// DEPTH_FUNC
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_DEPTH_MASK, 0 },						// DEPTH_MASK
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_POLYGON_OFFSET, 0 },					// POLYGON_OFFSET
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_LINE_WIDTH, 0 },						// LINE_WIDTH
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_POINT_SIZE, 0 },						// POINT_SIZE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_SHADE_MODEL, 0 },					// SHADE_MODEL
+	{ D3DLISTOPT_STATE, D3DLIST_OP_MATERIALFV, 2 },											// MATERIALFV: faces and GL_AMBIENT_AND_DIFFUSE alias
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_MATRIX_MODE, 0 },					// MATRIX_MODE
+	{ D3DLISTOPT_MATRIX, D3DLIST_OP_NONE, 0 },												// LOAD_IDENTITY
+	{ D3DLISTOPT_MATRIX, D3DLIST_OP_NONE, 0 },												// LOAD_MATRIX
+	{ D3DLISTOPT_MATRIX | D3DLISTOPT_MULT, D3DLIST_OP_NONE, 0 },							// MULT_MATRIX
+	{ D3DLISTOPT_MATRIX, D3DLIST_OP_NONE, 0 },												// PUSH_MATRIX
+	{ D3DLISTOPT_MATRIX, D3DLIST_OP_NONE, 0 },												// POP_MATRIX
+	{ D3DLISTOPT_MATRIX | D3DLISTOPT_MULT, D3DLIST_OP_NONE, 0 },							// ROTATE
+	{ D3DLISTOPT_MATRIX | D3DLISTOPT_MULT, D3DLIST_OP_NONE, 0 },							// SCALE
+	{ D3DLISTOPT_MATRIX | D3DLISTOPT_MULT, D3DLIST_OP_NONE, 0 },							// TRANSLATE
+	{ 0, D3DLIST_OP_NONE, 0 },																// INIT_NAMES
+	{ 0, D3DLIST_OP_NONE, 0 },																// LOAD_NAME
+	{ 0, D3DLIST_OP_NONE, 0 },																// PUSH_NAME
+	{ 0, D3DLIST_OP_NONE, 0 },																// POP_NAME
+	{ 0, D3DLIST_OP_NONE, 0 },																// PASS_THROUGH
+	{ D3DLISTOPT_STATE, D3DLIST_OP_LIGHTFV, 2 },											// LIGHTFV: positions go through the modelview
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_LIGHT_MODELFV, 1 },					// LIGHT_MODELF
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_LIGHT_MODELFV, 1 },					// LIGHT_MODELFV
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_COLOR_MATERIAL, 0 },					// COLOR_MATERIAL
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_FOGFV, 1 },							// FOGFV
+	{ D3DLISTOPT_STATE | D3DLISTOPT_PER_UNIT, D3DLIST_OP_TEX_GENFV, 2 },					// TEX_GENFV: eye planes go through the modelview
+	{ D3DLISTOPT_STATE | D3DLISTOPT_PER_UNIT, D3DLIST_OP_TEX_GENFV, 2 },					// TEX_GENIV
+	{ D3DLISTOPT_READS, D3DLIST_OP_NONE, 0 },												// TEX_PARAMETERFV: changes the bound texture
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_POLYGON_MODE, 0 },					// POLYGON_MODE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_CLEAR_COLOR, 0 },					// CLEAR_COLOR
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_CLEAR_DEPTH, 0 },					// CLEAR_DEPTH
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_CLEAR_STENCIL, 0 },					// CLEAR_STENCIL
+	{ D3DLISTOPT_READS, D3DLIST_OP_NONE, 0 },												// CLEAR
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_MAP1, 1 },							// MAP1
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_MAP2, 1 },							// MAP2
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_MAP_GRID1, 0 },						// MAP_GRID1
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_MAP_GRID2, 0 },						// MAP_GRID2
+	{ D3DLISTOPT_READS, D3DLIST_OP_NONE, 0 },												// EVAL_MESH1
+	{ D3DLISTOPT_READS, D3DLIST_OP_NONE, 0 },												// EVAL_MESH2
+	{ D3DLISTOPT_MATRIX, D3DLIST_OP_NONE, 0 },												// FRUSTUM
+	{ D3DLISTOPT_MATRIX, D3DLIST_OP_NONE, 0 },												// ORTHO: offset by the viewport
+	{ D3DLISTOPT_READS, D3DLIST_OP_NONE, 0 },												// VIEWPORT: may change the projection matrix
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_SCISSOR, 0 },						// SCISSOR
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_DEPTH_RANGE, 0 },					// DEPTH_RANGE
+	{ D3DLISTOPT_STATE | D3DLISTOPT_UNIQUE, D3DLIST_OP_STENCIL_MASK, 0 },					// STENCIL_MASK
+	{ 0, D3DLIST_OP_NONE, 0 },																// STENCIL_FUNC: the face set depends on two-sided stenciling
+	{ 0, D3DLIST_OP_NONE, 0 },																// STENCIL_OP
+	{ 0, D3DLIST_OP_NONE, 0 },																// ACTIVE_STENCIL_FACE
+};
+
+typedef struct D3DListOptCommand_s
+{
+	D3DListOp		op;
+	int				args;		// offset into the argument pool
+	int				numArgs;
+	bool			keep;
+} D3DListOptCommand;
+
+// A state slot: the class, the texture unit for per-unit state, and the key args
+typedef struct D3DListStateKey_s
+{
+	unsigned int	cls;
+	unsigned int	unit;
+	unsigned int	key[2];
+
+	bool operator<( const D3DListStateKey_s &other ) const
+	{
+		if ( cls != other.cls ) return cls < other.cls;
+		if ( unit != other.unit ) return unit < other.unit;
+		if ( key[0] != other.key[0] ) return key[0] < other.key[0];
+		return key[1] < other.key[1];
+	}
+} D3DListStateKey;
+
+typedef std::map<D3DListStateKey, int> D3DListStateMap;
+
+class D3DListOptimizer
+{
+public:
+	D3DListOptimizer( D3DListProgram *program, const D3DListOptimizeParams *params );
+
+	void Run( D3DListOptimizeStats *stats );
+
+private:
+	void Decode();
+	bool DropRedundantState();
+	void FoldMatrices();
+	void FoldGroup( const std::vector<int> &group, bool sameKindOnly );
+	bool FoldPair( D3DListOptCommand *into, const D3DListOptCommand *next );
+	void Emit();
+	bool CanMerge( const D3DListRun *first, const D3DListRun *next, int numVertices ) const;
+	void EmitRuns( const std::vector<int> &runs );
+
+	float ArgFloat( int offset ) const
+	{
+		float f;
+		memcpy( &f, &m_pool[offset], sizeof( f ) );
+		return f;
+	}
+	int AddArgs( const float *values, int count );
+	bool SameValue( const D3DListOptCommand *a, const D3DListOptCommand *b ) const;
+	bool PerUnit( const D3DListOptCommand *cmd ) const;
+	D3DListStateKey StateKey( const D3DListOptCommand *cmd, unsigned int unit ) const;
+
+	D3DListProgram					*m_program;
+	const D3DListOptimizeParams		*m_params;
+	std::vector<unsigned int>		m_pool;
+	std::vector<D3DListOptCommand>	m_commands;
+	D3DListProgram					m_out;
+	std::vector<int>				m_weld;
+};
+
+D3DListOptimizer :: D3DListOptimizer( D3DListProgram *program, const D3DListOptimizeParams *params )
+{
+	m_program = program;
+	m_params = params;
+}
+
+void D3DListOptimizer :: Decode()
+{
+	m_pool = m_program->commands;
+	m_commands.clear();
+
+	const int size = (int)m_pool.size();
+	int offset = 0;
+	while ( offset < size ) {
+		D3DListOptCommand cmd;
+		cmd.op = D3DList_CommandOp( m_pool[offset] );
+		cmd.numArgs = D3DList_CommandNumArgs( m_pool[offset] );
+		cmd.args = offset + 1;
+		cmd.keep = ( cmd.op > D3DLIST_OP_NONE && cmd.op < D3DLIST_OP_MAX );
+		offset = cmd.args + cmd.numArgs;
+		if ( offset > size )
+			break;
+		m_commands.push_back( cmd );
+	}
+}
+
+int D3DListOptimizer :: AddArgs( const float *values, int count )
+{
+	const int offset = (int)m_pool.size();
+	m_pool.resize( offset + count );
+	memcpy( &m_pool[offset], values, sizeof( float ) * count );
+	return offset;
+}
+
+bool D3DListOptimizer :: SameValue( const D3DListOptCommand *a, const D3DListOptCommand *b ) const
+{
+	if ( a->op != b->op || a->numArgs != b->numArgs )
+		return false;
+	return !a->numArgs || !memcmp( &m_pool[a->args], &m_pool[b->args], sizeof( unsigned int ) * a->numArgs );
+}
+
+bool D3DListOptimizer :: PerUnit( const D3DListOptCommand *cmd ) const
+{
+	if ( !( c_opInfo[cmd->op].flags & D3DLISTOPT_PER_UNIT ) )
+		return false;
+	if ( cmd->op != D3DLIST_OP_ENABLE && cmd->op != D3DLIST_OP_DISABLE )
+		return true;
+	return cmd->numArgs > 0 && D3DList_IsUnitCap( m_pool[cmd->args] );
+}
+
+D3DListStateKey D3DListOptimizer :: StateKey( const D3DListOptCommand *cmd, unsigned int unit ) const
+{
+	const D3DListOpInfo *info = &c_opInfo[cmd->op];
+	D3DListStateKey key;
+	key.cls = info->stateClass;
+	key.unit = PerUnit( cmd ) ? unit : 0;
+	key.key[0] = ( info->numKeyArgs > 0 && cmd->numArgs > 0 ) ? m_pool[cmd->args] : 0;
+	key.key[1] = ( info->numKeyArgs > 1 && cmd->numArgs > 1 ) ? m_pool[cmd->args + 1] : 0;
+	return key;
+}
+
+// One pass of redundant and dead state removal. Dropping a call can uncover
+// more (a unit switch only needed by a dropped bind is dead, and the switch
+// back becomes redundant), so the caller repeats the pass until nothing changes.
+bool D3DListOptimizer :: DropRedundantState()
+{
+	D3DListStateMap known;		// state set earlier in the list -> the command that set it
+	D3DListStateMap pending;	// state not read since it was set -> the command that set it
+	unsigned int unit = 0;		// 0 until glActiveTexture: whatever unit was active
+	bool changed = false;
+
+	D3DListStateKey activeKey;
+	memset( &activeKey, 0, sizeof( activeKey ) );
+	activeKey.cls = D3DLIST_OP_ACTIVE_TEXTURE;
+	D3DListStateKey modeKey;
+	memset( &modeKey, 0, sizeof( modeKey ) );
+	modeKey.cls = D3DLIST_OP_MATRIX_MODE;
+
+	for ( size_t i = 0; i < m_commands.size(); ++i ) {
+		D3DListOptCommand *cmd = &m_commands[i];
+		if ( !cmd->keep )
+			continue;
+
+		const D3DListOpInfo *info = &c_opInfo[cmd->op];
+		if ( info->flags & D3DLISTOPT_BARRIER ) {
+			known.clear();
+			pending.clear();
+			unit = 0;
+			continue;
+		}
+		if ( cmd->op == D3DLIST_OP_DRAW || ( info->flags & D3DLISTOPT_READS ) ) {
+			pending.clear();
+			continue;
+		}
+		if ( info->flags & D3DLISTOPT_MATRIX ) {
+			pending.erase( modeKey );
+			pending.erase( activeKey );
+			continue;
+		}
+		if ( !( info->flags & D3DLISTOPT_STATE ) )
+			continue;
+
+		const D3DListStateKey key = StateKey( cmd, unit );
+		if ( info->flags & D3DLISTOPT_UNIQUE ) {
+			D3DListStateMap::iterator it = known.find( key );
+			if ( it != known.end() && SameValue( &m_commands[it->second], cmd ) ) {
+				cmd->keep = false;
+				changed = true;
+				continue;
+			}
+			known[key] = (int)i;
+		}
+		if ( PerUnit( cmd ) )
+			pending.erase( activeKey );
+
+		int &last = pending.insert( D3DListStateMap::value_type( key, -1 ) ).first->second;
+		if ( last >= 0 ) {
+			m_commands[last].keep = false;
+			changed = true;
+		}
+		last = (int)i;
+
+		if ( cmd->op == D3DLIST_OP_ACTIVE_TEXTURE && cmd->numArgs > 0 )
+			unit = m_pool[cmd->args];
+	}
+
+	return changed;
+}
+
+// Matrix of a ROTATE, SCALE, TRANSLATE or MULT_MATRIX command, as the stack builds it
+static void D3DList_CommandMatrix( float *out, D3DListOp op, const float *args )
+{
+	switch ( op )
+	{
+	case D3DLIST_OP_ROTATE:
+		D3DMatrix_RotationAxis( out, args[0] * ( 3.141592654f / 180.0f ), args[1], args[2], args[3] );
+		break;
+	case D3DLIST_OP_SCALE:
+		D3DMatrix_Scaling( out, args[0], args[1], args[2] );
+		break;
+	case D3DLIST_OP_TRANSLATE:
+		D3DMatrix_Translation( out, args[0], args[1], args[2] );
+		break;
+	default:
+		memcpy( out, args, sizeof( float ) * 16 );
+		break;
+	}
+}
+
+bool D3DListOptimizer :: FoldPair( D3DListOptCommand *into, const D3DListOptCommand *next )
+{
+	if ( into->op != next->op || into->numArgs != next->numArgs )
+		return false;
+
+	float a[4], b[4];
+	for ( int i = 0; i < into->numArgs && i < 4; ++i ) {
+		a[i] = ArgFloat( into->args + i );
+		b[i] = ArgFloat( next->args + i );
+	}
+
+	switch ( into->op )
+	{
+	case D3DLIST_OP_TRANSLATE:
+		for ( int i = 0; i < 3; ++i )
+			a[i] += b[i];
+		break;
+	case D3DLIST_OP_SCALE:
+		for ( int i = 0; i < 3; ++i )
+			a[i] *= b[i];
+		break;
+	case D3DLIST_OP_ROTATE:
+		if ( memcmp( &m_pool[into->args + 1], &m_pool[next->args + 1], sizeof( unsigned int ) * 3 ) )
+			return false;
+		a[0] += b[0];
+		break;
+	default:
+		return false;
+	}
+
+	into->args = AddArgs( a, into->numArgs );
+	return true;
+}
+
+void D3DListOptimizer :: FoldGroup( const std::vector<int> &group, bool sameKindOnly )
+{
+	if ( group.size() < 2 )
+		return;
+
+	if ( sameKindOnly ) {
+		D3DListOptCommand *into = &m_commands[group[0]];
+		for ( size_t i = 1; i < group.size(); ++i ) {
+			D3DListOptCommand *next = &m_commands[group[i]];
+			if ( FoldPair( into, next ) )
+				next->keep = false;
+			else
+				into = next;
+		}
+		return;
+	}
+
+	// top = M * top for each call, so the product is Mn * ... * M1
+	float product[16], m[16], args[16];
+	D3DMatrix_Identity( product );
+	for ( size_t i = 0; i < group.size(); ++i ) {
+		D3DListOptCommand *cmd = &m_commands[group[i]];
+		for ( int j = 0; j < cmd->numArgs && j < 16; ++j )
+			args[j] = ArgFloat( cmd->args + j );
+		D3DList_CommandMatrix( m, cmd->op, args );
+		D3DMatrix_Multiply( product, m, product );
+		cmd->keep = false;
+	}
+
+	D3DListOptCommand *first = &m_commands[group[0]];
+	first->op = D3DLIST_OP_MULT_MATRIX;
+	first->numArgs = 16;
+	first->args = AddArgs( product, 16 );
+	first->keep = true;
+}
+
+void D3DListOptimizer :: FoldMatrices()
+{
+	std::vector<int> group;
+	bool hasMult = false;
+	bool modeKnown = false;
+	unsigned int mode = 0;
+
+	for ( size_t i = 0; i <= m_commands.size(); ++i ) {
+		D3DListOptCommand *cmd = ( i < m_commands.size() ) ? &m_commands[i] : nullptr;
+		if ( cmd && !cmd->keep )
+			continue;
+
+		// commands with missing arguments are left alone
+		bool mult = cmd && ( c_opInfo[cmd->op].flags & D3DLISTOPT_MULT ) &&
+			cmd->numArgs == ( cmd->op == D3DLIST_OP_MULT_MATRIX ? 16 : ( cmd->op == D3DLIST_OP_ROTATE ? 4 : 3 ) );
+		if ( mult ) {
+			group.push_back( (int)i );
+			hasMult |= ( cmd->op == D3DLIST_OP_MULT_MATRIX );
+			continue;
+		}
+
+		FoldGroup( group, !hasMult && ( !modeKnown || mode == m_params->projectionMode ) );
+		group.clear();
+		hasMult = false;
+
+		if ( !cmd )
+			break;
+		if ( c_opInfo[cmd->op].flags & D3DLISTOPT_BARRIER )
+			modeKnown = false;
+		else if ( cmd->op == D3DLIST_OP_MATRIX_MODE && cmd->numArgs > 0 ) {
+			modeKnown = true;
+			mode = m_pool[cmd->args];
+		}
+	}
+}
+
+bool D3DListOptimizer :: CanMerge( const D3DListRun *first, const D3DListRun *next, int numVertices ) const
+{
+	return first->primClass == next->primClass && first->xyzw == next->xyzw &&
+		first->normal == next->normal && first->texCoordBits == next->texCoordBits &&
+		numVertices + next->numVertices <= m_params->maxRunVertices;
+}
+
+// Appends one run made of the given source runs to the output program
+void D3DListOptimizer :: EmitRuns( const std::vector<int> &runs )
+{
+	const std::vector<D3DListVertex> &srcVertices = m_program->vertices;
+	const std::vector<unsigned int> &srcIndices = m_program->indices;
+
+	D3DListRun run = m_program->runs[runs[0]];
+	run.inherit = 0;
+	run.firstVertex = (int)m_out.vertices.size();
+	run.firstIndex = (int)m_out.indices.size();
+
+	if ( run.primClass == D3DLIST_PRIM_POINTS ) {
+		for ( size_t i = 0; i < runs.size(); ++i ) {
+			const D3DListRun *src = &m_program->runs[runs[i]];
+			for ( int j = 0; j < src->numVertices; ++j ) {
+				m_out.vertices.push_back( srcVertices[src->firstVertex + j] );
+				run.inherit |= srcVertices[src->firstVertex + j].inherit;
+			}
+		}
+	} else if ( m_params->weldVertices ) {
+		int numIndices = 0;
+		for ( size_t i = 0; i < runs.size(); ++i )
+			numIndices += m_program->runs[runs[i]].numIndices;
+		int size = 16;
+		while ( size < numIndices * 2 )
+			size <<= 1;
+		m_weld.assign( size, -1 );
+
+		for ( size_t i = 0; i < runs.size(); ++i ) {
+			const D3DListRun *src = &m_program->runs[runs[i]];
+			for ( int j = 0; j < src->numIndices; ++j ) {
+				const D3DListVertex *v = &srcVertices[src->firstVertex + srcIndices[src->firstIndex + j]];
+
+				// FNV-1a over the vertex
+				const unsigned char *bytes = (const unsigned char*)v;
+				unsigned int hash = 2166136261u;
+				for ( size_t k = 0; k < sizeof( D3DListVertex ); ++k )
+					hash = ( hash ^ bytes[k] ) * 16777619u;
+
+				int slot = (int)( hash & ( size - 1 ) );
+				while ( m_weld[slot] >= 0 && memcmp( &m_out.vertices[run.firstVertex + m_weld[slot]], v, sizeof( D3DListVertex ) ) )
+					slot = ( slot + 1 ) & ( size - 1 );
+				if ( m_weld[slot] < 0 ) {
+					m_weld[slot] = (int)m_out.vertices.size() - run.firstVertex;
+					m_out.vertices.push_back( *v );
+					run.inherit |= v->inherit;
+				}
+				m_out.indices.push_back( (unsigned int)m_weld[slot] );
+			}
+		}
+	} else {
+		for ( size_t i = 0; i < runs.size(); ++i ) {
+			const D3DListRun *src = &m_program->runs[runs[i]];
+			const unsigned int base = (unsigned int)( m_out.vertices.size() - run.firstVertex );
+			for ( int j = 0; j < src->numVertices; ++j ) {
+				m_out.vertices.push_back( srcVertices[src->firstVertex + j] );
+				run.inherit |= srcVertices[src->firstVertex + j].inherit;
+			}
+			for ( int j = 0; j < src->numIndices; ++j )
+				m_out.indices.push_back( base + srcIndices[src->firstIndex + j] );
+		}
+	}
+
+	run.numVertices = (int)m_out.vertices.size() - run.firstVertex;
+	run.numIndices = (int)m_out.indices.size() - run.firstIndex;
+	if ( !run.numVertices || ( run.primClass != D3DLIST_PRIM_POINTS && !run.numIndices ) ) {
+		m_out.vertices.resize( run.firstVertex );
+		m_out.indices.resize( run.firstIndex );
+		return;
+	}
+
+	m_out.commands.push_back( D3DList_CommandHeader( D3DLIST_OP_DRAW, 1 ) );
+	m_out.commands.push_back( (unsigned int)m_out.runs.size() );
+	m_out.runs.push_back( run );
+}
+
+void D3DListOptimizer :: Emit()
+{
+	const int numRuns = (int)m_program->runs.size();
+	std::vector<int> runs;
+	int numVertices = 0;
+
+	for ( size_t i = 0; i <= m_commands.size(); ++i ) {
+		const D3DListOptCommand *cmd = ( i < m_commands.size() ) ? &m_commands[i] : nullptr;
+		if ( cmd && !cmd->keep )
+			continue;
+
+		if ( cmd && cmd->op == D3DLIST_OP_DRAW ) {
+			const int index = cmd->numArgs ? (int)m_pool[cmd->args] : -1;
+			if ( index < 0 || index >= numRuns )
+				continue;
+			const D3DListRun *run = &m_program->runs[index];
+			if ( !runs.empty() && m_params->mergeRuns && CanMerge( &m_program->runs[runs[0]], run, numVertices ) ) {
+				runs.push_back( index );
+				numVertices += run->numVertices;
+				continue;
+			}
+			if ( !runs.empty() )
+				EmitRuns( runs );
+			runs.assign( 1, index );
+			numVertices = run->numVertices;
+			continue;
+		}
+
+		if ( !runs.empty() )
+			EmitRuns( runs );
+		runs.clear();
+		if ( !cmd )
+			break;
+
+		m_out.commands.push_back( D3DList_CommandHeader( cmd->op, cmd->numArgs ) );
+		if ( cmd->numArgs )
+			m_out.commands.insert( m_out.commands.end(), m_pool.begin() + cmd->args, m_pool.begin() + cmd->args + cmd->numArgs );
+	}
+}
+
+void D3DListOptimizer :: Run( D3DListOptimizeStats *stats )
+{
+	Decode();
+
+	if ( stats ) {
+		stats->commandsBefore = (int)m_commands.size();
+		stats->verticesBefore = (int)m_program->vertices.size();
+		stats->drawsBefore = 0;
+		for ( size_t i = 0; i < m_commands.size(); ++i ) {
+			if ( m_commands[i].op == D3DLIST_OP_DRAW )
+				++stats->drawsBefore;
+		}
+	}
+
+	if ( m_params->dropRedundantState ) {
+		// every pass that changes something drops a command
+		while ( DropRedundantState() )
+			;
+	}
+	if ( m_params->foldMatrices )
+		FoldMatrices();
+	Emit();
+
+	m_program->commands.swap( m_out.commands );
+	m_program->vertices.swap( m_out.vertices );
+	m_program->indices.swap( m_out.indices );
+	m_program->runs.swap( m_out.runs );
+
+	if ( stats ) {
+		stats->commandsAfter = D3DList_CountCommands( m_program );
+		stats->verticesAfter = (int)m_program->vertices.size();
+		stats->drawsAfter = (int)m_program->runs.size();
+	}
+}
+
+//==================================================================================
+// Interface
+//==================================================================================
+
+void D3DList_DefaultOptimizeParams( D3DListOptimizeParams *params, unsigned int projectionMode )
+{
+	params->dropRedundantState = true;
+	params->foldMatrices = true;
+	params->mergeRuns = true;
+	params->weldVertices = true;
+	params->projectionMode = projectionMode;
+	params->maxRunVertices = 0x10000;
+}
+
+int D3DList_CountCommands( const D3DListProgram *program )
+{
+	int count = 0;
+	size_t offset = 0;
+	while ( offset < program->commands.size() ) {
+		offset += 1 + D3DList_CommandNumArgs( program->commands[offset] );
+		++count;
+	}
+	return count;
+}
+
+void D3DList_Optimize( D3DListProgram *program, const D3DListOptimizeParams *params, D3DListOptimizeStats *stats )
+{
+	D3DListOptimizer optimizer( program, params );
+	optimizer.Run( stats );
+}
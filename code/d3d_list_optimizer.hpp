@@ -0,0 +1,197 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_LIST_OPTIMIZER_H
+#define QINDIEGL_D3D_LIST_OPTIMIZER_H
+
+#include <vector>
+
+//==================================================================================
+// Display list programs
+//----------------------------------------------------------------------------------
+// The recorded form of a display list: a command stream, the captured vertices,
+// and the runs of primitives the DRAW commands refer to. Each command is a
+// header (op | numArgs << 8) followed by its arguments; floats are stored by
+// their bits.
+//
+// D3DList_Optimize rewrites a program at glEndList. It drops state calls that
+// set a value already known to be current or that are overwritten before
+// anything uses them, folds consecutive matrix operations, merges the runs of
+// draws that end up next to each other and welds duplicate vertices.
+//
+// Like d3d_matrix_math, the module knows nothing about the GL state, so it can
+// be compiled into the tests. d3d_lists.cpp records and executes the programs.
+//==================================================================================
+
+#define QINDIEGL_LIST_STAGES		8
+
+typedef enum D3DListOp_e
+{
+	D3DLIST_OP_NONE = 0,
+	D3DLIST_OP_DRAW,			// internal: draw a run of recorded primitives
+	D3DLIST_OP_CURRENT,			// internal: set current color/normal/texcoords
+	D3DLIST_OP_CALL_LIST,
+	D3DLIST_OP_CALL_LISTS,
+	D3DLIST_OP_LIST_BASE,
+	D3DLIST_OP_ENABLE,
+	D3DLIST_OP_DISABLE,
+	D3DLIST_OP_PUSH_ATTRIB,
+	D3DLIST_OP_POP_ATTRIB,
+	D3DLIST_OP_BIND_TEXTURE,
+	D3DLIST_OP_ACTIVE_TEXTURE,
+	D3DLIST_OP_TEX_ENVFV,
+	D3DLIST_OP_TEX_ENVIV,
+	D3DLIST_OP_ALPHA_FUNC,
+	D3DLIST_OP_BLEND_FUNC,
+	D3DLIST_OP_COLOR_MASK,
+	D3DLIST_OP_CULL_FACE,
+	D3DLIST_OP_FRONT_FACE,
+	D3DLIST_OP_DEPTH_FUNC,
+	D3DLIST_OP_DEPTH_MASK,
+	D3DLIST_OP_POLYGON_OFFSET,
+	D3DLIST_OP_LINE_WIDTH,
+	D3DLIST_OP_POINT_SIZE,
+	D3DLIST_OP_SHADE_MODEL,
+	D3DLIST_OP_MATERIALFV,
+	D3DLIST_OP_MATRIX_MODE,
+	D3DLIST_OP_LOAD_IDENTITY,
+	D3DLIST_OP_LOAD_MATRIX,
+	D3DLIST_OP_MULT_MATRIX,
+	D3DLIST_OP_PUSH_MATRIX,
+	D3DLIST_OP_POP_MATRIX,
+	D3DLIST_OP_ROTATE,
+	D3DLIST_OP_SCALE,
+	D3DLIST_OP_TRANSLATE,
+	D3DLIST_OP_INIT_NAMES,
+	D3DLIST_OP_LOAD_NAME,
+	D3DLIST_OP_PUSH_NAME,
+	D3DLIST_OP_POP_NAME,
+	D3DLIST_OP_PASS_THROUGH,
+	D3DLIST_OP_LIGHTFV,
+	D3DLIST_OP_LIGHT_MODELF,
+	D3DLIST_OP_LIGHT_MODELFV,
+	D3DLIST_OP_COLOR_MATERIAL,
+	D3DLIST_OP_FOGFV,
+	D3DLIST_OP_TEX_GENFV,
+	D3DLIST_OP_TEX_GENIV,
+	D3DLIST_OP_TEX_PARAMETERFV,
+	D3DLIST_OP_POLYGON_MODE,
+	D3DLIST_OP_CLEAR_COLOR,
+	D3DLIST_OP_CLEAR_DEPTH,
+	D3DLIST_OP_CLEAR_STENCIL,
+	D3DLIST_OP_CLEAR,
+	D3DLIST_OP_MAP1,
+	D3DLIST_OP_MAP2,
+	D3DLIST_OP_MAP_GRID1,
+	D3DLIST_OP_MAP_GRID2,
+	D3DLIST_OP_EVAL_MESH1,
+	D3DLIST_OP_EVAL_MESH2,
+	D3DLIST_OP_FRUSTUM,
+	D3DLIST_OP_ORTHO,
+	D3DLIST_OP_VIEWPORT,
+	D3DLIST_OP_SCISSOR,
+	D3DLIST_OP_DEPTH_RANGE,
+	D3DLIST_OP_STENCIL_MASK,
+	D3DLIST_OP_STENCIL_FUNC,
+	D3DLIST_OP_STENCIL_OP,
+	D3DLIST_OP_ACTIVE_STENCIL_FACE,
+	D3DLIST_OP_MAX
+} D3DListOp;
+
+// Attributes that a vertex takes from the current state on execution
+#define D3DLIST_INHERIT_COLOR		0x1
+#define D3DLIST_INHERIT_COLOR2		0x2
+#define D3DLIST_INHERIT_NORMAL		0x4
+#define D3DLIST_INHERIT_TEXCOORD0	0x8
+#define D3DLIST_INHERIT_ALL			( ( D3DLIST_INHERIT_TEXCOORD0 << QINDIEGL_LIST_STAGES ) - 1 )
+
+// CURRENT: mask of the attributes it sets, color, color2, normal[3], texcoords[stages][4]
+#define D3DLIST_CURRENT_ARGS		( 6 + QINDIEGL_LIST_STAGES * 4 )
+
+typedef enum D3DListPrimClass_e
+{
+	D3DLIST_PRIM_TRIANGLES = 0,
+	D3DLIST_PRIM_LINES,
+	D3DLIST_PRIM_POINTS,
+	D3DLIST_PRIM_MAX
+} D3DListPrimClass;
+
+typedef struct D3DListVertex_s
+{
+	float			position[4];
+	float			normal[3];
+	unsigned int	color;
+	unsigned int	color2;
+	unsigned int	inherit;
+	float			texCoord[QINDIEGL_LIST_STAGES][4];
+} D3DListVertex;
+
+// Primitives of one class and vertex layout, as triangle or line list indices
+// relative to firstVertex; points are not indexed
+typedef struct D3DListRun_s
+{
+	D3DListPrimClass	primClass;
+	bool			xyzw;
+	bool			normal;			// glNormal was issued, as in immediate mode
+	unsigned int	texCoordBits;	// texcoord sizes, as in immediate mode
+	unsigned int	inherit;
+	int				firstVertex;
+	int				numVertices;
+	int				firstIndex;
+	int				numIndices;
+} D3DListRun;
+
+typedef struct D3DListProgram_s
+{
+	std::vector<unsigned int>	commands;
+	std::vector<D3DListVertex>	vertices;
+	std::vector<unsigned int>	indices;
+	std::vector<D3DListRun>		runs;
+} D3DListProgram;
+
+typedef struct D3DListOptimizeParams_s
+{
+	bool			dropRedundantState;
+	bool			foldMatrices;
+	bool			mergeRuns;
+	bool			weldVertices;
+	unsigned int	projectionMode;		// GL_PROJECTION, see D3DList_Optimize
+	int				maxRunVertices;		// merged runs stay below this, to keep 16-bit indices
+} D3DListOptimizeParams;
+
+typedef struct D3DListOptimizeStats_s
+{
+	int				commandsBefore;
+	int				commandsAfter;
+	int				verticesBefore;
+	int				verticesAfter;
+	int				drawsBefore;
+	int				drawsAfter;
+} D3DListOptimizeStats;
+
+inline unsigned int D3DList_CommandHeader( D3DListOp op, int numArgs ) { return (unsigned int)op | ( (unsigned int)numArgs << 8 ); }
+inline D3DListOp D3DList_CommandOp( unsigned int header ) { return (D3DListOp)( header & 0xFF ); }
+inline int D3DList_CommandNumArgs( unsigned int header ) { return (int)( header >> 8 ); }
+
+void D3DList_DefaultOptimizeParams( D3DListOptimizeParams *params, unsigned int projectionMode );
+int D3DList_CountCommands( const D3DListProgram *program );
+void D3DList_Optimize( D3DListProgram *program, const D3DListOptimizeParams *params, D3DListOptimizeStats *stats );
+
+#endif //QINDIEGL_D3D_LIST_OPTIMIZER_H
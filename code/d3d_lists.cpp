@@ -1,5 +1,5 @@
 /***************************************************************************
-* Copyright( C ) 2011-2016, Crystice Softworks.
+* Copyright (C) 2011-2016, Crystice Softworks.
 * 
 * This file is part of QindieGL source code.
 * Please note that QindieGL is not driver, it's emulator.
@@ -7,11 +7,11 @@
 * QindieGL source code is free software; you can redistribute it and/or 
 * modify it under the terms of the GNU General Public License as 
 * published by the Free Software Foundation; either version 2 of 
-* the License, or( at your option ) any later version.
+* the License, or (at your option) any later version.
 * 
 * QindieGL source code is distributed in the hope that it will be 
 * useful, but WITHOUT ANY WARRANTY; without even the implied 
-* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
 * See the GNU General Public License for more details.
 * 
 * You should have received a copy of the GNU General Public License
@@ -22,83 +22,1214 @@
 #include "d3d_global.hpp"
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
+#include "d3d_immediate.hpp"
+#include "d3d_lists.hpp"
+#include "d3d_feedback.hpp"
+#include "d3d_eval.hpp"
+#include "d3d_extension.hpp"
+#include <map>
+#include <vector>
 
 //==================================================================================
 // Display Lists
 //----------------------------------------------------------------------------------
-// BIG TODO!
+// A list is a stream of commands. State calls are kept as GL calls and replayed
+// through the entry points, which already shadow the state and apply it lazily.
+// Geometry is captured vertex by vertex from the immediate mode buffer and merged
+// into runs: consecutive primitives of the same class and vertex layout, with no
+// other command in between, share a run and one draw call. Runs are converted
+// to indexed triangle/line lists and written into a managed vertex buffer the
+// first time they are drawn, so a list costs one DrawIndexedPrimitive per run
+// instead of re-sending its vertices every frame. At glEndList the recorded
+// program goes through D3DList_Optimize (see d3d_list_optimizer.cpp).
+//
+// The vertex layout depends on state at draw time (enabled samplers, texture
+// transforms, secondary color), so a run is rewritten when it is drawn with a
+// different layout. Attributes a list uses without setting them (e.g. glColor
+// issued before glCallList) are taken from the current state and also rewrite
+// the run when they change. Stages with texgen enabled can't be baked and go
+// through the immediate mode buffer instead.
 //==================================================================================
 
-OPENGL_API void WINAPI glListBase( GLuint )
+D3DListContext_t D3DListContext;
+
+// Draw-time state that selects the vertex layout of a run
+#define D3DLIST_SIG_SAMPLERS		0xFF
+#define D3DLIST_SIG_TRANSFORM		0x100
+#define D3DLIST_SIG_SPECULAR		0x200
+#define D3DLIST_SIG_TEXGEN			0x400
+
+static_assert( MAX_D3D_TMU == QINDIEGL_LIST_STAGES, "list vertices store a texcoord per stage" );
+
+// Where a run lives in the vertex buffer and what it was written with
+typedef struct D3DListRunBuffer_s
+{
+	bool		baked;
+	DWORD		signature;
+	int			stride;
+	int			reservedStride;
+	UINT		vbOffset;
+	UINT		baseVertex;
+	DWORD		fvf;
+	// inherited attributes the run was written with
+	DWORD		color;
+	DWORD		color2;
+	float		normalValue[3];
+	float		texCoordValue[MAX_D3D_TMU][4];
+} D3DListRunBuffer;
+
+class D3DDisplayList
+{
+public:
+	D3DDisplayList();
+	~D3DDisplayList();
+
+	void BeginPrimitive( GLenum mode );
+	void AddVertex( float x, float y, float z, float w, bool xyzw );
+	void EndPrimitive();
+	void AddCommand( D3DListOp op, const DWORD *args, int numArgs );
+	void Finish();
+	void Execute();
+
+	int NumVertices() const { return (int)m_program.vertices.size(); }
+	int NumRuns() const { return (int)m_program.runs.size(); }
+
+private:
+	void FlushCurrent();
+	void SetCurrent( const unsigned int *args );
+	bool DrawRun( const D3DListRun *run, D3DListRunBuffer *buffer );
+	void DrawRunImmediate( const D3DListRun *run );
+	bool EncodeRun( const D3DListRun *run, D3DListRunBuffer *buffer, DWORD signature );
+	bool CreateBuffers( DWORD signature );
+	void ReleaseBuffers();
+
+	D3DListProgram					m_program;
+	std::vector<D3DListRunBuffer>	m_buffers;		// one per run, made by Finish
+	LPDIRECT3DVERTEXBUFFER9		m_pVertexBuffer;
+	LPDIRECT3DINDEXBUFFER9		m_pIndexBuffer;
+
+	// compile state
+	GLenum		m_primMode;
+	int			m_primFirst;
+	bool		m_primXYZW;
+	int			m_lastRun;		// run the next primitive may extend
+	DWORD		m_listSet;		// attributes set by the list so far
+	unsigned int	m_flushed[D3DLIST_CURRENT_ARGS];
+};
+
+typedef std::map<GLuint, D3DDisplayList*> D3DDisplayListMap;
+
+static D3DDisplayListMap s_displayLists;
+
+static struct {
+	DWORD		listsCompiled;
+	DWORD		verticesCompiled;
+	DWORD		listsOptimized;
+	DWORD		commandsBefore;
+	DWORD		commandsAfter;
+	DWORD		verticesBefore;
+	DWORD		verticesAfter;
+	DWORD		drawsBefore;
+	DWORD		drawsAfter;
+	DWORD		bakedDraws;
+	DWORD		immediateDraws;
+	DWORD		runRewrites;
+} s_listStats;
+
+// saved by glNewList, GL_COMPILE must not change the current vertex state
+static DWORD s_savedColor;
+static DWORD s_savedColor2;
+static FLOAT s_savedNormal[3];
+static FLOAT s_savedTexCoord[MAX_D3D_TMU][4];
+static DWORD s_savedIsSet;
+
+static inline float D3DList_ArgFloat( unsigned int d )
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glListBase: lists are not supported\n" );
-	}	
+	return *((float*)&d);
 }
 
-OPENGL_API void WINAPI glNewList( GLuint, GLenum )
+static DWORD D3DList_SetBits()
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glNewList: lists are not supported\n" );
-	}	
+	DWORD bits = 0;
+	if ( D3DState.CurrentState.isSet.bits.color ) bits |= D3DLIST_INHERIT_COLOR;
+	if ( D3DState.CurrentState.isSet.bits.color2 || D3DState.CurrentState.isSet.bits.fog ) bits |= D3DLIST_INHERIT_COLOR2;
+	if ( D3DState.CurrentState.isSet.bits.norm ) bits |= D3DLIST_INHERIT_NORMAL;
+	// a one-component texcoord can't be told from no texcoord at all
+	for ( int i = 0; i < D3DGlobal.maxActiveTMU; ++i ) {
+		if ( ( DWORD( D3DState.CurrentState.isSet.bits.texcoord ) >> ( i * 2 ) ) & 0x3 )
+			bits |= D3DLIST_INHERIT_TEXCOORD0 << i;
+	}
+	return bits;
 }
 
-OPENGL_API void WINAPI glEndList()
+static DWORD D3DList_Signature()
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glEndList: lists are not supported\n" );
+	DWORD signature = 0;
+	for ( int i = 0; i < D3DGlobal.maxActiveTMU; ++i ) {
+		if ( D3DState.EnableState.textureEnabled[i] ) {
+			signature |= ( 1 << i );
+			if ( D3DState.EnableState.texGenEnabled[i] )
+				signature |= D3DLIST_SIG_TEXGEN;
+		}
 	}
+	if ( D3DState.TextureState.transformEnabled )
+		signature |= D3DLIST_SIG_TRANSFORM;
+	if ( ( D3DState.EnableState.fogEnabled && D3DState.FogState.fogCoordMode ) ||
+		D3DState.EnableState.colorSumEnabled )
+		signature |= D3DLIST_SIG_SPECULAR;
+	return signature;
 }
 
-OPENGL_API void WINAPI glCallList( GLuint )
+// Same layout as the immediate mode buffer builds for the primitive
+static int D3DList_VertexFormat( const D3DListRun *run, DWORD signature, DWORD *pFVF )
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glCallList: lists are not supported\n" );
+	DWORD fvf = D3DFVF_DIFFUSE;
+	int size = sizeof( DWORD );
+
+	if ( run->xyzw ) {
+		fvf |= D3DFVF_XYZW;
+		size += 4 * sizeof( float );
+	} else {
+		fvf |= D3DFVF_XYZ;
+		size += 3 * sizeof( float );
+	}
+	if ( run->normal ) {
+		fvf |= D3DFVF_NORMAL;
+		size += 3 * sizeof( float );
+	}
+	if ( signature & D3DLIST_SIG_SPECULAR ) {
+		fvf |= D3DFVF_SPECULAR;
+		size += sizeof( DWORD );
 	}
+
+	int numSamplers = 0;
+	for ( int i = 0; i < D3DGlobal.maxActiveTMU; ++i ) {
+		if ( !( signature & ( 1 << i ) ) )
+			continue;
+		int numCoords = ( signature & D3DLIST_SIG_TRANSFORM ) ? 4 : 
+			( ( run->texCoordBits >> ( i * 2 ) ) & 0x3 ) + 1;
+		switch ( numCoords )
+		{
+		case 1: fvf |= D3DFVF_TEXCOORDSIZE1( numSamplers ); break;
+		case 2: fvf |= D3DFVF_TEXCOORDSIZE2( numSamplers ); break;
+		case 3: fvf |= D3DFVF_TEXCOORDSIZE3( numSamplers ); break;
+		default: fvf |= D3DFVF_TEXCOORDSIZE4( numSamplers ); break;
+		}
+		size += numCoords * sizeof( float );
+		++numSamplers;
+	}
+	fvf |= ( numSamplers << D3DFVF_TEXCOUNT_SHIFT );
+
+	if ( pFVF ) *pFVF = fvf;
+	return size;
 }
 
-OPENGL_API void WINAPI glCallLists( GLsizei, GLenum, const GLvoid* )
+static D3DListPrimClass D3DList_PrimitiveClass( GLenum mode )
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glCallLists: lists are not supported\n" );
+	switch ( mode )
+	{
+	case GL_TRIANGLES:
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN:
+	case GL_QUADS:
+	case GL_QUAD_STRIP:
+	case GL_POLYGON:
+		return D3DLIST_PRIM_TRIANGLES;
+	case GL_LINES:
+	case GL_LINE_STRIP:
+	case GL_LINE_LOOP:
+		return D3DLIST_PRIM_LINES;
+	case GL_POINTS:
+		return D3DLIST_PRIM_POINTS;
+	default:
+		return D3DLIST_PRIM_MAX;
 	}
 }
 
-OPENGL_API void WINAPI glDeleteLists( GLuint, GLsizei )
+// Converts a primitive to triangle or line list indices, keeping the winding
+static void D3DList_AppendIndices( std::vector<GLuint> &indices, GLenum mode, GLuint base, int count )
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glDeleteLists: lists are not supported\n" );
+	switch ( mode )
+	{
+	case GL_TRIANGLES:
+		for ( int i = 0; i + 2 < count; i += 3 ) {
+			indices.push_back( base + i );
+			indices.push_back( base + i + 1 );
+			indices.push_back( base + i + 2 );
+		}
+		break;
+	case GL_QUADS:
+		for ( int i = 0; i + 3 < count; i += 4 ) {
+			indices.push_back( base + i );
+			indices.push_back( base + i + 1 );
+			indices.push_back( base + i + 2 );
+			indices.push_back( base + i );
+			indices.push_back( base + i + 2 );
+			indices.push_back( base + i + 3 );
+		}
+		break;
+	case GL_QUAD_STRIP:
+		// quadstrip is EXACT the same as tristrip, without a trailing odd vertex
+		count &= ~1;
+		// fall through
+	case GL_TRIANGLE_STRIP:
+		for ( int i = 0; i + 2 < count; ++i ) {
+			indices.push_back( base + i + ( i & 1 ) );
+			indices.push_back( base + i + 1 - ( i & 1 ) );
+			indices.push_back( base + i + 2 );
+		}
+		break;
+	case GL_POLYGON:
+	case GL_TRIANGLE_FAN:
+		for ( int i = 1; i + 1 < count; ++i ) {
+			indices.push_back( base );
+			indices.push_back( base + i );
+			indices.push_back( base + i + 1 );
+		}
+		break;
+	case GL_LINES:
+		for ( int i = 0; i + 1 < count; i += 2 ) {
+			indices.push_back( base + i );
+			indices.push_back( base + i + 1 );
+		}
+		break;
+	case GL_LINE_STRIP:
+	case GL_LINE_LOOP:
+		for ( int i = 0; i + 1 < count; ++i ) {
+			indices.push_back( base + i );
+			indices.push_back( base + i + 1 );
+		}
+		if ( mode == GL_LINE_LOOP && count > 1 ) {
+			indices.push_back( base + count - 1 );
+			indices.push_back( base );
+		}
+		break;
+	default:
+		break;
 	}
 }
 
-OPENGL_API GLuint WINAPI glGenLists( GLsizei )
+static void D3DList_Call( GLuint name );
+
+//==================================================================================
+// D3DDisplayList
+//==================================================================================
+
+D3DDisplayList :: D3DDisplayList()
+{
+	m_pVertexBuffer = nullptr;
+	m_pIndexBuffer = nullptr;
+	m_primMode = 0;
+	m_primFirst = -1;
+	m_primXYZW = false;
+	m_lastRun = -1;
+	m_listSet = 0;
+	memset( m_flushed, 0, sizeof( m_flushed ) );
+}
+
+D3DDisplayList :: ~D3DDisplayList()
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glGenLists: lists are not supported\n" );
+	ReleaseBuffers();
+}
+
+void D3DDisplayList :: ReleaseBuffers()
+{
+	if ( m_pVertexBuffer ) {
+		m_pVertexBuffer->Release();
+		m_pVertexBuffer = nullptr;
+	}
+	if ( m_pIndexBuffer ) {
+		m_pIndexBuffer->Release();
+		m_pIndexBuffer = nullptr;
 	}
-	return 0;
+	for ( size_t i = 0; i < m_buffers.size(); ++i )
+		m_buffers[i].baked = false;
+}
+
+void D3DDisplayList :: BeginPrimitive( GLenum mode )
+{
+	m_primMode = mode;
+	m_primFirst = (int)m_program.vertices.size();
+	m_primXYZW = false;
+}
+
+void D3DDisplayList :: AddVertex( float x, float y, float z, float w, bool xyzw )
+{
+	if ( m_primFirst < 0 )
+		return;
+
+	m_listSet |= D3DList_SetBits();
+
+	D3DListVertex v;
+	v.position[0] = x;
+	v.position[1] = y;
+	v.position[2] = z;
+	v.position[3] = w;
+	memcpy( v.normal, D3DState.CurrentState.currentNormal, sizeof( v.normal ) );
+	v.color = D3DState.CurrentState.currentColor;
+	v.color2 = D3DState.CurrentState.currentColor2;
+	v.inherit = D3DLIST_INHERIT_ALL & ~m_listSet;
+	memcpy( v.texCoord, D3DState.CurrentState.currentTexCoord, sizeof( v.texCoord ) );
+	m_program.vertices.push_back( v );
+
+	m_primXYZW |= xyzw;
 }
 
-OPENGL_API GLboolean WINAPI glIsList( GLuint )
+void D3DDisplayList :: EndPrimitive()
 {
-	static bool warningPrinted = false;
-	if( !warningPrinted ) {
-		warningPrinted = true;
-		logPrintf( "WARNING: glIsList: lists are not supported\n" );
+	if ( m_primFirst < 0 )
+		return;
+
+	const int first = m_primFirst;
+	const int count = (int)m_program.vertices.size() - first;
+	const D3DListPrimClass primClass = D3DList_PrimitiveClass( m_primMode );
+	m_primFirst = -1;
+
+	if ( primClass == D3DLIST_PRIM_MAX ) {
+		logPrintf( "WARNING: glBegin - unsupported mode 0x%x\n", m_primMode );
+		m_program.vertices.resize( first );
+		return;
+	}
+	if ( count < ( primClass == D3DLIST_PRIM_TRIANGLES ? 3 : ( primClass == D3DLIST_PRIM_LINES ? 2 : 1 ) ) ) {
+		m_program.vertices.resize( first );
+		return;
+	}
+
+	const bool normal = D3DState.CurrentState.isSet.bits.norm != 0;
+	const DWORD texCoordBits = D3DState.CurrentState.isSet.bits.texcoord;
+
+	D3DListRun *run = nullptr;
+	if ( m_lastRun >= 0 ) {
+		D3DListRun *last = &m_program.runs[m_lastRun];
+		if ( last->primClass == primClass && last->xyzw == m_primXYZW &&
+			last->normal == normal && last->texCoordBits == texCoordBits )
+			run = last;
+	}
+	if ( !run ) {
+		D3DListRun newRun;
+		memset( &newRun, 0, sizeof( newRun ) );
+		newRun.primClass = primClass;
+		newRun.xyzw = m_primXYZW;
+		newRun.normal = normal;
+		newRun.texCoordBits = texCoordBits;
+		newRun.firstVertex = first;
+		newRun.firstIndex = (int)m_program.indices.size();
+		m_lastRun = (int)m_program.runs.size();
+		m_program.runs.push_back( newRun );
+		m_program.commands.push_back( D3DList_CommandHeader( D3DLIST_OP_DRAW, 1 ) );
+		m_program.commands.push_back( (unsigned int)m_lastRun );
+		run = &m_program.runs[m_lastRun];
 	}
-	return GL_FALSE;
+
+	if ( primClass != D3DLIST_PRIM_POINTS )
+		D3DList_AppendIndices( m_program.indices, m_primMode, first - run->firstVertex, count );
+	for ( int i = first; i < first + count; ++i )
+		run->inherit |= m_program.vertices[i].inherit;
+	run->numVertices = (int)m_program.vertices.size() - run->firstVertex;
+	run->numIndices = (int)m_program.indices.size() - run->firstIndex;
+}
+
+// Current attributes set by the list are recorded before anything that may
+// depend on them, such as a nested list, and at the end of the list
+void D3DDisplayList :: FlushCurrent()
+{
+	m_listSet |= D3DList_SetBits();
+	if ( !m_listSet )
+		return;
+
+	unsigned int args[D3DLIST_CURRENT_ARGS];
+	args[0] = m_listSet;
+	args[1] = D3DState.CurrentState.currentColor;
+	args[2] = D3DState.CurrentState.currentColor2;
+	memcpy( args + 3, D3DState.CurrentState.currentNormal, sizeof( FLOAT ) * 3 );
+	memcpy( args + 6, D3DState.CurrentState.currentTexCoord, sizeof( FLOAT ) * 4 * MAX_D3D_TMU );
+	if ( !memcmp( args, m_flushed, sizeof( args ) ) )
+		return;
+	memcpy( m_flushed, args, sizeof( args ) );
+
+	m_program.commands.push_back( D3DList_CommandHeader( D3DLIST_OP_CURRENT, D3DLIST_CURRENT_ARGS ) );
+	m_program.commands.insert( m_program.commands.end(), args, args + D3DLIST_CURRENT_ARGS );
+	m_lastRun = -1;
+}
+
+void D3DDisplayList :: SetCurrent( const unsigned int *args )
+{
+	const DWORD mask = args[0];
+	if ( mask & D3DLIST_INHERIT_COLOR )
+		D3DState.CurrentState.currentColor = args[1];
+	if ( mask & D3DLIST_INHERIT_COLOR2 )
+		D3DState.CurrentState.currentColor2 = args[2];
+	if ( mask & D3DLIST_INHERIT_NORMAL )
+		memcpy( D3DState.CurrentState.currentNormal, args + 3, sizeof( FLOAT ) * 3 );
+	for ( int i = 0; i < MAX_D3D_TMU; ++i ) {
+		if ( mask & ( D3DLIST_INHERIT_TEXCOORD0 << i ) )
+			memcpy( D3DState.CurrentState.currentTexCoord[i], args + 6 + i * 4, sizeof( FLOAT ) * 4 );
+	}
+}
+
+void D3DDisplayList :: AddCommand( D3DListOp op, const DWORD *args, int numArgs )
+{
+	FlushCurrent();
+
+	m_program.commands.push_back( D3DList_CommandHeader( op, numArgs ) );
+	if ( numArgs > 0 )
+		m_program.commands.insert( m_program.commands.end(), args, args + numArgs );
+	m_lastRun = -1;
+
+	if ( op == D3DLIST_OP_CALL_LIST || op == D3DLIST_OP_CALL_LISTS ) {
+		// whatever the called lists leave is only known on execution
+		m_listSet = 0;
+		memset( m_flushed, 0, sizeof( m_flushed ) );
+	}
+}
+
+void D3DDisplayList :: Finish()
+{
+	EndPrimitive();
+	FlushCurrent();
+
+	++s_listStats.listsCompiled;
+	s_listStats.verticesCompiled += (DWORD)m_program.vertices.size();
+
+	if ( D3DGlobal.settings.optimizeDisplayLists ) {
+		D3DListOptimizeParams params;
+		D3DListOptimizeStats stats;
+		D3DList_DefaultOptimizeParams( &params, GL_PROJECTION );
+		D3DList_Optimize( &m_program, &params, &stats );
+
+		++s_listStats.listsOptimized;
+		s_listStats.commandsBefore += stats.commandsBefore;
+		s_listStats.commandsAfter += stats.commandsAfter;
+		s_listStats.verticesBefore += stats.verticesBefore;
+		s_listStats.verticesAfter += stats.verticesAfter;
+		s_listStats.drawsBefore += stats.drawsBefore;
+		s_listStats.drawsAfter += stats.drawsAfter;
+	}
+
+	D3DListRunBuffer buffer;
+	memset( &buffer, 0, sizeof( buffer ) );
+	m_buffers.assign( m_program.runs.size(), buffer );
+}
+
+bool D3DDisplayList :: CreateBuffers( DWORD signature )
+{
+	ReleaseBuffers();
+
+	UINT vbSize = 0;
+	bool index32 = false;
+	for ( size_t i = 0; i < m_program.runs.size(); ++i ) {
+		const D3DListRun *run = &m_program.runs[i];
+		D3DListRunBuffer *buffer = &m_buffers[i];
+		buffer->reservedStride = QINDIEGL_MAX( buffer->reservedStride, D3DList_VertexFormat( run, signature, nullptr ) );
+		buffer->vbOffset = vbSize;
+		// one extra vertex leaves room to align the run to any smaller stride
+		vbSize += buffer->reservedStride * ( run->numVertices + 1 );
+		if ( run->primClass != D3DLIST_PRIM_POINTS && run->numVertices > 0x10000 )
+			index32 = true;
+	}
+	if ( !vbSize )
+		return false;
+
+	if ( index32 && D3DGlobal.hD3DCaps.MaxVertexIndex <= 0xFFFF ) {
+		PRINT_ONCE( "WARNING: display list is too large for 16-bit indices\n" );
+		return false;
+	}
+
+	HRESULT hr = D3DGlobal.pDevice->CreateVertexBuffer( vbSize, D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED, &m_pVertexBuffer, nullptr );
+	if ( FAILED( hr ) ) {
+		D3DGlobal.lastError = hr;
+		m_pVertexBuffer = nullptr;
+		return false;
+	}
+
+	if ( m_program.indices.empty() )
+		return true;
+
+	const UINT indexSize = index32 ? sizeof( GLuint ) : sizeof( GLushort );
+	hr = D3DGlobal.pDevice->CreateIndexBuffer( (UINT)m_program.indices.size() * indexSize, D3DUSAGE_WRITEONLY,
+		index32 ? D3DFMT_INDEX32 : D3DFMT_INDEX16, D3DPOOL_MANAGED, &m_pIndexBuffer, nullptr );
+	if ( FAILED( hr ) ) {
+		D3DGlobal.lastError = hr;
+		m_pIndexBuffer = nullptr;
+		ReleaseBuffers();
+		return false;
+	}
+
+	void *locked = nullptr;
+	hr = m_pIndexBuffer->Lock( 0, 0, &locked, 0 );
+	if ( FAILED( hr ) ) {
+		D3DGlobal.lastError = hr;
+		ReleaseBuffers();
+		return false;
+	}
+	if ( index32 ) {
+		memcpy( locked, m_program.indices.data(), m_program.indices.size() * sizeof( GLuint ) );
+	} else {
+		GLushort *dst = (GLushort*)locked;
+		for ( size_t i = 0; i < m_program.indices.size(); ++i )
+			dst[i] = (GLushort)m_program.indices[i];
+	}
+	m_pIndexBuffer->Unlock();
+
+	return true;
+}
+
+bool D3DDisplayList :: EncodeRun( const D3DListRun *run, D3DListRunBuffer *buffer, DWORD signature )
+{
+	DWORD fvf;
+	const int stride = D3DList_VertexFormat( run, signature, &fvf );
+	if ( !m_pVertexBuffer || stride > buffer->reservedStride ) {
+		if ( !CreateBuffers( signature ) )
+			return false;
+	}
+
+	const UINT start = ( ( buffer->vbOffset + stride - 1 ) / stride ) * stride;
+	BYTE *locked = nullptr;
+	HRESULT hr = m_pVertexBuffer->Lock( buffer->vbOffset, buffer->reservedStride * ( run->numVertices + 1 ), (void**)&locked, 0 );
+	if ( FAILED( hr ) ) {
+		D3DGlobal.lastError = hr;
+		return false;
+	}
+
+	float *dst = (float*)( locked + ( start - buffer->vbOffset ) );
+	const D3DListVertex *src = &m_program.vertices[run->firstVertex];
+	for ( int i = 0; i < run->numVertices; ++i, ++src ) {
+		if ( run->xyzw ) {
+			memcpy( dst, src->position, sizeof( FLOAT ) * 4 );
+			dst += 4;
+		} else {
+			memcpy( dst, src->position, sizeof( FLOAT ) * 3 );
+			dst += 3;
+		}
+		if ( run->normal ) {
+			memcpy( dst, ( src->inherit & D3DLIST_INHERIT_NORMAL ) ? D3DState.CurrentState.currentNormal : src->normal, sizeof( FLOAT ) * 3 );
+			dst += 3;
+		}
+		*( DWORD* )dst = ( src->inherit & D3DLIST_INHERIT_COLOR ) ? D3DState.CurrentState.currentColor : src->color;
+		++dst;
+		if ( signature & D3DLIST_SIG_SPECULAR ) {
+			*( DWORD* )dst = ( src->inherit & D3DLIST_INHERIT_COLOR2 ) ? D3DState.CurrentState.currentColor2 : src->color2;
+			++dst;
+		}
+		for ( int j = 0; j < D3DGlobal.maxActiveTMU; ++j ) {
+			if ( !( signature & ( 1 << j ) ) )
+				continue;
+			int numCoords = ( signature & D3DLIST_SIG_TRANSFORM ) ? 4 : ( ( run->texCoordBits >> ( j * 2 ) ) & 0x3 ) + 1;
+			memcpy( dst, ( src->inherit & ( D3DLIST_INHERIT_TEXCOORD0 << j ) ) ? D3DState.CurrentState.currentTexCoord[j] : src->texCoord[j], sizeof( FLOAT ) * numCoords );
+			dst += numCoords;
+		}
+	}
+
+	m_pVertexBuffer->Unlock();
+
+	buffer->baked = true;
+	buffer->signature = signature;
+	buffer->stride = stride;
+	buffer->fvf = fvf;
+	buffer->baseVertex = start / stride;
+	buffer->color = D3DState.CurrentState.currentColor;
+	buffer->color2 = D3DState.CurrentState.currentColor2;
+	memcpy( buffer->normalValue, D3DState.CurrentState.currentNormal, sizeof( buffer->normalValue ) );
+	memcpy( buffer->texCoordValue, D3DState.CurrentState.currentTexCoord, sizeof( buffer->texCoordValue ) );
+	++s_listStats.runRewrites;
+	return true;
+}
+
+static bool D3DList_InheritedChanged( const D3DListRun *run, const D3DListRunBuffer *buffer )
+{
+	if ( ( run->inherit & D3DLIST_INHERIT_COLOR ) && buffer->color != D3DState.CurrentState.currentColor )
+		return true;
+	if ( ( run->inherit & D3DLIST_INHERIT_COLOR2 ) && ( buffer->signature & D3DLIST_SIG_SPECULAR ) && 
+		buffer->color2 != D3DState.CurrentState.currentColor2 )
+		return true;
+	if ( ( run->inherit & D3DLIST_INHERIT_NORMAL ) && run->normal && 
+		memcmp( buffer->normalValue, D3DState.CurrentState.currentNormal, sizeof( buffer->normalValue ) ) )
+		return true;
+	for ( int i = 0; i < D3DGlobal.maxActiveTMU; ++i ) {
+		if ( ( run->inherit & ( D3DLIST_INHERIT_TEXCOORD0 << i ) ) && ( buffer->signature & ( 1 << i ) ) &&
+			memcmp( buffer->texCoordValue[i], D3DState.CurrentState.currentTexCoord[i], sizeof( FLOAT ) * 4 ) )
+			return true;
+	}
+	return false;
+}
+
+bool D3DDisplayList :: DrawRun( const D3DListRun *run, D3DListRunBuffer *buffer )
+{
+	if ( run->primClass != D3DLIST_PRIM_POINTS && !run->numIndices )
+		return true;
+
+	// selection and feedback take the vertices from D3DIMBuffer
+	if ( D3DFeedback_IsActive() )
+		return false;
+
+	const DWORD signature = D3DList_Signature();
+	if ( signature & D3DLIST_SIG_TEXGEN )
+		return false;
+
+	if ( !buffer->baked || buffer->signature != signature || ( run->inherit && D3DList_InheritedChanged( run, buffer ) ) ) {
+		if ( !EncodeRun( run, buffer, signature ) )
+			return false;
+	}
+
+	D3DState_Check();
+	D3DState_AssureBeginScene();
+
+	//skip drawcall if untextured ortho
+	if ( D3DGlobal.settings.game.orthoskipuntextureddraws && !D3DState.TextureState.currentSamplerCount )
+	{
+		if ( D3DGlobal_IsOrthoProjection() ) return true;
+	}
+
+	HRESULT hr = D3DGlobal.pDevice->SetFVF( buffer->fvf );
+	if ( FAILED( hr ) ) {
+		D3DGlobal.lastError = hr;
+		return true;
+	}
+	hr = D3DGlobal.pDevice->SetStreamSource( 0, m_pVertexBuffer, 0, buffer->stride );
+	if ( FAILED( hr ) ) {
+		D3DGlobal.lastError = hr;
+		return true;
+	}
+
+	switch ( run->primClass )
+	{
+	case D3DLIST_PRIM_POINTS:
+		hr = D3DGlobal.pDevice->DrawPrimitive( D3DPT_POINTLIST, buffer->baseVertex, run->numVertices );
+		break;
+	case D3DLIST_PRIM_LINES:
+		hr = D3DGlobal.pDevice->SetIndices( m_pIndexBuffer );
+		if ( SUCCEEDED( hr ) )
+			hr = D3DGlobal.pDevice->DrawIndexedPrimitive( D3DPT_LINELIST, buffer->baseVertex, 0, run->numVertices, run->firstIndex, run->numIndices / 2 );
+		break;
+	default:
+		hr = D3DGlobal.pDevice->SetIndices( m_pIndexBuffer );
+		if ( SUCCEEDED( hr ) )
+			hr = D3DGlobal.pDevice->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, buffer->baseVertex, 0, run->numVertices, run->firstIndex, run->numIndices / 3 );
+		break;
+	}
+	if ( FAILED( hr ) )
+		D3DGlobal.lastError = hr;
+
+	++s_listStats.bakedDraws;
+	return true;
+}
+
+// Feeds a run through the immediate mode buffer, which applies texgen
+void D3DDisplayList :: DrawRunImmediate( const D3DListRun *run )
+{
+	static const GLenum c_primModes[D3DLIST_PRIM_MAX] = { GL_TRIANGLES, GL_LINES, GL_POINTS };
+
+	assert( D3DGlobal.pIMBuffer != nullptr );
+
+	const DWORD savedColor = D3DState.CurrentState.currentColor;
+	const DWORD savedColor2 = D3DState.CurrentState.currentColor2;
+	const DWORD savedIsSet = D3DState.CurrentState.isSet.all;
+	FLOAT savedNormal[3];
+	FLOAT savedTexCoord[MAX_D3D_TMU][4];
+	memcpy( savedNormal, D3DState.CurrentState.currentNormal, sizeof( savedNormal ) );
+	memcpy( savedTexCoord, D3DState.CurrentState.currentTexCoord, sizeof( savedTexCoord ) );
+
+	D3DState_Check();
+	D3DState_AssureBeginScene();
+	D3DGlobal.pIMBuffer->Begin( c_primModes[run->primClass] );
+
+	const int count = ( run->primClass == D3DLIST_PRIM_POINTS ) ? run->numVertices : run->numIndices;
+	for ( int i = 0; i < count; ++i ) {
+		const int index = ( run->primClass == D3DLIST_PRIM_POINTS ) ? i : (int)m_program.indices[run->firstIndex + i];
+		const D3DListVertex *v = &m_program.vertices[run->firstVertex + index];
+
+		D3DState.CurrentState.currentColor = ( v->inherit & D3DLIST_INHERIT_COLOR ) ? savedColor : v->color;
+		D3DState.CurrentState.currentColor2 = ( v->inherit & D3DLIST_INHERIT_COLOR2 ) ? savedColor2 : v->color2;
+		memcpy( D3DState.CurrentState.currentNormal, ( v->inherit & D3DLIST_INHERIT_NORMAL ) ? savedNormal : v->normal, sizeof( savedNormal ) );
+		for ( int j = 0; j < D3DGlobal.maxActiveTMU; ++j )
+			memcpy( D3DState.CurrentState.currentTexCoord[j], ( v->inherit & ( D3DLIST_INHERIT_TEXCOORD0 << j ) ) ? savedTexCoord[j] : v->texCoord[j], sizeof( FLOAT ) * 4 );
+
+		if ( run->xyzw )
+			D3DGlobal.pIMBuffer->AddVertex( v->position[0], v->position[1], v->position[2], v->position[3] );
+		else
+			D3DGlobal.pIMBuffer->AddVertex( v->position[0], v->position[1], v->position[2] );
+	}
+
+	D3DState.CurrentState.isSet.all = 0;
+	D3DState.CurrentState.isSet.bits.norm = run->normal ? 1 : 0;
+	D3DState.CurrentState.isSet.bits.texcoord = run->texCoordBits;
+	D3DGlobal.pIMBuffer->End();
+
+	D3DState.CurrentState.currentColor = savedColor;
+	D3DState.CurrentState.currentColor2 = savedColor2;
+	D3DState.CurrentState.isSet.all = savedIsSet;
+	memcpy( D3DState.CurrentState.currentNormal, savedNormal, sizeof( savedNormal ) );
+	memcpy( D3DState.CurrentState.currentTexCoord, savedTexCoord, sizeof( savedTexCoord ) );
+
+	++s_listStats.immediateDraws;
+}
+
+void D3DDisplayList :: Execute()
+{
+	const unsigned int *cmd = m_program.commands.data();
+	const unsigned int *end = cmd + m_program.commands.size();
+
+	while ( cmd < end ) {
+		const D3DListOp op = D3DList_CommandOp( cmd[0] );
+		const int numArgs = D3DList_CommandNumArgs( cmd[0] );
+		const unsigned int *args = cmd + 1;
+		cmd = args + numArgs;
+
+		switch ( op )
+		{
+		case D3DLIST_OP_DRAW:
+			{
+				const D3DListRun *run = &m_program.runs[args[0]];
+				if ( !DrawRun( run, &m_buffers[args[0]] ) )
+					DrawRunImmediate( run );
+			}
+			break;
+		case D3DLIST_OP_CURRENT:
+			SetCurrent( args );
+			break;
+		case D3DLIST_OP_CALL_LIST:
+			D3DList_Call( args[0] );
+			break;
+		case D3DLIST_OP_CALL_LISTS:
+			for ( int i = 0; i < numArgs; ++i )
+				D3DList_Call( D3DListContext.listBase + args[i] );
+			break;
+		case D3DLIST_OP_LIST_BASE:
+			glListBase( args[0] );
+			break;
+		case D3DLIST_OP_ENABLE:
+			glEnable( args[0] );
+			break;
+		case D3DLIST_OP_DISABLE:
+			glDisable( args[0] );
+			break;
+		case D3DLIST_OP_PUSH_ATTRIB:
+			glPushAttrib( args[0] );
+			break;
+		case D3DLIST_OP_POP_ATTRIB:
+			glPopAttrib();
+			break;
+		case D3DLIST_OP_BIND_TEXTURE:
+			glBindTexture( args[0], args[1] );
+			break;
+		case D3DLIST_OP_ACTIVE_TEXTURE:
+			glActiveTexture( args[0] );
+			break;
+		case D3DLIST_OP_TEX_ENVFV:
+			glTexEnvfv( args[0], args[1], (const GLfloat*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_TEX_ENVIV:
+			glTexEnviv( args[0], args[1], (const GLint*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_ALPHA_FUNC:
+			glAlphaFunc( args[0], D3DList_ArgFloat( args[1] ) );
+			break;
+		case D3DLIST_OP_BLEND_FUNC:
+			glBlendFunc( args[0], args[1] );
+			break;
+		case D3DLIST_OP_COLOR_MASK:
+			glColorMask( (GLboolean)args[0], (GLboolean)args[1], (GLboolean)args[2], (GLboolean)args[3] );
+			break;
+		case D3DLIST_OP_CULL_FACE:
+			glCullFace( args[0] );
+			break;
+		case D3DLIST_OP_FRONT_FACE:
+			glFrontFace( args[0] );
+			break;
+		case D3DLIST_OP_DEPTH_FUNC:
+			glDepthFunc( args[0] );
+			break;
+		case D3DLIST_OP_DEPTH_MASK:
+			glDepthMask( (GLboolean)args[0] );
+			break;
+		case D3DLIST_OP_POLYGON_OFFSET:
+			glPolygonOffset( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ) );
+			break;
+		case D3DLIST_OP_LINE_WIDTH:
+			glLineWidth( D3DList_ArgFloat( args[0] ) );
+			break;
+		case D3DLIST_OP_POINT_SIZE:
+			glPointSize( D3DList_ArgFloat( args[0] ) );
+			break;
+		case D3DLIST_OP_SHADE_MODEL:
+			glShadeModel( args[0] );
+			break;
+		case D3DLIST_OP_MATERIALFV:
+			glMaterialfv( args[0], args[1], (const GLfloat*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_MATRIX_MODE:
+			glMatrixMode( args[0] );
+			break;
+		case D3DLIST_OP_LOAD_IDENTITY:
+			glLoadIdentity();
+			break;
+		case D3DLIST_OP_LOAD_MATRIX:
+			glLoadMatrixf( (const GLfloat*)args );
+			break;
+		case D3DLIST_OP_MULT_MATRIX:
+			glMultMatrixf( (const GLfloat*)args );
+			break;
+		case D3DLIST_OP_PUSH_MATRIX:
+			glPushMatrix();
+			break;
+		case D3DLIST_OP_POP_MATRIX:
+			glPopMatrix();
+			break;
+		case D3DLIST_OP_ROTATE:
+			glRotatef( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ), D3DList_ArgFloat( args[3] ) );
+			break;
+		case D3DLIST_OP_SCALE:
+			glScalef( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ) );
+			break;
+		case D3DLIST_OP_TRANSLATE:
+			glTranslatef( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ) );
+			break;
+		case D3DLIST_OP_INIT_NAMES:
+			glInitNames();
+			break;
+		case D3DLIST_OP_LOAD_NAME:
+			glLoadName( args[0] );
+			break;
+		case D3DLIST_OP_PUSH_NAME:
+			glPushName( args[0] );
+			break;
+		case D3DLIST_OP_POP_NAME:
+			glPopName();
+			break;
+		case D3DLIST_OP_PASS_THROUGH:
+			glPassThrough( D3DList_ArgFloat( args[0] ) );
+			break;
+		case D3DLIST_OP_LIGHTFV:
+			glLightfv( args[0], args[1], (const GLfloat*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_LIGHT_MODELF:
+			glLightModelf( args[0], D3DList_ArgFloat( args[1] ) );
+			break;
+		case D3DLIST_OP_LIGHT_MODELFV:
+			glLightModelfv( args[0], (const GLfloat*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_COLOR_MATERIAL:
+			glColorMaterial( args[0], args[1] );
+			break;
+		case D3DLIST_OP_FOGFV:
+			glFogfv( args[0], (const GLfloat*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_TEX_GENFV:
+			glTexGenfv( args[0], args[1], (const GLfloat*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_TEX_GENIV:
+			glTexGeniv( args[0], args[1], (const GLint*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_TEX_PARAMETERFV:
+			glTexParameterfv( args[0], args[1], (const GLfloat*)( args + 2 ) );
+			break;
+		case D3DLIST_OP_POLYGON_MODE:
+			glPolygonMode( args[0], args[1] );
+			break;
+		case D3DLIST_OP_CLEAR_COLOR:
+			glClearColor( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ), D3DList_ArgFloat( args[3] ) );
+			break;
+		case D3DLIST_OP_CLEAR_DEPTH:
+			glClearDepth( D3DList_ArgFloat( args[0] ) );
+			break;
+		case D3DLIST_OP_CLEAR_STENCIL:
+			glClearStencil( (GLint)args[0] );
+			break;
+		case D3DLIST_OP_CLEAR:
+			glClear( args[0] );
+			break;
+		case D3DLIST_OP_MAP1:
+			glMap1f( args[0], D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ), args[3], args[4], (const GLfloat*)( args + 5 ) );
+			break;
+		case D3DLIST_OP_MAP2:
+			glMap2f( args[0], D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ), args[3], args[4],
+				D3DList_ArgFloat( args[5] ), D3DList_ArgFloat( args[6] ), args[7], args[8], (const GLfloat*)( args + 9 ) );
+			break;
+		case D3DLIST_OP_MAP_GRID1:
+			glMapGrid1f( args[0], D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ) );
+			break;
+		case D3DLIST_OP_MAP_GRID2:
+			glMapGrid2f( args[0], D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ),
+				args[3], D3DList_ArgFloat( args[4] ), D3DList_ArgFloat( args[5] ) );
+			break;
+		case D3DLIST_OP_EVAL_MESH1:
+			glEvalMesh1( args[0], args[1], args[2] );
+			break;
+		case D3DLIST_OP_EVAL_MESH2:
+			glEvalMesh2( args[0], args[1], args[2], args[3], args[4] );
+			break;
+		case D3DLIST_OP_FRUSTUM:
+			glFrustum( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ),
+				D3DList_ArgFloat( args[3] ), D3DList_ArgFloat( args[4] ), D3DList_ArgFloat( args[5] ) );
+			break;
+		case D3DLIST_OP_ORTHO:
+			glOrtho( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ), D3DList_ArgFloat( args[2] ),
+				D3DList_ArgFloat( args[3] ), D3DList_ArgFloat( args[4] ), D3DList_ArgFloat( args[5] ) );
+			break;
+		case D3DLIST_OP_VIEWPORT:
+			glViewport( (GLint)args[0], (GLint)args[1], (GLsizei)args[2], (GLsizei)args[3] );
+			break;
+		case D3DLIST_OP_SCISSOR:
+			glScissor( (GLint)args[0], (GLint)args[1], (GLsizei)args[2], (GLsizei)args[3] );
+			break;
+		case D3DLIST_OP_DEPTH_RANGE:
+			glDepthRange( D3DList_ArgFloat( args[0] ), D3DList_ArgFloat( args[1] ) );
+			break;
+		case D3DLIST_OP_STENCIL_MASK:
+			glStencilMask( args[0] );
+			break;
+		case D3DLIST_OP_STENCIL_FUNC:
+			glStencilFunc( args[0], (GLint)args[1], args[2] );
+			break;
+		case D3DLIST_OP_STENCIL_OP:
+			glStencilOp( args[0], args[1], args[2] );
+			break;
+		case D3DLIST_OP_ACTIVE_STENCIL_FACE:
+			glActiveStencilFace( args[0] );
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+//==================================================================================
+// Compilation
+//==================================================================================
+
+bool D3DList_Compile( D3DListOp op, const DWORD *args, int numArgs )
+{
+	assert( D3DListContext.compiling != nullptr );
+	D3DListContext.compiling->AddCommand( op, args, numArgs );
+	return D3DListContext.compileMode == GL_COMPILE;
+}
+
+void D3DList_Begin( GLenum mode )
+{
+	assert( D3DListContext.compiling != nullptr );
+	D3DListContext.compiling->BeginPrimitive( mode );
+}
+
+void D3DList_Vertex( float x, float y, float z, float w, bool xyzw )
+{
+	assert( D3DListContext.compiling != nullptr );
+	D3DListContext.compiling->AddVertex( x, y, z, w, xyzw );
+}
+
+void D3DList_End()
+{
+	assert( D3DListContext.compiling != nullptr );
+	D3DListContext.compiling->EndPrimitive();
+}
+
+static void D3DList_Call( GLuint name )
+{
+	if ( D3DListContext.callDepth >= D3D_MAX_LIST_NESTING )
+		return;
+
+	D3DDisplayListMap::iterator it = s_displayLists.find( name );
+	if ( it == s_displayLists.end() || !it->second )
+		return;
+
+	++D3DListContext.callDepth;
+	it->second->Execute();
+	--D3DListContext.callDepth;
+}
+
+static bool D3DList_DecodeNames( GLsizei n, GLenum type, const GLvoid *lists, std::vector<DWORD> &names )
+{
+	const GLubyte *bytes = (const GLubyte*)lists;
+	names.resize( n );
+
+	switch ( type )
+	{
+	case GL_BYTE:
+		for ( GLsizei i = 0; i < n; ++i ) names[i] = (DWORD)( (const GLbyte*)lists )[i];
+		break;
+	case GL_UNSIGNED_BYTE:
+		for ( GLsizei i = 0; i < n; ++i ) names[i] = bytes[i];
+		break;
+	case GL_SHORT:
+		for ( GLsizei i = 0; i < n; ++i ) names[i] = (DWORD)( (const GLshort*)lists )[i];
+		break;
+	case GL_UNSIGNED_SHORT:
+		for ( GLsizei i = 0; i < n; ++i ) names[i] = ( (const GLushort*)lists )[i];
+		break;
+	case GL_INT:
+		for ( GLsizei i = 0; i < n; ++i ) names[i] = (DWORD)( (const GLint*)lists )[i];
+		break;
+	case GL_UNSIGNED_INT:
+		for ( GLsizei i = 0; i < n; ++i ) names[i] = ( (const GLuint*)lists )[i];
+		break;
+	case GL_FLOAT:
+		for ( GLsizei i = 0; i < n; ++i ) names[i] = (DWORD)( (const GLfloat*)lists )[i];
+		break;
+	case GL_2_BYTES:
+		for ( GLsizei i = 0; i < n; ++i, bytes += 2 ) names[i] = ( bytes[0] << 8 ) | bytes[1];
+		break;
+	case GL_3_BYTES:
+		for ( GLsizei i = 0; i < n; ++i, bytes += 3 ) names[i] = ( bytes[0] << 16 ) | ( bytes[1] << 8 ) | bytes[2];
+		break;
+	case GL_4_BYTES:
+		for ( GLsizei i = 0; i < n; ++i, bytes += 4 ) names[i] = ( bytes[0] << 24 ) | ( bytes[1] << 16 ) | ( bytes[2] << 8 ) | bytes[3];
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+void D3DList_Cleanup()
+{
+	if ( D3DListContext.compiling ) {
+		delete D3DListContext.compiling;
+		D3DListContext.compiling = nullptr;
+	}
+	for ( D3DDisplayListMap::iterator it = s_displayLists.begin(); it != s_displayLists.end(); ++it )
+		delete it->second;
+	s_displayLists.clear();
+
+	if ( s_listStats.listsCompiled )
+		logPrintf( "Display lists: %u compiled (%u vertices), %u draws from static buffers, %u through immediate mode, %u runs written\n",
+			s_listStats.listsCompiled, s_listStats.verticesCompiled, s_listStats.bakedDraws, s_listStats.immediateDraws, s_listStats.runRewrites );
+	if ( s_listStats.listsOptimized )
+		logPrintf( "Display list optimizer: %u lists, %u -> %u commands, %u -> %u vertices, %u -> %u draws\n",
+			s_listStats.listsOptimized, s_listStats.commandsBefore, s_listStats.commandsAfter,
+			s_listStats.verticesBefore, s_listStats.verticesAfter, s_listStats.drawsBefore, s_listStats.drawsAfter );
+	memset( &s_listStats, 0, sizeof( s_listStats ) );
+}
+
+//==================================================================================
+// Entry points
+//==================================================================================
+
+OPENGL_API void WINAPI glListBase( GLuint base )
+{
+	D3DLIST_COMPILE( D3DLIST_OP_LIST_BASE, base );
+	D3DListContext.listBase = base;
+}
+
+OPENGL_API void WINAPI glNewList( GLuint list, GLenum mode )
+{
+	if ( D3DListContext.compiling ) {
+		D3DGlobal.lastError = E_INVALID_OPERATION;
+		return;
+	}
+	if ( !list ) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+	if ( mode != GL_COMPILE && mode != GL_COMPILE_AND_EXECUTE ) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+
+	s_savedColor = D3DState.CurrentState.currentColor;
+	s_savedColor2 = D3DState.CurrentState.currentColor2;
+	s_savedIsSet = D3DState.CurrentState.isSet.all;
+	memcpy( s_savedNormal, D3DState.CurrentState.currentNormal, sizeof( s_savedNormal ) );
+	memcpy( s_savedTexCoord, D3DState.CurrentState.currentTexCoord, sizeof( s_savedTexCoord ) );
+	// from here on the set bits tell what the list itself specifies
+	D3DState.CurrentState.isSet.all = 0;
+
+	D3DListContext.compiling = new D3DDisplayList;
+	D3DListContext.compilingName = list;
+	D3DListContext.compileMode = mode;
+}
+
+OPENGL_API void WINAPI glEndList()
+{
+	D3DDisplayList *list = D3DListContext.compiling;
+	if ( !list || D3DListContext.callDepth ) {
+		D3DGlobal.lastError = E_INVALID_OPERATION;
+		return;
+	}
+
+	list->Finish();
+
+	D3DDisplayList *&slot = s_displayLists[D3DListContext.compilingName];
+	delete slot;
+	slot = list;
+
+	if ( D3DListContext.compileMode == GL_COMPILE ) {
+		D3DState.CurrentState.currentColor = s_savedColor;
+		D3DState.CurrentState.currentColor2 = s_savedColor2;
+		memcpy( D3DState.CurrentState.currentNormal, s_savedNormal, sizeof( s_savedNormal ) );
+		memcpy( D3DState.CurrentState.currentTexCoord, s_savedTexCoord, sizeof( s_savedTexCoord ) );
+		D3DEval_EndList();
+	}
+	D3DState.CurrentState.isSet.all = s_savedIsSet;
+
+	D3DListContext.compiling = nullptr;
+	D3DListContext.compilingName = 0;
+	D3DListContext.compileMode = 0;
+}
+
+OPENGL_API void WINAPI glCallList( GLuint list )
+{
+	D3DLIST_COMPILE( D3DLIST_OP_CALL_LIST, list );
+	D3DList_Call( list );
+}
+
+OPENGL_API void WINAPI glCallLists( GLsizei n, GLenum type, const GLvoid *lists )
+{
+	static std::vector<DWORD> names;
+
+	if ( n < 0 ) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+	if ( !n || !lists )
+		return;
+	if ( !D3DList_DecodeNames( n, type, lists, names ) ) {
+		D3DGlobal.lastError = E_INVALID_ENUM;
+		return;
+	}
+
+	// names are stored as given, the list base is added on execution
+	if ( D3DList_IsCompiling() && n <= 0xFFFFFF && D3DList_Compile( D3DLIST_OP_CALL_LISTS, names.data(), n ) )
+		return;
+
+	for ( GLsizei i = 0; i < n; ++i )
+		D3DList_Call( D3DListContext.listBase + names[i] );
+}
+
+OPENGL_API void WINAPI glDeleteLists( GLuint list, GLsizei range )
+{
+	if ( range < 0 ) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return;
+	}
+
+	D3DDisplayListMap::iterator it = s_displayLists.lower_bound( list );
+	while ( it != s_displayLists.end() && it->first - list < (GLuint)range ) {
+		delete it->second;
+		it = s_displayLists.erase( it );
+	}
+}
+
+OPENGL_API GLuint WINAPI glGenLists( GLsizei range )
+{
+	if ( range < 0 ) {
+		D3DGlobal.lastError = E_INVALIDARG;
+		return 0;
+	}
+	if ( !range )
+		return 0;
+
+	// names are handed out past the highest one in use
+	GLuint first = s_displayLists.empty() ? 1 : s_displayLists.rbegin()->first + 1;
+	if ( !first || first + (GLuint)range - 1 < first ) {
+		D3DGlobal.lastError = E_OUTOFMEMORY;
+		return 0;
+	}
+
+	for ( GLsizei i = 0; i < range; ++i )
+		s_displayLists[first + i] = nullptr;
+	return first;
+}
+
+OPENGL_API GLboolean WINAPI glIsList( GLuint list )
+{
+	return ( s_displayLists.find( list ) != s_displayLists.end() ) ? GL_TRUE : GL_FALSE;
 }
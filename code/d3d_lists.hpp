@@ -0,0 +1,120 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_LISTS_H
+#define QINDIEGL_D3D_LISTS_H
+
+#include "d3d_list_optimizer.hpp"
+
+//==================================================================================
+// Display lists
+//----------------------------------------------------------------------------------
+// While a list is compiled, the entry points that can be compiled pass their
+// arguments to D3DList_Compile (see D3DLIST_COMPILE). With GL_COMPILE the call
+// is only recorded, with GL_COMPILE_AND_EXECUTE it is recorded and executed.
+// Vertices are caught in D3DIMBuffer, so glVertex, glArrayElement, glRect and
+// array draws all end up in the list geometry, which is optimized at glEndList
+// (see d3d_list_optimizer.hpp) and baked into static vertex and index buffers.
+//==================================================================================
+
+class D3DDisplayList;
+
+#define D3D_MAX_LIST_NESTING		64
+
+typedef struct D3DListContext_s
+{
+	D3DDisplayList	*compiling;		// list between glNewList and glEndList
+	GLuint			compilingName;
+	GLenum			compileMode;
+	GLuint			listBase;
+	int				callDepth;		// lists being executed
+} D3DListContext_t;
+
+extern D3DListContext_t D3DListContext;
+
+// Nothing is recorded while lists execute, even in the middle of glNewList
+inline bool D3DList_IsCompiling()
+{
+	return D3DListContext.compiling != nullptr && !D3DListContext.callDepth;
+}
+inline bool D3DList_ExecutesWhileCompiling()
+{
+	return D3DListContext.compileMode == GL_COMPILE_AND_EXECUTE;
+}
+// A recorded call that draws runs like a list being executed under
+// GL_COMPILE_AND_EXECUTE, so that its vertices are not recorded as well
+inline void D3DList_SuspendCompile()
+{
+	++D3DListContext.callDepth;
+}
+inline void D3DList_ResumeCompile()
+{
+	--D3DListContext.callDepth;
+}
+
+// Records a call into the list being compiled.
+// Returns true if the call must not be executed now (GL_COMPILE).
+extern bool D3DList_Compile( D3DListOp op, const DWORD *args, int numArgs );
+
+inline DWORD D3DList_Arg( GLuint v ) { return v; }
+inline DWORD D3DList_Arg( GLint v ) { return (DWORD)v; }
+inline DWORD D3DList_Arg( GLboolean v ) { return v; }
+inline DWORD D3DList_Arg( GLfloat v ) { return UTIL_FloatToDword( v ); }
+inline DWORD D3DList_Arg( GLdouble v ) { return UTIL_FloatToDword( (GLfloat)v ); }
+
+inline bool D3DList_Record( D3DListOp op )
+{
+	return D3DList_Compile( op, nullptr, 0 );
+}
+template<typename... T> inline bool D3DList_Record( D3DListOp op, T... args )
+{
+	const DWORD packed[] = { D3DList_Arg( args )... };
+	return D3DList_Compile( op, packed, (int)sizeof...(T) );
+}
+
+template<typename T> inline bool D3DList_RecordMatrix( D3DListOp op, const T *m )
+{
+	DWORD packed[16];
+	for ( int i = 0; i < 16; ++i )
+		packed[i] = D3DList_Arg( m[i] );
+	return D3DList_Compile( op, packed, 16 );
+}
+// two enums and up to four values, padded to four
+template<typename T> inline bool D3DList_RecordVector( D3DListOp op, GLenum e0, GLenum e1, const T *v, int n )
+{
+	DWORD packed[6] = { e0, e1, 0, 0, 0, 0 };
+	for ( int i = 0; i < n; ++i )
+		packed[2 + i] = D3DList_Arg( v[i] );
+	return D3DList_Compile( op, packed, 6 );
+}
+
+// Entry point prologue: records the call if a list is being compiled and
+// leaves the entry point if the list is not executed at the same time
+#define D3DLIST_COMPILE( ... ) \
+	if (D3DList_IsCompiling() && D3DList_Record( __VA_ARGS__ )) return
+
+// Geometry, fed by D3DIMBuffer while a list is compiled
+extern void D3DList_Begin( GLenum mode );
+extern void D3DList_Vertex( float x, float y, float z, float w, bool xyzw );
+extern void D3DList_End();
+
+extern void D3DList_Cleanup();
+
+#endif //QINDIEGL_D3D_LISTS_H
@@ -22,6 +22,7 @@
 #include "d3d_global.hpp"
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
+#include "d3d_lists.hpp"
 
 //==================================================================================
 // Materials
@@ -31,6 +32,8 @@
 
 OPENGL_API void WINAPI glColorMaterial( GLenum face, GLenum mode )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_COLOR_MATERIAL, face, mode );
+
 	static bool warningPrinted = false;
 
 	if( face != GL_FRONT_AND_BACK ) {
@@ -48,6 +51,9 @@ OPENGL_API void WINAPI glColorMaterial( GLenum face, GLenum mode )
 
 OPENGL_API void WINAPI glMaterialf( GLenum face, GLenum pname, GLfloat param )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_MATERIALFV, face, pname, &param, 1 ) )
+		return;
+
 	static bool warningPrinted = false;
 
 	if( face != GL_FRONT_AND_BACK ) {
@@ -75,6 +81,10 @@ OPENGL_API void WINAPI glMateriali( GLenum face, GLenum pname, GLint param )
 
 OPENGL_API void WINAPI glMaterialfv( GLenum face, GLenum pname, const GLfloat *params )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_MATERIALFV, face, pname, params,
+		( pname == GL_SHININESS ) ? 1 : ( ( pname == GL_COLOR_INDEXES ) ? 3 : 4 ) ) )
+		return;
+
 	static bool warningPrinted = false;
 
 	if( face != GL_FRONT_AND_BACK ) {
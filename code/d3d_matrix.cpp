@@ -22,8 +22,10 @@
 #include "d3d_global.hpp"
 #include "d3d_state.hpp"
 #include "d3d_matrix_stack.hpp"
+#include "d3d_matrix_math.hpp"
 #include "d3d_matrix_detection.hpp"
 #include "d3d_utils.hpp"
+#include "d3d_lists.hpp"
 //==================================================================================
 // Some words about projection matrices
 //----------------------------------------------------------------------------------
@@ -60,7 +62,8 @@
 //==================================================================================
 // Matrix operation functions
 //----------------------------------------------------------------------------------
-// We use some D3DX functionality to implement it
+// The math lives in d3d_matrix_math.cpp; translate and scale are folded into
+// the stack top directly instead of going through a full multiply
 //==================================================================================
 
 static inline void CheckTexCoordOffset_Hack( bool ortho )
@@ -83,6 +86,7 @@ static inline void CheckTexCoordOffset_Hack( bool ortho )
 
 OPENGL_API void WINAPI glMatrixMode( GLenum mode )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_MATRIX_MODE, mode );
 	if( D3DState.TransformState.matrixMode != mode )
 	{
 		D3DState.TransformState.matrixMode = mode;
@@ -93,6 +97,7 @@ OPENGL_API void WINAPI glMatrixMode( GLenum mode )
 
 OPENGL_API void WINAPI glLoadIdentity()
 {
+	D3DLIST_COMPILE( D3DLIST_OP_LOAD_IDENTITY );
 	if( !D3DState.currentMatrixStack ) return;
 	D3DState.currentMatrixStack->load_identity( );
 	*D3DState.currentMatrixModified = true;
@@ -158,10 +163,12 @@ static void ProjectionMatrix_GLtoD3D( FLOAT *m )
 
 OPENGL_API void WINAPI glLoadMatrixf( const GLfloat *m )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordMatrix( D3DLIST_OP_LOAD_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
 	bool b2Dproj = false;
 	if( D3DGlobal.settings.projectionFix ) {
-		D3DXMATRIX m2( m );
+		FLOAT m2[16];
+		memcpy( m2, m, sizeof(m2) );
 		if( D3DState.TransformState.matrixMode == GL_PROJECTION ) {
 			b2Dproj =( m2[2*4+3] >= 0 );
 			ProjectionMatrix_GLtoD3D( m2 );
@@ -183,6 +190,7 @@ OPENGL_API void WINAPI glLoadMatrixf( const GLfloat *m )
 }
 OPENGL_API void WINAPI glLoadMatrixd( const GLdouble *m )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordMatrix( D3DLIST_OP_LOAD_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
 	bool b2Dproj = false;
 	FLOAT mf[16];
@@ -208,6 +216,7 @@ OPENGL_API void WINAPI glLoadMatrixd( const GLdouble *m )
 }
 OPENGL_API void WINAPI glMultMatrixf( const GLfloat *m )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordMatrix( D3DLIST_OP_MULT_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
 	D3DState.currentMatrixStack->multiply( m );
 	*D3DState.currentMatrixModified = true;
@@ -220,6 +229,7 @@ OPENGL_API void WINAPI glMultMatrixf( const GLfloat *m )
 }
 OPENGL_API void WINAPI glMultMatrixd( const GLdouble *m )
 {
+	if( D3DList_IsCompiling() && D3DList_RecordMatrix( D3DLIST_OP_MULT_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
 	FLOAT mf[16];
 	for( int i = 0; i < 16; ++i ) 
@@ -233,12 +243,22 @@ OPENGL_API void WINAPI glMultMatrixd( const GLdouble *m )
 		D3DGlobal.modelMatrixStack->multiply( mf );
 	}
 }
+// Records the transpose of m, which glLoadMatrix and glMultMatrix then take as is
+template<typename T> static bool D3DMatrix_RecordTranspose( D3DListOp op, const T *m )
+{
+	T mt[16];
+	for( int i = 0; i < 4; ++i )
+		for( int j = 0; j < 4; ++j )
+			mt[i*4+j] = m[j*4+i];
+	return D3DList_RecordMatrix( op, mt );
+}
 OPENGL_API void WINAPI glLoadTransposeMatrixf( const GLfloat *m )
 {
+	if( D3DList_IsCompiling() && D3DMatrix_RecordTranspose( D3DLIST_OP_LOAD_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
 	bool b2Dproj = false;
-	D3DXMATRIX mt;
-	D3DXMatrixTranspose( &mt,(D3DXMATRIX*)m );
+	FLOAT mt[16];
+	D3DMatrix_Transpose( mt, m );
 	if( D3DGlobal.settings.projectionFix ) {
 		if( D3DState.TransformState.matrixMode == GL_PROJECTION ) {
 			b2Dproj =( mt[2*4+3] >= 0 );
@@ -252,19 +272,20 @@ OPENGL_API void WINAPI glLoadTransposeMatrixf( const GLfloat *m )
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
 		D3DXMATRIX model, view;
-		matrix_detect_process_upload(&mt.m[0][0], &model, &view);
+		matrix_detect_process_upload(mt, &model, &view);
 		D3DGlobal.modelMatrixStack->load(model);
 		D3DGlobal.viewMatrixStack->load(view);
 	}
 }
 OPENGL_API void WINAPI glLoadTransposeMatrixd( const GLdouble *m )
 {
+	if( D3DList_IsCompiling() && D3DMatrix_RecordTranspose( D3DLIST_OP_LOAD_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
 	bool b2Dproj = false;
-	D3DXMATRIX mt;
-	for( int i = 0; i < 4; ++i ) 
-		for( int j = 0; j < 4; ++i ) 
-			mt.m[i][j] =(FLOAT)m[i*4+j];
+	FLOAT mt[16];
+	for( int i = 0; i < 16; ++i ) 
+		mt[i] =(FLOAT)m[i];
+	D3DMatrix_Transpose( mt, mt );
 	if( D3DGlobal.settings.projectionFix ) {
 		if( D3DState.TransformState.matrixMode == GL_PROJECTION ) {
 			b2Dproj =( mt[2*4+3] >= 0 );
@@ -278,16 +299,17 @@ OPENGL_API void WINAPI glLoadTransposeMatrixd( const GLdouble *m )
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
 		D3DXMATRIX model, view;
-		matrix_detect_process_upload(&mt.m[0][0], &model, &view);
+		matrix_detect_process_upload(mt, &model, &view);
 		D3DGlobal.modelMatrixStack->load(model);
 		D3DGlobal.viewMatrixStack->load(view);
 	}
 }
 OPENGL_API void WINAPI glMultTransposeMatrixf( const GLfloat *m )
 {
+	if( D3DList_IsCompiling() && D3DMatrix_RecordTranspose( D3DLIST_OP_MULT_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX mt;
-	D3DXMatrixTranspose( &mt,(D3DXMATRIX*)m );
+	FLOAT mt[16];
+	D3DMatrix_Transpose( mt, m );
 	D3DState.currentMatrixStack->multiply( mt );
 	*D3DState.currentMatrixModified = true;
 	CheckTexCoordOffset_Hack( false );
@@ -299,11 +321,12 @@ OPENGL_API void WINAPI glMultTransposeMatrixf( const GLfloat *m )
 }
 OPENGL_API void WINAPI glMultTransposeMatrixd( const GLdouble *m )
 {
+	if( D3DList_IsCompiling() && D3DMatrix_RecordTranspose( D3DLIST_OP_MULT_MATRIX, m ) ) return;
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX mt;
-	for( int i = 0; i < 4; ++i ) 
-		for( int j = 0; j < 4; ++i ) 
-			mt.m[i][j] =(FLOAT)m[i*4+j];
+	FLOAT mt[16];
+	for( int i = 0; i < 16; ++i ) 
+		mt[i] =(FLOAT)m[i];
+	D3DMatrix_Transpose( mt, mt );
 	D3DState.currentMatrixStack->multiply( mt );
 	*D3DState.currentMatrixModified = true;
 	CheckTexCoordOffset_Hack( false );
@@ -315,18 +338,20 @@ OPENGL_API void WINAPI glMultTransposeMatrixd( const GLdouble *m )
 }
 OPENGL_API void WINAPI glFrustum( GLdouble left, GLdouble right, GLdouble bottom, GLdouble top, GLdouble zNear, GLdouble zFar )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_FRUSTUM, left, right, bottom, top, zNear, zFar );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXMatrixPerspectiveOffCenterRH( &m,(FLOAT)left,(FLOAT)right,(FLOAT)bottom,(FLOAT)top,(FLOAT)zNear,(FLOAT)zFar );
+	FLOAT m[16];
+	D3DMatrix_FrustumRH( m,(FLOAT)left,(FLOAT)right,(FLOAT)bottom,(FLOAT)top,(FLOAT)zNear,(FLOAT)zFar );
 	D3DState.currentMatrixStack->multiply( m );
 	*D3DState.currentMatrixModified = true;
 	CheckTexCoordOffset_Hack( false );
 }
 OPENGL_API void WINAPI glOrtho( GLdouble left, GLdouble right, GLdouble bottom, GLdouble top, GLdouble zNear, GLdouble zFar )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_ORTHO, left, right, bottom, top, zNear, zFar );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXMatrixOrthoOffCenterRH( &m,(FLOAT)left + D3DState.viewport_offX,
+	FLOAT m[16];
+	D3DMatrix_OrthoRH( m,(FLOAT)left + D3DState.viewport_offX,
 		(FLOAT)right + D3DState.viewport_offX,
 		(FLOAT)bottom - D3DState.viewport_offY,
 		(FLOAT)top - D3DState.viewport_offY,
@@ -337,6 +362,7 @@ OPENGL_API void WINAPI glOrtho( GLdouble left, GLdouble right, GLdouble bottom,
 }
 OPENGL_API void WINAPI glPopMatrix( void )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_POP_MATRIX );
 	if( !D3DState.currentMatrixStack ) return;
 	HRESULT hr = D3DState.currentMatrixStack->pop( );
 	if( FAILED( hr ) ) D3DGlobal.lastError = hr;
@@ -350,6 +376,7 @@ OPENGL_API void WINAPI glPopMatrix( void )
 }
 OPENGL_API void WINAPI glPushMatrix( void )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_PUSH_MATRIX );
 	if( !D3DState.currentMatrixStack ) return;
 	HRESULT hr = D3DState.currentMatrixStack->push( );
 	if( FAILED( hr ) ) D3DGlobal.lastError = hr;
@@ -362,81 +389,73 @@ OPENGL_API void WINAPI glPushMatrix( void )
 }
 OPENGL_API void WINAPI glRotatef( GLfloat angle, GLfloat x, GLfloat y, GLfloat z )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_ROTATE, angle, x, y, z );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXVECTOR3 v( x,y,z );
-	D3DXMatrixRotationAxis( &m, &v, D3DXToRadian( angle ) );
-	D3DState.currentMatrixStack->multiply( m );
+	D3DState.currentMatrixStack->rotate( angle, x, y, z );
 	*D3DState.currentMatrixModified = true;
 
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
-		D3DGlobal.modelMatrixStack->multiply( m );
+		D3DGlobal.modelMatrixStack->rotate( angle, x, y, z );
 	}
 }
 OPENGL_API void WINAPI glRotated( GLdouble angle, GLdouble x, GLdouble y, GLdouble z )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_ROTATE, angle, x, y, z );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXVECTOR3 v( (FLOAT)x,(FLOAT)y,(FLOAT)z );
-	D3DXMatrixRotationAxis( &m, &v, D3DXToRadian( (FLOAT)angle ) );
-	D3DState.currentMatrixStack->multiply( m );
+	D3DState.currentMatrixStack->rotate( (GLfloat)angle, (GLfloat)x, (GLfloat)y, (GLfloat)z );
 	*D3DState.currentMatrixModified = true;
 
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
-		D3DGlobal.modelMatrixStack->multiply( m );
+		D3DGlobal.modelMatrixStack->rotate( (GLfloat)angle, (GLfloat)x, (GLfloat)y, (GLfloat)z );
 	}
 }
 OPENGL_API void WINAPI glScalef( GLfloat x, GLfloat y, GLfloat z )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_SCALE, x, y, z );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXMatrixScaling( &m, x, y, z );
-	D3DState.currentMatrixStack->multiply( m );
+	D3DState.currentMatrixStack->scale( x, y, z );
 	*D3DState.currentMatrixModified = true;
 
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
-		D3DGlobal.modelMatrixStack->multiply( m );
+		D3DGlobal.modelMatrixStack->scale( x, y, z );
 	}
 }
 OPENGL_API void WINAPI glScaled( GLdouble x, GLdouble y, GLdouble z )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_SCALE, x, y, z );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXMatrixScaling( &m,(FLOAT)x,(FLOAT)y,(FLOAT)z );
-	D3DState.currentMatrixStack->multiply( m );
+	D3DState.currentMatrixStack->scale( (GLfloat)x, (GLfloat)y, (GLfloat)z );
 	*D3DState.currentMatrixModified = true;
 
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
-		D3DGlobal.modelMatrixStack->multiply( m );
+		D3DGlobal.modelMatrixStack->scale( (GLfloat)x, (GLfloat)y, (GLfloat)z );
 	}
 }
 OPENGL_API void WINAPI glTranslatef( GLfloat x, GLfloat y, GLfloat z )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_TRANSLATE, x, y, z );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXMatrixTranslation( &m, x, y, z );
-	D3DState.currentMatrixStack->multiply( m );
+	D3DState.currentMatrixStack->translate( x, y, z );
 	*D3DState.currentMatrixModified = true;
 
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
-		D3DGlobal.modelMatrixStack->multiply( m );
+		D3DGlobal.modelMatrixStack->translate( x, y, z );
 	}
 }
 OPENGL_API void WINAPI glTranslated( GLdouble x, GLdouble y, GLdouble z )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_TRANSLATE, x, y, z );
 	if( !D3DState.currentMatrixStack ) return;
-	D3DXMATRIX m;
-	D3DXMatrixTranslation( &m,(FLOAT)x,(FLOAT)y,(FLOAT)z );
-	D3DState.currentMatrixStack->multiply( m );
+	D3DState.currentMatrixStack->translate( (GLfloat)x, (GLfloat)y, (GLfloat)z );
 	*D3DState.currentMatrixModified = true;
 
 	if (D3DState.TransformState.matrixMode == GL_MODELVIEW)
 	{
-		D3DGlobal.modelMatrixStack->multiply( m );
+		D3DGlobal.modelMatrixStack->translate( (GLfloat)x, (GLfloat)y, (GLfloat)z );
 	}
 }
\ No newline at end of file
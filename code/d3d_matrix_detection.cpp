@@ -4,6 +4,7 @@
 #include "d3d_wrapper.hpp"
 #include "d3d_global.hpp"
 #include "d3d_utils.hpp"
+#include "d3d_matrix_math.hpp"
 
 #include <iostream>
 #include <fstream>
@@ -68,11 +69,21 @@ static struct matrix_log_data g_mat_log_data[100];
 static int g_mat_log_idx = 0;
 static int g_mat_log_global_count = 0;
 
+// exact bit pattern -> g_mat_log_data index, rebuilt every logging round
+#define MATRIX_LOG_HASH_SIZE	256
+static struct matrix_log_hash
+{
+	UINT64 hash;
+	int index;
+} g_mat_log_hash[MATRIX_LOG_HASH_SIZE];
+static int g_mat_log_hash_count = 0;
+
 static int g_mat_log_print_one_round = 0;
 
 void* g_mat_addrs[3];
 int g_mat_addr_count = 0;
 int g_mat_addr_selected = 0;
+static struct matrix_cache_entry *g_mat_addr_entry[3];
 
 static float g_mat_identity[16] =
 {
@@ -82,8 +93,49 @@ static float g_mat_identity[16] =
 	0.0, 0.0, 0.0, 1.0
 };
 
-static D3DXMATRIX g_mat_cache;
-static D3DXMATRIX g_mat_cache_inverse;
+//==================================================================================
+// Matrix cache
+//----------------------------------------------------------------------------------
+// Uploaded matrices are looked up by the exact bit pattern. An entry keeps the
+// content classification and, once asked for, the inverse, so alternating
+// cameras (sky portals, mirrors) don't cost a 4x4 inverse for every entity.
+// Camera entries are preferred to stay when a slot has to be reused, since
+// per-entity matrices are mostly seen once.
+// Each stored pointer also remembers the entry of its last contents, which is
+// checked before hashing.
+//==================================================================================
+#define MATRIX_CACHE_SIZE		64		// power of two
+#define MATRIX_CACHE_PROBES		4
+
+enum matrix_class_flags
+{
+	MCLS_USED = 1 << 0,
+	MCLS_IDENTITY = 1 << 1,
+	MCLS_FLIPPING = 1 << 2,
+	MCLS_CAMERA = 1 << 3,		// inverted as a camera, inverse is valid
+	MCLS_SINGULAR = 1 << 4
+};
+
+struct matrix_cache_entry
+{
+	UINT64 hash;
+	float mat[16];
+	D3DXMATRIX inverse;
+	unsigned int flags;
+	unsigned int last_use;
+};
+
+static struct matrix_cache_entry g_mat_cache[MATRIX_CACHE_SIZE];
+static unsigned int g_mat_cache_clock = 0;
+
+static struct matrix_cache_stats
+{
+	unsigned int lookups;
+	unsigned int hits;
+	unsigned int pointer_hits;
+	unsigned int inverses;
+	unsigned int inverse_hits;
+} g_mat_cache_stats;
 
 enum detection_mode_e
 {
@@ -95,6 +147,13 @@ enum detection_mode_e
 bool g_mat_detection_enabled = false;
 int g_mat_detection_mode = 0;
 
+static void matrix_log_hash_clear()
+{
+	for ( int i = 0; i < MATRIX_LOG_HASH_SIZE; i++ )
+		g_mat_log_hash[i].index = -1;
+	g_mat_log_hash_count = 0;
+}
+
 bool matrix_detect_is_detection_enabled()
 {
 	return g_mat_detection_enabled;
@@ -110,16 +169,105 @@ inline bool matrix_is_transposed(const float* a, const float* b)
 	return matrix_detect_are_equal(a, b, 12);
 }
 
+static void matrix_cache_bind_pointer( const float* mat, struct matrix_cache_entry *e )
+{
+	for ( int i = 0; i < g_mat_addr_count; i++ )
+	{
+		if ( g_mat_addrs[i] == mat )
+			g_mat_addr_entry[i] = e;
+	}
+}
+
+static struct matrix_cache_entry *matrix_cache_lookup( const float* mat )
+{
+	g_mat_cache_stats.lookups++;
+	g_mat_cache_clock++;
+
+	// the pointer the matrix came from usually holds the same contents as last time
+	for ( int i = 0; i < g_mat_addr_count; i++ )
+	{
+		struct matrix_cache_entry *e = g_mat_addr_entry[i];
+		if ( g_mat_addrs[i] == mat && e && ( e->flags & MCLS_USED ) && 0 == memcmp( e->mat, mat, sizeof( e->mat ) ) )
+		{
+			g_mat_cache_stats.hits++;
+			g_mat_cache_stats.pointer_hits++;
+			e->last_use = g_mat_cache_clock;
+			return e;
+		}
+	}
+
+	UINT64 hash = UTIL_HashBytes( mat, sizeof( float ) * 16 );
+	struct matrix_cache_entry *victim = NULL;
+	for ( int i = 0; i < MATRIX_CACHE_PROBES; i++ )
+	{
+		struct matrix_cache_entry *e = &g_mat_cache[( hash + i ) & ( MATRIX_CACHE_SIZE - 1 )];
+		if ( !( e->flags & MCLS_USED ) )
+		{
+			if ( !victim || ( victim->flags & MCLS_USED ) )
+				victim = e;
+			continue;
+		}
+		if ( e->hash == hash && 0 == memcmp( e->mat, mat, sizeof( e->mat ) ) )
+		{
+			g_mat_cache_stats.hits++;
+			e->last_use = g_mat_cache_clock;
+			matrix_cache_bind_pointer( mat, e );
+			return e;
+		}
+		// reuse empty slots first, then non-camera ones, then the oldest
+		if ( !victim ||
+			( ( victim->flags & MCLS_USED ) &&
+			  ( ( ( victim->flags & MCLS_CAMERA ) && !( e->flags & MCLS_CAMERA ) ) ||
+				( ( victim->flags & MCLS_CAMERA ) == ( e->flags & MCLS_CAMERA ) && e->last_use < victim->last_use ) ) ) )
+		{
+			victim = e;
+		}
+	}
+
+	victim->hash = hash;
+	memcpy( victim->mat, mat, sizeof( victim->mat ) );
+	victim->flags = MCLS_USED;
+	if ( matrix_is_identity( mat ) )
+		victim->flags |= MCLS_IDENTITY;
+	if ( matrix_is_flippingmat( mat ) )
+		victim->flags |= MCLS_FLIPPING;
+	victim->last_use = g_mat_cache_clock;
+	matrix_cache_bind_pointer( mat, victim );
+	return victim;
+}
+
+static void matrix_cache_reset()
+{
+	memset( g_mat_cache, 0, sizeof( g_mat_cache ) );
+	memset( g_mat_addr_entry, 0, sizeof( g_mat_addr_entry ) );
+	memset( &g_mat_cache_stats, 0, sizeof( g_mat_cache_stats ) );
+	g_mat_cache_clock = 0;
+}
+
+static void matrix_cache_log_stats()
+{
+	const struct matrix_cache_stats &st = g_mat_cache_stats;
+	logPrintf( "MatrixDetection cache: %u lookups, %u hits (%.1f%%, %u by pointer), %u inverses, %u inverse hits (%.1f%%)\n",
+		st.lookups, st.hits, st.lookups ? 100.0f * st.hits / st.lookups : 0.0f, st.pointer_hits,
+		st.inverses, st.inverse_hits, st.inverses ? 100.0f * st.inverse_hits / st.inverses : 0.0f );
+}
+
 D3DXMATRIX *matrix_get_inverse( const float* mat )
 {
-	if ( 0 == memcmp( &g_mat_cache.m[0][0], mat, sizeof( g_mat_cache.m ) ) )
+	struct matrix_cache_entry *e = matrix_cache_lookup( mat );
+
+	g_mat_cache_stats.inverses++;
+	if ( e->flags & ( MCLS_CAMERA | MCLS_SINGULAR ) )
 	{
-		return &g_mat_cache_inverse;
+		g_mat_cache_stats.inverse_hits++;
+		return &e->inverse;
 	}
-	memcpy( &g_mat_cache.m[0][0], mat, sizeof( g_mat_cache.m ) );
-	void *tmp = D3DXMatrixInverse(&g_mat_cache_inverse, NULL, &g_mat_cache);
-	if ( tmp == NULL )
+
+	e->flags |= MCLS_CAMERA;
+	if ( !D3DMatrix_InverseTyped( &e->inverse.m[0][0], mat, D3DMatrix_Classify( mat ) ) )
 	{
+		e->flags |= MCLS_SINGULAR;
+		D3DMatrix_Identity( &e->inverse.m[0][0] );
 		char out[145];
 		unsigned int* ptr = (unsigned int*)mat;
 		snprintf( out, sizeof( out ), "%x %x %x %x\n%x %x %x %x\n%x %x %x %x\n%x %x %x %x",
@@ -129,7 +277,7 @@ D3DXMATRIX *matrix_get_inverse( const float* mat )
 			ptr[12], ptr[13], ptr[14], ptr[15] );
 		PRINT_ONCE("WARNING: matrix inverse failed: %s\n", out);
 	}
-	return &g_mat_cache_inverse;
+	return &e->inverse;
 }
 
 void matrix_detect_process_upload(const float* mat, D3DXMATRIX* detected_model, D3DXMATRIX* detected_view)
@@ -139,7 +287,7 @@ void matrix_detect_process_upload(const float* mat, D3DXMATRIX* detected_model,
 	if (g_mat_detection_enabled == FALSE || g_mat_detection_mode == DETECTION_NONE)
 	{
 		memcpy(&detected_model->m[0][0], mat, 16*sizeof(float));
-		D3DXMatrixIdentity(detected_view);
+		D3DMatrix_Identity(&detected_view->m[0][0]);
 		if (g_mat_log_print_one_round & 2)
 		{
 			//matrix_print_s(&detected_model->m[0][0], "detected model N");
@@ -148,7 +296,7 @@ void matrix_detect_process_upload(const float* mat, D3DXMATRIX* detected_model,
 	}
 	else if (g_mat_addr_count == 0 || g_mat_detection_mode == DETECTION_IDTECH2)
 	{
-		D3DXMatrixIdentity(detected_model);
+		D3DMatrix_Identity(&detected_model->m[0][0]);
 		memcpy(&detected_view->m[0][0], mat, 16*sizeof(float));
 		if (g_mat_log_print_one_round & 2)
 		{
@@ -158,18 +306,19 @@ void matrix_detect_process_upload(const float* mat, D3DXMATRIX* detected_model,
 	}
 	else if(g_mat_detection_mode == DETECTION_IDTECH3)
 	{
-		if (matrix_is_identity(mat))
+		const struct matrix_cache_entry *entry = matrix_cache_lookup(mat);
+		if (entry->flags & MCLS_IDENTITY)
 		{
-			D3DXMatrixIdentity(detected_model);
-			D3DXMatrixIdentity(detected_view);
+			D3DMatrix_Identity(&detected_model->m[0][0]);
+			D3DMatrix_Identity(&detected_view->m[0][0]);
 			if ( g_mat_log_print_one_round & 2 )
 			{
 				logPrintf( "matrix simple (detected identity)\n" );
 			}
 		}
-		else if (matrix_is_flippingmat(mat))
+		else if (entry->flags & MCLS_FLIPPING)
 		{
-			D3DXMatrixIdentity(detected_model);
+			D3DMatrix_Identity(&detected_model->m[0][0]);
 			memcpy(&detected_view->m[0][0], mat, 16*sizeof(float));
 			//memcpy(&detected_model->m[0][0], mat, 16*sizeof(float));
 			//D3DXMatrixIdentity(detected_view);
@@ -180,7 +329,7 @@ void matrix_detect_process_upload(const float* mat, D3DXMATRIX* detected_model,
 		}
 		else if (mat == g_mat_addrs[g_mat_addr_selected])
 		{
-			D3DXMatrixIdentity(detected_model);
+			D3DMatrix_Identity(&detected_model->m[0][0]);
 			memcpy(&detected_view->m[0][0], mat, 16*sizeof(float));
 
 			if (g_mat_log_print_one_round & 2)
@@ -191,8 +340,7 @@ void matrix_detect_process_upload(const float* mat, D3DXMATRIX* detected_model,
 		}
 		else if (mat != g_mat_addrs[g_mat_addr_selected])
 		{
-			D3DXMATRIX local = D3DXMATRIX(mat);
-			D3DXMatrixMultiply(detected_model, &local, matrix_get_inverse((const float*)(g_mat_addrs[g_mat_addr_selected])));
+			D3DMatrix_Multiply(&detected_model->m[0][0], mat, &matrix_get_inverse((const float*)(g_mat_addrs[g_mat_addr_selected]))->m[0][0]);
 			memcpy(&detected_view->m[0][0], g_mat_addrs[g_mat_addr_selected], sizeof(detected_view->m));
 
 			if (g_mat_log_print_one_round & 2)
@@ -285,19 +433,52 @@ void matrix_detect_process_upload(const float* mat, D3DXMATRIX* detected_model,
 	}
 	if ( g_mat_log_print_one_round )
 	{
-		for ( int i = 0; i < g_mat_log_idx; i++ )
+		// exact bit match through the hash first, then the old epsilon compare
+		UINT64 hash = UTIL_HashBytes( mat, sizeof( float ) * 16 );
+		int found = -1;
+		int slot = (int)( hash & ( MATRIX_LOG_HASH_SIZE - 1 ) );
+		for ( ; g_mat_log_hash[slot].index >= 0; slot = ( slot + 1 ) & ( MATRIX_LOG_HASH_SIZE - 1 ) )
+		{
+			const int idx = g_mat_log_hash[slot].index;
+			if ( g_mat_log_hash[slot].hash == hash && 0 == memcmp( g_mat_log_data[idx].mat, mat, sizeof( g_mat_log_data[0].mat ) ) )
+			{
+				found = idx;
+				break;
+			}
+		}
+		if ( found < 0 )
 		{
-			if ( matrix_detect_are_equal( mat, g_mat_log_data[i].mat, 0 ) )
+			for ( int i = 0; i < g_mat_log_idx; i++ )
 			{
-				g_mat_log_data[i].usage++;
-				g_mat_log_data[i].flags |= flags;
-				g_mat_log_data[i].seq_num.push_back( g_mat_log_global_count );
-				g_mat_log_data[i].seq_ptr.push_back( (void*)mat );
-				g_mat_log_global_count++;
-				return;
+				if ( matrix_detect_are_equal( mat, g_mat_log_data[i].mat, 0 ) )
+				{
+					found = i;
+					break;
+				}
 			}
 		}
-		if ( g_mat_log_idx < ARRAYSIZE( g_mat_log_data ) )
+		if ( found < 0 && g_mat_log_idx < ARRAYSIZE( g_mat_log_data ) )
+		{
+			found = g_mat_log_idx;
+		}
+		// remember this exact pattern; keep the table at most half full
+		if ( found >= 0 && g_mat_log_hash[slot].index < 0 && g_mat_log_hash_count < MATRIX_LOG_HASH_SIZE / 2 )
+		{
+			g_mat_log_hash[slot].hash = hash;
+			g_mat_log_hash[slot].index = found;
+			g_mat_log_hash_count++;
+		}
+
+		if ( found >= 0 && found < g_mat_log_idx )
+		{
+			g_mat_log_data[found].usage++;
+			g_mat_log_data[found].flags |= flags;
+			g_mat_log_data[found].seq_num.push_back( g_mat_log_global_count );
+			g_mat_log_data[found].seq_ptr.push_back( (void*)mat );
+			g_mat_log_global_count++;
+			return;
+		}
+		if ( found >= 0 )
 		{
 			memcpy( g_mat_log_data[g_mat_log_idx].mat, mat, sizeof( g_mat_log_data[0].mat ) );
 			g_mat_log_data[g_mat_log_idx].usage = 1;
@@ -317,7 +498,7 @@ void matrix_detect_on_world_retrieve(const float* mat, D3DXMATRIX* detected_mode
 	if (g_mat_detection_mode == DETECTION_IDTECH2)
 	{
 		//store modelview in view matrix
-		D3DXMatrixIdentity(detected_model);
+		D3DMatrix_Identity(&detected_model->m[0][0]);
 		memcpy(&(detected_view->m[0][0]), mat, sizeof(detected_view->m));
 	}
 }
@@ -355,11 +536,12 @@ void matrix_detect_frame_ended()
 		{
 			matrix_print(g_mat_log_data[i].mat, i, g_mat_log_data[i].usage, g_mat_log_data[i].flags, g_mat_log_data[i].seq_num.data(), g_mat_log_data[i].seq_ptr.data());
 		}
-
+		matrix_cache_log_stats();
 	}
 
 	g_mat_log_idx = 0;
 	g_mat_log_global_count = 0;
+	matrix_log_hash_clear();
 
 	g_mat_log_print_one_round = 0;
 
@@ -401,6 +583,7 @@ void matrix_detect_configuration_reset()
 	matrix_detect_frame_ended();
 	g_mat_addr_count = 0;
 	g_mat_addr_selected = 0;
+	matrix_cache_reset();
 
 	mINI::INIStructure &ini = *((mINI::INIStructure *)D3DGlobal_GetIniHandler());
 	g_mat_detection_enabled = read_confval("enable_camera_detection", ini);
@@ -0,0 +1,626 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "d3d_matrix_math.hpp"
+
+#if QINDIEGL_MATRIX_SSE
+#include <xmmintrin.h>
+#endif
+
+//==================================================================================
+// 4x4 matrix kernels
+//----------------------------------------------------------------------------------
+// Only plain SSE float instructions are used, so the SSE path is available
+// everywhere the texgen SSE path is. The scalar versions are the reference the
+// tests compare the SSE ones against.
+//==================================================================================
+
+static bool s_matrixUseSSE = false;
+
+void D3DMatrix_UseSSE( bool enable )
+{
+#if QINDIEGL_MATRIX_SSE
+	s_matrixUseSSE = enable;
+#else
+	(void)enable;
+	s_matrixUseSSE = false;
+#endif
+}
+
+bool D3DMatrix_IsUsingSSE()
+{
+	return s_matrixUseSSE;
+}
+
+//==================================================================================
+// Builders
+//==================================================================================
+void D3DMatrix_Identity( float *out )
+{
+	memset( out, 0, sizeof(float)*16 );
+	out[0] = out[5] = out[10] = out[15] = 1.0f;
+}
+
+void D3DMatrix_Translation( float *out, float x, float y, float z )
+{
+	D3DMatrix_Identity( out );
+	out[12] = x;
+	out[13] = y;
+	out[14] = z;
+}
+
+void D3DMatrix_Scaling( float *out, float x, float y, float z )
+{
+	memset( out, 0, sizeof(float)*16 );
+	out[0] = x;
+	out[5] = y;
+	out[10] = z;
+	out[15] = 1.0f;
+}
+
+void D3DMatrix_RotationAxis( float *out, float angle, float x, float y, float z )
+{
+	float len = sqrtf( x*x + y*y + z*z );
+	if( len == 0.0f ) {
+		D3DMatrix_Identity( out );
+		return;
+	}
+	x /= len;
+	y /= len;
+	z /= len;
+
+	float s = sinf( angle );
+	float c = cosf( angle );
+	float ic = 1.0f - c;
+
+	out[0] = x*x*ic + c;
+	out[1] = x*y*ic + z*s;
+	out[2] = x*z*ic - y*s;
+	out[3] = 0.0f;
+	out[4] = x*y*ic - z*s;
+	out[5] = y*y*ic + c;
+	out[6] = y*z*ic + x*s;
+	out[7] = 0.0f;
+	out[8] = x*z*ic + y*s;
+	out[9] = y*z*ic - x*s;
+	out[10] = z*z*ic + c;
+	out[11] = 0.0f;
+	out[12] = 0.0f;
+	out[13] = 0.0f;
+	out[14] = 0.0f;
+	out[15] = 1.0f;
+}
+
+// Same matrix as D3DXMatrixPerspectiveOffCenterRH
+void D3DMatrix_FrustumRH( float *out, float l, float r, float b, float t, float zn, float zf )
+{
+	memset( out, 0, sizeof(float)*16 );
+	out[0] = 2.0f * zn / ( r - l );
+	out[5] = 2.0f * zn / ( t - b );
+	out[8] = ( l + r ) / ( r - l );
+	out[9] = ( t + b ) / ( t - b );
+	out[10] = zf / ( zn - zf );
+	out[11] = -1.0f;
+	out[14] = zn * zf / ( zn - zf );
+}
+
+// Same matrix as D3DXMatrixOrthoOffCenterRH
+void D3DMatrix_OrthoRH( float *out, float l, float r, float b, float t, float zn, float zf )
+{
+	memset( out, 0, sizeof(float)*16 );
+	out[0] = 2.0f / ( r - l );
+	out[5] = 2.0f / ( t - b );
+	out[10] = 1.0f / ( zn - zf );
+	out[12] = ( l + r ) / ( l - r );
+	out[13] = ( t + b ) / ( b - t );
+	out[14] = zn / ( zn - zf );
+	out[15] = 1.0f;
+}
+
+//==================================================================================
+// Queries
+//==================================================================================
+bool D3DMatrix_IsIdentity( const float *m )
+{
+	for( int i = 0; i < 16; ++i ) {
+		if( m[i] != ( ( i % 5 ) ? 0.0f : 1.0f ) )
+			return false;
+	}
+	return true;
+}
+
+bool D3DMatrix_IsAffine( const float *m )
+{
+	return ( m[3] == 0.0f && m[7] == 0.0f && m[11] == 0.0f && m[15] == 1.0f );
+}
+
+// Exact compares everywhere except for the rigid check, since rotations built
+// from sin/cos are never exactly orthonormal
+D3DMatrixType D3DMatrix_Classify( const float *m )
+{
+	if( m[3] != 0.0f || m[7] != 0.0f || m[11] != 0.0f )
+		return D3DMT_PROJECTIVE;
+	if( m[15] != 1.0f )
+		return ( m[15] != 0.0f ) ? D3DMT_ORTHO : D3DMT_PROJECTIVE;
+
+	if( m[1] == 0.0f && m[2] == 0.0f && m[4] == 0.0f && m[6] == 0.0f && m[8] == 0.0f && m[9] == 0.0f ) {
+		if( m[0] != 1.0f || m[5] != 1.0f || m[10] != 1.0f )
+			return D3DMT_SCALE;
+		if( m[12] != 0.0f || m[13] != 0.0f || m[14] != 0.0f )
+			return D3DMT_TRANSLATION;
+		return D3DMT_IDENTITY;
+	}
+
+	const float eps = 1e-5f;
+	for( int i = 0; i < 3; ++i ) {
+		for( int j = i; j < 3; ++j ) {
+			float d = m[i*4+0]*m[j*4+0] + m[i*4+1]*m[j*4+1] + m[i*4+2]*m[j*4+2];
+			if( fabsf( d - ( ( i == j ) ? 1.0f : 0.0f ) ) > eps )
+				return D3DMT_AFFINE;
+		}
+	}
+	return D3DMT_RIGID;
+}
+
+D3DMatrixType D3DMatrix_CombineTypes( D3DMatrixType a, D3DMatrixType b )
+{
+	if( a == D3DMT_IDENTITY )
+		return b;
+	if( b == D3DMT_IDENTITY )
+		return a;
+
+	D3DMatrixType hi = ( a > b ) ? a : b;
+	D3DMatrixType lo = ( a > b ) ? b : a;
+	// a non-uniform scale and a rotation make a skew
+	if( hi == D3DMT_RIGID && lo == D3DMT_SCALE )
+		return D3DMT_AFFINE;
+	return hi;
+}
+
+//==================================================================================
+// Scalar reference kernels
+//==================================================================================
+void D3DMatrix_Multiply_Ref( float *out, const float *a, const float *b )
+{
+	float tmp[16];
+	for( int i = 0; i < 4; ++i ) {
+		for( int j = 0; j < 4; ++j ) {
+			tmp[i*4+j] = a[i*4+0] * b[0*4+j] +
+						 a[i*4+1] * b[1*4+j] +
+						 a[i*4+2] * b[2*4+j] +
+						 a[i*4+3] * b[3*4+j];
+		}
+	}
+	memcpy( out, tmp, sizeof(tmp) );
+}
+
+void D3DMatrix_MultiplyAffine_Ref( float *out, const float *a, const float *b )
+{
+	float tmp[16];
+	for( int j = 0; j < 4; ++j ) {
+		for( int i = 0; i < 3; ++i )
+			tmp[i*4+j] = a[i*4+0] * b[j] + a[i*4+1] * b[4+j] + a[i*4+2] * b[8+j];
+		tmp[12+j] = a[12] * b[j] + a[13] * b[4+j] + a[14] * b[8+j] + b[12+j];
+	}
+	memcpy( out, tmp, sizeof(tmp) );
+}
+
+void D3DMatrix_Transpose_Ref( float *out, const float *m )
+{
+	float tmp[16];
+	for( int i = 0; i < 4; ++i ) {
+		for( int j = 0; j < 4; ++j )
+			tmp[j*4+i] = m[i*4+j];
+	}
+	memcpy( out, tmp, sizeof(tmp) );
+}
+
+// Cofactor expansion; inverse(transpose(M)) == transpose(inverse(M)),
+// so it does not care about the storage order
+bool D3DMatrix_Inverse_Ref( float *out, const float *m )
+{
+	float inv[16];
+
+	inv[0] = m[5]*m[10]*m[15] - m[5]*m[11]*m[14] - m[9]*m[6]*m[15] + m[9]*m[7]*m[14] + m[13]*m[6]*m[11] - m[13]*m[7]*m[10];
+	inv[4] = -m[4]*m[10]*m[15] + m[4]*m[11]*m[14] + m[8]*m[6]*m[15] - m[8]*m[7]*m[14] - m[12]*m[6]*m[11] + m[12]*m[7]*m[10];
+	inv[8] = m[4]*m[9]*m[15] - m[4]*m[11]*m[13] - m[8]*m[5]*m[15] + m[8]*m[7]*m[13] + m[12]*m[5]*m[11] - m[12]*m[7]*m[9];
+	inv[12] = -m[4]*m[9]*m[14] + m[4]*m[10]*m[13] + m[8]*m[5]*m[14] - m[8]*m[6]*m[13] - m[12]*m[5]*m[10] + m[12]*m[6]*m[9];
+	inv[1] = -m[1]*m[10]*m[15] + m[1]*m[11]*m[14] + m[9]*m[2]*m[15] - m[9]*m[3]*m[14] - m[13]*m[2]*m[11] + m[13]*m[3]*m[10];
+	inv[5] = m[0]*m[10]*m[15] - m[0]*m[11]*m[14] - m[8]*m[2]*m[15] + m[8]*m[3]*m[14] + m[12]*m[2]*m[11] - m[12]*m[3]*m[10];
+	inv[9] = -m[0]*m[9]*m[15] + m[0]*m[11]*m[13] + m[8]*m[1]*m[15] - m[8]*m[3]*m[13] - m[12]*m[1]*m[11] + m[12]*m[3]*m[9];
+	inv[13] = m[0]*m[9]*m[14] - m[0]*m[10]*m[13] - m[8]*m[1]*m[14] + m[8]*m[2]*m[13] + m[12]*m[1]*m[10] - m[12]*m[2]*m[9];
+	inv[2] = m[1]*m[6]*m[15] - m[1]*m[7]*m[14] - m[5]*m[2]*m[15] + m[5]*m[3]*m[14] + m[13]*m[2]*m[7] - m[13]*m[3]*m[6];
+	inv[6] = -m[0]*m[6]*m[15] + m[0]*m[7]*m[14] + m[4]*m[2]*m[15] - m[4]*m[3]*m[14] - m[12]*m[2]*m[7] + m[12]*m[3]*m[6];
+	inv[10] = m[0]*m[5]*m[15] - m[0]*m[7]*m[13] - m[4]*m[1]*m[15] + m[4]*m[3]*m[13] + m[12]*m[1]*m[7] - m[12]*m[3]*m[5];
+	inv[14] = -m[0]*m[5]*m[14] + m[0]*m[6]*m[13] + m[4]*m[1]*m[14] - m[4]*m[2]*m[13] - m[12]*m[1]*m[6] + m[12]*m[2]*m[5];
+	inv[3] = -m[1]*m[6]*m[11] + m[1]*m[7]*m[10] + m[5]*m[2]*m[11] - m[5]*m[3]*m[10] - m[9]*m[2]*m[7] + m[9]*m[3]*m[6];
+	inv[7] = m[0]*m[6]*m[11] - m[0]*m[7]*m[10] - m[4]*m[2]*m[11] + m[4]*m[3]*m[10] + m[8]*m[2]*m[7] - m[8]*m[3]*m[6];
+	inv[11] = -m[0]*m[5]*m[11] + m[0]*m[7]*m[9] + m[4]*m[1]*m[11] - m[4]*m[3]*m[9] - m[8]*m[1]*m[7] + m[8]*m[3]*m[5];
+	inv[15] = m[0]*m[5]*m[10] - m[0]*m[6]*m[9] - m[4]*m[1]*m[10] + m[4]*m[2]*m[9] + m[8]*m[1]*m[6] - m[8]*m[2]*m[5];
+
+	float det = m[0]*inv[0] + m[1]*inv[4] + m[2]*inv[8] + m[3]*inv[12];
+	if( det == 0.0f )
+		return false;
+
+	float invdet = 1.0f / det;
+	for( int i = 0; i < 16; ++i )
+		out[i] = inv[i] * invdet;
+	return true;
+}
+
+// [ M 0 ]^-1   [ M^-1      0 ]
+// [ t 1 ]    = [ -t*M^-1   1 ]
+// The columns of M^-1 are the cross products of the rows of M over det(M).
+bool D3DMatrix_InverseAffine_Ref( float *out, const float *m )
+{
+	const float *r0 = m;
+	const float *r1 = m + 4;
+	const float *r2 = m + 8;
+	float c[3][3];
+
+	c[0][0] = r1[1]*r2[2] - r1[2]*r2[1];
+	c[0][1] = r1[2]*r2[0] - r1[0]*r2[2];
+	c[0][2] = r1[0]*r2[1] - r1[1]*r2[0];
+	c[1][0] = r2[1]*r0[2] - r2[2]*r0[1];
+	c[1][1] = r2[2]*r0[0] - r2[0]*r0[2];
+	c[1][2] = r2[0]*r0[1] - r2[1]*r0[0];
+	c[2][0] = r0[1]*r1[2] - r0[2]*r1[1];
+	c[2][1] = r0[2]*r1[0] - r0[0]*r1[2];
+	c[2][2] = r0[0]*r1[1] - r0[1]*r1[0];
+
+	float det = r0[0]*c[0][0] + r0[1]*c[0][1] + r0[2]*c[0][2];
+	if( det == 0.0f )
+		return false;
+
+	float invdet = 1.0f / det;
+	float tx = m[12], ty = m[13], tz = m[14];
+	float inv[16];
+	for( int i = 0; i < 3; ++i ) {
+		for( int j = 0; j < 3; ++j )
+			inv[i*4+j] = c[j][i] * invdet;
+		inv[i*4+3] = 0.0f;
+	}
+	for( int j = 0; j < 3; ++j )
+		inv[12+j] = -( tx*inv[j] + ty*inv[4+j] + tz*inv[8+j] );
+	inv[15] = 1.0f;
+
+	memcpy( out, inv, sizeof(inv) );
+	return true;
+}
+
+void D3DMatrix_TransformVec4_Ref( float *out4, const float *m, const float *v4 )
+{
+	float x = v4[0], y = v4[1], z = v4[2], w = v4[3];
+	for( int j = 0; j < 4; ++j )
+		out4[j] = x*m[j] + y*m[4+j] + z*m[8+j] + w*m[12+j];
+}
+
+//==================================================================================
+// SSE kernels
+//==================================================================================
+#if QINDIEGL_MATRIX_SSE
+
+#define MATRIX_SWIZZLE( v, x, y, z, w )		_mm_shuffle_ps( (v), (v), _MM_SHUFFLE( (w), (z), (y), (x) ) )
+#define MATRIX_SHUFFLE( a, b, x, y, z, w )	_mm_shuffle_ps( (a), (b), _MM_SHUFFLE( (w), (z), (y), (x) ) )
+
+static inline __m128 D3DMatrix_Row_SSE( const float *a, __m128 b0, __m128 b1, __m128 b2, __m128 b3 )
+{
+	__m128 r = _mm_mul_ps( _mm_set1_ps( a[0] ), b0 );
+	r = _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( a[1] ), b1 ) );
+	r = _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( a[2] ), b2 ) );
+	return _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( a[3] ), b3 ) );
+}
+
+void D3DMatrix_Multiply_SSE( float *out, const float *a, const float *b )
+{
+	__m128 b0 = _mm_loadu_ps( b );
+	__m128 b1 = _mm_loadu_ps( b + 4 );
+	__m128 b2 = _mm_loadu_ps( b + 8 );
+	__m128 b3 = _mm_loadu_ps( b + 12 );
+
+	__m128 r0 = D3DMatrix_Row_SSE( a, b0, b1, b2, b3 );
+	__m128 r1 = D3DMatrix_Row_SSE( a + 4, b0, b1, b2, b3 );
+	__m128 r2 = D3DMatrix_Row_SSE( a + 8, b0, b1, b2, b3 );
+	__m128 r3 = D3DMatrix_Row_SSE( a + 12, b0, b1, b2, b3 );
+
+	_mm_storeu_ps( out, r0 );
+	_mm_storeu_ps( out + 4, r1 );
+	_mm_storeu_ps( out + 8, r2 );
+	_mm_storeu_ps( out + 12, r3 );
+}
+
+static inline __m128 D3DMatrix_Row3_SSE( const float *a, __m128 b0, __m128 b1, __m128 b2 )
+{
+	__m128 r = _mm_mul_ps( _mm_set1_ps( a[0] ), b0 );
+	r = _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( a[1] ), b1 ) );
+	return _mm_add_ps( r, _mm_mul_ps( _mm_set1_ps( a[2] ), b2 ) );
+}
+
+void D3DMatrix_MultiplyAffine_SSE( float *out, const float *a, const float *b )
+{
+	__m128 b0 = _mm_loadu_ps( b );
+	__m128 b1 = _mm_loadu_ps( b + 4 );
+	__m128 b2 = _mm_loadu_ps( b + 8 );
+	__m128 b3 = _mm_loadu_ps( b + 12 );
+
+	__m128 r0 = D3DMatrix_Row3_SSE( a, b0, b1, b2 );
+	__m128 r1 = D3DMatrix_Row3_SSE( a + 4, b0, b1, b2 );
+	__m128 r2 = D3DMatrix_Row3_SSE( a + 8, b0, b1, b2 );
+	__m128 r3 = _mm_add_ps( D3DMatrix_Row3_SSE( a + 12, b0, b1, b2 ), b3 );
+
+	_mm_storeu_ps( out, r0 );
+	_mm_storeu_ps( out + 4, r1 );
+	_mm_storeu_ps( out + 8, r2 );
+	_mm_storeu_ps( out + 12, r3 );
+}
+
+void D3DMatrix_Transpose_SSE( float *out, const float *m )
+{
+	__m128 r0 = _mm_loadu_ps( m );
+	__m128 r1 = _mm_loadu_ps( m + 4 );
+	__m128 r2 = _mm_loadu_ps( m + 8 );
+	__m128 r3 = _mm_loadu_ps( m + 12 );
+
+	_MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+
+	_mm_storeu_ps( out, r0 );
+	_mm_storeu_ps( out + 4, r1 );
+	_mm_storeu_ps( out + 8, r2 );
+	_mm_storeu_ps( out + 12, r3 );
+}
+
+// 2x2 blocks are stored row-major in one register as (m00, m01, m10, m11)
+// A * B
+static inline __m128 D3DMatrix_Mat2Mul_SSE( __m128 a, __m128 b )
+{
+	return _mm_add_ps( _mm_mul_ps( a, MATRIX_SWIZZLE( b, 0, 3, 0, 3 ) ),
+					   _mm_mul_ps( MATRIX_SWIZZLE( a, 1, 0, 3, 2 ), MATRIX_SWIZZLE( b, 2, 1, 2, 1 ) ) );
+}
+// adj(A) * B
+static inline __m128 D3DMatrix_Mat2AdjMul_SSE( __m128 a, __m128 b )
+{
+	return _mm_sub_ps( _mm_mul_ps( MATRIX_SWIZZLE( a, 3, 3, 0, 0 ), b ),
+					   _mm_mul_ps( MATRIX_SWIZZLE( a, 1, 1, 2, 2 ), MATRIX_SWIZZLE( b, 2, 3, 0, 1 ) ) );
+}
+// A * adj(B)
+static inline __m128 D3DMatrix_Mat2MulAdj_SSE( __m128 a, __m128 b )
+{
+	return _mm_sub_ps( _mm_mul_ps( a, MATRIX_SWIZZLE( b, 3, 0, 3, 0 ) ),
+					   _mm_mul_ps( MATRIX_SWIZZLE( a, 1, 0, 3, 2 ), MATRIX_SWIZZLE( b, 2, 1, 2, 1 ) ) );
+}
+
+// Block-wise inverse: M = [A B; C D] with 2x2 blocks, everything is expressed
+// through 2x2 adjugates so there is a single division.
+bool D3DMatrix_Inverse_SSE( float *out, const float *m )
+{
+	__m128 r0 = _mm_loadu_ps( m );
+	__m128 r1 = _mm_loadu_ps( m + 4 );
+	__m128 r2 = _mm_loadu_ps( m + 8 );
+	__m128 r3 = _mm_loadu_ps( m + 12 );
+
+	__m128 A = _mm_movelh_ps( r0, r1 );
+	__m128 B = _mm_movehl_ps( r1, r0 );
+	__m128 C = _mm_movelh_ps( r2, r3 );
+	__m128 D = _mm_movehl_ps( r3, r2 );
+
+	// (|A|, |B|, |C|, |D|)
+	__m128 detSub = _mm_sub_ps( _mm_mul_ps( MATRIX_SHUFFLE( r0, r2, 0, 2, 0, 2 ), MATRIX_SHUFFLE( r1, r3, 1, 3, 1, 3 ) ),
+								_mm_mul_ps( MATRIX_SHUFFLE( r0, r2, 1, 3, 1, 3 ), MATRIX_SHUFFLE( r1, r3, 0, 2, 0, 2 ) ) );
+	__m128 detA = MATRIX_SWIZZLE( detSub, 0, 0, 0, 0 );
+	__m128 detB = MATRIX_SWIZZLE( detSub, 1, 1, 1, 1 );
+	__m128 detC = MATRIX_SWIZZLE( detSub, 2, 2, 2, 2 );
+	__m128 detD = MATRIX_SWIZZLE( detSub, 3, 3, 3, 3 );
+
+	__m128 D_C = D3DMatrix_Mat2AdjMul_SSE( D, C );
+	__m128 A_B = D3DMatrix_Mat2AdjMul_SSE( A, B );
+
+	// adjugates of the result blocks X, Y, Z, W
+	__m128 X_ = _mm_sub_ps( _mm_mul_ps( detD, A ), D3DMatrix_Mat2Mul_SSE( B, D_C ) );
+	__m128 W_ = _mm_sub_ps( _mm_mul_ps( detA, D ), D3DMatrix_Mat2Mul_SSE( C, A_B ) );
+	__m128 Y_ = _mm_sub_ps( _mm_mul_ps( detB, C ), D3DMatrix_Mat2MulAdj_SSE( D, A_B ) );
+	__m128 Z_ = _mm_sub_ps( _mm_mul_ps( detC, B ), D3DMatrix_Mat2MulAdj_SSE( A, D_C ) );
+
+	// |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+	__m128 tr = _mm_mul_ps( A_B, MATRIX_SWIZZLE( D_C, 0, 2, 1, 3 ) );
+	tr = _mm_add_ps( tr, MATRIX_SWIZZLE( tr, 1, 0, 3, 2 ) );
+	tr = _mm_add_ps( tr, MATRIX_SWIZZLE( tr, 2, 3, 0, 1 ) );
+	__m128 detM = _mm_add_ps( _mm_mul_ps( detA, detD ), _mm_mul_ps( detB, detC ) );
+	detM = _mm_sub_ps( detM, tr );
+
+	if( _mm_cvtss_f32( detM ) == 0.0f )
+		return false;
+
+	__m128 rDetM = _mm_div_ps( _mm_setr_ps( 1.0f, -1.0f, -1.0f, 1.0f ), detM );
+	X_ = _mm_mul_ps( X_, rDetM );
+	Y_ = _mm_mul_ps( Y_, rDetM );
+	Z_ = _mm_mul_ps( Z_, rDetM );
+	W_ = _mm_mul_ps( W_, rDetM );
+
+	// undo the adjugates while putting the blocks back into rows
+	_mm_storeu_ps( out, MATRIX_SHUFFLE( X_, Y_, 3, 1, 3, 1 ) );
+	_mm_storeu_ps( out + 4, MATRIX_SHUFFLE( X_, Y_, 2, 0, 2, 0 ) );
+	_mm_storeu_ps( out + 8, MATRIX_SHUFFLE( Z_, W_, 3, 1, 3, 1 ) );
+	_mm_storeu_ps( out + 12, MATRIX_SHUFFLE( Z_, W_, 2, 0, 2, 0 ) );
+	return true;
+}
+
+static inline __m128 D3DMatrix_Cross_SSE( __m128 a, __m128 b )
+{
+	return _mm_sub_ps( _mm_mul_ps( MATRIX_SWIZZLE( a, 1, 2, 0, 3 ), MATRIX_SWIZZLE( b, 2, 0, 1, 3 ) ),
+					   _mm_mul_ps( MATRIX_SWIZZLE( a, 2, 0, 1, 3 ), MATRIX_SWIZZLE( b, 1, 2, 0, 3 ) ) );
+}
+
+bool D3DMatrix_InverseAffine_SSE( float *out, const float *m )
+{
+	static const union { unsigned int u[4]; __m128 v; } maskXYZ = { { 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0 } };
+
+	__m128 r0 = _mm_and_ps( _mm_loadu_ps( m ), maskXYZ.v );
+	__m128 r1 = _mm_and_ps( _mm_loadu_ps( m + 4 ), maskXYZ.v );
+	__m128 r2 = _mm_and_ps( _mm_loadu_ps( m + 8 ), maskXYZ.v );
+	__m128 t = _mm_loadu_ps( m + 12 );
+
+	__m128 c0 = D3DMatrix_Cross_SSE( r1, r2 );
+	__m128 c1 = D3DMatrix_Cross_SSE( r2, r0 );
+	__m128 c2 = D3DMatrix_Cross_SSE( r0, r1 );
+
+	__m128 det = _mm_mul_ps( r0, c0 );
+	det = _mm_add_ps( det, MATRIX_SWIZZLE( det, 1, 0, 3, 2 ) );
+	det = _mm_add_ps( det, MATRIX_SWIZZLE( det, 2, 3, 0, 1 ) );
+	if( _mm_cvtss_f32( det ) == 0.0f )
+		return false;
+
+	__m128 rdet = _mm_div_ps( _mm_set1_ps( 1.0f ), det );
+	c0 = _mm_mul_ps( c0, rdet );
+	c1 = _mm_mul_ps( c1, rdet );
+	c2 = _mm_mul_ps( c2, rdet );
+	__m128 c3 = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+
+	__m128 tr = _mm_mul_ps( MATRIX_SWIZZLE( t, 0, 0, 0, 0 ), c0 );
+	tr = _mm_add_ps( tr, _mm_mul_ps( MATRIX_SWIZZLE( t, 1, 1, 1, 1 ), c1 ) );
+	tr = _mm_add_ps( tr, _mm_mul_ps( MATRIX_SWIZZLE( t, 2, 2, 2, 2 ), c2 ) );
+	tr = _mm_sub_ps( _mm_setr_ps( 0.0f, 0.0f, 0.0f, 1.0f ), tr );
+
+	_mm_storeu_ps( out, c0 );
+	_mm_storeu_ps( out + 4, c1 );
+	_mm_storeu_ps( out + 8, c2 );
+	_mm_storeu_ps( out + 12, tr );
+	return true;
+}
+
+void D3DMatrix_TransformVec4_SSE( float *out4, const float *m, const float *v4 )
+{
+	_mm_storeu_ps( out4, D3DMatrix_Row_SSE( v4, _mm_loadu_ps( m ), _mm_loadu_ps( m + 4 ), _mm_loadu_ps( m + 8 ), _mm_loadu_ps( m + 12 ) ) );
+}
+
+#endif //QINDIEGL_MATRIX_SSE
+
+//==================================================================================
+// Dispatch
+//==================================================================================
+#if QINDIEGL_MATRIX_SSE
+#define MATRIX_DISPATCH( func, ... )	( s_matrixUseSSE ? func##_SSE( __VA_ARGS__ ) : func##_Ref( __VA_ARGS__ ) )
+#else
+#define MATRIX_DISPATCH( func, ... )	func##_Ref( __VA_ARGS__ )
+#endif
+
+void D3DMatrix_Multiply( float *out, const float *a, const float *b )
+{
+	MATRIX_DISPATCH( D3DMatrix_Multiply, out, a, b );
+}
+
+void D3DMatrix_MultiplyAffine( float *out, const float *a, const float *b )
+{
+	MATRIX_DISPATCH( D3DMatrix_MultiplyAffine, out, a, b );
+}
+
+void D3DMatrix_Transpose( float *out, const float *m )
+{
+	MATRIX_DISPATCH( D3DMatrix_Transpose, out, m );
+}
+
+bool D3DMatrix_Inverse( float *out, const float *m )
+{
+	return MATRIX_DISPATCH( D3DMatrix_Inverse, out, m );
+}
+
+bool D3DMatrix_InverseAffine( float *out, const float *m )
+{
+	return MATRIX_DISPATCH( D3DMatrix_InverseAffine, out, m );
+}
+
+void D3DMatrix_TransformVec4( float *out4, const float *m, const float *v4 )
+{
+	MATRIX_DISPATCH( D3DMatrix_TransformVec4, out4, m, v4 );
+}
+
+bool D3DMatrix_InverseTyped( float *out, const float *m, D3DMatrixType type )
+{
+	switch( type ) {
+	case D3DMT_IDENTITY:
+		if( out != m )
+			memcpy( out, m, sizeof(float)*16 );
+		return true;
+	case D3DMT_TRANSLATION:
+		if( out != m )
+			memcpy( out, m, sizeof(float)*16 );
+		out[12] = -m[12];
+		out[13] = -m[13];
+		out[14] = -m[14];
+		return true;
+	case D3DMT_SCALE:
+		{
+			if( m[0] == 0.0f || m[5] == 0.0f || m[10] == 0.0f )
+				return false;
+			float sx = 1.0f / m[0], sy = 1.0f / m[5], sz = 1.0f / m[10];
+			float tx = m[12], ty = m[13], tz = m[14];
+			D3DMatrix_Scaling( out, sx, sy, sz );
+			out[12] = -tx * sx;
+			out[13] = -ty * sy;
+			out[14] = -tz * sz;
+		}
+		return true;
+	case D3DMT_RIGID:
+		{
+			// R^-1 = R^T, and the translation goes back through it
+			float inv[16];
+			for( int i = 0; i < 3; ++i ) {
+				for( int j = 0; j < 3; ++j )
+					inv[i*4+j] = m[j*4+i];
+				inv[i*4+3] = 0.0f;
+				inv[12+i] = -( m[12]*m[i*4+0] + m[13]*m[i*4+1] + m[14]*m[i*4+2] );
+			}
+			inv[15] = 1.0f;
+			memcpy( out, inv, sizeof(inv) );
+		}
+		return true;
+	case D3DMT_AFFINE:
+		return D3DMatrix_InverseAffine( out, m );
+	default:
+		return D3DMatrix_Inverse( out, m );
+	}
+}
+
+void D3DMatrix_TransformPoint( float *out4, const float *m, const float *v3 )
+{
+	float v[4] = { v3[0], v3[1], v3[2], 1.0f };
+	D3DMatrix_TransformVec4( out4, m, v );
+}
+
+void D3DMatrix_TransformCoord( float *out3, const float *m, const float *v3 )
+{
+	float v[4];
+	D3DMatrix_TransformPoint( v, m, v3 );
+	float rw = ( v[3] != 0.0f ) ? ( 1.0f / v[3] ) : 0.0f;
+	out3[0] = v[0] * rw;
+	out3[1] = v[1] * rw;
+	out3[2] = v[2] * rw;
+}
+
+void D3DMatrix_TransformNormal( float *out3, const float *m, const float *v3 )
+{
+	float v[4] = { v3[0], v3[1], v3[2], 0.0f };
+	D3DMatrix_TransformVec4( v, m, v );
+	out3[0] = v[0];
+	out3[1] = v[1];
+	out3[2] = v[2];
+}
@@ -0,0 +1,115 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_MATRIX_MATH_H
+#define QINDIEGL_D3D_MATRIX_MATH_H
+
+//==================================================================================
+// 4x4 matrix kernels
+//----------------------------------------------------------------------------------
+// Matrices are 16 floats laid out like D3DXMATRIX: row-major, row vectors,
+// translation in elements 12..14. This is the same memory layout as an OpenGL
+// column-major matrix, so GL matrices can be passed in as is.
+//
+// The module depends on nothing but the CRT and the SSE intrinsics, so it can
+// be compiled into the tests on any platform. Every kernel has a scalar
+// reference version (_Ref) and, on x86/x64, an SSE version (_SSE); the
+// unsuffixed entry points pick one of them depending on D3DMatrix_UseSSE().
+// Output may alias any input.
+//==================================================================================
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#define QINDIEGL_MATRIX_SSE		1
+#else
+#define QINDIEGL_MATRIX_SSE		0
+#endif
+
+// Matrix classes, from the most special to the most general one. Every class
+// includes the ones above it, so the class of a product is never lower than
+// the classes of its factors (see D3DMatrix_CombineTypes).
+enum D3DMatrixType
+{
+	D3DMT_IDENTITY = 0,		// I
+	D3DMT_TRANSLATION,		// I plus a translation row
+	D3DMT_SCALE,			// diagonal 3x3 plus a translation row
+	D3DMT_RIGID,			// orthonormal 3x3 plus a translation row
+	D3DMT_AFFINE,			// last column is (0, 0, 0, 1)
+	D3DMT_ORTHO,			// last column is (0, 0, 0, w), w != 0: no perspective divide
+	D3DMT_PROJECTIVE		// anything else
+};
+
+void D3DMatrix_UseSSE( bool enable );
+bool D3DMatrix_IsUsingSSE();
+
+// Builders
+void D3DMatrix_Identity( float *out );
+void D3DMatrix_Translation( float *out, float x, float y, float z );
+void D3DMatrix_Scaling( float *out, float x, float y, float z );
+void D3DMatrix_RotationAxis( float *out, float angle, float x, float y, float z );
+void D3DMatrix_FrustumRH( float *out, float l, float r, float b, float t, float zn, float zf );
+void D3DMatrix_OrthoRH( float *out, float l, float r, float b, float t, float zn, float zf );
+
+// Queries
+bool D3DMatrix_IsIdentity( const float *m );
+bool D3DMatrix_IsAffine( const float *m );
+
+D3DMatrixType D3DMatrix_Classify( const float *m );
+D3DMatrixType D3DMatrix_CombineTypes( D3DMatrixType a, D3DMatrixType b );
+
+// out = a * b
+void D3DMatrix_Multiply( float *out, const float *a, const float *b );
+// out = a * b for an affine a; skips the known last column of a
+void D3DMatrix_MultiplyAffine( float *out, const float *a, const float *b );
+void D3DMatrix_Transpose( float *out, const float *m );
+// General inverse; returns false and leaves out untouched if m is singular
+bool D3DMatrix_Inverse( float *out, const float *m );
+// Inverse of a matrix with (0,0,0,1) last column; same contract as above
+bool D3DMatrix_InverseAffine( float *out, const float *m );
+
+// Inverse using the cheapest method valid for the given class of m
+bool D3DMatrix_InverseTyped( float *out, const float *m, D3DMatrixType type );
+
+// out4 = (v.x, v.y, v.z, 1) * m
+void D3DMatrix_TransformPoint( float *out4, const float *m, const float *v3 );
+// out3 = ((v.x, v.y, v.z, 1) * m) projected back to w = 1
+void D3DMatrix_TransformCoord( float *out3, const float *m, const float *v3 );
+// out3 = (v.x, v.y, v.z, 0) * m
+void D3DMatrix_TransformNormal( float *out3, const float *m, const float *v3 );
+// out4 = v4 * m
+void D3DMatrix_TransformVec4( float *out4, const float *m, const float *v4 );
+
+// Kernels behind the dispatching entry points above
+void D3DMatrix_Multiply_Ref( float *out, const float *a, const float *b );
+void D3DMatrix_MultiplyAffine_Ref( float *out, const float *a, const float *b );
+void D3DMatrix_Transpose_Ref( float *out, const float *m );
+bool D3DMatrix_Inverse_Ref( float *out, const float *m );
+bool D3DMatrix_InverseAffine_Ref( float *out, const float *m );
+void D3DMatrix_TransformVec4_Ref( float *out4, const float *m, const float *v4 );
+
+#if QINDIEGL_MATRIX_SSE
+void D3DMatrix_Multiply_SSE( float *out, const float *a, const float *b );
+void D3DMatrix_MultiplyAffine_SSE( float *out, const float *a, const float *b );
+void D3DMatrix_Transpose_SSE( float *out, const float *m );
+bool D3DMatrix_Inverse_SSE( float *out, const float *m );
+bool D3DMatrix_InverseAffine_SSE( float *out, const float *m );
+void D3DMatrix_TransformVec4_SSE( float *out4, const float *m, const float *v4 );
+#endif
+
+#endif //QINDIEGL_D3D_MATRIX_MATH_H
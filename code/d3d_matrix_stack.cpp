@@ -31,39 +31,31 @@ void D3DStateMatrix :: set_dirty()
 	m_inverse_dirty = TRUE;
 	m_transpose_dirty = TRUE;
 	m_invtrans_dirty = TRUE;
-	m_identity_dirty = TRUE;
-	m_identity = FALSE;
+	m_type_dirty = TRUE;
+	m_type = D3DMT_PROJECTIVE;
 }
 
 void D3DStateMatrix :: set_identity()
 {
-	m_inverse_dirty = TRUE;
-	m_transpose_dirty = TRUE;
-	m_invtrans_dirty = TRUE;
-
-	m_identity_dirty = FALSE;
-	m_identity = TRUE;
+	set_type( D3DMT_IDENTITY );
 }
 
-BOOL D3DStateMatrix::is_identity()
+// The matrix was changed by an operation whose result class is known,
+// so there is no need to classify it again
+void D3DStateMatrix :: set_type( D3DMatrixType type )
 {
-	check_identity();
-	return m_identity;
-}
+	m_inverse_dirty = TRUE;
+	m_transpose_dirty = TRUE;
+	m_invtrans_dirty = TRUE;
 
-BOOL D3DStateMatrix::is_ortho()
-{
-	return m_matrix._34 >= 0;
+	m_type_dirty = FALSE;
+	m_type = type;
 }
 
 void D3DStateMatrix :: check_inverse()
 {
 	if (m_inverse_dirty) {
-		if (m_identity) {
-			memcpy( m_inverse, m_matrix, sizeof(D3DXMATRIX) );
-		} else {
-			D3DXMatrixInverse( &m_inverse, nullptr, &m_matrix );
-		}
+		D3DMatrix_InverseTyped( &m_inverse.m[0][0], &m_matrix.m[0][0], type() );
 		m_inverse_dirty = FALSE;
 	}
 }
@@ -71,10 +63,10 @@ void D3DStateMatrix :: check_inverse()
 void D3DStateMatrix :: check_transpose()
 {
 	if (m_transpose_dirty) {
-		if (m_identity) {
+		if (is_identity()) {
 			memcpy( m_transpose, m_matrix, sizeof(D3DXMATRIX) );
 		} else {
-			D3DXMatrixTranspose( &m_transpose, &m_matrix );
+			D3DMatrix_Transpose( &m_transpose.m[0][0], &m_matrix.m[0][0] );
 		}
 		m_transpose_dirty = FALSE;
 	}
@@ -83,60 +75,164 @@ void D3DStateMatrix :: check_transpose()
 void D3DStateMatrix :: check_invtrans()
 {
 	if (m_invtrans_dirty) {
-		if (m_identity) {
+		if (is_identity()) {
 			memcpy( m_invtrans, m_matrix, sizeof(D3DXMATRIX) );
 		} else {
 			check_inverse();
-			D3DXMatrixTranspose( &m_invtrans, &m_inverse );
+			D3DMatrix_Transpose( &m_invtrans.m[0][0], &m_inverse.m[0][0] );
 		}
 		m_invtrans_dirty = FALSE;
 	}
 }
 
-void D3DStateMatrix :: check_identity()
+void D3DStateMatrix :: check_type()
 {
-	if (m_identity_dirty) {
-		m_identity = D3DXMatrixIsIdentity(&m_matrix);
-		m_identity_dirty = FALSE;
+	if (m_type_dirty) {
+		m_type = D3DMatrix_Classify( &m_matrix.m[0][0] );
+		m_type_dirty = FALSE;
 	}
 }
 
 //----------------------------------------------------------------
 
-D3DMatrixStack :: D3DMatrixStack() : m_iStackDepth( 0 )
+D3DMatrixStack :: D3DMatrixStack() : m_iStackDepth( 0 ), m_iSharedFrom( 0 ), m_PendingType( D3DMT_IDENTITY )
 {
-	for ( int i = 0; i < D3D_MAX_MATRIX_STACK_DEPTH; ++i) {
-		D3DXMatrixIdentity( m_Stack[i] );
-		m_Stack[i].set_identity();
+	D3DMatrix_Identity( m_Top.data() );
+	m_Top.set_identity();
+	D3DMatrix_Identity( &m_Pending.m[0][0] );
+}
+
+// Levels that still refer to the top get their own copy before the top changes
+void D3DMatrixStack :: detach()
+{
+	if ( m_iSharedFrom == m_iStackDepth )
+		return;
+
+	D3DMatrixType type = m_Top.type();
+	for ( int i = m_iSharedFrom; i < m_iStackDepth; ++i ) {
+		memcpy( &m_Saved[i].matrix.m[0][0], m_Top.data(), sizeof(D3DXMATRIX) );
+		m_Saved[i].type = type;
 	}
+	m_iSharedFrom = m_iStackDepth;
+}
+
+void D3DMatrixStack :: fold()
+{
+	if ( m_PendingType == D3DMT_IDENTITY )
+		return;
+
+	D3DMatrixType ttype = m_Top.type();
+	if ( ttype == D3DMT_IDENTITY )
+		memcpy( m_Top.data(), &m_Pending.m[0][0], sizeof(D3DXMATRIX) );
+	else
+		D3DMatrix_MultiplyAffine( m_Top.data(), &m_Pending.m[0][0], m_Top.data() );
+	m_Top.set_type( D3DMatrix_CombineTypes( m_PendingType, ttype ) );
+
+	D3DMatrix_Identity( &m_Pending.m[0][0] );
+	m_PendingType = D3DMT_IDENTITY;
+}
+
+// pending = m * pending, m is affine
+void D3DMatrixStack :: defer( const FLOAT *m, D3DMatrixType type )
+{
+	detach();
+	if ( m_PendingType == D3DMT_IDENTITY )
+		memcpy( &m_Pending.m[0][0], m, sizeof(D3DXMATRIX) );
+	else
+		D3DMatrix_MultiplyAffine( &m_Pending.m[0][0], m, &m_Pending.m[0][0] );
+	m_PendingType = D3DMatrix_CombineTypes( type, m_PendingType );
+}
+
+D3DStateMatrix &D3DMatrixStack :: modify_top()
+{
+	fold();
+	detach();
+	m_Top.set_dirty();
+	return m_Top;
 }
 
 void D3DMatrixStack :: load_identity()
 {
-	D3DXMatrixIdentity( this->top() );
-	this->top().set_identity();
+	detach();
+	D3DMatrix_Identity( m_Top.data() );
+	m_Top.set_identity();
+	D3DMatrix_Identity( &m_Pending.m[0][0] );
+	m_PendingType = D3DMT_IDENTITY;
 }
 
 void D3DMatrixStack :: load( const GLfloat *m )
 {
-	memcpy( this->top(), m, sizeof(GLfloat)*16 );
-	this->top().set_dirty();
+	detach();
+	memcpy( m_Top.data(), m, sizeof(GLfloat)*16 );
+	m_Top.set_dirty();
+	D3DMatrix_Identity( &m_Pending.m[0][0] );
+	m_PendingType = D3DMT_IDENTITY;
 }
 
 void D3DMatrixStack :: multiply( const GLfloat *m )
 {
-	FLOAT temp[16];
-	memcpy( temp, m, sizeof(FLOAT)*16 );
-	D3DXMatrixMultiply( this->top(), (D3DXMATRIX*)temp, this->top() );
-	this->top().set_dirty();
+	D3DMatrixType mtype = D3DMatrix_Classify( m );
+	if ( mtype == D3DMT_IDENTITY )
+		return;
+	if ( mtype <= D3DMT_AFFINE ) {
+		defer( m, mtype );
+		return;
+	}
+
+	fold();
+	detach();
+	D3DMatrixType ttype = m_Top.type();
+	if ( ttype == D3DMT_IDENTITY )
+		memcpy( m_Top.data(), m, sizeof(GLfloat)*16 );
+	else
+		D3DMatrix_Multiply( m_Top.data(), m, m_Top.data() );
+	m_Top.set_type( D3DMatrix_CombineTypes( mtype, ttype ) );
+}
+
+void D3DMatrixStack :: translate( GLfloat x, GLfloat y, GLfloat z )
+{
+	if ( x == 0.0f && y == 0.0f && z == 0.0f )
+		return;
+
+	detach();
+	FLOAT *m = &m_Pending.m[0][0];
+	// T * P only changes the translation row: r3 += x*r0 + y*r1 + z*r2
+	for ( int i = 0; i < 3; ++i )
+		m[12+i] += x * m[i] + y * m[4+i] + z * m[8+i];
+	m_PendingType = D3DMatrix_CombineTypes( D3DMT_TRANSLATION, m_PendingType );
+}
+
+void D3DMatrixStack :: scale( GLfloat x, GLfloat y, GLfloat z )
+{
+	if ( x == 1.0f && y == 1.0f && z == 1.0f )
+		return;
+
+	detach();
+	FLOAT *m = &m_Pending.m[0][0];
+	// S * P only scales the first three rows
+	for ( int i = 0; i < 3; ++i ) {
+		m[i] *= x;
+		m[4+i] *= y;
+		m[8+i] *= z;
+	}
+	m_PendingType = D3DMatrix_CombineTypes( D3DMT_SCALE, m_PendingType );
+}
+
+void D3DMatrixStack :: rotate( GLfloat angle, GLfloat x, GLfloat y, GLfloat z )
+{
+	FLOAT r[16];
+	D3DMatrix_RotationAxis( r, D3DXToRadian( angle ), x, y, z );
+	if ( D3DMatrix_IsIdentity( r ) )
+		return;
+	defer( r, D3DMT_RIGID );
 }
 
 HRESULT D3DMatrixStack :: push()
 {
 	if (m_iStackDepth == (D3D_MAX_MATRIX_STACK_DEPTH-1))
 		return E_STACK_OVERFLOW;
+	fold();
 	++m_iStackDepth;
-	memcpy(	this->m_Stack[m_iStackDepth], this->m_Stack[m_iStackDepth-1], sizeof(D3DStateMatrix) );
 	return S_OK;
 }
 
@@ -148,5 +244,14 @@ HRESULT D3DMatrixStack :: pop()
 		return E_STACK_UNDERFLOW;
 	}
 	--m_iStackDepth;
+	if (m_iStackDepth < m_iSharedFrom) {
+		// the top was written since the matching push; whatever is still
+		// pending belonged to the level being dropped
+		memcpy( m_Top.data(), &m_Saved[m_iStackDepth].matrix.m[0][0], sizeof(D3DXMATRIX) );
+		m_Top.set_type( m_Saved[m_iStackDepth].type );
+		m_iSharedFrom = m_iStackDepth;
+		D3DMatrix_Identity( &m_Pending.m[0][0] );
+		m_PendingType = D3DMT_IDENTITY;
+	}
 	return S_OK;
-}
\ No newline at end of file
+}
@@ -21,6 +21,8 @@
 #ifndef QINDIEGL_D3D_MATRIX_STACK_H
 #define QINDIEGL_D3D_MATRIX_STACK_H
 
+#include "d3d_matrix_math.hpp"
+
 #define D3D_MAX_MATRIX_STACK_DEPTH		32
 
 class D3DStateMatrix
@@ -31,11 +33,16 @@ public:
 
 	void set_dirty();
 	void set_identity();
-	BOOL is_identity();
-	BOOL is_ortho();
+	void set_type( D3DMatrixType type );
+	D3DMatrixType type()				{ check_type(); return m_type; }
+	BOOL is_identity()					{ return type() == D3DMT_IDENTITY; }
+	BOOL is_affine()					{ return type() <= D3DMT_AFFINE; }
+	BOOL is_ortho()						{ return type() <= D3DMT_ORTHO; }
 
 	operator D3DXMATRIX *()				{ return &m_matrix; }
 	operator const D3DXMATRIX *() const	{ return &m_matrix; }
+	FLOAT *data()						{ return &m_matrix.m[0][0]; }
+	const FLOAT *data() const			{ return &m_matrix.m[0][0]; }
 	const D3DXMATRIX *inverse() 		{ check_inverse(); return &m_inverse; }
 	const D3DXMATRIX *transpose() 		{ check_transpose(); return &m_transpose; }
 	const D3DXMATRIX *invtrans()		{ check_invtrans(); return &m_invtrans; }
@@ -44,7 +51,7 @@ private:
 	void check_inverse();
 	void check_transpose();
 	void check_invtrans();
-	void check_identity();
+	void check_type();
 
 private:
 	D3DXMATRIX	m_matrix;
@@ -54,31 +61,62 @@ private:
 	BOOL		m_inverse_dirty;
 	BOOL		m_transpose_dirty;
 	BOOL		m_invtrans_dirty;
-	BOOL		m_identity_dirty;
-	BOOL		m_identity;
+	BOOL		m_type_dirty;
+	D3DMatrixType	m_type;
 };
 
+//==================================================================================
+// Only the top of the stack is a full D3DStateMatrix with its derived matrices;
+// the levels below keep just the base matrix and its class. A push does not copy
+// anything: the new level keeps referring to the top until the top is written
+// (see detach), so a push/pop pair around code that does not touch the matrix
+// costs nothing and keeps the derived matrices of the top valid.
+//
+// Affine operations (glTranslate/glRotate/glScale and affine glMultMatrix) are
+// not applied to the top right away: they are concatenated into a pending
+// affine matrix, which is folded into the top when the top is read or saved.
+// A pop that restores a saved level just drops it.
+//==================================================================================
 class D3DMatrixStack
 {
 public:
 	D3DMatrixStack();
 	~D3DMatrixStack() {}
 
-	D3DStateMatrix &top()				{ return m_Stack[m_iStackDepth]; }
-	const D3DStateMatrix &top() const	{ return m_Stack[m_iStackDepth]; }
+	D3DStateMatrix &top()				{ fold(); return m_Top; }
 	int stack_depth() const				{ return m_iStackDepth; }
 	int max_stack_depth() const			{ return D3D_MAX_MATRIX_STACK_DEPTH; }
 
+	// Top matrix for direct writes; the caller is done with it before the next stack call
+	D3DStateMatrix &modify_top();
+
 	void load_identity();
 	void load( const GLfloat *m );
 	void multiply( const GLfloat *m );
+	void translate( GLfloat x, GLfloat y, GLfloat z );
+	void scale( GLfloat x, GLfloat y, GLfloat z );
+	void rotate( GLfloat angle, GLfloat x, GLfloat y, GLfloat z );
 
 	HRESULT push();
 	HRESULT pop();
 
 private:
+	void detach();
+	void fold();
+	void defer( const FLOAT *m, D3DMatrixType type );
+
+	struct D3DMatrixLevel
+	{
+		D3DXMATRIX		matrix;
+		D3DMatrixType	type;
+	};
+
 	int				m_iStackDepth;
-	D3DStateMatrix	m_Stack[D3D_MAX_MATRIX_STACK_DEPTH];
+	int				m_iSharedFrom;		// levels [m_iSharedFrom, m_iStackDepth) are still equal to the top
+	D3DStateMatrix	m_Top;
+	D3DXMATRIX		m_Pending;			// applied before the top: top = pending * top
+	D3DMatrixType	m_PendingType;		// D3DMT_IDENTITY when nothing is pending
+	D3DMatrixLevel	m_Saved[D3D_MAX_MATRIX_STACK_DEPTH-1];
 };
 
 #endif //QINDIEGL_D3D_MATRIX_STACK_H
\ No newline at end of file
@@ -23,6 +23,9 @@
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
 #include "d3d_matrix_stack.hpp"
+#include "d3d_pixels.hpp"
+#include "d3d_lists.hpp"
+#include "d3d_feedback.hpp"
 
 //==================================================================================
 // Misc functions
@@ -30,13 +33,21 @@
 
 OPENGL_API void WINAPI glClear( GLbitfield mask )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_CLEAR, mask );
+
 	if (!D3DGlobal.initialized) {
 		D3DGlobal.lastError = E_FAIL;
 		return;
 	}
+	//nothing is written to the framebuffer in selection and feedback modes
+	if (D3DFeedback_IsActive())
+		return;
 	DWORD clearMask = 0;
 	if (mask & GL_COLOR_BUFFER_BIT) clearMask |= D3DCLEAR_TARGET;
-	if (mask & GL_DEPTH_BUFFER_BIT) clearMask |= D3DCLEAR_ZBUFFER;
+	if (mask & GL_DEPTH_BUFFER_BIT) {
+		clearMask |= D3DCLEAR_ZBUFFER;
+		D3DPixels_InvalidateDepthCache();
+	}
 	if (mask & GL_STENCIL_BUFFER_BIT) clearMask |= D3DCLEAR_STENCIL;
 
 	HRESULT hr = D3DGlobal.pDevice->Clear( 0, nullptr, clearMask & ~(D3DGlobal.ignoreClearMask), D3DState.ColorBufferState.clearColor, D3DState.DepthBufferState.clearDepth, D3DState.StencilBufferState.clearStencil );
@@ -44,6 +55,7 @@ OPENGL_API void WINAPI glClear( GLbitfield mask )
 }
 OPENGL_API void WINAPI glClearColor( GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_CLEAR_COLOR, red, green, blue, alpha );
 	DWORD da = (DWORD)(alpha * 255);
 	DWORD dr = (DWORD)(red * 255);
 	DWORD dg = (DWORD)(green * 255);
@@ -52,10 +64,12 @@ OPENGL_API void WINAPI glClearColor( GLclampf red, GLclampf green, GLclampf blue
 }
 OPENGL_API void WINAPI glClearDepth( GLclampd depth )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_CLEAR_DEPTH, depth );
 	D3DState.DepthBufferState.clearDepth = (float)depth;
 }
 OPENGL_API void WINAPI glClearStencil( GLint s )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_CLEAR_STENCIL, s );
 	D3DState.StencilBufferState.clearStencil = s;
 }
 OPENGL_API void WINAPI glClearIndex( GLfloat )
@@ -69,6 +83,8 @@ OPENGL_API void WINAPI glClearAccum( GLfloat, GLfloat, GLfloat, GLfloat )
 }
 OPENGL_API void WINAPI glColorMask( GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_COLOR_MASK, red, green, blue, alpha );
+
 	DWORD mask = 0;
 	if (red) mask |= D3DCOLORWRITEENABLE_RED;
 	if (green) mask |= D3DCOLORWRITEENABLE_GREEN;
@@ -81,6 +97,7 @@ OPENGL_API void WINAPI glColorMask( GLboolean red, GLboolean green, GLboolean bl
 }
 OPENGL_API void WINAPI glCullFace( GLenum mode )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_CULL_FACE, mode );
 	if (D3DState.PolygonState.cullMode != mode) {
 		D3DState.PolygonState.cullMode = mode;
 		D3DState_SetCullMode();
@@ -88,6 +105,7 @@ OPENGL_API void WINAPI glCullFace( GLenum mode )
 }
 OPENGL_API void WINAPI glFrontFace( GLenum mode )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_FRONT_FACE, mode );
 	if (D3DState.PolygonState.frontFace != mode) {
 		D3DState.PolygonState.frontFace = mode;
 		D3DState_SetCullMode();
@@ -95,6 +113,7 @@ OPENGL_API void WINAPI glFrontFace( GLenum mode )
 }
 OPENGL_API void WINAPI glDepthFunc( GLenum func )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_DEPTH_FUNC, func );
 	DWORD dfunc = UTIL_GLtoD3DCmpFunc(func);
 	if (dfunc != D3DState.DepthBufferState.depthTestFunc) {
 		D3DState.DepthBufferState.depthTestFunc = dfunc;
@@ -103,6 +122,7 @@ OPENGL_API void WINAPI glDepthFunc( GLenum func )
 }
 OPENGL_API void WINAPI glDepthMask( GLboolean flag )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_DEPTH_MASK, flag );
 	if (D3DState.DepthBufferState.depthWriteMask != flag) {
 		D3DState.DepthBufferState.depthWriteMask = flag;
 		D3DState_SetRenderState( D3DRS_ZWRITEENABLE, flag );
@@ -110,6 +130,7 @@ OPENGL_API void WINAPI glDepthMask( GLboolean flag )
 }
 OPENGL_API void WINAPI glDepthRange( GLclampd zNear, GLclampd zFar )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_DEPTH_RANGE, zNear, zFar );
 	D3DState.viewport.MinZ = (float)zNear;
 	D3DState.viewport.MaxZ = (float)zFar;
 	if (!D3DGlobal.initialized) {
@@ -135,6 +156,8 @@ OPENGL_API void WINAPI glReadBuffer( GLenum )
 }
 OPENGL_API void WINAPI glPolygonMode( GLenum face, GLenum mode )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_POLYGON_MODE, face, mode );
+
 	if (face != GL_FRONT_AND_BACK) {
 		logPrintf("WARNING: glPolygonMode: only GL_FRONT_AND_BACK is supported\n");
 	}
@@ -148,6 +171,7 @@ OPENGL_API void WINAPI glPolygonMode( GLenum face, GLenum mode )
 }
 OPENGL_API void WINAPI glPolygonOffset( GLfloat factor, GLfloat units )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_POLYGON_OFFSET, factor, units );
 	//WG: not sure about these values, but it solved the decals looking wrong from a distance in Wolf
 	D3DState.PolygonState.depthBiasFactor = factor; //-factor * 0.0025f;
 	D3DState.PolygonState.depthBiasUnits = units / 250000.0f; //units * 0.000125f;
@@ -177,8 +201,10 @@ OPENGL_API void WINAPI glLineStipple( GLint, GLushort )
 		logPrintf("WARNING: glLineStipple is not supported\n");
 	}
 }
-OPENGL_API void WINAPI glLineWidth( GLfloat )
+OPENGL_API void WINAPI glLineWidth( GLfloat width )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_LINE_WIDTH, width );
+
 	static bool warningPrinted = false;
 	if (!warningPrinted) {
 		warningPrinted = true;
@@ -187,6 +213,8 @@ OPENGL_API void WINAPI glLineWidth( GLfloat )
 }
 OPENGL_API void WINAPI glShadeModel( GLenum mode )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_SHADE_MODEL, mode );
+
 	const DWORD dmode = (mode == GL_FLAT) ? D3DSHADE_FLAT : D3DSHADE_GOURAUD;
 
 	if (dmode != D3DState.LightingState.shadeMode) {
@@ -196,6 +224,7 @@ OPENGL_API void WINAPI glShadeModel( GLenum mode )
 }
 OPENGL_API void WINAPI glPointSize( GLfloat size )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_POINT_SIZE, size );
 	size = QINDIEGL_MAX( QINDIEGL_MIN( size, D3DGlobal.hD3DCaps.MaxPointSize ), 1.0f );
 	if (D3DState.PointState.pointSize != size) {
 		D3DState.PointState.pointSize = size;
@@ -217,6 +246,7 @@ OPENGL_API void WINAPI glFinish()
 }
 OPENGL_API void WINAPI glViewport( GLint x, GLint y, GLsizei width, GLsizei height )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_VIEWPORT, x, y, width, height );
 	// translate from OpenGL bottom-left to D3D top-left
 	y = D3DGlobal.hCurrentMode.Height - (height + y);
 
@@ -263,6 +293,7 @@ OPENGL_API void WINAPI glViewport( GLint x, GLint y, GLsizei width, GLsizei heig
 			// What if game loads a new matrix after this call?
 			float x0 = 2.0f * (-(float)tx) / width;
 			float x1 = 2.0f * ((float)ty) / height;
+			pm = D3DGlobal.projectionMatrixStack->modify_top();
 			pm->m[2][0] = x0;
 			pm->m[2][1] = x1;
 		}
@@ -275,6 +306,7 @@ OPENGL_API void WINAPI glViewport( GLint x, GLint y, GLsizei width, GLsizei heig
 }
 OPENGL_API void WINAPI glScissor( GLint x, GLint y, GLsizei width, GLsizei height )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_SCISSOR, x, y, width, height );
 	// translate from OpenGL bottom-left to D3D top-left
 	y = D3DGlobal.hCurrentMode.Height - (height + y);
 
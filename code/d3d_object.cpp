@@ -29,7 +29,7 @@
 // OpenGL object management
 //==================================================================================
 
-D3DObjectBuffer :: D3DObjectBuffer() : m_size( 0 ), m_pBuffer( nullptr )
+D3DObjectBuffer :: D3DObjectBuffer() : m_size( 0 ), m_capacity( 0 ), m_pBuffer( nullptr )
 {
 }
 
@@ -41,43 +41,55 @@ D3DObjectBuffer :: ~D3DObjectBuffer()
 	UTIL_Free(m_pBuffer);
 }
 
+bool D3DObjectBuffer :: Grow( int size )
+{
+	if (size > m_capacity) {
+		int capacity = QINDIEGL_MAX( QINDIEGL_MAX( m_capacity * 2, 256 ), size );
+		D3DObj *pBuffer = (D3DObj*)UTIL_Realloc(m_pBuffer, sizeof(D3DObj) * capacity);
+		if (!pBuffer)
+			return false;
+		memset( pBuffer + m_capacity, 0, sizeof(D3DObj) * (capacity - m_capacity) );
+		m_pBuffer = pBuffer;
+		m_capacity = capacity;
+	}
+	if (size > m_size)
+		m_size = size;
+	return true;
+}
+
+void D3DObjectBuffer :: ReleaseName( int index )
+{
+	m_pBuffer[index].type = D3D_OBJECT_TYPE_NONE;
+	if (!m_pBuffer[index].freeListed) {
+		m_pBuffer[index].freeListed = true;
+		m_freeList.push_back( index );
+	}
+}
+
 HRESULT D3DObjectBuffer :: GenObjects( D3DObjType type, GLsizei count, GLuint *identifiers )
 {
 	if (!identifiers) return E_INVALIDARG;
-
-	//all identifiers must be subsequent
-	if (m_size >= count) {
-		for (int i = 0; i + count <= m_size; )	{
-			int j;
-			for (j = 0; j < count; ++j)	{
-				if (m_pBuffer[i+j].type != D3D_OBJECT_TYPE_NONE)
-					break;
-			}
-			if ( j < count ) {
-				i += j + 1;
+	if (count <= 0) return S_OK;
+
+	//single names are recycled; entries may have been taken by GetObjectData since they were freed
+	if (count == 1) {
+		while (!m_freeList.empty()) {
+			int index = m_freeList.back();
+			m_freeList.pop_back();
+			m_pBuffer[index].freeListed = false;
+			if (index >= m_size || m_pBuffer[index].type != D3D_OBJECT_TYPE_NONE)
 				continue;
-			}
-			//found a number of identifiers
-			for ( int k = 0; k < count; ++k ) {
-				m_pBuffer[i+k].type = type;
-				m_pBuffer[i+k].data.any = nullptr;
-				identifiers[k] = i+k+1;
-			}
+
+			m_pBuffer[index].type = type;
+			m_pBuffer[index].data.any = nullptr;
+			identifiers[0] = index+1;
 			return S_OK;
 		}
 	}
 
+	//all identifiers must be subsequent
 	int oldsize = m_size;
-	m_size += count;
-	if (!m_pBuffer) {
-		m_pBuffer = (D3DObj*)UTIL_Alloc(sizeof(D3DObj) * m_size);
-		memset( m_pBuffer, 0, sizeof(D3DObj) * m_size );
-	} else {
-		m_pBuffer = (D3DObj*)UTIL_Realloc(m_pBuffer, sizeof(D3DObj) * m_size);
-		memset( m_pBuffer + oldsize, 0, sizeof(D3DObj) * (m_size - oldsize) );
-	}
-
-	if (!m_pBuffer)
+	if (!Grow( m_size + count ))
 		return E_OUTOFMEMORY;
 
 	//allocated a number of identifiers
@@ -100,8 +112,12 @@ HRESULT D3DObjectBuffer :: DeleteObjects( D3DObjType type, GLsizei count, const
 			continue;
 
 		FreeObjectMemory(&m_pBuffer[identifiers[i]-1]);
-		m_pBuffer[identifiers[i]-1].type = D3D_OBJECT_TYPE_NONE;
+		ReleaseName( identifiers[i]-1 );
 	}
+
+	//give trailing names back to the contiguous range
+	while (m_size > 0 && m_pBuffer[m_size-1].type == D3D_OBJECT_TYPE_NONE)
+		--m_size;
 	return S_OK;
 }
 
@@ -122,16 +138,8 @@ void *D3DObjectBuffer :: GetObjectData( D3DObjType type, GLuint objIdentifier )
 	{
 		//create new object
 		if (objIdentifier > (GLuint)m_size) {
-			int oldsize = m_size;
-			m_size = objIdentifier;
-			if (!m_pBuffer) {
-				m_pBuffer = (D3DObj*)UTIL_Alloc(sizeof(D3DObj) * m_size);
-				memset( m_pBuffer, 0, sizeof(D3DObj) * m_size );
-			} else {
-				m_pBuffer = (D3DObj*)UTIL_Realloc(m_pBuffer, sizeof(D3DObj) * m_size);
-				memset( m_pBuffer + oldsize, 0, sizeof(D3DObj) * (m_size - oldsize) );
-			}
-			if (!m_pBuffer) return nullptr;
+			if (objIdentifier > (GLuint)INT_MAX || !Grow( (int)objIdentifier ))
+				return nullptr;
 			m_pBuffer[objIdentifier-1].data.any = nullptr;
 		} else { //or overwrite existing
 			FreeObjectMemory(&m_pBuffer[objIdentifier-1]);
@@ -160,7 +168,8 @@ void D3DObjectBuffer :: FreeObjectMemory( D3DObj *pObject )
 		switch (pObject->type)
 		{
 		case D3D_OBJECT_TYPE_TEXTURE:
-			//pObject->data.texture->DumpTexture();
+			if (D3DGlobal.settings.dumpTextures)
+				pObject->data.texture->DumpTexture();
 			delete pObject->data.texture;
 			break;
 		default:
@@ -21,6 +21,8 @@
 #ifndef QINDIEGL_D3D_OBJECT_H
 #define QINDIEGL_D3D_OBJECT_H
 
+#include <vector>
+
 class D3DTextureObject;
 
 typedef enum D3DObjType_e
@@ -33,6 +35,7 @@ typedef enum D3DObjType_e
 typedef struct D3DObj_s
 {
 	D3DObjType type;
+	bool freeListed;
 	union
 	{
 		D3DTextureObject *texture;
@@ -40,6 +43,9 @@ typedef struct D3DObj_s
 	} data;
 } D3DObj;
 
+// Dense table of GL object names. Single names are recycled from a free list,
+// multiple names are handed out as a contiguous range at the end of the table,
+// which grows geometrically.
 class D3DObjectBuffer
 {
 public:
@@ -53,9 +59,15 @@ public:
 protected:
 	void FreeObjectMemory( D3DObj *pObject );
 
+private:
+	bool Grow( int size );
+	void ReleaseName( int index );
+
 private:
 	int		m_size;
+	int		m_capacity;
 	D3DObj *m_pBuffer;
+	std::vector<int> m_freeList;
 };
 
 #endif //QINDIEGL_D3D_OBJECT_H
\ No newline at end of file
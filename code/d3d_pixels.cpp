@@ -23,6 +23,7 @@
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
 #include "d3d_pixels.hpp"
+#include "d3d_readback.hpp"
 
 //==================================================================================
 // Pixel operations
@@ -49,71 +50,90 @@ static inline unsigned int D3D_ByteSwap32( unsigned int x )
 	return(D3D_ByteSwap16(x&0xffff)<<16) |(D3D_ByteSwap16(x>>16));
 }
 
-inline void D3DPixels_ModifyA( GLubyte *a )
+// Pixel transfer scale, bias and color maps only depend on the channel value,
+// so they are folded into one table per channel whenever the state changes.
+static struct {
+	bool		valid;
+	bool		identity;
+	GLubyte		red[256];
+	GLubyte		green[256];
+	GLubyte		blue[256];
+	GLubyte		alpha[256];
+} s_transferTables;
+
+static GLubyte D3DPixels_TransferChannel( int value, float scale, float bias, const GLfloat *map, DWORD mapSize )
 {
-	float fA = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)(*a) / 255.0f) * D3DState.ClientPixelStoreState.transferAlphaScale + D3DState.ClientPixelStoreState.transferAlphaBias ));
+	float f = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)value / 255.0f) * scale + bias ));
 
 	if(D3DState.ClientPixelStoreState.transferMapColor)
-		fA = D3DState.ClientPixelStoreState.pixelmapAtoA[(DWORD)(fA *(D3DState.ClientPixelStoreState.pixelmapSizeAtoA-1))];
+		f = map[(DWORD)(f *(mapSize-1))];
 
-	*a = static_cast<GLubyte>( QINDIEGL_CLAMP( fA * 255.0f ) );
+	return static_cast<GLubyte>( QINDIEGL_CLAMP( f * 255.0f ) );
 }
 
-inline void D3DPixels_ModifyBGR( GLubyte *bgr )
+void D3DPixels_InvalidateTransferTables()
 {
-	float fR = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgr[2] / 255.0f) * D3DState.ClientPixelStoreState.transferRedScale + D3DState.ClientPixelStoreState.transferRedBias ));
-	float fG = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgr[1] / 255.0f) * D3DState.ClientPixelStoreState.transferGreenScale + D3DState.ClientPixelStoreState.transferGreenBias ));
-	float fB = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgr[0] / 255.0f) * D3DState.ClientPixelStoreState.transferBlueScale + D3DState.ClientPixelStoreState.transferBlueBias ));
+	s_transferTables.valid = false;
+}
 
-	if(D3DState.ClientPixelStoreState.transferMapColor) {
-		fR = D3DState.ClientPixelStoreState.pixelmapRtoR[(DWORD)(fR *(D3DState.ClientPixelStoreState.pixelmapSizeRtoR-1))];
-		fG = D3DState.ClientPixelStoreState.pixelmapGtoG[(DWORD)(fG *(D3DState.ClientPixelStoreState.pixelmapSizeGtoG-1))];
-		fB = D3DState.ClientPixelStoreState.pixelmapBtoB[(DWORD)(fB *(D3DState.ClientPixelStoreState.pixelmapSizeBtoB-1))];
+static void D3DPixels_UpdateTransferTables()
+{
+	if(s_transferTables.valid)
+		return;
+
+	const auto &state = D3DState.ClientPixelStoreState;
+	bool identity = true;
+	for( int i = 0; i < 256; ++i ) {
+		s_transferTables.red[i] = D3DPixels_TransferChannel( i, state.transferRedScale, state.transferRedBias, state.pixelmapRtoR, state.pixelmapSizeRtoR );
+		s_transferTables.green[i] = D3DPixels_TransferChannel( i, state.transferGreenScale, state.transferGreenBias, state.pixelmapGtoG, state.pixelmapSizeGtoG );
+		s_transferTables.blue[i] = D3DPixels_TransferChannel( i, state.transferBlueScale, state.transferBlueBias, state.pixelmapBtoB, state.pixelmapSizeBtoB );
+		s_transferTables.alpha[i] = D3DPixels_TransferChannel( i, state.transferAlphaScale, state.transferAlphaBias, state.pixelmapAtoA, state.pixelmapSizeAtoA );
+		if(s_transferTables.red[i] != i || s_transferTables.green[i] != i || s_transferTables.blue[i] != i || s_transferTables.alpha[i] != i)
+			identity = false;
 	}
 
-	bgr[2] = static_cast<GLubyte>( QINDIEGL_CLAMP( fR * 255.0f ) );
-	bgr[1] = static_cast<GLubyte>( QINDIEGL_CLAMP( fG * 255.0f ) );
-	bgr[0] = static_cast<GLubyte>( QINDIEGL_CLAMP( fB * 255.0f ) );
+	s_transferTables.identity = identity;
+	s_transferTables.valid = true;
 }
 
-inline void D3DPixels_ModifyBGRA( GLubyte *bgra )
+inline void D3DPixels_ModifyA( GLubyte *a )
 {
-	float fR = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[2] / 255.0f) * D3DState.ClientPixelStoreState.transferRedScale + D3DState.ClientPixelStoreState.transferRedBias ));
-	float fG = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[1] / 255.0f) * D3DState.ClientPixelStoreState.transferGreenScale + D3DState.ClientPixelStoreState.transferGreenBias ));
-	float fB = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[0] / 255.0f) * D3DState.ClientPixelStoreState.transferBlueScale + D3DState.ClientPixelStoreState.transferBlueBias ));
-	float fA = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[3] / 255.0f) * D3DState.ClientPixelStoreState.transferAlphaScale + D3DState.ClientPixelStoreState.transferAlphaBias ));
+	if(s_transferTables.identity)
+		return;
 
-	if(D3DState.ClientPixelStoreState.transferMapColor) {
-		fR = D3DState.ClientPixelStoreState.pixelmapRtoR[(DWORD)(fR *(D3DState.ClientPixelStoreState.pixelmapSizeRtoR-1))];
-		fG = D3DState.ClientPixelStoreState.pixelmapGtoG[(DWORD)(fG *(D3DState.ClientPixelStoreState.pixelmapSizeGtoG-1))];
-		fB = D3DState.ClientPixelStoreState.pixelmapBtoB[(DWORD)(fB *(D3DState.ClientPixelStoreState.pixelmapSizeBtoB-1))];
-		fA = D3DState.ClientPixelStoreState.pixelmapAtoA[(DWORD)(fA *(D3DState.ClientPixelStoreState.pixelmapSizeAtoA-1))];
-	}
+	*a = s_transferTables.alpha[*a];
+}
+
+inline void D3DPixels_ModifyBGR( GLubyte *bgr )
+{
+	if(s_transferTables.identity)
+		return;
 
-	bgra[2] = static_cast<GLubyte>( QINDIEGL_CLAMP( fR * 255.0f ) );
-	bgra[1] = static_cast<GLubyte>( QINDIEGL_CLAMP( fG * 255.0f ) );
-	bgra[0] = static_cast<GLubyte>( QINDIEGL_CLAMP( fB * 255.0f ) );
-	bgra[3] = static_cast<GLubyte>( QINDIEGL_CLAMP( fA * 255.0f ) );
+	bgr[2] = s_transferTables.red[bgr[2]];
+	bgr[1] = s_transferTables.green[bgr[1]];
+	bgr[0] = s_transferTables.blue[bgr[0]];
 }
 
-inline void D3DPixels_ModifyABGR( GLubyte *bgra )
+inline void D3DPixels_ModifyBGRA( GLubyte *bgra )
 {
-	float fR = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[3] / 255.0f) * D3DState.ClientPixelStoreState.transferRedScale + D3DState.ClientPixelStoreState.transferRedBias ));
-	float fG = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[2] / 255.0f) * D3DState.ClientPixelStoreState.transferGreenScale + D3DState.ClientPixelStoreState.transferGreenBias ));
-	float fB = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[1] / 255.0f) * D3DState.ClientPixelStoreState.transferBlueScale + D3DState.ClientPixelStoreState.transferBlueBias ));
-	float fA = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f,((float)bgra[0] / 255.0f) * D3DState.ClientPixelStoreState.transferAlphaScale + D3DState.ClientPixelStoreState.transferAlphaBias ));
+	if(s_transferTables.identity)
+		return;
 
-	if(D3DState.ClientPixelStoreState.transferMapColor) {
-		fR = D3DState.ClientPixelStoreState.pixelmapRtoR[(DWORD)(fR *(D3DState.ClientPixelStoreState.pixelmapSizeRtoR-1))];
-		fG = D3DState.ClientPixelStoreState.pixelmapGtoG[(DWORD)(fG *(D3DState.ClientPixelStoreState.pixelmapSizeGtoG-1))];
-		fB = D3DState.ClientPixelStoreState.pixelmapBtoB[(DWORD)(fB *(D3DState.ClientPixelStoreState.pixelmapSizeBtoB-1))];
-		fA = D3DState.ClientPixelStoreState.pixelmapAtoA[(DWORD)(fA *(D3DState.ClientPixelStoreState.pixelmapSizeAtoA-1))];
-	}
+	bgra[2] = s_transferTables.red[bgra[2]];
+	bgra[1] = s_transferTables.green[bgra[1]];
+	bgra[0] = s_transferTables.blue[bgra[0]];
+	bgra[3] = s_transferTables.alpha[bgra[3]];
+}
 
-	bgra[3] = static_cast<GLubyte>( QINDIEGL_CLAMP( fR * 255.0f ) );
-	bgra[2] = static_cast<GLubyte>( QINDIEGL_CLAMP( fG * 255.0f ) );
-	bgra[1] = static_cast<GLubyte>( QINDIEGL_CLAMP( fB * 255.0f ) );
-	bgra[0] = static_cast<GLubyte>( QINDIEGL_CLAMP( fA * 255.0f ) );
+inline void D3DPixels_ModifyABGR( GLubyte *bgra )
+{
+	if(s_transferTables.identity)
+		return;
+
+	bgra[3] = s_transferTables.red[bgra[3]];
+	bgra[2] = s_transferTables.green[bgra[2]];
+	bgra[1] = s_transferTables.blue[bgra[1]];
+	bgra[0] = s_transferTables.alpha[bgra[0]];
 }
 
 static void D3DPixels_UnpackPixel( int srcbytes, GLubyte *srcdata, int dstbytes, GLubyte *dstdata, eTexTypeInternal intfmt, DWORD channelMask, DWORD flags )
@@ -492,72 +512,6 @@ static void D3DPixels_PackDepthStencil( int srcbytes, const GLuint *srcdata, int
 
 #pragma warning( default: 4100 )
 
-template<typename T>
-static GLubyte D3DPixels_DisassemblePackedPixel( ePixelPackageInternal pack_mode, int comp, T pixel )
-{
-	DWORD dwPixel =(DWORD)pixel;
-	switch(pack_mode) {
-	default:
-		logPrintf("WARNING: unsupported packed pixel mode %i\n", pack_mode);
-		return 0;
-	case PP_TYPE_R3_G3_B2:
-		switch(comp) {
-		case 0:
-			return(GLubyte)((((dwPixel >> 5) & 7) * 255) / 7);
-		case 1:
-			return(GLubyte)((((dwPixel >> 2) & 7) * 255) / 7);
-		case 2:
-			return(GLubyte)(((dwPixel & 3) * 255) / 3);
-		default:
-			return 255;
-		}
-	case PP_TYPE_R4_G4_B4_A4:
-		switch(comp) {
-		case 0:
-			return(GLubyte)((((dwPixel >> 12) & 15) * 255) / 15);
-		case 1:
-			return(GLubyte)((((dwPixel >> 8) & 15) * 255) / 15);
-		case 2:
-			return(GLubyte)((((dwPixel >> 4) & 15) * 255) / 15);
-		default:
-			return(GLubyte)(((dwPixel & 15) * 255) / 15);
-		}
-	case PP_TYPE_R5_G5_B5_A1:
-		switch(comp) {
-		case 0:
-			return(GLubyte)((((dwPixel >> 11) & 31) * 255) / 31);
-		case 1:
-			return(GLubyte)((((dwPixel >> 6) & 31) * 255) / 31);
-		case 2:
-			return(GLubyte)((((dwPixel >> 1) & 31) * 255) / 31);
-		default:
-			return((dwPixel & 1) ? 255 : 0);
-		}
-	case PP_TYPE_R8_G8_B8_A8:
-		switch(comp) {
-		case 0:
-			return(GLubyte)((dwPixel >> 24) & 255);
-		case 1:
-			return(GLubyte)((dwPixel >> 16) & 255);
-		case 2:
-			return(GLubyte)((dwPixel >> 8) & 255);
-		default:
-			return(GLubyte)(dwPixel & 255);
-		}
-	case PP_TYPE_R10_G10_B10_A2:
-		switch(comp) {
-		case 0:
-			return(GLubyte)(((dwPixel >> 22) & 1023) >> 2);
-		case 1:
-			return(GLubyte)(((dwPixel >> 12) & 1023) >> 2);
-		case 2:
-			return(GLubyte)(((dwPixel >> 2) & 1023) >> 2);
-		default:
-			return(GLubyte)(((dwPixel & 3) * 255) / 3);
-		}
-	}
-}
-
 template<typename T>
 static T D3DPixels_AssemblePackedPixel( ePixelPackageInternal pack_mode, int num_comp, GLubyte *pixel )
 {
@@ -706,6 +660,142 @@ static T D3DPixels_AssemblePackedPixel( ePixelPackageInternal pack_mode, int num
 #pragma warning( disable: 4127 ) // conditional expression is constant
 #pragma warning( disable: 4244 ) // conversion, possible loss of data
 
+//=========================================
+// Unpack conversion tables
+//-----------------------------------------
+// Packed pixels are split with a per-format shift/mask and each field is
+// expanded through a small table. Plain channels of 8-bit types go through
+// a 256-entry table, wider types are scaled in fixed point and corrected
+// against the steps of the float formula, so results stay bit-identical.
+//=========================================
+typedef struct D3DPackedLayout_s
+{
+	int				shift[4];
+	DWORD			mask[4];
+	const GLubyte	*expand[4];
+} D3DPackedLayout;
+
+typedef struct D3DChannelSteps_s
+{
+	DWORD		mul;			//255 / max in 0.32 fixed point
+	DWORD		step[256];		//smallest value that converts to each byte
+} D3DChannelSteps;
+
+static struct {
+	bool				initialized;
+	GLubyte				expand1[2];
+	GLubyte				expand2[4];
+	GLubyte				expand3[8];
+	GLubyte				expand4[16];
+	GLubyte				expand5[32];
+	GLubyte				expand8[256];
+	GLubyte				expand10[1024];
+	GLubyte				opaque[1];
+	GLubyte				ubyteScale[256];
+	GLubyte				byteScale[256];
+	D3DChannelSteps		ushortSteps;
+	D3DChannelSteps		shortSteps;
+	D3DChannelSteps		uintSteps;
+	D3DChannelSteps		intSteps;
+	D3DPackedLayout		layouts[PP_TYPE_R10_G10_B10_A2 + 1];
+} s_unpackTables;
+
+template<typename T>
+static GLubyte D3DPixels_ScaleChannelReference( T value )
+{
+	return static_cast<GLubyte>( QINDIEGL_CLAMP(((GLfloat)value / std::numeric_limits<T>::max()) * 255) );
+}
+
+template<typename T>
+static void D3DPixels_BuildChannelSteps( D3DChannelSteps *steps )
+{
+	const UINT64 maxValue = (UINT64)std::numeric_limits<T>::max();
+	steps->mul = (DWORD)((255ull << 32) / maxValue);
+	steps->step[0] = 0;
+	for (int k = 1; k < 256; ++k) {
+		//the reference conversion is monotonic, find where it first reaches k
+		UINT64 lo = steps->step[k-1], hi = maxValue + 1;
+		while (lo < hi) {
+			UINT64 mid = (lo + hi) >> 1;
+			if (D3DPixels_ScaleChannelReference<T>( (T)mid ) >= k)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		steps->step[k] = (DWORD)QINDIEGL_MIN( lo, (UINT64)0xFFFFFFFF );
+	}
+}
+
+static void D3DPixels_SetPackedLayout( ePixelPackageInternal pack_mode, int comp, int shift, DWORD mask, const GLubyte *expand )
+{
+	s_unpackTables.layouts[pack_mode].shift[comp] = shift;
+	s_unpackTables.layouts[pack_mode].mask[comp] = mask;
+	s_unpackTables.layouts[pack_mode].expand[comp] = expand;
+}
+
+static void D3DPixels_InitUnpackTables()
+{
+	if (s_unpackTables.initialized)
+		return;
+
+	for (DWORD i = 0; i < 2; ++i) s_unpackTables.expand1[i] = i ? 255 : 0;
+	for (DWORD i = 0; i < 4; ++i) s_unpackTables.expand2[i] = (GLubyte)((i * 255) / 3);
+	for (DWORD i = 0; i < 8; ++i) s_unpackTables.expand3[i] = (GLubyte)((i * 255) / 7);
+	for (DWORD i = 0; i < 16; ++i) s_unpackTables.expand4[i] = (GLubyte)((i * 255) / 15);
+	for (DWORD i = 0; i < 32; ++i) s_unpackTables.expand5[i] = (GLubyte)((i * 255) / 31);
+	for (DWORD i = 0; i < 256; ++i) s_unpackTables.expand8[i] = (GLubyte)i;
+	for (DWORD i = 0; i < 1024; ++i) s_unpackTables.expand10[i] = (GLubyte)(i >> 2);
+	s_unpackTables.opaque[0] = 255;
+
+	for (int i = 0; i < 256; ++i) {
+		s_unpackTables.ubyteScale[i] = D3DPixels_ScaleChannelReference<GLubyte>( (GLubyte)i );
+		s_unpackTables.byteScale[i] = D3DPixels_ScaleChannelReference<GLbyte>( (GLbyte)i );
+	}
+	D3DPixels_BuildChannelSteps<GLushort>( &s_unpackTables.ushortSteps );
+	D3DPixels_BuildChannelSteps<GLshort>( &s_unpackTables.shortSteps );
+	D3DPixels_BuildChannelSteps<GLuint>( &s_unpackTables.uintSteps );
+	D3DPixels_BuildChannelSteps<GLint>( &s_unpackTables.intSteps );
+
+	D3DPixels_SetPackedLayout( PP_TYPE_R3_G3_B2, 0, 5, 7, s_unpackTables.expand3 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R3_G3_B2, 1, 2, 7, s_unpackTables.expand3 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R3_G3_B2, 2, 0, 3, s_unpackTables.expand2 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R3_G3_B2, 3, 0, 0, s_unpackTables.opaque );
+	D3DPixels_SetPackedLayout( PP_TYPE_R4_G4_B4_A4, 0, 12, 15, s_unpackTables.expand4 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R4_G4_B4_A4, 1, 8, 15, s_unpackTables.expand4 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R4_G4_B4_A4, 2, 4, 15, s_unpackTables.expand4 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R4_G4_B4_A4, 3, 0, 15, s_unpackTables.expand4 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R5_G5_B5_A1, 0, 11, 31, s_unpackTables.expand5 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R5_G5_B5_A1, 1, 6, 31, s_unpackTables.expand5 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R5_G5_B5_A1, 2, 1, 31, s_unpackTables.expand5 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R5_G5_B5_A1, 3, 0, 1, s_unpackTables.expand1 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R8_G8_B8_A8, 0, 24, 255, s_unpackTables.expand8 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R8_G8_B8_A8, 1, 16, 255, s_unpackTables.expand8 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R8_G8_B8_A8, 2, 8, 255, s_unpackTables.expand8 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R8_G8_B8_A8, 3, 0, 255, s_unpackTables.expand8 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R10_G10_B10_A2, 0, 22, 1023, s_unpackTables.expand10 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R10_G10_B10_A2, 1, 12, 1023, s_unpackTables.expand10 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R10_G10_B10_A2, 2, 2, 1023, s_unpackTables.expand10 );
+	D3DPixels_SetPackedLayout( PP_TYPE_R10_G10_B10_A2, 3, 0, 3, s_unpackTables.expand2 );
+
+	s_unpackTables.initialized = true;
+}
+
+static inline GLubyte D3DPixels_ScaleFixed( DWORD value, const D3DChannelSteps &steps )
+{
+	DWORD c = (DWORD)(((UINT64)value * steps.mul) >> 32);
+	if (c > 255) c = 255;
+	while (c < 255 && value >= steps.step[c+1]) ++c;
+	while (c > 0 && value < steps.step[c]) --c;
+	return (GLubyte)c;
+}
+
+static inline GLubyte D3DPixels_ScaleChannel( GLubyte value )	{ return s_unpackTables.ubyteScale[value]; }
+static inline GLubyte D3DPixels_ScaleChannel( GLbyte value )	{ return s_unpackTables.byteScale[(GLubyte)value]; }
+static inline GLubyte D3DPixels_ScaleChannel( GLushort value )	{ return D3DPixels_ScaleFixed( value, s_unpackTables.ushortSteps ); }
+static inline GLubyte D3DPixels_ScaleChannel( GLshort value )	{ return (value > 0) ? D3DPixels_ScaleFixed( (DWORD)value, s_unpackTables.shortSteps ) : 0; }
+static inline GLubyte D3DPixels_ScaleChannel( GLuint value )	{ return D3DPixels_ScaleFixed( value, s_unpackTables.uintSteps ); }
+static inline GLubyte D3DPixels_ScaleChannel( GLint value )		{ return (value > 0) ? D3DPixels_ScaleFixed( (DWORD)value, s_unpackTables.intSteps ) : 0; }
+
 template<typename T> 
 static void D3DPixels_UnpackInternal( ePixelPackageInternal pack_mode, int width, int height, int depth, int hpitch, int vpitch, GLubyte *dstbytes, int dstpixelsize, eTexTypeInternal intfmt, DWORD channelMask, DWORD flags, bool flipVertical, int fmtpixelsize, int realpixelsize, const T *pixels )
 {
@@ -729,6 +819,9 @@ static void D3DPixels_UnpackInternal( ePixelPackageInternal pack_mode, int width
 	in += D3DState.ClientPixelStoreState.unpackSkipRows * row_length;
 	in += D3DState.ClientPixelStoreState.unpackSkipImages * image_height;
 	
+	const D3DPackedLayout *layout = (pack_mode == PP_TYPE_UNPACKED) ? nullptr : &s_unpackTables.layouts[pack_mode];
+	const bool swapBytes = D3DState.ClientPixelStoreState.unpackSwapBytes && sizeof(T) > 1;
+
 	GLubyte *sliceptr = dstbytes;
 	for( int i = 0; i < depth; ++i ) {
 		GLubyte *rowptr = sliceptr;
@@ -736,27 +829,27 @@ static void D3DPixels_UnpackInternal( ePixelPackageInternal pack_mode, int width
 			for( int k = 0; k < width; ++k ) {
 				const T *ppixel = in + i*image_height +(flipVertical ?(height - j - 1) : j)*row_length + k*realpixelsize;
 
-				if(pack_mode == PP_TYPE_UNPACKED) {
+				if(!layout) {
 					for( int l = 0; l < fmtpixelsize; ++l ) {
 						T pixeldata = ppixel[l];
-						if(D3DState.ClientPixelStoreState.unpackSwapBytes) {
+						if(swapBytes) {
 							if(sizeof(T) == 4)
 								pixeldata = static_cast<T>( D3D_ByteSwap32(pixeldata) );
-							else if(sizeof(T) == 2)
+							else
 								pixeldata = static_cast<T>( D3D_ByteSwap16(pixeldata) );
 						}
-						ubpixel[l] = static_cast<GLubyte>( QINDIEGL_CLAMP(((GLfloat)pixeldata / std::numeric_limits<T>::max()) * 255) );
+						ubpixel[l] = D3DPixels_ScaleChannel( pixeldata );
 					}
 				} else {
-					T pixeldata = *ppixel;
-					if(D3DState.ClientPixelStoreState.unpackSwapBytes) {
+					DWORD pixeldata =(DWORD)*ppixel;
+					if(swapBytes) {
 						if(sizeof(T) == 4)
-						pixeldata = static_cast<T>( D3D_ByteSwap32(pixeldata) );
-					else if(sizeof(T) == 2)
-						pixeldata = static_cast<T>( D3D_ByteSwap16(pixeldata) );
+							pixeldata = D3D_ByteSwap32(pixeldata);
+						else
+							pixeldata = D3D_ByteSwap16((unsigned short)pixeldata);
 					}
 					for( int l = 0; l < fmtpixelsize; ++l ) {
-						ubpixel[l] = D3DPixels_DisassemblePackedPixel<T>( pack_mode, l, pixeldata );
+						ubpixel[l] = layout->expand[l][(pixeldata >> layout->shift[l]) & layout->mask[l]];
 					}
 				}
 				D3DPixels_UnpackPixel( fmtpixelsize, ubpixel, dstpixelsize, rowptr + k*dstpixelsize, intfmt, channelMask, flags );
@@ -1003,6 +1096,9 @@ HRESULT D3DPixels_Unpack( int width, int height, int depth, int hpitch, int vpit
 	if(FAILED(hr))
 		return hr;
 
+	D3DPixels_InitUnpackTables();
+	D3DPixels_UpdateTransferTables();
+
 	switch(type) {
 	case GL_UNSIGNED_BYTE:
 		D3DPixels_UnpackInternal<GLubyte>( PP_TYPE_UNPACKED, width, height, depth, hpitch, vpitch, dstbytes, dstpixelsize, intfmt, channelMask, flags, flipVertical, srcPixelSize, srcPixelSize,(const GLubyte*)pixels);
@@ -1058,6 +1154,8 @@ HRESULT D3DPixels_Pack( int width, int height, int depth, int hpitch, int vpitch
 	if(FAILED(hr))
 		return hr;
 
+	D3DPixels_UpdateTransferTables();
+
 	switch(type) {
 	case GL_UNSIGNED_BYTE:
 		D3DPixels_PackInternal<GLubyte>( PP_TYPE_UNPACKED, width, height, depth, hpitch, vpitch, srcbytes, srcpixelsize, intfmt, channelMask, flags, flipVertical, dstPixelSize, dstPixelSize,(GLubyte*)pixels);
@@ -1103,6 +1201,284 @@ HRESULT D3DPixels_Pack( int width, int height, int depth, int hpitch, int vpitch
 	return S_OK;
 }
 
+static bool D3DPixels_IsIdentityTransfer()
+{
+	if (D3DState.ClientPixelStoreState.transferMapColor ||
+		D3DState.ClientPixelStoreState.transferRedScale != 1.0f ||
+		D3DState.ClientPixelStoreState.transferGreenScale != 1.0f ||
+		D3DState.ClientPixelStoreState.transferBlueScale != 1.0f ||
+		D3DState.ClientPixelStoreState.transferAlphaScale != 1.0f ||
+		D3DState.ClientPixelStoreState.transferRedBias != 0.0f ||
+		D3DState.ClientPixelStoreState.transferGreenBias != 0.0f ||
+		D3DState.ClientPixelStoreState.transferBlueBias != 0.0f ||
+		D3DState.ClientPixelStoreState.transferAlphaBias != 0.0f)
+		return false;
+
+	return true;
+}
+
+bool D3DPixels_IsDefaultUnpackState()
+{
+	if (D3DState.ClientPixelStoreState.unpackSwapBytes ||
+		D3DState.ClientPixelStoreState.unpackRowLength ||
+		D3DState.ClientPixelStoreState.unpackImageHeight ||
+		D3DState.ClientPixelStoreState.unpackSkipPixels ||
+		D3DState.ClientPixelStoreState.unpackSkipRows ||
+		D3DState.ClientPixelStoreState.unpackSkipImages)
+		return false;
+
+	return D3DPixels_IsIdentityTransfer();
+}
+
+bool D3DPixels_IsDefaultPackState()
+{
+	if (D3DState.ClientPixelStoreState.packSwapBytes ||
+		D3DState.ClientPixelStoreState.packRowLength ||
+		D3DState.ClientPixelStoreState.packImageHeight ||
+		D3DState.ClientPixelStoreState.packSkipPixels ||
+		D3DState.ClientPixelStoreState.packSkipRows ||
+		D3DState.ClientPixelStoreState.packSkipImages)
+		return false;
+
+	return D3DPixels_IsIdentityTransfer();
+}
+
+int D3DPixels_GetUnpackedImageSize( int width, int height, int depth, GLenum format, GLenum type )
+{
+	DWORD flags;
+	int pixelSize;
+	DWORD channelMask;
+
+	HRESULT hr = D3DPixels_GetPixelInfo( format, pixelSize, channelMask, flags );
+	if(FAILED(hr))
+		return 0;
+
+	switch(type) {
+	case GL_UNSIGNED_BYTE:
+	case GL_BYTE:
+		break;
+	case GL_UNSIGNED_SHORT:
+	case GL_SHORT:
+		pixelSize *= 2;
+		break;
+	case GL_UNSIGNED_INT:
+	case GL_INT:
+	case GL_FLOAT:
+		pixelSize *= 4;
+		break;
+	case GL_UNSIGNED_BYTE_3_3_2_EXT:
+		pixelSize = 1;
+		break;
+	case GL_UNSIGNED_SHORT_5_5_5_1_EXT:
+	case GL_UNSIGNED_SHORT_4_4_4_4_EXT:
+		pixelSize = 2;
+		break;
+	case GL_UNSIGNED_INT_8_8_8_8_EXT:
+	case GL_UNSIGNED_INT_10_10_10_2_EXT:
+		pixelSize = 4;
+		break;
+	default:
+		return 0;
+	}
+
+	int row_length = width*pixelSize;
+	if(D3DState.ClientPixelStoreState.unpackAlignment > 0) {
+		int alignment = D3DState.ClientPixelStoreState.unpackAlignment - 1;
+		row_length =(row_length + alignment) & ~alignment;
+	}
+
+	//the last row is not padded
+	return (height*depth - 1)*row_length + width*pixelSize;
+}
+
+//=================================
+// Depth readback
+//---------------------------------
+// Only possible when the depth buffer was created with a lockable format
+// (ReadableDepth setting). The whole buffer is copied once and the copy is
+// reused until the depth buffer is cleared, something is drawn with depth
+// writes on, or the frame ends, so the reads for all flares drawn after the
+// scene cost a single transfer.
+//=================================
+
+static struct {
+	bool		valid;
+	D3DFORMAT	format;
+	int			width;
+	int			height;
+	int			pitch;
+	int			size;
+	GLubyte		*data;
+} s_depthCache;
+
+void D3DPixels_InvalidateDepthCache()
+{
+	s_depthCache.valid = false;
+}
+
+void D3DPixels_FreeDepthCache()
+{
+	if (s_depthCache.data)
+		UTIL_Free( s_depthCache.data );
+	memset( &s_depthCache, 0, sizeof(s_depthCache) );
+}
+
+bool D3DPixels_IsLockableDepthFormat( D3DFORMAT format )
+{
+	return (format == D3DFMT_D16_LOCKABLE || format == D3DFMT_D32_LOCKABLE || format == D3DFMT_D32F_LOCKABLE);
+}
+
+static int D3DPixels_GetDepthTypeSize( GLenum type )
+{
+	switch(type) {
+	case GL_UNSIGNED_BYTE:
+	case GL_BYTE:
+		return 1;
+	case GL_UNSIGNED_SHORT:
+	case GL_SHORT:
+		return 2;
+	case GL_UNSIGNED_INT:
+	case GL_INT:
+	case GL_FLOAT:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+//Returns the row length and the offset of the first pixel of a single component pack
+static void D3DPixels_GetDepthPackLayout( int width, int typeSize, int &row_length, int &offset )
+{
+	row_length = width*typeSize;
+	if(D3DState.ClientPixelStoreState.packRowLength > 0)
+		row_length = D3DState.ClientPixelStoreState.packRowLength*typeSize;
+	if(D3DState.ClientPixelStoreState.packAlignment > 0) {
+		int alignment = D3DState.ClientPixelStoreState.packAlignment - 1;
+		row_length =(row_length + alignment) & ~alignment;
+	}
+	offset = D3DState.ClientPixelStoreState.packSkipPixels*typeSize + D3DState.ClientPixelStoreState.packSkipRows*row_length;
+}
+
+static HRESULT D3DPixels_ClearDepthStencil( int width, int height, GLenum type, GLvoid *pixels )
+{
+	int typeSize = D3DPixels_GetDepthTypeSize( type );
+	if(!typeSize) {
+		logPrintf("WARNING: Texture data type 0x%x is not supported\n", type);
+		return E_INVALIDARG;
+	}
+
+	int row_length, offset;
+	D3DPixels_GetDepthPackLayout( width, typeSize, row_length, offset );
+	for(int i = 0; i < height; ++i)
+		memset((GLubyte*)pixels + offset + i*row_length, 0, width*typeSize );
+	return S_OK;
+}
+
+static HRESULT D3DPixels_UpdateDepthCache()
+{
+	if(s_depthCache.valid)
+		return S_OK;
+
+	LPDIRECT3DSURFACE9 lpDepthStencil = nullptr;
+	D3DSURFACE_DESC desc;
+	HRESULT hr = D3DGlobal.pDevice->GetDepthStencilSurface( &lpDepthStencil );
+	if(FAILED(hr))
+		return hr;
+	hr = lpDepthStencil->GetDesc( &desc );
+	if(FAILED(hr) || !D3DPixels_IsLockableDepthFormat( desc.Format ) || desc.MultiSampleType != D3DMULTISAMPLE_NONE) {
+		lpDepthStencil->Release();
+		return E_NOTIMPL;
+	}
+
+	int pixelSize = (desc.Format == D3DFMT_D16_LOCKABLE) ? 2 : 4;
+	int pitch = desc.Width * pixelSize;
+	int size = pitch * desc.Height;
+	if(size > s_depthCache.size) {
+		if(s_depthCache.data)
+			UTIL_Free( s_depthCache.data );
+		s_depthCache.data = (GLubyte*)UTIL_Alloc( size );
+		s_depthCache.size = s_depthCache.data ? size : 0;
+		if(!s_depthCache.data) {
+			lpDepthStencil->Release();
+			return E_OUTOFMEMORY;
+		}
+	}
+
+	D3DLOCKED_RECT lockrect;
+	hr = lpDepthStencil->LockRect( &lockrect, nullptr, D3DLOCK_NOSYSLOCK|D3DLOCK_READONLY );
+	if(FAILED(hr)) {
+		logPrintf("WARNING: glReadPixels: depth buffer LockRect failed with error '%s'\n", DXGetErrorString(hr));
+		lpDepthStencil->Release();
+		return hr;
+	}
+	for(UINT i = 0; i < desc.Height; ++i)
+		memcpy( s_depthCache.data + i*pitch, (GLubyte*)lockrect.pBits + i*lockrect.Pitch, pitch );
+	lpDepthStencil->UnlockRect();
+	lpDepthStencil->Release();
+
+	s_depthCache.format = desc.Format;
+	s_depthCache.width = desc.Width;
+	s_depthCache.height = desc.Height;
+	s_depthCache.pitch = pitch;
+	s_depthCache.valid = true;
+	return S_OK;
+}
+
+//E_NOTIMPL if the depth buffer can't be read
+static HRESULT D3DPixels_ReadDepth( GLint x, GLint y, GLsizei width, GLsizei height, GLenum type, GLvoid *pixels )
+{
+	int typeSize = D3DPixels_GetDepthTypeSize( type );
+	if(!typeSize) {
+		logPrintf("WARNING: Texture data type 0x%x is not supported\n", type);
+		return E_INVALIDARG;
+	}
+
+	HRESULT hr = D3DPixels_UpdateDepthCache();
+	if(FAILED(hr))
+		return hr;
+
+	int row_length, offset;
+	D3DPixels_GetDepthPackLayout( width, typeSize, row_length, offset );
+
+	//pixels outside of the buffer are left untouched
+	int x0 = QINDIEGL_MAX( x, 0 );
+	int y0 = QINDIEGL_MAX( y, 0 );
+	int x1 = QINDIEGL_MIN( x + width, s_depthCache.width );
+	int y1 = QINDIEGL_MIN( y + height, s_depthCache.height );
+
+	for(int j = y0; j < y1; ++j) {
+		//GL rows go bottom to top
+		const GLubyte *src = s_depthCache.data + (s_depthCache.height - j - 1)*s_depthCache.pitch;
+		GLubyte *out = (GLubyte*)pixels + offset + (j - y)*row_length + (x0 - x)*typeSize;
+		for(int k = x0; k < x1; ++k, out += typeSize) {
+			GLfloat depth;
+			switch(s_depthCache.format) {
+			case D3DFMT_D16_LOCKABLE:
+				depth = ((const GLushort*)src)[k] / 65535.0f;
+				break;
+			case D3DFMT_D32_LOCKABLE:
+				depth = (GLfloat)(((const GLuint*)src)[k] / 4294967295.0);
+				break;
+			default:
+				depth = ((const GLfloat*)src)[k];
+				break;
+			}
+			depth = QINDIEGL_MIN( 1.0f, QINDIEGL_MAX( 0.0f, depth ));
+
+			switch(type) {
+			case GL_UNSIGNED_BYTE:	*(GLubyte*)out = (GLubyte)(depth * 255.0f + 0.5f); break;
+			case GL_BYTE:			*(GLbyte*)out = (GLbyte)(depth * 127.0f + 0.5f); break;
+			case GL_UNSIGNED_SHORT:	*(GLushort*)out = (GLushort)(depth * 65535.0f + 0.5f); break;
+			case GL_SHORT:			*(GLshort*)out = (GLshort)(depth * 32767.0f + 0.5f); break;
+			case GL_UNSIGNED_INT:	*(GLuint*)out = (GLuint)(depth * 4294967295.0 + 0.5); break;
+			case GL_INT:			*(GLint*)out = (GLint)(depth * 2147483647.0 + 0.5); break;
+			default:				*(GLfloat*)out = depth; break;
+			}
+		}
+	}
+	return S_OK;
+}
+
 //=================================
 
 OPENGL_API void WINAPI glReadPixels( GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid *pixels )
@@ -1117,108 +1493,31 @@ OPENGL_API void WINAPI glReadPixels( GLint x, GLint y, GLsizei width, GLsizei he
 
 	if( format == GL_DEPTH_COMPONENT || format == GL_STENCIL_INDEX ) 
 	{
-		static bool msgPrinted = false;
-		if(!msgPrinted) {
-			logPrintf("WARNING: glReadPixels: reading depth-stencil is not supported\n");
-			msgPrinted = true;
-		}
-		for(int i = 0; i < height; ++i) {
-			for(int j = 0; j < width; ++j) {
-				switch(type) {
-				case GL_UNSIGNED_BYTE:
-					*((GLubyte*)pixels + i*height + j) = 0;
-					break;
-				case GL_BYTE:
-					*((GLbyte*)pixels + i*height + j) = 0;
-					break;
-				case GL_UNSIGNED_SHORT:
-					*((GLushort*)pixels + i*height + j) = 0;
-					break;
-				case GL_SHORT:
-					*((GLshort*)pixels + i*height + j) = 0;
-					break;
-				case GL_UNSIGNED_INT:
-					*((GLuint*)pixels + i*height + j) = 0;
-					break;
-				case GL_INT:
-					*((GLint*)pixels + i*height + j) = 0;
-					break;
-				case GL_FLOAT:
-					*((GLfloat*)pixels + i*height + j) = 0;
-					break;
-				default:
-					logPrintf("WARNING: Texture data type 0x%x is not supported\n", type);
-					D3DGlobal.lastError = E_INVALIDARG;
-					break;
-				}
+		if( format == GL_DEPTH_COMPONENT ) {
+			hr = D3DPixels_ReadDepth( x, y, width, height, type, pixels );
+			if(hr != E_NOTIMPL) {
+				if(FAILED(hr)) D3DGlobal.lastError = hr;
+				return;
 			}
+			PRINT_ONCE("WARNING: glReadPixels: depth buffer is not lockable, set ReadableDepth = 1 to read depth\n");
+		} else if(D3DGlobal.stencilBits) {
+			PRINT_ONCE("WARNING: glReadPixels: reading stencil is not supported\n");
 		}
+		hr = D3DPixels_ClearDepthStencil( width, height, type, pixels );
+		if(FAILED(hr)) D3DGlobal.lastError = hr;
 		return;
-	/*	D3DSURFACE_DESC desc;
-		LPDIRECT3DSURFACE9 lpDS;
-		LPDIRECT3DSURFACE9 lpDS2;
-
-		hr = D3DGlobal.pDevice->GetDepthStencilSurface( &lpRenderTarget );
-		if(FAILED(hr)) {
-			D3DGlobal.lastError = hr;
-			logPrintf("WARNING: glReadPixels: GetDepthStencilSurface failed with error '%s'\n", DXGetErrorString(hr));
-			return;
-		} 
-		hr = lpRenderTarget->GetDesc(&desc);
-		if(FAILED(hr)) {
-			D3DGlobal.lastError = hr;
-			logPrintf("WARNING: glReadPixels: GetDesc failed with error '%s'\n", DXGetErrorString(hr));
-			return;
-		}
-
-		hr = D3DGlobal.pDevice->CreateDepthStencilSurface( desc.Width, 
-														desc.Height, 
-														desc.Format, 
-														D3DMULTISAMPLE_NONE, 
-														0, FALSE, 
-														&lpDS, nullptr );
-		if(FAILED(hr)) {
-			D3DGlobal.lastError = hr;
-			logPrintf("WARNING: glReadPixels: CreateDepthStencilSurface failed with error '%s'\n", DXGetErrorString(hr));
-			return;
-		}
-
-		hr = D3DGlobal.pDevice->StretchRect( lpRenderTarget, nullptr, lpDS, nullptr, D3DTEXF_NONE );
-		if(FAILED(hr)) {
-			D3DGlobal.lastError = hr;
-			logPrintf("WARNING: glReadPixels: StretchRect failed with error '%s'\n", DXGetErrorString(hr));
-			return;
-		}
-
-		lpRenderTarget->Release();
-
-		//create offscreen surface that will hold an antialiased screen image
-		hr = D3DGlobal.pDevice->CreateOffscreenPlainSurface( desc.Width, 
-															 desc.Height, 
-															 D3DFMT_D16_LOCKABLE, 
-															 D3DPOOL_SYSTEMMEM, 
-															 &lpDS2, nullptr );
-		if(FAILED(hr)) {
-			D3DGlobal.lastError = hr;
-			logPrintf("WARNING: glReadPixels: CreateOffscreenPlainSurface failed with error '%s'\n", DXGetErrorString(hr));
-			return;
-		}
-
-		hr = D3DGlobal.pDevice->GetRenderTargetData( lpDS, lpDS2 );
-		if(FAILED(hr)) {
-			D3DGlobal.lastError = hr;
-			logPrintf("WARNING: glReadPixels: GetRenderTargetData failed with error '%s'\n", DXGetErrorString(hr));
-			return;
-		}
-
-		lpDS->Release();
-		lpDS2->Release();
-
-		logPrintf("WARNING: glReadPixels: reading depth will be ok\n");
-		return;*/
 	} else {
 		D3DSURFACE_DESC desc;
 
+		if (D3DGlobal.pReadback && D3DGlobal.pReadback->IsEnabled()) {
+			//S_OK means pixels were filled from an earlier frame
+			hr = D3DGlobal.pReadback->ReadPixels( x, y, width, height, format, type, pixels );
+			if (hr == S_OK)
+				return;
+			if (FAILED(hr))
+				D3DGlobal.lastError = hr;
+		}
+
 		hr = D3DGlobal.pDevice->GetRenderTarget( 0, &lpRenderTarget );
 		if(FAILED(hr)) {
 			D3DGlobal.lastError = hr;
@@ -1311,12 +1610,6 @@ OPENGL_API void WINAPI glReadPixels( GLint x, GLint y, GLsizei width, GLsizei he
 		D3DGlobal.lastError = hr;
 	}
 
-	if( format == GL_DEPTH_COMPONENT )
-	{
-		logPrintf("glReadPixels(GL_DEPTH_COMPONENT): %i %i %i %i\n", x,y,width,height);
-		logPrintf("glReadPixels(GL_DEPTH_COMPONENT): %f\n", *(GLfloat*)pixels);
-	}
-	
 	//And we are done
 	D3DGlobal.pSystemMemRT->UnlockRect();
 
@@ -1461,6 +1754,7 @@ OPENGL_API void WINAPI glPixelMapfv( GLenum map, GLsizei mapsize, const GLfloat
 		mapsize = IMPL_MAX_PIXEL_MAP_TABLE;
 	}
 
+	D3DPixels_InvalidateTransferTables();
 	*mapSizePointer = mapsize;
 	memcpy( mapPointer, values, mapsize * sizeof(GLfloat) );
 }
@@ -1498,6 +1792,7 @@ OPENGL_API void WINAPI glPixelMapuiv( GLenum map, GLsizei mapsize, const GLuint
 		mapsize = IMPL_MAX_PIXEL_MAP_TABLE;
 	}
 
+	D3DPixels_InvalidateTransferTables();
 	*mapSizePointer = mapsize;
 	for(int i = 0; i < mapsize; ++i)
 		mapPointer[i] = static_cast<GLfloat>(values[i] / UINT_MAX);
@@ -1536,6 +1831,7 @@ OPENGL_API void WINAPI glPixelMapusv( GLenum map, GLsizei mapsize, const GLushor
 		mapsize = IMPL_MAX_PIXEL_MAP_TABLE;
 	}
 
+	D3DPixels_InvalidateTransferTables();
 	*mapSizePointer = mapsize;
 	for(int i = 0; i < mapsize; ++i)
 		mapPointer[i] = static_cast<GLfloat>(values[i] / USHRT_MAX);
@@ -1615,6 +1911,8 @@ OPENGL_API void WINAPI glPixelStoref( GLenum pname, GLfloat param )
 
 OPENGL_API void WINAPI glPixelTransferi( GLenum pname, GLint param )
 {
+	D3DPixels_InvalidateTransferTables();
+
 	switch(pname) {
 	case GL_MAP_COLOR:
 		D3DState.ClientPixelStoreState.transferMapColor =(param > 0) ? GL_TRUE : GL_FALSE;
@@ -1660,6 +1958,8 @@ OPENGL_API void WINAPI glPixelTransferi( GLenum pname, GLint param )
 }
 OPENGL_API void WINAPI glPixelTransferf( GLenum pname, GLfloat param )
 {
+	D3DPixels_InvalidateTransferTables();
+
 	switch(pname) {
 	case GL_MAP_COLOR:
 		D3DState.ClientPixelStoreState.transferMapColor =(param > 0) ? GL_TRUE : GL_FALSE;
@@ -22,6 +22,13 @@
 #define QINDIEGL_D3D_PIXELS_H
 
 extern HRESULT D3DPixels_Unpack( int width, int height, int depth, int hpitch, int vpitch, GLubyte *dstbytes, int dstpixelsize, eTexTypeInternal intfmt, bool flipVertical, GLenum format, GLenum type, const GLvoid *pixels );
+extern bool D3DPixels_IsDefaultUnpackState();
+extern bool D3DPixels_IsDefaultPackState();
+extern void D3DPixels_InvalidateTransferTables();
+extern bool D3DPixels_IsLockableDepthFormat( D3DFORMAT format );
+extern void D3DPixels_InvalidateDepthCache();
+extern void D3DPixels_FreeDepthCache();
+extern int D3DPixels_GetUnpackedImageSize( int width, int height, int depth, GLenum format, GLenum type );
 extern HRESULT D3DPixels_Pack( int width, int height, int depth, int hpitch, int vpitch, const GLubyte *srcbytes, int srcpixelsize, eTexTypeInternal intfmt, bool flipVertical, GLenum format, GLenum type, GLvoid *pixels );
 
 #endif //QINDIEGL_D3D_PIXELS_H
\ No newline at end of file
@@ -0,0 +1,457 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include "d3d_wrapper.hpp"
+#include "d3d_global.hpp"
+#include "d3d_state.hpp"
+#include "d3d_utils.hpp"
+#include "d3d_pixels.hpp"
+#include "d3d_readback.hpp"
+
+//==================================================================================
+// Asynchronous readback
+//----------------------------------------------------------------------------------
+// Ring of render target copies. Each slot goes FREE -> COPIED -> CONVERTING ->
+// CONVERTED -> FREE. The GPU copy is issued by glReadPixels, the system memory
+// fetch happens at the end of a later frame and the format conversion runs on the
+// worker thread. Slot states are only changed with m_mutex held.
+//==================================================================================
+
+D3DReadbackQueue :: D3DReadbackQueue()
+{
+	m_latency = 0;
+	m_numSlots = 0;
+	m_frame = 1;
+	m_shutdown = false;
+	memset( &m_stats, 0, sizeof(m_stats) );
+
+	for (int i = 0; i < D3D_READBACK_MAX_SLOTS; ++i) {
+		m_slots[i].state = SLOT_FREE;
+		m_slots[i].frame = 0;
+		m_slots[i].pRenderTarget = nullptr;
+		m_slots[i].pSystemMem = nullptr;
+		m_slots[i].pQuery = nullptr;
+		m_slots[i].d3dFormat = D3DFMT_UNKNOWN;
+		m_slots[i].srcBits = nullptr;
+		m_slots[i].srcPitch = 0;
+	}
+}
+
+D3DReadbackQueue :: ~D3DReadbackQueue()
+{
+	ReleaseSurfaces();
+	StopWorker();
+}
+
+void D3DReadbackQueue :: SetLatency( int frames )
+{
+	frames = QINDIEGL_MAX( 0, QINDIEGL_MIN( frames, D3D_READBACK_MAX_SLOTS - 1 ) );
+	if (frames == m_latency)
+		return;
+
+	ReleaseSurfaces();
+	m_results.clear();
+
+	m_latency = frames;
+	m_numSlots = frames ? frames + 1 : 0;
+	if (m_latency)
+		StartWorker();
+	else
+		StopWorker();
+}
+
+bool D3DReadbackQueue :: CanQueue( GLenum format, GLenum type, D3DFORMAT backBufferFormat )
+{
+	if (type != GL_UNSIGNED_BYTE)
+		return false;
+	if (format != GL_RGB && format != GL_RGBA && format != GL_BGR_EXT && format != GL_BGRA_EXT)
+		return false;
+	if (backBufferFormat != D3DFMT_X8R8G8B8 && backBufferFormat != D3DFMT_A8R8G8B8)
+		return false;
+	return D3DPixels_IsDefaultPackState();
+}
+
+bool D3DReadbackQueue :: SameRequest( const D3DReadbackRequest &a, const D3DReadbackRequest &b )
+{
+	return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height &&
+		a.format == b.format && a.type == b.type && a.alignment == b.alignment;
+}
+
+static int D3DReadback_GetRowLength( const D3DReadbackRequest &request, int components )
+{
+	int row_length = request.width * components;
+	if (request.alignment > 0) {
+		int alignment = request.alignment - 1;
+		row_length = (row_length + alignment) & ~alignment;
+	}
+	return row_length;
+}
+
+static int D3DReadback_GetComponents( GLenum format )
+{
+	return (format == GL_RGB || format == GL_BGR_EXT) ? 3 : 4;
+}
+
+int D3DReadbackQueue :: GetResultSize( const D3DReadbackRequest &request )
+{
+	int components = D3DReadback_GetComponents( request.format );
+	//the last row is not padded
+	return (request.height - 1) * D3DReadback_GetRowLength( request, components ) + request.width * components;
+}
+
+void D3DReadbackQueue :: Convert( const Slot &slot, GLubyte *dst )
+{
+	const D3DReadbackRequest &request = slot.request;
+	const int components = D3DReadback_GetComponents( request.format );
+	const int row_length = D3DReadback_GetRowLength( request, components );
+	const bool swapRB = (request.format == GL_RGB || request.format == GL_RGBA);
+	const bool hasAlpha = (slot.d3dFormat == D3DFMT_A8R8G8B8);
+
+	//D3D rows go top to bottom, GL rows bottom to top
+	for (int j = 0; j < request.height; ++j) {
+		const GLubyte *src = slot.srcBits + (request.height - j - 1) * slot.srcPitch;
+		GLubyte *out = dst + j * row_length;
+		for (int k = 0; k < request.width; ++k, src += 4, out += components) {
+			if (swapRB) {
+				out[0] = src[2];
+				out[1] = src[1];
+				out[2] = src[0];
+			} else {
+				out[0] = src[0];
+				out[1] = src[1];
+				out[2] = src[2];
+			}
+			if (components == 4)
+				out[3] = hasAlpha ? src[3] : 255;
+		}
+	}
+}
+
+HRESULT D3DReadbackQueue :: ReadPixels( GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid *pixels )
+{
+	if (!IsEnabled() || width <= 0 || height <= 0)
+		return S_FALSE;
+
+	Retire();
+
+	D3DReadbackRequest request;
+	request.x = x;
+	request.y = y;
+	request.width = width;
+	request.height = height;
+	request.format = format;
+	request.type = type;
+	request.alignment = D3DState.ClientPixelStoreState.packAlignment;
+
+	HRESULT hr = Queue( request );
+	if (hr != S_OK) {
+		m_stats.syncReads++;
+		return hr;
+	}
+
+	//deliver the newest finished copy of the same request
+	for (size_t i = 0; i < m_results.size(); ++i) {
+		if (SameRequest( m_results[i].request, request )) {
+			memcpy( pixels, m_results[i].data.data(), m_results[i].data.size() );
+			m_stats.delivered++;
+			return S_OK;
+		}
+	}
+
+	//nothing finished yet, the caller reads synchronously this time
+	m_stats.syncReads++;
+	return S_FALSE;
+}
+
+HRESULT D3DReadbackQueue :: Queue( const D3DReadbackRequest &request )
+{
+	LPDIRECT3DSURFACE9 lpRenderTarget = nullptr;
+	D3DSURFACE_DESC desc;
+
+	HRESULT hr = D3DGlobal.pDevice->GetRenderTarget( 0, &lpRenderTarget );
+	if (FAILED(hr)) {
+		logPrintf("WARNING: D3DReadbackQueue: GetRenderTarget failed with error '%s'\n", DXGetErrorString(hr));
+		return hr;
+	}
+	hr = lpRenderTarget->GetDesc( &desc );
+	if (FAILED(hr)) {
+		lpRenderTarget->Release();
+		return hr;
+	}
+
+	//partially offscreen reads are clipped by the synchronous path
+	if (!CanQueue( request.format, request.type, desc.Format ) ||
+		request.x < 0 || request.y < 0 ||
+		request.x + request.width > (GLint)desc.Width ||
+		request.y + request.height > (GLint)desc.Height) {
+		lpRenderTarget->Release();
+		return S_FALSE;
+	}
+
+	Slot *pSlot = nullptr;
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		for (int i = 0; i < m_numSlots; ++i) {
+			if (m_slots[i].state == SLOT_FREE) {
+				pSlot = &m_slots[i];
+				break;
+			}
+		}
+	}
+	if (!pSlot) {
+		//ring is full: finish the oldest copy now
+		pSlot = &m_slots[0];
+		for (int i = 1; i < m_numSlots; ++i) {
+			if (m_slots[i].frame < pSlot->frame)
+				pSlot = &m_slots[i];
+		}
+		WaitForSlot( *pSlot );
+		Retire();
+		m_stats.stalls++;
+	}
+
+	if (pSlot->pRenderTarget) {
+		D3DSURFACE_DESC slotDesc;
+		pSlot->pRenderTarget->GetDesc( &slotDesc );
+		if (slotDesc.Width != (UINT)request.width || slotDesc.Height != (UINT)request.height || slotDesc.Format != desc.Format)
+			ReleaseSlot( *pSlot );
+	}
+
+	if (!pSlot->pRenderTarget) {
+		hr = D3DGlobal.pDevice->CreateRenderTarget( request.width, request.height, desc.Format, D3DMULTISAMPLE_NONE, 0, FALSE, &pSlot->pRenderTarget, nullptr );
+		if (SUCCEEDED(hr))
+			hr = D3DGlobal.pDevice->CreateOffscreenPlainSurface( request.width, request.height, desc.Format, D3DPOOL_SYSTEMMEM, &pSlot->pSystemMem, nullptr );
+		if (FAILED(hr)) {
+			logPrintf("WARNING: D3DReadbackQueue: failed to create readback surfaces with error '%s'\n", DXGetErrorString(hr));
+			ReleaseSlot( *pSlot );
+			lpRenderTarget->Release();
+			return hr;
+		}
+		//without event queries the copy is fetched by frame age alone
+		if (FAILED(D3DGlobal.pDevice->CreateQuery( D3DQUERYTYPE_EVENT, &pSlot->pQuery )))
+			pSlot->pQuery = nullptr;
+	}
+
+	RECT srcrect;
+	srcrect.left = request.x;
+	srcrect.right = request.x + request.width;
+	srcrect.top = desc.Height - (request.y + request.height);
+	srcrect.bottom = srcrect.top + request.height;
+
+	//also resolves a multisampled back buffer
+	hr = D3DGlobal.pDevice->StretchRect( lpRenderTarget, &srcrect, pSlot->pRenderTarget, nullptr, D3DTEXF_NONE );
+	lpRenderTarget->Release();
+	if (FAILED(hr)) {
+		logPrintf("WARNING: D3DReadbackQueue: StretchRect failed with error '%s'\n", DXGetErrorString(hr));
+		return hr;
+	}
+	if (pSlot->pQuery)
+		pSlot->pQuery->Issue( D3DISSUE_END );
+
+	std::lock_guard<std::mutex> lock( m_mutex );
+	pSlot->request = request;
+	pSlot->frame = m_frame;
+	pSlot->d3dFormat = desc.Format;
+	pSlot->state = SLOT_COPIED;
+	m_stats.queued++;
+	return S_OK;
+}
+
+HRESULT D3DReadbackQueue :: Fetch( Slot &slot )
+{
+	assert(slot.state == SLOT_COPIED);
+
+	HRESULT hr = D3DGlobal.pDevice->GetRenderTargetData( slot.pRenderTarget, slot.pSystemMem );
+	D3DLOCKED_RECT lockrect;
+	if (SUCCEEDED(hr))
+		hr = slot.pSystemMem->LockRect( &lockrect, nullptr, D3DLOCK_NOSYSLOCK|D3DLOCK_READONLY );
+	if (FAILED(hr)) {
+		logPrintf("WARNING: D3DReadbackQueue: readback failed with error '%s'\n", DXGetErrorString(hr));
+		std::lock_guard<std::mutex> lock( m_mutex );
+		slot.state = SLOT_FREE;
+		return hr;
+	}
+
+	slot.srcBits = (const GLubyte*)lockrect.pBits;
+	slot.srcPitch = lockrect.Pitch;
+	slot.data.resize( GetResultSize( slot.request ) );
+
+	std::lock_guard<std::mutex> lock( m_mutex );
+	slot.state = SLOT_CONVERTING;
+	m_jobs.push_back( (int)(&slot - m_slots) );
+	m_workReady.notify_one();
+	return S_OK;
+}
+
+void D3DReadbackQueue :: Retire()
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	for (int i = 0; i < m_numSlots; ++i) {
+		Slot &slot = m_slots[i];
+		if (slot.state != SLOT_CONVERTED)
+			continue;
+
+		slot.pSystemMem->UnlockRect();
+		slot.srcBits = nullptr;
+
+		//keep only the newest result of every request
+		Result *pResult = nullptr;
+		for (size_t j = 0; j < m_results.size(); ++j) {
+			if (SameRequest( m_results[j].request, slot.request )) {
+				pResult = &m_results[j];
+				break;
+			}
+		}
+		if (!pResult) {
+			if (m_results.size() < D3D_READBACK_MAX_RESULTS) {
+				m_results.push_back( Result() );
+				pResult = &m_results.back();
+			} else {
+				pResult = &m_results[0];
+				for (size_t j = 1; j < m_results.size(); ++j) {
+					if (m_results[j].frame < pResult->frame)
+						pResult = &m_results[j];
+				}
+			}
+		}
+		if (slot.frame >= pResult->frame || !SameRequest( pResult->request, slot.request )) {
+			pResult->request = slot.request;
+			pResult->frame = slot.frame;
+			pResult->data.swap( slot.data );
+		}
+		slot.state = SLOT_FREE;
+	}
+}
+
+void D3DReadbackQueue :: WaitForSlot( Slot &slot )
+{
+	if (slot.state == SLOT_COPIED)
+		Fetch( slot );
+
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_workDone.wait( lock, [&slot]{ return slot.state != SLOT_CONVERTING; } );
+}
+
+void D3DReadbackQueue :: EndFrame()
+{
+	if (!IsEnabled())
+		return;
+
+	++m_frame;
+
+	for (int i = 0; i < m_numSlots; ++i) {
+		Slot &slot = m_slots[i];
+		{
+			std::lock_guard<std::mutex> lock( m_mutex );
+			if (slot.state != SLOT_COPIED)
+				continue;
+		}
+		//fetch once the GPU is done with the copy, or when the latency is used up
+		bool ready = (m_frame - slot.frame) >= (DWORD)m_latency;
+		if (!ready && slot.pQuery)
+			ready = (slot.pQuery->GetData( nullptr, 0, 0 ) == S_OK);
+		if (ready)
+			Fetch( slot );
+	}
+
+	Retire();
+}
+
+void D3DReadbackQueue :: ReleaseSlot( Slot &slot )
+{
+	if (slot.pQuery) {
+		slot.pQuery->Release();
+		slot.pQuery = nullptr;
+	}
+	if (slot.pSystemMem) {
+		slot.pSystemMem->Release();
+		slot.pSystemMem = nullptr;
+	}
+	if (slot.pRenderTarget) {
+		slot.pRenderTarget->Release();
+		slot.pRenderTarget = nullptr;
+	}
+	slot.state = SLOT_FREE;
+}
+
+void D3DReadbackQueue :: ReleaseSurfaces()
+{
+	for (int i = 0; i < m_numSlots; ++i) {
+		std::unique_lock<std::mutex> lock( m_mutex );
+		m_workDone.wait( lock, [this, i]{ return m_slots[i].state != SLOT_CONVERTING; } );
+	}
+	Retire();
+
+	//pending copies are lost, video memory surfaces do not survive a reset
+	for (int i = 0; i < D3D_READBACK_MAX_SLOTS; ++i)
+		ReleaseSlot( m_slots[i] );
+}
+
+//=================================
+// Worker thread
+//=================================
+
+void D3DReadbackQueue :: StartWorker()
+{
+	if (m_worker.joinable())
+		return;
+	m_shutdown = false;
+	m_worker = std::thread( &D3DReadbackQueue::WorkerMain, this );
+}
+
+void D3DReadbackQueue :: StopWorker()
+{
+	if (!m_worker.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_shutdown = true;
+	}
+	m_workReady.notify_all();
+	m_worker.join();
+}
+
+void D3DReadbackQueue :: WorkerMain()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	for (;;) {
+		m_workReady.wait( lock, [this]{ return m_shutdown || !m_jobs.empty(); } );
+		if (m_jobs.empty())
+			break;
+
+		Slot &slot = m_slots[m_jobs.front()];
+		m_jobs.erase( m_jobs.begin() );
+
+		lock.unlock();
+		Convert( slot, slot.data.data() );
+		lock.lock();
+
+		slot.state = SLOT_CONVERTED;
+		m_workDone.notify_all();
+	}
+}
+
+void D3DReadbackQueue :: LogStats() const
+{
+	if (!m_stats.queued)
+		return;
+
+	logPrintf("Async readback: %u queued, %u delivered, %u synchronous, %u stalls\n", m_stats.queued, m_stats.delivered, m_stats.syncReads, m_stats.stalls);
+}
@@ -0,0 +1,131 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_READBACK_H
+#define QINDIEGL_D3D_READBACK_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define D3D_READBACK_MAX_SLOTS		4
+#define D3D_READBACK_MAX_RESULTS	4
+
+typedef struct D3DReadbackRequest_s
+{
+	GLint		x;
+	GLint		y;
+	GLsizei		width;
+	GLsizei		height;
+	GLenum		format;
+	GLenum		type;
+	int			alignment;
+} D3DReadbackRequest;
+
+typedef struct D3DReadbackStats_s
+{
+	DWORD		queued;
+	DWORD		delivered;
+	DWORD		syncReads;
+	DWORD		stalls;
+} D3DReadbackStats;
+
+// Asynchronous glReadPixels for screenshot and video capture. A read copies the
+// requested rectangle into a video memory render target and returns the newest
+// finished result of an identical earlier request. Copies are fetched into system
+// memory at the end of a later frame, once the GPU is done with them, and converted
+// to the client format by a worker thread. Only plain byte RGB(A)/BGR(A) reads with
+// default pack state are queued, everything else keeps the synchronous path.
+class D3DReadbackQueue
+{
+public:
+	D3DReadbackQueue();
+	~D3DReadbackQueue();
+
+	void SetLatency( int frames );
+	bool IsEnabled() const						{ return m_latency > 0; }
+	const D3DReadbackStats &GetStats() const	{ return m_stats; }
+
+	// S_OK if pixels were filled from an earlier frame, S_FALSE if the caller
+	// has to read synchronously this time
+	HRESULT ReadPixels( GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, GLvoid *pixels );
+	void EndFrame();
+	void ReleaseSurfaces();
+	void LogStats() const;
+
+private:
+	enum eSlotState {
+		SLOT_FREE,
+		SLOT_COPIED,		//StretchRect issued, waiting for the GPU
+		SLOT_CONVERTING,	//surface locked, queued for the worker
+		SLOT_CONVERTED		//worker is done, waiting to be retired
+	};
+
+	typedef struct Slot_s {
+		eSlotState				state;
+		D3DReadbackRequest		request;
+		DWORD					frame;
+		LPDIRECT3DSURFACE9		pRenderTarget;
+		LPDIRECT3DSURFACE9		pSystemMem;
+		LPDIRECT3DQUERY9		pQuery;
+		D3DFORMAT				d3dFormat;
+		const GLubyte			*srcBits;
+		int						srcPitch;
+		std::vector<GLubyte>	data;
+	} Slot;
+
+	typedef struct Result_s {
+		D3DReadbackRequest		request;
+		DWORD					frame;
+		std::vector<GLubyte>	data;
+	} Result;
+
+	static bool CanQueue( GLenum format, GLenum type, D3DFORMAT backBufferFormat );
+	static bool SameRequest( const D3DReadbackRequest &a, const D3DReadbackRequest &b );
+	static int GetResultSize( const D3DReadbackRequest &request );
+	static void Convert( const Slot &slot, GLubyte *dst );
+
+	HRESULT Queue( const D3DReadbackRequest &request );
+	HRESULT Fetch( Slot &slot );
+	void Retire();
+	void WaitForSlot( Slot &slot );
+	void ReleaseSlot( Slot &slot );
+	void StartWorker();
+	void StopWorker();
+	void WorkerMain();
+
+private:
+	int						m_latency;
+	int						m_numSlots;
+	DWORD					m_frame;
+	Slot					m_slots[D3D_READBACK_MAX_SLOTS];
+	std::vector<Result>		m_results;
+	D3DReadbackStats		m_stats;
+
+	std::thread				m_worker;
+	std::mutex				m_mutex;
+	std::condition_variable	m_workReady;
+	std::condition_variable	m_workDone;
+	std::vector<int>		m_jobs;
+	bool					m_shutdown;
+};
+
+#endif //QINDIEGL_D3D_READBACK_H
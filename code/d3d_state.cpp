@@ -26,6 +26,8 @@
 #include "d3d_matrix_stack.hpp"
 #include "d3d_combiners.hpp"
 #include "d3d_matrix_detection.hpp"
+#include "d3d_pixels.hpp"
+#include "d3d_lists.hpp"
 #include <map>
 
 D3DState_t D3DState;
@@ -67,6 +69,13 @@ static void D3DState_Copy( const D3DState_t *src, D3DState_t *dst, GLbitfield ma
 	if (mask & GL_ENABLE_BIT) {
 		memcpy(&dst->EnableState, &src->EnableState, sizeof(src->EnableState));
 	}
+	if (mask & GL_EVAL_BIT) {
+		memcpy(&dst->EvalState, &src->EvalState, sizeof(src->EvalState));
+		if (!(mask & GL_ENABLE_BIT)) {
+			dst->EnableState.evalMapEnableMask = src->EnableState.evalMapEnableMask;
+			dst->EnableState.autoNormalEnabled = src->EnableState.autoNormalEnabled;
+		}
+	}
 	if (mask & GL_FOG_BIT) {
 		memcpy(&dst->FogState, &src->FogState, sizeof(src->FogState));
 		if (!(mask & GL_ENABLE_BIT)) {
@@ -599,7 +608,12 @@ void D3DState_Check()
 	//this is actually needed before any draw commands (glBegin, glDrawArrays etc.)
 	D3DState_SetTransform();
 	D3DState_SetLight();
+	D3DTex_CommitSubImageUpdates();
 	D3DState_SetTexture();
+
+	//D3D writes depth only with the depth test on
+	if (D3DState.EnableState.depthTestEnabled && D3DState.DepthBufferState.depthWriteMask)
+		D3DPixels_InvalidateDepthCache();
 }
 
 void D3DState_Apply( GLbitfield mask )
@@ -728,6 +742,12 @@ void D3DState_SetDefaults()
 	D3DState.PolygonState.frontFace = GL_CCW;
 	D3DState.StencilBufferState.activeStencilFace = GL_CCW;
 	D3DState.TransformState.matrixMode = GL_MODELVIEW;
+	D3DState.EvalState.grid1Segments = 1;
+	D3DState.EvalState.grid1Domain[1] = 1.0f;
+	D3DState.EvalState.grid2Segments[0] = 1;
+	D3DState.EvalState.grid2Segments[1] = 1;
+	D3DState.EvalState.grid2Domain[1] = 1.0f;
+	D3DState.EvalState.grid2Domain[3] = 1.0f;
 	D3DState.CurrentState.currentColor = D3DCOLOR_XRGB( 255, 255, 255 );
 	D3DState.CurrentState.currentColor2 = 0;
 	D3DState.CurrentState.currentNormal[0] = 0.0f;
@@ -876,6 +896,7 @@ void D3DState_SetDefaults()
 	D3DState.ClientPixelStoreState.pixelmapSizeGtoG = 1;
 	D3DState.ClientPixelStoreState.pixelmapSizeBtoB = 1;
 	D3DState.ClientPixelStoreState.pixelmapSizeAtoA = 1;
+	D3DPixels_InvalidateTransferTables();
 
 	D3DState.ClientVertexArrayState.vertexInfo._internal.compiledLast = -1;
 	D3DState.ClientVertexArrayState.normalInfo._internal.compiledLast = -1;
@@ -925,6 +946,7 @@ void D3DState_SetDefaults()
 
 OPENGL_API void WINAPI glPushAttrib( GLbitfield mask )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_PUSH_ATTRIB, mask );
 	D3DStateCopyMask = mask;
 	D3DState_Copy( &D3DState, &D3DStateCopy, mask );
 }
@@ -937,12 +959,14 @@ OPENGL_API void WINAPI glPushClientAttrib( GLbitfield mask )
 
 OPENGL_API void WINAPI glPopAttrib()
 {
+	D3DLIST_COMPILE( D3DLIST_OP_POP_ATTRIB );
 	if (!D3DStateCopyMask) {
 		D3DGlobal.lastError = E_STACK_UNDERFLOW;
 		return;
 	}
 
 	D3DState_Copy( &D3DStateCopy, &D3DState, D3DStateCopyMask );
+	D3DPixels_InvalidateTransferTables();
 
 	D3DState.modelViewMatrixModified = TRUE;
 	D3DState.projectionMatrixModified = TRUE;
@@ -969,6 +993,7 @@ OPENGL_API void WINAPI glPopClientAttrib()
 	}
 
 	D3DState_CopyClient( &D3DStateCopy, &D3DState, D3DStateClientCopyMask );
+	D3DPixels_InvalidateTransferTables();
 	D3DStateClientCopyMask = 0;
 }
 
@@ -1045,6 +1070,8 @@ static DWORD D3DState_IsEnabledState( GLenum cap )
 		}
 
 	case GL_AUTO_NORMAL:
+		return D3DState.EnableState.autoNormalEnabled;
+
 	case GL_POLYGON_OFFSET_LINE:
 	case GL_POLYGON_OFFSET_POINT:
 		//silently ignore these caps
@@ -1059,6 +1086,7 @@ static DWORD D3DState_IsEnabledState( GLenum cap )
 	case GL_MAP1_TEXTURE_COORD_4:
 	case GL_MAP1_VERTEX_3:
 	case GL_MAP1_VERTEX_4:
+		return (D3DState.EnableState.evalMapEnableMask & (1 << (cap - GL_MAP1_COLOR_4)));
 	case GL_MAP2_COLOR_4:
 	case GL_MAP2_INDEX:
 	case GL_MAP2_NORMAL:
@@ -1068,7 +1096,7 @@ static DWORD D3DState_IsEnabledState( GLenum cap )
 	case GL_MAP2_TEXTURE_COORD_4:
 	case GL_MAP2_VERTEX_3:
 	case GL_MAP2_VERTEX_4:
-		return 0;
+		return (D3DState.EnableState.evalMapEnableMask & (1 << (16 + cap - GL_MAP2_COLOR_4)));
 
 	case GL_POLYGON_SMOOTH:
 	case GL_POLYGON_STIPPLE:
@@ -1266,13 +1294,16 @@ static void D3DState_EnableDisableState( GLenum cap, DWORD value )
 		}
 		break;
 
-	case GL_AUTO_NORMAL:
 	case GL_LINE_STIPPLE:
 	case GL_POLYGON_OFFSET_LINE:
 	case GL_POLYGON_OFFSET_POINT:
 		//silently ignore these caps
 		break;
 
+	case GL_AUTO_NORMAL:
+		D3DState.EnableState.autoNormalEnabled = value;
+		break;
+
 	case GL_MAP1_COLOR_4:
 	case GL_MAP1_INDEX:
 	case GL_MAP1_NORMAL:
@@ -1282,6 +1313,9 @@ static void D3DState_EnableDisableState( GLenum cap, DWORD value )
 	case GL_MAP1_TEXTURE_COORD_4:
 	case GL_MAP1_VERTEX_3:
 	case GL_MAP1_VERTEX_4:
+		if (value) D3DState.EnableState.evalMapEnableMask |= (1 << (cap - GL_MAP1_COLOR_4));
+		else D3DState.EnableState.evalMapEnableMask &= ~(1 << (cap - GL_MAP1_COLOR_4));
+		break;
 	case GL_MAP2_COLOR_4:
 	case GL_MAP2_INDEX:
 	case GL_MAP2_NORMAL:
@@ -1291,7 +1325,8 @@ static void D3DState_EnableDisableState( GLenum cap, DWORD value )
 	case GL_MAP2_TEXTURE_COORD_4:
 	case GL_MAP2_VERTEX_3:
 	case GL_MAP2_VERTEX_4:
-		logPrintf("WARNING: evaluators are not supported\n");
+		if (value) D3DState.EnableState.evalMapEnableMask |= (1 << (16 + cap - GL_MAP2_COLOR_4));
+		else D3DState.EnableState.evalMapEnableMask &= ~(1 << (16 + cap - GL_MAP2_COLOR_4));
 		break;
 
 	case GL_POLYGON_SMOOTH:
@@ -1369,11 +1404,13 @@ static void D3DState_EnableDisableClientState( GLenum cap, DWORD value )
 
 OPENGL_API void WINAPI glEnable( GLenum cap )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_ENABLE, cap );
 	D3DState_EnableDisableState( cap, TRUE );
 }
 
 OPENGL_API void WINAPI glDisable( GLenum cap )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_DISABLE, cap );
 	D3DState_EnableDisableState( cap, FALSE );
 }
 
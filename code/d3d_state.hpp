@@ -87,11 +87,19 @@ typedef struct D3DState_s
 		DWORD			colorSumEnabled;
 		DWORD			normalizeEnabled;
 		DWORD			clipPlaneEnableMask;
+		DWORD			evalMapEnableMask;		// bit n is GL_MAP1_COLOR_4 + n, bit 16 + n is GL_MAP2_COLOR_4 + n
+		DWORD			autoNormalEnabled;
 		DWORD			textureEnabled[MAX_D3D_TMU];
 		DWORD			texGenEnabled[MAX_D3D_TMU];
 		DWORD			textureTargetEnabled[MAX_D3D_TMU][D3D_TEXTARGET_MAX];
 		DWORD			lightEnabled[IMPL_MAX_LIGHTS];
 	} EnableState;
+	struct {
+		GLint			grid1Segments;
+		FLOAT			grid1Domain[2];
+		GLint			grid2Segments[2];
+		FLOAT			grid2Domain[4];
+	} EvalState;
 	struct {
 		DWORD			fogColor;
 		DWORD			fogCoordMode;
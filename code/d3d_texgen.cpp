@@ -23,6 +23,9 @@
 #include "d3d_state.hpp"
 #include "d3d_utils.hpp"
 #include "d3d_matrix_stack.hpp"
+#include "d3d_matrix_math.hpp"
+#include "d3d_texgen_batch.hpp"
+#include "d3d_lists.hpp"
 #include <immintrin.h>
 
 //==================================================================================
@@ -42,18 +45,32 @@ static void TrVertexFunc_Copy( const GLfloat *vertex, float *output )
 
 static void TrVertexFunc_TransformByModelview( const GLfloat *vertex, float *output )
 {
-	D3DXVec3TransformCoord((D3DXVECTOR3*)output, (D3DXVECTOR3*)vertex, D3DGlobal.modelviewMatrixStack->top());
+	D3DStateMatrix &mv = D3DGlobal.modelviewMatrixStack->top();
+	if (mv.is_affine()) {
+		// w stays 1, no divide needed
+		D3DMatrix_TransformPoint( output, mv.data(), vertex );
+	} else {
+		D3DMatrix_TransformCoord( output, mv.data(), vertex );
+		output[3] = 1.0f;
+	}
 }
 
 static void TrVertexFunc_TransformByModelviewAndNormalize( const GLfloat *vertex, float *output )
 {
-	D3DXVec3TransformCoord((D3DXVECTOR3*)output, (D3DXVECTOR3*)vertex, D3DGlobal.modelviewMatrixStack->top());
+	TrVertexFunc_TransformByModelview( vertex, output );
 	D3DXVec3Normalize((D3DXVECTOR3*)output, (D3DXVECTOR3*)output);
 }
 
 static void TrNormalFunc_TransformByModelview( const GLfloat *normal, float *output )
 {
-	D3DXVec3TransformNormal((D3DXVECTOR3*)output, (D3DXVECTOR3*)normal, D3DGlobal.modelviewMatrixStack->top().invtrans());
+	D3DStateMatrix &mv = D3DGlobal.modelviewMatrixStack->top();
+	// the inverse transpose of a rotation is the rotation itself
+	if (mv.type() <= D3DMT_TRANSLATION)
+		memcpy( output, normal, sizeof(float)*3 );
+	else if (mv.type() == D3DMT_RIGID)
+		D3DMatrix_TransformNormal( output, mv.data(), normal );
+	else
+		D3DMatrix_TransformNormal( output, &mv.invtrans()->m[0][0], normal );
 }
 
 static void TexGenFunc_None( int /*stage*/, int coord, const GLfloat* /*vertex*/, const GLfloat* /*normal*/, float *output_texcoord )
@@ -246,6 +263,63 @@ void SelectTexGenFunc( int stage, int coord )
 	}
 }
 
+//==================================================================================
+// Batch texgen setup
+//----------------------------------------------------------------------------------
+// Vertex arrays generate texcoords for the whole locked range at once through
+// D3DTexGen_Batch. The modelview and normal matrices are taken from the stack
+// top here, so they are valid until the next modelview change.
+//==================================================================================
+
+void D3DTexGen_SetupBatch( D3DTexGenBatch *batch )
+{
+	D3DStateMatrix &mv = D3DGlobal.modelviewMatrixStack->top();
+	batch->modelview = mv.data();
+	batch->modelviewAffine = mv.is_affine() != FALSE;
+	// same choice as TrNormalFunc_TransformByModelview
+	if (mv.type() <= D3DMT_TRANSLATION)
+		batch->normalMatrix = nullptr;
+	else if (mv.type() == D3DMT_RIGID)
+		batch->normalMatrix = mv.data();
+	else
+		batch->normalMatrix = &mv.invtrans()->m[0][0];
+	batch->numStages = 0;
+}
+
+void D3DTexGen_AddBatchStage( D3DTexGenBatch *batch, int stage, float *output )
+{
+	if (batch->numStages >= QINDIEGL_TEXGEN_BATCH_STAGES)
+		return;
+
+	D3DTexGenBatchStage *bs = &batch->stages[batch->numStages++];
+	bs->enabled = D3DState.EnableState.texGenEnabled[stage] & 0xF;
+	bs->output = output;
+	for (int i = 0; i < 4; ++i) {
+		switch (D3DState.TextureState.TexGen[stage][i].mode) {
+		case GL_OBJECT_LINEAR:
+			bs->mode[i] = D3DTGB_OBJECT_LINEAR;
+			memcpy( bs->plane[i], D3DState.TextureState.TexGen[stage][i].objectPlane, sizeof(bs->plane[i]) );
+			break;
+		case GL_EYE_LINEAR:
+			bs->mode[i] = D3DTGB_EYE_LINEAR;
+			memcpy( bs->plane[i], D3DState.TextureState.TexGen[stage][i].eyePlane, sizeof(bs->plane[i]) );
+			break;
+		case GL_SPHERE_MAP:
+			bs->mode[i] = D3DTGB_SPHERE_MAP;
+			break;
+		case GL_REFLECTION_MAP_ARB:
+			bs->mode[i] = D3DTGB_REFLECTION_MAP;
+			break;
+		case GL_NORMAL_MAP_ARB:
+			bs->mode[i] = D3DTGB_NORMAL_MAP;
+			break;
+		default:
+			bs->mode[i] = D3DTGB_NONE;
+			break;
+		}
+	}
+}
+
 template<typename T>
 static void SetupTexGen( int stage, int coord, GLenum pname, const T *params )
 {
@@ -262,13 +336,12 @@ static void SetupTexGen( int stage, int coord, GLenum pname, const T *params )
 		break;
 	case GL_EYE_PLANE:
 		{
-			D3DXPLANE d3dxPlane((GLfloat)params[0],(GLfloat)params[1],(GLfloat)params[2],(GLfloat)params[3]);
-			D3DXPLANE d3dxTPlane;
-			D3DXPlaneTransform( &d3dxTPlane, &d3dxPlane, D3DGlobal.modelviewMatrixStack->top().invtrans() );
-			D3DState.TextureState.TexGen[stage][coord].eyePlane[0] = (FLOAT)d3dxTPlane.a;
-			D3DState.TextureState.TexGen[stage][coord].eyePlane[1] = (FLOAT)d3dxTPlane.b;
-			D3DState.TextureState.TexGen[stage][coord].eyePlane[2] = (FLOAT)d3dxTPlane.c;
-			D3DState.TextureState.TexGen[stage][coord].eyePlane[3] = (FLOAT)d3dxTPlane.d;
+			FLOAT plane[4] = { (FLOAT)params[0], (FLOAT)params[1], (FLOAT)params[2], (FLOAT)params[3] };
+			D3DStateMatrix &mv = D3DGlobal.modelviewMatrixStack->top();
+			if (mv.is_identity())
+				memcpy( D3DState.TextureState.TexGen[stage][coord].eyePlane, plane, sizeof(plane) );
+			else
+				D3DMatrix_TransformVec4( D3DState.TextureState.TexGen[stage][coord].eyePlane, &mv.invtrans()->m[0][0], plane );
 		}
 		break;
 	default:
@@ -304,26 +377,38 @@ static void GetTexGen( int stage, int coord, GLenum pname, T *params )
 
 OPENGL_API void WINAPI glTexGenf( GLenum coord,  GLenum pname,  GLfloat param )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_GENFV, coord, pname, &param, 1 ))
+		return;
 	SetupTexGen( D3DState.TextureState.currentTMU, coord - GL_S, pname, &param );
 }
 OPENGL_API void WINAPI glTexGend( GLenum coord,  GLenum pname,  GLdouble param )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_GENFV, coord, pname, &param, 1 ))
+		return;
 	SetupTexGen( D3DState.TextureState.currentTMU, coord - GL_S, pname, &param );
 }
 OPENGL_API void WINAPI glTexGeni( GLenum coord,  GLenum pname,  GLint param )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_GENIV, coord, pname, &param, 1 ))
+		return;
 	SetupTexGen( D3DState.TextureState.currentTMU, coord - GL_S, pname, &param );
 }
 OPENGL_API void WINAPI glTexGenfv( GLenum coord,  GLenum pname,  const GLfloat *params )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_GENFV, coord, pname, params, (pname == GL_OBJECT_PLANE || pname == GL_EYE_PLANE) ? 4 : 1 ))
+		return;
 	SetupTexGen( D3DState.TextureState.currentTMU, coord - GL_S, pname, params );
 }
 OPENGL_API void WINAPI glTexGendv( GLenum coord,  GLenum pname,  const GLdouble *params )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_GENFV, coord, pname, params, (pname == GL_OBJECT_PLANE || pname == GL_EYE_PLANE) ? 4 : 1 ))
+		return;
 	SetupTexGen( D3DState.TextureState.currentTMU, coord - GL_S, pname, params );
 }
 OPENGL_API void WINAPI glTexGeniv( GLenum coord,  GLenum pname,  const GLint *params )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_GENIV, coord, pname, params, (pname == GL_OBJECT_PLANE || pname == GL_EYE_PLANE) ? 4 : 1 ))
+		return;
 	SetupTexGen( D3DState.TextureState.currentTMU, coord - GL_S, pname, params );
 }
 OPENGL_API void WINAPI glGetTexGenfv( GLenum coord,  GLenum pname,  GLfloat *params )
@@ -0,0 +1,343 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "d3d_texgen_batch.hpp"
+
+#if QINDIEGL_MATRIX_SSE
+#include <xmmintrin.h>
+#endif
+
+//==================================================================================
+// Batch texture generation
+//----------------------------------------------------------------------------------
+// Each mode needs some of the per-vertex terms below; they are worked out once
+// per batch, computed once per vertex and then shared by every coordinate:
+//   eye    - position in eye space (eye-linear)
+//   dir    - normalized eye space position (sphere map, reflection map)
+//   normal - eye space normal (sphere map, reflection map, normal map)
+//==================================================================================
+
+enum
+{
+	TGB_NEED_EYE	= 1,
+	TGB_NEED_DIR	= 2,
+	TGB_NEED_NORMAL	= 4,
+	TGB_NEED_SPHERE	= 8
+};
+
+static const float s_defaultNormal[3] = { 0.0f, 0.0f, 1.0f };
+
+static unsigned int TexGenBatch_Needs( const D3DTexGenBatch *batch )
+{
+	unsigned int needs = 0;
+	for (int i = 0; i < batch->numStages; ++i) {
+		const D3DTexGenBatchStage *stage = &batch->stages[i];
+		for (int j = 0; j < 4; ++j) {
+			if (!(stage->enabled & (1 << j)))
+				continue;
+			switch (stage->mode[j]) {
+			case D3DTGB_EYE_LINEAR:
+				needs |= TGB_NEED_EYE;
+				break;
+			case D3DTGB_SPHERE_MAP:
+				if (j < 2)
+					needs |= TGB_NEED_EYE | TGB_NEED_DIR | TGB_NEED_NORMAL | TGB_NEED_SPHERE;
+				break;
+			case D3DTGB_REFLECTION_MAP:
+				if (j < 3)
+					needs |= TGB_NEED_EYE | TGB_NEED_DIR | TGB_NEED_NORMAL;
+				break;
+			case D3DTGB_NORMAL_MAP:
+				if (j < 3)
+					needs |= TGB_NEED_NORMAL;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	return needs;
+}
+
+//==================================================================================
+// Reference version, one vertex at a time
+//==================================================================================
+void D3DTexGen_Batch_Ref( const D3DTexGenBatch *batch, const float *positions, const float *normals, int count )
+{
+	const unsigned int needs = TexGenBatch_Needs( batch );
+
+	for (int v = 0; v < count; ++v, positions += 4) {
+		float eye[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		float normal[3] = { 0.0f, 0.0f, 0.0f };
+		float refl[3] = { 0.0f, 0.0f, 0.0f };
+		float sphere[2] = { 0.0f, 0.0f };
+
+		if (needs & TGB_NEED_EYE) {
+			if (batch->modelviewAffine) {
+				D3DMatrix_TransformPoint( eye, batch->modelview, positions );
+			} else {
+				D3DMatrix_TransformCoord( eye, batch->modelview, positions );
+				eye[3] = 1.0f;
+			}
+		}
+		if (needs & TGB_NEED_NORMAL) {
+			const float *n = normals ? normals + v*3 : s_defaultNormal;
+			if (batch->normalMatrix)
+				D3DMatrix_TransformNormal( normal, batch->normalMatrix, n );
+			else
+				memcpy( normal, n, sizeof(normal) );
+		}
+		if (needs & TGB_NEED_DIR) {
+			float dir[3];
+			float len2 = eye[0]*eye[0] + eye[1]*eye[1] + eye[2]*eye[2];
+			float scale = (len2 > 0.0f) ? (1.0f / sqrtf( len2 )) : 0.0f;
+			dir[0] = eye[0] * scale;
+			dir[1] = eye[1] * scale;
+			dir[2] = eye[2] * scale;
+
+			float fdot = 2.0f * (normal[0]*dir[0] + normal[1]*dir[1] + normal[2]*dir[2]);
+			refl[0] = dir[0] - normal[0] * fdot;
+			refl[1] = dir[1] - normal[1] * fdot;
+			refl[2] = dir[2] - normal[2] * fdot;
+
+			if (needs & TGB_NEED_SPHERE) {
+				float rz = refl[2] + 1.0f;
+				float m = 2.0f * sqrtf( refl[0]*refl[0] + refl[1]*refl[1] + rz*rz );
+				sphere[0] = refl[0] / m + 0.5f;
+				sphere[1] = refl[1] / m + 0.5f;
+			}
+		}
+
+		for (int i = 0; i < batch->numStages; ++i) {
+			const D3DTexGenBatchStage *stage = &batch->stages[i];
+			float *out = stage->output + v*4;
+			for (int j = 0; j < 4; ++j) {
+				if (!(stage->enabled & (1 << j)))
+					continue;
+				const float *p = stage->plane[j];
+				switch (stage->mode[j]) {
+				case D3DTGB_OBJECT_LINEAR:
+					out[j] = positions[0]*p[0] + positions[1]*p[1] + positions[2]*p[2] + positions[3]*p[3];
+					break;
+				case D3DTGB_EYE_LINEAR:
+					out[j] = eye[0]*p[0] + eye[1]*p[1] + eye[2]*p[2] + eye[3]*p[3];
+					break;
+				case D3DTGB_SPHERE_MAP:
+					out[j] = (j < 2) ? sphere[j] : ((j == 3) ? 1.0f : 0.0f);
+					break;
+				case D3DTGB_REFLECTION_MAP:
+					out[j] = (j < 3) ? refl[j] : 1.0f;
+					break;
+				case D3DTGB_NORMAL_MAP:
+					out[j] = (j < 3) ? normal[j] : 1.0f;
+					break;
+				default:
+					out[j] = (j == 3) ? 1.0f : 0.0f;
+					break;
+				}
+			}
+		}
+	}
+}
+
+//==================================================================================
+// SSE version, blocks of 4 vertices in SoA form
+//==================================================================================
+#if QINDIEGL_MATRIX_SSE
+
+// lanes past the end of a partial block repeat its last vertex
+static inline int TexGenBatch_Lane( int lane, int lanes )
+{
+	return (lane < lanes) ? lane : (lanes - 1);
+}
+
+static inline __m128 TexGenBatch_Dot4( __m128 x, __m128 y, __m128 z, __m128 w, const __m128 *p )
+{
+	return _mm_add_ps( _mm_add_ps( _mm_mul_ps( x, p[0] ), _mm_mul_ps( y, p[1] ) ),
+					   _mm_add_ps( _mm_mul_ps( z, p[2] ), _mm_mul_ps( w, p[3] ) ) );
+}
+
+void D3DTexGen_Batch_SSE( const D3DTexGenBatch *batch, const float *positions, const float *normals, int count )
+{
+	const unsigned int needs = TexGenBatch_Needs( batch );
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 two = _mm_set1_ps( 2.0f );
+	const __m128 half = _mm_set1_ps( 0.5f );
+
+	// splat everything the inner loop reads from the batch, once
+	__m128 mv[16], nm[9];
+	for (int k = 0; k < 16; ++k)
+		mv[k] = _mm_set1_ps( batch->modelview[k] );
+	if (batch->normalMatrix) {
+		for (int r = 0; r < 3; ++r)
+			for (int c = 0; c < 3; ++c)
+				nm[r*3+c] = _mm_set1_ps( batch->normalMatrix[r*4+c] );
+	}
+	__m128 planes[QINDIEGL_TEXGEN_BATCH_STAGES][4][4];
+	for (int i = 0; i < batch->numStages; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			if (!(batch->stages[i].enabled & (1 << j)))
+				continue;
+			for (int k = 0; k < 4; ++k)
+				planes[i][j][k] = _mm_set1_ps( batch->stages[i].plane[j][k] );
+		}
+	}
+
+	for (int v = 0; v < count; v += 4) {
+		const int lanes = (count - v < 4) ? (count - v) : 4;
+
+		// gather positions, padding a partial block with its last vertex
+		__m128 px, py, pz, pw;
+		{
+			const float *src[4];
+			for (int l = 0; l < 4; ++l)
+				src[l] = positions + (v + TexGenBatch_Lane( l, lanes )) * 4;
+			px = _mm_loadu_ps( src[0] );
+			py = _mm_loadu_ps( src[1] );
+			pz = _mm_loadu_ps( src[2] );
+			pw = _mm_loadu_ps( src[3] );
+			_MM_TRANSPOSE4_PS( px, py, pz, pw );
+		}
+
+		__m128 ex = zero, ey = zero, ez = zero, ew = one;
+		if (needs & TGB_NEED_EYE) {
+			ex = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, mv[0] ), _mm_mul_ps( py, mv[4] ) ), _mm_add_ps( _mm_mul_ps( pz, mv[8] ), mv[12] ) );
+			ey = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, mv[1] ), _mm_mul_ps( py, mv[5] ) ), _mm_add_ps( _mm_mul_ps( pz, mv[9] ), mv[13] ) );
+			ez = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, mv[2] ), _mm_mul_ps( py, mv[6] ) ), _mm_add_ps( _mm_mul_ps( pz, mv[10] ), mv[14] ) );
+			if (!batch->modelviewAffine) {
+				ew = _mm_add_ps( _mm_add_ps( _mm_mul_ps( px, mv[3] ), _mm_mul_ps( py, mv[7] ) ), _mm_add_ps( _mm_mul_ps( pz, mv[11] ), mv[15] ) );
+				__m128 rw = _mm_and_ps( _mm_cmpneq_ps( ew, zero ), _mm_div_ps( one, ew ) );
+				ex = _mm_mul_ps( ex, rw );
+				ey = _mm_mul_ps( ey, rw );
+				ez = _mm_mul_ps( ez, rw );
+				ew = one;
+			}
+		}
+
+		__m128 nx = zero, ny = zero, nz = zero;
+		if (needs & TGB_NEED_NORMAL) {
+			if (normals) {
+				const float *n[4];
+				for (int l = 0; l < 4; ++l)
+					n[l] = normals + (v + TexGenBatch_Lane( l, lanes )) * 3;
+				nx = _mm_setr_ps( n[0][0], n[1][0], n[2][0], n[3][0] );
+				ny = _mm_setr_ps( n[0][1], n[1][1], n[2][1], n[3][1] );
+				nz = _mm_setr_ps( n[0][2], n[1][2], n[2][2], n[3][2] );
+			} else {
+				nz = one;
+			}
+			if (batch->normalMatrix) {
+				__m128 tx = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, nm[0] ), _mm_mul_ps( ny, nm[3] ) ), _mm_mul_ps( nz, nm[6] ) );
+				__m128 ty = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, nm[1] ), _mm_mul_ps( ny, nm[4] ) ), _mm_mul_ps( nz, nm[7] ) );
+				__m128 tz = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, nm[2] ), _mm_mul_ps( ny, nm[5] ) ), _mm_mul_ps( nz, nm[8] ) );
+				nx = tx; ny = ty; nz = tz;
+			}
+		}
+
+		__m128 rx = zero, ry = zero, rz = zero, sphereS = zero, sphereT = zero;
+		if (needs & TGB_NEED_DIR) {
+			__m128 len2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ex, ex ), _mm_mul_ps( ey, ey ) ), _mm_mul_ps( ez, ez ) );
+			__m128 scale = _mm_and_ps( _mm_cmpgt_ps( len2, zero ), _mm_div_ps( one, _mm_sqrt_ps( len2 ) ) );
+			__m128 dx = _mm_mul_ps( ex, scale );
+			__m128 dy = _mm_mul_ps( ey, scale );
+			__m128 dz = _mm_mul_ps( ez, scale );
+
+			__m128 fdot = _mm_add_ps( _mm_add_ps( _mm_mul_ps( nx, dx ), _mm_mul_ps( ny, dy ) ), _mm_mul_ps( nz, dz ) );
+			fdot = _mm_mul_ps( fdot, two );
+			rx = _mm_sub_ps( dx, _mm_mul_ps( nx, fdot ) );
+			ry = _mm_sub_ps( dy, _mm_mul_ps( ny, fdot ) );
+			rz = _mm_sub_ps( dz, _mm_mul_ps( nz, fdot ) );
+
+			if (needs & TGB_NEED_SPHERE) {
+				__m128 rz1 = _mm_add_ps( rz, one );
+				__m128 m = _mm_add_ps( _mm_add_ps( _mm_mul_ps( rx, rx ), _mm_mul_ps( ry, ry ) ), _mm_mul_ps( rz1, rz1 ) );
+				m = _mm_mul_ps( two, _mm_sqrt_ps( m ) );
+				sphereS = _mm_add_ps( _mm_div_ps( rx, m ), half );
+				sphereT = _mm_add_ps( _mm_div_ps( ry, m ), half );
+			}
+		}
+
+		for (int i = 0; i < batch->numStages; ++i) {
+			const D3DTexGenBatchStage *stage = &batch->stages[i];
+			__m128 c[4] = { zero, zero, zero, zero };
+			for (int j = 0; j < 4; ++j) {
+				if (!(stage->enabled & (1 << j)))
+					continue;
+				switch (stage->mode[j]) {
+				case D3DTGB_OBJECT_LINEAR:
+					c[j] = TexGenBatch_Dot4( px, py, pz, pw, planes[i][j] );
+					break;
+				case D3DTGB_EYE_LINEAR:
+					c[j] = TexGenBatch_Dot4( ex, ey, ez, ew, planes[i][j] );
+					break;
+				case D3DTGB_SPHERE_MAP:
+					c[j] = (j == 0) ? sphereS : ((j == 1) ? sphereT : ((j == 3) ? one : zero));
+					break;
+				case D3DTGB_REFLECTION_MAP:
+					c[j] = (j == 0) ? rx : ((j == 1) ? ry : ((j == 2) ? rz : one));
+					break;
+				case D3DTGB_NORMAL_MAP:
+					c[j] = (j == 0) ? nx : ((j == 1) ? ny : ((j == 2) ? nz : one));
+					break;
+				default:
+					c[j] = (j == 3) ? one : zero;
+					break;
+				}
+			}
+
+			// back to one texcoord per vertex
+			_MM_TRANSPOSE4_PS( c[0], c[1], c[2], c[3] );
+			float *out = stage->output + v*4;
+			if (lanes == 4 && stage->enabled == 0xF) {
+				_mm_storeu_ps( out, c[0] );
+				_mm_storeu_ps( out + 4, c[1] );
+				_mm_storeu_ps( out + 8, c[2] );
+				_mm_storeu_ps( out + 12, c[3] );
+			} else {
+				float tmp[4];
+				for (int l = 0; l < lanes; ++l, out += 4) {
+					_mm_storeu_ps( tmp, c[l] );
+					for (int j = 0; j < 4; ++j) {
+						if (stage->enabled & (1 << j))
+							out[j] = tmp[j];
+					}
+				}
+			}
+		}
+	}
+}
+
+#endif //QINDIEGL_MATRIX_SSE
+
+void D3DTexGen_Batch( const D3DTexGenBatch *batch, const float *positions, const float *normals, int count )
+{
+	if (count <= 0 || batch->numStages <= 0)
+		return;
+#if QINDIEGL_MATRIX_SSE
+	if (D3DMatrix_IsUsingSSE()) {
+		D3DTexGen_Batch_SSE( batch, positions, normals, count );
+		return;
+	}
+#endif
+	D3DTexGen_Batch_Ref( batch, positions, normals, count );
+}
@@ -0,0 +1,82 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_TEXGEN_BATCH_H
+#define QINDIEGL_D3D_TEXGEN_BATCH_H
+
+#include "d3d_matrix_math.hpp"
+
+//==================================================================================
+// Batch texture generation
+//----------------------------------------------------------------------------------
+// Generates texture coordinates for a whole range of vertices at once. Every
+// vertex is transformed into eye space once, and that result is shared by all
+// the enabled coordinates of all the enabled stages. The SSE version works on
+// blocks of 4 vertices laid out as SoA, the reference version on one vertex at
+// a time; D3DTexGen_Batch picks one of them depending on D3DMatrix_UseSSE().
+//
+// Like d3d_matrix_math, the module knows nothing about the GL state, so it can
+// be compiled into the tests. d3d_texgen.cpp fills D3DTexGenBatch from it.
+//==================================================================================
+
+#define QINDIEGL_TEXGEN_BATCH_STAGES	8
+
+enum D3DTexGenBatchMode
+{
+	D3DTGB_NONE = 0,
+	D3DTGB_OBJECT_LINEAR,
+	D3DTGB_EYE_LINEAR,
+	D3DTGB_SPHERE_MAP,
+	D3DTGB_REFLECTION_MAP,
+	D3DTGB_NORMAL_MAP
+};
+
+struct D3DTexGenBatchStage
+{
+	unsigned int		enabled;		// bit i set: generate coordinate i (s, t, r, q)
+	D3DTexGenBatchMode	mode[4];
+	float				plane[4][4];	// object plane or eye plane, depending on mode
+	float				*output;		// 4 floats per vertex, only enabled coordinates are written
+};
+
+struct D3DTexGenBatch
+{
+	const float			*modelview;		// 16 floats
+	bool				modelviewAffine;// no perspective divide needed
+	const float			*normalMatrix;	// 16 floats, nullptr to use the normals as they are
+	int					numStages;
+	D3DTexGenBatchStage	stages[QINDIEGL_TEXGEN_BATCH_STAGES];
+};
+
+// Positions are 4 floats per vertex (w is only used by object-linear),
+// normals 3 floats per vertex. Normals may be nullptr if no stage needs them.
+void D3DTexGen_Batch( const D3DTexGenBatch *batch, const float *positions, const float *normals, int count );
+
+void D3DTexGen_Batch_Ref( const D3DTexGenBatch *batch, const float *positions, const float *normals, int count );
+#if QINDIEGL_MATRIX_SSE
+void D3DTexGen_Batch_SSE( const D3DTexGenBatch *batch, const float *positions, const float *normals, int count );
+#endif
+
+// Fill a batch from the GL state; defined in d3d_texgen.cpp. The modelview and
+// normal matrices point into the stack top until the next modelview change.
+extern void D3DTexGen_SetupBatch( D3DTexGenBatch *batch );
+extern void D3DTexGen_AddBatchStage( D3DTexGenBatch *batch, int stage, float *output );
+
+#endif //QINDIEGL_D3D_TEXGEN_BATCH_H
@@ -24,7 +24,13 @@
 #include "d3d_utils.hpp"
 #include "d3d_object.hpp"
 #include "d3d_texture.hpp"
+#include "d3d_texture_manager.hpp"
+#include "d3d_texture_cache.hpp"
 #include "d3d_pixels.hpp"
+#include "d3d_texture_dump.hpp"
+#include "d3d_lists.hpp"
+#include <vector>
+#include <algorithm>
 
 //==================================================================================
 // Texturing
@@ -61,6 +67,19 @@ D3DTextureObject :: D3DTextureObject( GLuint gl_index )
 	m_priority = 0;
 	m_lodBias = 0;
 	m_glIndex = gl_index;
+	m_pShadowCopy = nullptr;
+	m_residentBytes = 0;
+	m_lastUsedFrame = 0;
+	m_managerIndex = -1;
+	m_imageUploads = 0;
+	m_uncompressedFormat = D3DFMT_UNKNOWN;
+	m_compressionDisabled = GL_FALSE;
+	m_pLevelShadows = nullptr;
+	m_numLevelShadows = 0;
+	m_updatesPending = false;
+	m_renderTarget = false;
+	m_gpuCopyDisabled = GL_FALSE;
+	m_renderTargetDemotions = 0;
 }
 
 D3DTextureObject :: ~D3DTextureObject()
@@ -206,8 +225,163 @@ static D3DFORMAT D3DTex_SelectDepthFormat(GLint internalformat)
 	return D3DFMT_UNKNOWN;
 }
 
+static bool D3DTex_IsCompressedFormat(D3DFORMAT format)
+{
+	switch (format) {
+	case D3DFMT_DXT1:
+	case D3DFMT_DXT2:
+	case D3DFMT_DXT3:
+	case D3DFMT_DXT4:
+	case D3DFMT_DXT5:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Picks the block-compressed format a large RGB(A) texture is stored in when
+// runtime compression is enabled, D3DFMT_UNKNOWN keeps the requested format
+static D3DFORMAT D3DTex_SelectCompressedFormat(GLenum target, GLsizei width, GLsizei height, D3DFORMAT format)
+{
+	if (!D3DGlobal.settings.compressTextures || !D3DGlobal.supportsS3TC)
+		return D3DFMT_UNKNOWN;
+	if (target == GL_TEXTURE_3D_EXT || (width & 3) || (height & 3))
+		return D3DFMT_UNKNOWN;
+
+	DWORD minSize = D3DGlobal.settings.compressTexturesMinSize;
+	if ((DWORD)(width * height) < minSize * minSize)
+		return D3DFMT_UNKNOWN;
+
+	switch (format) {
+	case D3DFMT_X8R8G8B8:
+		return D3DFMT_DXT1;
+	case D3DFMT_A8R8G8B8:
+		return D3DFMT_DXT5;
+	default:
+		return D3DFMT_UNKNOWN;
+	}
+}
+
+static void D3DTex_GetLevelLayout(D3DFORMAT format, GLsizei width, GLsizei height, UINT &rowBytes, UINT &rowCount)
+{
+	switch (format) {
+	case D3DFMT_DXT1:
+		rowBytes = QINDIEGL_MAX( 1, (width + 3) / 4 ) * 8;
+		rowCount = QINDIEGL_MAX( 1, (height + 3) / 4 );
+		return;
+	case D3DFMT_DXT3:
+	case D3DFMT_DXT5:
+		rowBytes = QINDIEGL_MAX( 1, (width + 3) / 4 ) * 16;
+		rowCount = QINDIEGL_MAX( 1, (height + 3) / 4 );
+		return;
+	case D3DFMT_L8:
+	case D3DFMT_A8:
+		rowBytes = width;
+		break;
+	case D3DFMT_A8L8:
+	case D3DFMT_X1R5G5B5:
+	case D3DFMT_A1R5G5B5:
+	case D3DFMT_A4R4G4B4:
+	case D3DFMT_R5G6B5:
+	case D3DFMT_D16:
+	case D3DFMT_D16_LOCKABLE:
+		rowBytes = width * 2;
+		break;
+	default:
+		rowBytes = width * 4;
+		break;
+	}
+	rowCount = height;
+}
+
+static int D3DTex_RectArea( const RECT &rect )
+{
+	return (rect.right - rect.left) * (rect.bottom - rect.top);
+}
+
+static RECT D3DTex_RectUnion( const RECT &a, const RECT &b )
+{
+	RECT r;
+	r.left = QINDIEGL_MIN( a.left, b.left );
+	r.top = QINDIEGL_MIN( a.top, b.top );
+	r.right = QINDIEGL_MAX( a.right, b.right );
+	r.bottom = QINDIEGL_MAX( a.bottom, b.bottom );
+	return r;
+}
+
+static void D3DTex_AddDirtyRect( D3DTexLevelShadow *shadow, RECT rect )
+{
+	//merge while the bounding box costs no more than both rectangles,
+	//i.e. they overlap or sit next to each other
+	for (int i = 0; i < shadow->numDirty; ) {
+		RECT u = D3DTex_RectUnion( shadow->dirty[i], rect );
+		if (D3DTex_RectArea( u ) <= D3DTex_RectArea( shadow->dirty[i] ) + D3DTex_RectArea( rect )) {
+			rect = u;
+			shadow->dirty[i] = shadow->dirty[--shadow->numDirty];
+			i = 0;
+		} else {
+			++i;
+		}
+	}
+
+	if (shadow->numDirty < D3D_TEX_MAX_DIRTY_RECTS) {
+		shadow->dirty[shadow->numDirty++] = rect;
+		return;
+	}
+
+	//out of slots, grow the rectangle that wastes the least
+	int best = 0;
+	int bestGrowth = INT_MAX;
+	for (int i = 0; i < shadow->numDirty; ++i) {
+		int growth = D3DTex_RectArea( D3DTex_RectUnion( shadow->dirty[i], rect ) ) - D3DTex_RectArea( shadow->dirty[i] );
+		if (growth < bestGrowth) {
+			bestGrowth = growth;
+			best = i;
+		}
+	}
+	shadow->dirty[best] = D3DTex_RectUnion( shadow->dirty[best], rect );
+}
+
+//textures with glTexSubImage updates waiting in their level shadows
+static std::vector<D3DTextureObject*> s_pendingTextures;
+
+static struct {
+	DWORD		subImageUpdates;
+	DWORD		subImageSkipped;
+	UINT64		subImageBytesSaved;
+	DWORD		gpuCopies;
+	DWORD		cpuCopies;
+} s_texStats;
+
+void D3DTex_LogStats()
+{
+	if (s_texStats.subImageSkipped)
+		logPrintf("Textures: %u of %u sub-image updates skipped as unchanged (%u KB)\n", s_texStats.subImageSkipped, s_texStats.subImageUpdates, (DWORD)(s_texStats.subImageBytesSaved >> 10));
+	if (s_texStats.gpuCopies || s_texStats.cpuCopies)
+		logPrintf("Textures: %u framebuffer copies on the GPU, %u through system memory\n", s_texStats.gpuCopies, s_texStats.cpuCopies);
+}
+
 void D3DTextureObject :: FreeD3DTexture()
 {
+	if (m_managerIndex >= 0 && D3DGlobal.pTextureManager) {
+		D3DGlobal.pTextureManager->Unregister( this );
+	}
+	if (m_pShadowCopy) {
+		UTIL_Free( m_pShadowCopy );
+		m_pShadowCopy = nullptr;
+	}
+	if (m_pLevelShadows) {
+		FreeLevelShadows( -1, 0, m_numLevelShadows );
+		UTIL_Free( m_pLevelShadows );
+		m_pLevelShadows = nullptr;
+		m_numLevelShadows = 0;
+	}
+	m_subImageHashes.clear();
+	m_renderTarget = false;
+	if (!s_pendingTextures.empty()) {
+		m_updatesPending = false;
+		s_pendingTextures.erase( std::remove( s_pendingTextures.begin(), s_pendingTextures.end(), this ), s_pendingTextures.end() );
+	}
 	if (m_pD3DTexture) {
 		if (m_target == GL_TEXTURE_3D_EXT) {
 			//logPrintf("FreeD3DTexture: %i x %i x %i x %s\n", m_width, m_height, m_depth, D3DGlobal_FormatToString(m_format) );
@@ -246,6 +420,15 @@ HRESULT D3DTextureObject :: CreateD3DTexture( GLenum target, GLsizei width, GLsi
 	m_border = border;
 	m_internalFormat = D3D_TEXTYPE_GENERIC;
 	m_dstbytes = 0;
+	m_uncompressedFormat = D3DFMT_UNKNOWN;
+
+	if (m_glIndex && !m_compressionDisabled) {
+		D3DFORMAT compressedFormat = D3DTex_SelectCompressedFormat(target, width, height, format);
+		if (compressedFormat != D3DFMT_UNKNOWN) {
+			m_uncompressedFormat = format;
+			m_format = format = compressedFormat;
+		}
+	}
 
 	if (m_autogenMipmaps) {
 		mipmaps = GL_TRUE;
@@ -277,6 +460,11 @@ HRESULT D3DTextureObject :: CreateD3DTexture( GLenum target, GLsizei width, GLsi
 		if (m_pD3DTexture) m_pD3DTexture->SetPriority( m_priority );
 	}
 
+	if (SUCCEEDED(hr) && m_managerIndex < 0 && m_glIndex && D3DGlobal.pTextureManager) {
+		UpdateResidentBytes();
+		D3DGlobal.pTextureManager->Register( this );
+	}
+
 	return hr;
 }
 
@@ -285,6 +473,12 @@ HRESULT D3DTextureObject :: RecreateD3DTexture( GLboolean mipmaps )
 	if (!m_pD3DTexture) return E_FAIL;
 	if (m_mipmaps == mipmaps) return S_OK;
 
+	if (m_renderTarget) {
+		HRESULT hr = EnsureLockable();
+		if (FAILED(hr)) return hr;
+	}
+	CommitSubImageUpdates();
+
 	if (m_target == GL_TEXTURE_3D_EXT) {
 		//logPrintf("RecreateD3DTexture: %i x %i x %i x %s (mipmaps = %s)\n", m_width, m_height, m_depth, D3DGlobal_FormatToString(m_format), mipmaps ? "true" : "false" );
 	} else {
@@ -369,11 +563,19 @@ HRESULT D3DTextureObject :: RecreateD3DTexture( GLboolean mipmaps )
 
 
 	m_mipmaps = mipmaps;
+
+	//the size estimate changes with the level count
+	if (m_managerIndex >= 0) D3DGlobal.pTextureManager->Resize( this );
 	return hr;
 }
 
 HRESULT D3DTextureObject :: FillTextureLevel( GLint cubeface, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const GLvoid *pixels )
 {
+	if (m_renderTarget) {
+		HRESULT hr = EnsureLockable();
+		if (FAILED(hr)) return hr;
+	}
+
 	if (D3DTex_IsDepthFormat(m_format)) {
 		switch (m_format) {
 		case D3DFMT_D16:
@@ -469,68 +671,145 @@ HRESULT D3DTextureObject :: FillTextureLevel( GLint cubeface, GLint level, GLint
 		return E_INVALID_OPERATION;
 	}
 
+	//buffered sub-image updates of this level are superseded
+	FreeLevelShadows( cubeface, level, level );
+	InvalidateSubImageHashes( cubeface, level, level );
+
 	if (!pixels)
 		return S_OK;
 
-	if (m_target == GL_TEXTURE_3D_EXT) {
-		D3DLOCKED_BOX lockrect;
-		hr = m_pD3DVolumeTexture->LockBox( level, &lockrect, NULL, 0 );
-		if (FAILED(hr)) return hr;
+	if (IsRuntimeCompressed()) {
+		if (m_dstbytes == 4) {
+			//convert to the uncompressed layout first, D3DX does the block compression
+			int rowBytes = width * m_dstbytes;
+			GLubyte *tempdata = (GLubyte*)UTIL_Alloc( rowBytes * height );
+			if (!tempdata)
+				return E_OUTOFMEMORY;
+
+			hr = D3DPixels_Unpack( width, height, 1, rowBytes, 0, tempdata, m_dstbytes, m_internalFormat, false, format, type, pixels );
+			if (SUCCEEDED(hr)) {
+				LPDIRECT3DSURFACE9 surface;
+				hr = GetLevelSurface( cubeface, level, &surface );
+				if (SUCCEEDED(hr)) {
+					RECT srcrect = { 0, 0, width, height };
+					hr = D3DXLoadSurfaceFromMemory( surface, NULL, NULL, tempdata, m_uncompressedFormat, rowBytes, NULL, &srcrect, D3DX_FILTER_NONE, 0 );
+					surface->Release();
+				}
+			}
+			UTIL_Free( tempdata );
+			return hr;
+		}
 
-		dstdata = (GLubyte*)lockrect.pBits;
-		pitch = lockrect.RowPitch;
-		pitch2 = lockrect.SlicePitch;
-	} else if (m_target == GL_TEXTURE_CUBE_MAP_ARB) {
-		D3DLOCKED_RECT lockrect;
-		hr = m_pD3DCubeTexture->LockRect( (D3DCUBEMAP_FACES)cubeface, level, &lockrect, NULL, 0 );
+		hr = UncompressD3DTexture();
 		if (FAILED(hr)) return hr;
+	}
 
-		dstdata = (GLubyte*)lockrect.pBits;
-		pitch = lockrect.Pitch;
-		pitch2 = 0;
-	} else {
-		D3DLOCKED_RECT lockrect;
-		hr = m_pD3DTexture->LockRect( level, &lockrect, NULL, 0 );
-		if (FAILED(hr)) return hr;
+	//textures that are respecified over and over (e.g. cinematics) would only flood the cache
+	if (level == 0 && cubeface == 0)
+		m_imageUploads++;
 
-		dstdata = (GLubyte*)lockrect.pBits;
-		pitch = lockrect.Pitch;
-		pitch2 = 0;
+	UINT64 cacheKey = 0;
+	const GLubyte *cached = nullptr;
+	D3DTextureCache *pCache = D3DGlobal.pTextureCache;
+	if (pCache && m_imageUploads <= 2) {
+		cacheKey = pCache->MakeKey( width, height, depth, internalformat, format, type, m_format, pixels );
+		if (cacheKey)
+			cached = pCache->Find( cacheKey, width, height, depth, m_format, m_internalFormat, m_dstbytes );
+	}
+
+	hr = LockLevel( cubeface, level, 0, &dstdata, &pitch, &pitch2 );
+	if (FAILED(hr)) return hr;
+
+	if (cached) {
+		int rowBytes = width * m_dstbytes;
+		for (int i = 0; i < depth; ++i) {
+			GLubyte *dst = dstdata + i * pitch2;
+			for (int j = 0; j < height; ++j, dst += pitch, cached += rowBytes)
+				memcpy( dst, cached, rowBytes );
+		}
+		return UnlockLevel( cubeface, level );
 	}
 
 	hr = D3DPixels_Unpack( width, height, depth, pitch, pitch2, dstdata, m_dstbytes, m_internalFormat, false, format, type, pixels );
 	if (FAILED(hr)) {
-		if (m_target == GL_TEXTURE_3D_EXT) {	
-			m_pD3DVolumeTexture->UnlockBox( level );
-		} else if (m_target == GL_TEXTURE_CUBE_MAP_ARB) {
-			m_pD3DCubeTexture->UnlockRect( (D3DCUBEMAP_FACES)cubeface, level );
-		} else {
-			m_pD3DTexture->UnlockRect( level );
-		}
+		UnlockLevel( cubeface, level );
 		return hr;
 	}
 
-	if (m_target == GL_TEXTURE_3D_EXT) {
-		hr = m_pD3DVolumeTexture->UnlockBox( level );
-	} else if (m_target == GL_TEXTURE_CUBE_MAP_ARB) {
-		hr = m_pD3DCubeTexture->UnlockRect( (D3DCUBEMAP_FACES)cubeface, level );
-	} else {
-		hr = m_pD3DTexture->UnlockRect( level );
+	if (cacheKey)
+		pCache->Store( cacheKey, width, height, depth, m_format, m_internalFormat, m_dstbytes, dstdata, pitch, pitch2 );
+
+	return UnlockLevel( cubeface, level );
+}
+
+HRESULT D3DTextureObject :: FillTextureSubLevel( GLint cubeface, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const GLvoid *pixels )
+{
+	HRESULT hr;
+
+	if (D3DTex_IsDepthFormat(m_format)) {
+		logPrintf("WARNING: Depth texture subimage updates are not supported for format %s\n", D3DGlobal_FormatToString(m_format));
+		return E_INVALID_OPERATION;
+	}
+	if (m_renderTarget) {
+		hr = EnsureLockable();
+		if (FAILED(hr)) return hr;
+	}
+
+	s_texStats.subImageUpdates++;
+	//the box is about to change; remember its contents only once they are in the texture or its level shadow
+	const D3DBOX box = { (UINT)xoffset, (UINT)yoffset, (UINT)(xoffset + width), (UINT)(yoffset + height), (UINT)zoffset, (UINT)(zoffset + depth) };
+	int size = 0;
+	if (D3DGlobal.settings.skipUnchangedTexSubImage && depth == 1 && D3DPixels_IsDefaultUnpackState())
+		size = D3DPixels_GetUnpackedImageSize( width, height, 1, format, type );
+	if (size <= 0) {
+		ForgetSubImageHashes( cubeface, level, box );
+		return UploadTextureSubLevel( cubeface, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels );
 	}
 
+	DWORD params[2] = { format, type };
+	UINT64 hash = UTIL_HashBytes( pixels, size, UTIL_HashBytes( params, sizeof(params) ) );
+	if (HasSubImageHash( cubeface, level, box, hash )) {
+		s_texStats.subImageSkipped++;
+		s_texStats.subImageBytesSaved += size;
+		return S_FALSE;
+	}
+
+	ForgetSubImageHashes( cubeface, level, box );
+	hr = UploadTextureSubLevel( cubeface, level, xoffset, yoffset, zoffset, width, height, depth, format, type, pixels );
+	if (SUCCEEDED(hr))
+		RecordSubImageHash( cubeface, level, box, hash );
 	return hr;
 }
 
-HRESULT D3DTextureObject :: FillTextureSubLevel( GLint cubeface, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const GLvoid *pixels )
+HRESULT D3DTextureObject :: UploadTextureSubLevel( GLint cubeface, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const GLvoid *pixels )
 {
 	HRESULT hr;
 	GLubyte *dstdata;
 	GLint pitch;
 	GLint pitch2;
 
-	if (D3DTex_IsDepthFormat(m_format)) {
-		logPrintf("WARNING: Depth texture subimage updates are not supported for format %s\n", D3DGlobal_FormatToString(m_format));
-		return E_INVALID_OPERATION;
+	//sub-image updates would need a recompression every time
+	if (IsRuntimeCompressed()) {
+		hr = UncompressD3DTexture();
+		if (FAILED(hr)) return hr;
+	}
+
+	//buffer the update in the level shadow, the dirty region is committed before the next draw
+	if (D3DGlobal.settings.batchTexSubImage && m_target != GL_TEXTURE_3D_EXT && !D3DTex_IsCompressedFormat(m_format) && depth == 1 &&
+		xoffset >= 0 && yoffset >= 0 && xoffset + width <= QINDIEGL_MAX( 1, m_width >> level ) && yoffset + height <= QINDIEGL_MAX( 1, m_height >> level )) {
+		D3DTexLevelShadow *shadow = GetLevelShadow( cubeface, level );
+		if (shadow) {
+			hr = D3DPixels_Unpack( width, height, 1, shadow->pitch, 0, shadow->data + yoffset * shadow->pitch + xoffset * m_dstbytes, m_dstbytes, m_internalFormat, false, format, type, pixels );
+			if (FAILED(hr)) return hr;
+
+			RECT rect = { xoffset, yoffset, xoffset + width, yoffset + height };
+			D3DTex_AddDirtyRect( shadow, rect );
+			if (!m_updatesPending) {
+				m_updatesPending = true;
+				s_pendingTextures.push_back( this );
+			}
+			return S_FALSE;
+		}
 	}
 
 	if (m_target == GL_TEXTURE_3D_EXT) {
@@ -614,6 +893,29 @@ HRESULT D3DTextureObject :: CopyTextureSubLevel( GLint cubeface, GLint level, GL
 		return E_FAIL;
 	}
 
+	if (IsRuntimeCompressed()) {
+		hr = UncompressD3DTexture();
+		if (FAILED(hr)) return hr;
+	}
+
+	//the level is written directly, its shadow would go stale
+	CommitSubImageUpdates();
+	FreeLevelShadows( cubeface, level, level );
+	InvalidateSubImageHashes( cubeface, level, level );
+
+	if (D3DGlobal.settings.gpuCopyTexImage && !m_gpuCopyDisabled) {
+		hr = CopyTextureSubLevelGPU( cubeface, level, xoffset, yoffset, x, y, width, height );
+		if (SUCCEEDED(hr)) {
+			s_texStats.gpuCopies++;
+			return hr;
+		}
+	}
+	if (m_renderTarget) {
+		hr = EnsureLockable();
+		if (FAILED(hr)) return hr;
+	}
+	s_texStats.cpuCopies++;
+
 	hr = D3DGlobal.pDevice->GetRenderTarget( 0, &lpRenderTarget );
 	if (FAILED(hr)) {
 		D3DGlobal.lastError = hr;
@@ -750,6 +1052,302 @@ HRESULT D3DTextureObject :: CopyTextureSubLevel( GLint cubeface, GLint level, GL
 	return hr;
 }
 
+//=========================================
+// Framebuffer copies on the GPU
+//-----------------------------------------
+// Textures which receive framebuffer copies are moved into the
+// default pool as render targets, so the copy becomes a StretchRect
+// instead of a readback through system memory. Any CPU access to
+// the texture moves it back into the managed pool.
+//=========================================
+static HRESULT D3DTex_CreateSingleLevel( GLenum target, GLsizei width, GLsizei height, DWORD usage, D3DFORMAT format, D3DPOOL pool, LPDIRECT3DBASETEXTURE9 *ppTexture )
+{
+	if (target == GL_TEXTURE_CUBE_MAP_ARB)
+		return D3DGlobal.pDevice->CreateCubeTexture( width, 1, usage, format, pool, (LPDIRECT3DCUBETEXTURE9*)ppTexture, NULL );
+	return D3DGlobal.pDevice->CreateTexture( width, height, 1, usage, format, pool, (LPDIRECT3DTEXTURE9*)ppTexture, NULL );
+}
+
+static HRESULT D3DTex_GetFaceSurface( LPDIRECT3DBASETEXTURE9 pTexture, GLenum target, GLint cubeface, LPDIRECT3DSURFACE9 *ppSurface )
+{
+	if (target == GL_TEXTURE_CUBE_MAP_ARB)
+		return ((LPDIRECT3DCUBETEXTURE9)pTexture)->GetCubeMapSurface( (D3DCUBEMAP_FACES)cubeface, 0, ppSurface );
+	return ((LPDIRECT3DTEXTURE9)pTexture)->GetSurfaceLevel( 0, ppSurface );
+}
+
+static HRESULT D3DTex_CopySurfaceBits( LPDIRECT3DSURFACE9 pDst, LPDIRECT3DSURFACE9 pSrc, D3DFORMAT format, GLsizei width, GLsizei height )
+{
+	D3DLOCKED_RECT srclockrect;
+	D3DLOCKED_RECT dstlockrect;
+	UINT rowBytes, rowCount;
+
+	HRESULT hr = pSrc->LockRect( &srclockrect, NULL, D3DLOCK_READONLY );
+	if (FAILED(hr)) return hr;
+	hr = pDst->LockRect( &dstlockrect, NULL, 0 );
+	if (FAILED(hr)) {
+		pSrc->UnlockRect();
+		return hr;
+	}
+
+	D3DTex_GetLevelLayout( format, width, height, rowBytes, rowCount );
+	const GLubyte *src = (const GLubyte*)srclockrect.pBits;
+	GLubyte *dst = (GLubyte*)dstlockrect.pBits;
+	for (UINT y = 0; y < rowCount; ++y, src += srclockrect.Pitch, dst += dstlockrect.Pitch)
+		memcpy( dst, src, rowBytes );
+
+	pDst->UnlockRect();
+	pSrc->UnlockRect();
+	return S_OK;
+}
+
+//copies the only level of every face between a render target and a managed texture
+static HRESULT D3DTex_TransferSingleLevel( LPDIRECT3DBASETEXTURE9 pDst, LPDIRECT3DBASETEXTURE9 pSrc, GLenum target, D3DFORMAT format, GLsizei width, GLsizei height, bool fromRenderTarget )
+{
+	LPDIRECT3DSURFACE9 pStaging = nullptr;
+	HRESULT hr = D3DGlobal.pDevice->CreateOffscreenPlainSurface( width, height, format, D3DPOOL_SYSTEMMEM, &pStaging, NULL );
+	if (FAILED(hr)) return hr;
+
+	int numFaces = (target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+	for (int face = 0; face < numFaces && SUCCEEDED(hr); ++face) {
+		LPDIRECT3DSURFACE9 pSrcSurface = nullptr;
+		LPDIRECT3DSURFACE9 pDstSurface = nullptr;
+		hr = D3DTex_GetFaceSurface( pSrc, target, face, &pSrcSurface );
+		if (SUCCEEDED(hr))
+			hr = D3DTex_GetFaceSurface( pDst, target, face, &pDstSurface );
+		if (SUCCEEDED(hr)) {
+			if (fromRenderTarget) {
+				hr = D3DGlobal.pDevice->GetRenderTargetData( pSrcSurface, pStaging );
+				if (SUCCEEDED(hr))
+					hr = D3DTex_CopySurfaceBits( pDstSurface, pStaging, format, width, height );
+			} else {
+				hr = D3DTex_CopySurfaceBits( pStaging, pSrcSurface, format, width, height );
+				if (SUCCEEDED(hr))
+					hr = D3DGlobal.pDevice->UpdateSurface( pStaging, NULL, pDstSurface, NULL );
+			}
+		}
+		if (pDstSurface) pDstSurface->Release();
+		if (pSrcSurface) pSrcSurface->Release();
+	}
+
+	pStaging->Release();
+	return hr;
+}
+
+HRESULT D3DTextureObject :: PromoteToRenderTarget( D3DFORMAT backBufferFormat )
+{
+	if (m_renderTarget)
+		return S_OK;
+
+	//mipmapped textures would need their chain rebuilt after every copy
+	if (m_target == GL_TEXTURE_3D_EXT || m_autogenMipmaps || IsEvicted() || IsRuntimeCompressed() || m_managerIndex < 0)
+		return E_NOTIMPL;
+	if (D3DTex_IsDepthFormat(m_format) || m_pD3DBaseTexture->GetLevelCount() != 1)
+		return E_NOTIMPL;
+
+	D3DRESOURCETYPE resourceType = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? D3DRTYPE_CUBETEXTURE : D3DRTYPE_TEXTURE;
+	HRESULT hr = D3DGlobal.pD3D->CheckDeviceFormat( D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, D3DGlobal.hCurrentMode.Format, D3DUSAGE_RENDERTARGET, resourceType, m_format );
+	if (FAILED(hr)) return E_NOTIMPL;
+	hr = D3DGlobal.pD3D->CheckDeviceFormatConversion( D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, backBufferFormat, m_format );
+	if (FAILED(hr)) return E_NOTIMPL;
+
+	LPDIRECT3DBASETEXTURE9 pRenderTexture = nullptr;
+	hr = D3DTex_CreateSingleLevel( m_target, m_width, m_height, D3DUSAGE_RENDERTARGET, m_format, D3DPOOL_DEFAULT, &pRenderTexture );
+	if (FAILED(hr)) return hr;
+
+	hr = D3DTex_TransferSingleLevel( pRenderTexture, m_pD3DBaseTexture, m_target, m_format, m_width, m_height, false );
+	if (FAILED(hr)) {
+		pRenderTexture->Release();
+		return hr;
+	}
+
+	m_pD3DBaseTexture->Release();
+	m_pD3DBaseTexture = pRenderTexture;
+	m_renderTarget = true;
+	return S_OK;
+}
+
+HRESULT D3DTextureObject :: DemoteRenderTarget()
+{
+	if (!m_renderTarget)
+		return S_OK;
+
+	LPDIRECT3DBASETEXTURE9 pManagedTexture = nullptr;
+	HRESULT hr = D3DTex_CreateSingleLevel( m_target, m_width, m_height, 0, m_format, D3DPOOL_MANAGED, &pManagedTexture );
+	if (FAILED(hr)) {
+		D3DGlobal.lastError = hr;
+		logPrintf("WARNING: DemoteRenderTarget: texture creation failed with error '%s'\n", DXGetErrorString(hr));
+		return hr;
+	}
+
+	//a default pool texture must not outlive a device reset, so keep going with undefined contents
+	hr = D3DTex_TransferSingleLevel( pManagedTexture, m_pD3DBaseTexture, m_target, m_format, m_width, m_height, true );
+	if (FAILED(hr))
+		logPrintf("WARNING: DemoteRenderTarget: readback failed with error '%s'\n", DXGetErrorString(hr));
+
+	pManagedTexture->SetPriority( m_priority );
+	m_pD3DBaseTexture->Release();
+	m_pD3DBaseTexture = pManagedTexture;
+	m_renderTarget = false;
+	return S_OK;
+}
+
+HRESULT D3DTextureObject :: EnsureLockable()
+{
+	if (!m_renderTarget)
+		return S_OK;
+
+	//stop promoting textures that keep bouncing between the GPU and the CPU
+	if (++m_renderTargetDemotions >= 2)
+		m_gpuCopyDisabled = GL_TRUE;
+	return DemoteRenderTarget();
+}
+
+//draws the top left width x height texels of pSource into pDest at x, y, upside down
+static HRESULT D3DTex_DrawFlipped( LPDIRECT3DTEXTURE9 pSource, LPDIRECT3DSURFACE9 pDest, GLint x, GLint y, GLsizei width, GLsizei height )
+{
+	D3DSURFACE_DESC srcdesc;
+	HRESULT hr = pSource->GetLevelDesc( 0, &srcdesc );
+	if (FAILED(hr)) return hr;
+
+	//state blocks do not cover the render target and depth buffer
+	LPDIRECT3DSTATEBLOCK9 pStateBlock = nullptr;
+	hr = D3DGlobal.pDevice->CreateStateBlock( D3DSBT_ALL, &pStateBlock );
+	if (FAILED(hr)) return hr;
+	LPDIRECT3DSURFACE9 lpOldTarget = nullptr;
+	LPDIRECT3DSURFACE9 lpOldDepth = nullptr;
+	D3DGlobal.pDevice->GetRenderTarget( 0, &lpOldTarget );
+	D3DGlobal.pDevice->GetDepthStencilSurface( &lpOldDepth );
+
+	D3DState_AssureBeginScene();
+	D3DGlobal.pDevice->SetRenderTarget( 0, pDest );
+	D3DGlobal.pDevice->SetDepthStencilSurface( nullptr );
+	D3DGlobal.pDevice->SetVertexShader( nullptr );
+	D3DGlobal.pDevice->SetPixelShader( nullptr );
+	D3DGlobal.pDevice->SetFVF( D3DFVF_XYZRHW | D3DFVF_TEX1 );
+	D3DGlobal.pDevice->SetTexture( 0, pSource );
+	D3DGlobal.pDevice->SetTextureStageState( 0, D3DTSS_COLOROP, D3DTOP_SELECTARG1 );
+	D3DGlobal.pDevice->SetTextureStageState( 0, D3DTSS_COLORARG1, D3DTA_TEXTURE );
+	D3DGlobal.pDevice->SetTextureStageState( 0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG1 );
+	D3DGlobal.pDevice->SetTextureStageState( 0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE );
+	D3DGlobal.pDevice->SetTextureStageState( 0, D3DTSS_TEXCOORDINDEX, 0 );
+	D3DGlobal.pDevice->SetTextureStageState( 0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE );
+	D3DGlobal.pDevice->SetTextureStageState( 1, D3DTSS_COLOROP, D3DTOP_DISABLE );
+	D3DGlobal.pDevice->SetSamplerState( 0, D3DSAMP_MINFILTER, D3DTEXF_POINT );
+	D3DGlobal.pDevice->SetSamplerState( 0, D3DSAMP_MAGFILTER, D3DTEXF_POINT );
+	D3DGlobal.pDevice->SetSamplerState( 0, D3DSAMP_MIPFILTER, D3DTEXF_NONE );
+	D3DGlobal.pDevice->SetSamplerState( 0, D3DSAMP_ADDRESSU, D3DTADDRESS_CLAMP );
+	D3DGlobal.pDevice->SetSamplerState( 0, D3DSAMP_ADDRESSV, D3DTADDRESS_CLAMP );
+	D3DGlobal.pDevice->SetSamplerState( 0, D3DSAMP_SRGBTEXTURE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_ZENABLE, D3DZB_FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_ZWRITEENABLE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_STENCILENABLE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_ALPHATESTENABLE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_ALPHABLENDENABLE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_FOGENABLE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_LIGHTING, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_CULLMODE, D3DCULL_NONE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_FILLMODE, D3DFILL_SOLID );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_SCISSORTESTENABLE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_CLIPPLANEENABLE, 0 );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_SRGBWRITEENABLE, FALSE );
+	D3DGlobal.pDevice->SetRenderState( D3DRS_COLORWRITEENABLE, 0xF );
+
+	//pixel edges sit half a texel up and left of the centers; the top row of the
+	//destination takes the bottom row of the source
+	float x0 = (float)x - 0.5f, y0 = (float)y - 0.5f;
+	float x1 = x0 + (float)width, y1 = y0 + (float)height;
+	float u = (float)width / (float)srcdesc.Width, v = (float)height / (float)srcdesc.Height;
+	const float quad[4][6] = {
+		{ x0, y0, 0.0f, 1.0f, 0.0f, v },
+		{ x1, y0, 0.0f, 1.0f, u, v },
+		{ x0, y1, 0.0f, 1.0f, 0.0f, 0.0f },
+		{ x1, y1, 0.0f, 1.0f, u, 0.0f },
+	};
+	hr = D3DGlobal.pDevice->DrawPrimitiveUP( D3DPT_TRIANGLESTRIP, 2, quad, sizeof(quad[0]) );
+
+	D3DGlobal.pDevice->SetRenderTarget( 0, lpOldTarget );
+	D3DGlobal.pDevice->SetDepthStencilSurface( lpOldDepth );
+	//after the render target, which resets the viewport
+	pStateBlock->Apply();
+	pStateBlock->Release();
+	if (lpOldTarget) lpOldTarget->Release();
+	if (lpOldDepth) lpOldDepth->Release();
+	return hr;
+}
+
+HRESULT D3DTextureObject :: CopyTextureSubLevelGPU( GLint cubeface, GLint level, GLint xoffset, GLint yoffset, GLint x, GLint y, GLsizei width, GLsizei height )
+{
+	HRESULT hr;
+	LPDIRECT3DSURFACE9 lpRenderTarget( nullptr );
+	LPDIRECT3DSURFACE9 lpDstSurface( nullptr );
+	D3DSURFACE_DESC desc;
+
+	if (level != 0 || m_target == GL_TEXTURE_3D_EXT)
+		return E_NOTIMPL;
+
+	hr = D3DGlobal.pDevice->GetRenderTarget( 0, &lpRenderTarget );
+	if (FAILED(hr)) return hr;
+
+	hr = lpRenderTarget->GetDesc( &desc );
+	if (FAILED(hr) || x < 0 || y < 0 || x + width > (GLint)desc.Width || y + height > (GLint)desc.Height ||
+		xoffset < 0 || yoffset < 0 || xoffset + width > m_width || yoffset + height > m_height) {
+		lpRenderTarget->Release();
+		return E_NOTIMPL;
+	}
+
+	hr = PromoteToRenderTarget( desc.Format );
+	if (FAILED(hr)) {
+		lpRenderTarget->Release();
+		return hr;
+	}
+
+	if (desc.MultiSampleType != D3DMULTISAMPLE_NONE) {
+		//multisampled surfaces can only be resolved as a whole
+		if (!D3DGlobal.pSystemMemFB) {
+			hr = D3DGlobal.pDevice->CreateRenderTarget( desc.Width, desc.Height, desc.Format, D3DMULTISAMPLE_NONE, 0, FALSE, &D3DGlobal.pSystemMemFB, NULL );
+			if (FAILED(hr)) {
+				lpRenderTarget->Release();
+				return hr;
+			}
+		}
+		hr = D3DGlobal.pDevice->StretchRect( lpRenderTarget, NULL, D3DGlobal.pSystemMemFB, NULL, D3DTEXF_NONE );
+		lpRenderTarget->Release();
+		if (FAILED(hr)) return hr;
+		lpRenderTarget = D3DGlobal.pSystemMemFB;
+		lpRenderTarget->AddRef();
+	}
+
+	hr = GetLevelSurface( cubeface, level, &lpDstSurface );
+	if (FAILED(hr)) {
+		lpRenderTarget->Release();
+		return hr;
+	}
+
+	//StretchRect cannot mirror, so the rows are copied as they are and then drawn upside down
+	LPDIRECT3DTEXTURE9 pFlipTarget = nullptr;
+	LPDIRECT3DSURFACE9 lpFlipSurface = nullptr;
+	hr = D3DGlobal.pTextureManager->GetFlipTarget( width, height, desc.Format, &pFlipTarget );
+	if (SUCCEEDED(hr))
+		hr = pFlipTarget->GetSurfaceLevel( 0, &lpFlipSurface );
+	if (SUCCEEDED(hr)) {
+		GLint top = (GLint)desc.Height - (y + height);
+		RECT srcrect = { x, top, x + width, top + height };
+		RECT dstrect = { 0, 0, width, height };
+		hr = D3DGlobal.pDevice->StretchRect( lpRenderTarget, &srcrect, lpFlipSurface, &dstrect, D3DTEXF_NONE );
+		lpFlipSurface->Release();
+		if (FAILED(hr))
+			logPrintf("WARNING: CopyTextureSubLevel: StretchRect failed with error '%s'\n", DXGetErrorString(hr));
+	}
+	if (SUCCEEDED(hr)) {
+		hr = D3DTex_DrawFlipped( pFlipTarget, lpDstSurface, xoffset, yoffset, width, height );
+		if (FAILED(hr))
+			logPrintf("WARNING: CopyTextureSubLevel: flipped draw failed with error '%s'\n", DXGetErrorString(hr));
+	}
+
+	lpDstSurface->Release();
+	lpRenderTarget->Release();
+	return hr;
+}
+
 HRESULT D3DTextureObject :: FillCompressedTextureLevel( GLint cubeface, GLint level, GLint /*internalformat*/, GLsizei /*width*/, GLsizei /*height*/, GLsizei /*depth*/, GLsizei imageSize, const GLvoid *pixels )
 {
 	HRESULT hr;
@@ -759,6 +1357,10 @@ HRESULT D3DTextureObject :: FillCompressedTextureLevel( GLint cubeface, GLint le
 
 	if (!pixels)
 		return S_OK;
+	if (m_renderTarget) {
+		hr = EnsureLockable();
+		if (FAILED(hr)) return hr;
+	}
 
 	if (m_target == GL_TEXTURE_3D_EXT) {
 		D3DLOCKED_BOX lockrect;
@@ -808,6 +1410,29 @@ HRESULT D3DTextureObject :: GetTexImage( GLint cubeface, GLint level, GLenum for
 
 	if (level > 0 && !m_mipmaps) 
 		return E_INVALIDARG;
+	if (m_renderTarget) {
+		hr = EnsureLockable();
+		if (FAILED(hr)) return hr;
+	}
+
+	CommitSubImageUpdates();
+
+	if (D3DTex_IsCompressedFormat(m_format)) {
+		LPDIRECT3DSURFACE9 surface;
+		hr = GetDecompressedLevel( cubeface, level, &surface );
+		if (FAILED(hr)) return hr;
+
+		D3DSURFACE_DESC desc;
+		D3DLOCKED_RECT lockrect;
+		surface->GetDesc( &desc );
+		hr = surface->LockRect( &lockrect, nullptr, D3DLOCK_READONLY );
+		if (SUCCEEDED(hr)) {
+			hr = D3DPixels_Pack( desc.Width, desc.Height, 1, lockrect.Pitch, 0, (const GLubyte*)lockrect.pBits, 4, m_internalFormat, false, format, type, pixels );
+			surface->UnlockRect();
+		}
+		surface->Release();
+		return hr;
+	}
 
 	if (m_target == GL_TEXTURE_3D_EXT) {
 		D3DLOCKED_BOX lockrect;
@@ -861,63 +1486,69 @@ HRESULT D3DTextureObject :: GetTexImage( GLint cubeface, GLint level, GLenum for
 HRESULT D3DTextureObject :: DumpTexture()
 {
 	HRESULT hr;
-	GLubyte *srcdata;
-	GLint pitch;
-	GLint pitch2;
-	static GLubyte dumpBuffer[18+1024*1024*4];
-	static int dumpCounter = 0;
 
+	if (!D3DGlobal.pTextureDumper)
+		return E_FAIL;
+	if (IsEvicted() && D3DGlobal.pTextureManager) {
+		hr = D3DGlobal.pTextureManager->MakeResident( this );
+		if (FAILED(hr)) return hr;
+	}
 	if (!m_pD3DTexture)
 		return E_FAIL;
 
-	if (m_width > 1024 || m_height > 1024)
-		return E_OUTOFMEMORY;
-
-	memset(dumpBuffer, 0, 18);
-	dumpBuffer[2] = 2;
-	dumpBuffer[12] = static_cast<GLubyte>( m_width & 255 );
-	dumpBuffer[13] = static_cast<GLubyte>( m_width >> 8 );
-	dumpBuffer[14] = static_cast<GLubyte>( m_height & 255 );
-	dumpBuffer[15] = static_cast<GLubyte>( m_height >> 8 );
-	dumpBuffer[16] = 32;
-
-	if (m_target == GL_TEXTURE_3D_EXT) {
-		//Cannot dump 3D image
-		return S_OK;
-	} else if (m_target == GL_TEXTURE_CUBE_MAP_ARB) {
-		//Cannot dump cubemap
+	if (m_target == GL_TEXTURE_3D_EXT || D3DTex_IsDepthFormat(m_format)) {
+		//Cannot dump 3D or depth image
 		return S_OK;
-	} else {
-		D3DLOCKED_RECT lockrect;
-		hr = m_pD3DTexture->LockRect( 0, &lockrect, nullptr, D3DLOCK_READONLY );
+	}
+	if (m_renderTarget) {
+		hr = EnsureLockable();
 		if (FAILED(hr)) return hr;
-
-		srcdata = (GLubyte*)lockrect.pBits;
-		pitch = lockrect.Pitch;
-		pitch2 = 0;
 	}
 
-	hr = D3DPixels_Pack( m_width, m_height, m_depth, pitch, pitch2, srcdata, m_dstbytes, m_internalFormat, true, GL_BGRA, GL_UNSIGNED_BYTE, dumpBuffer+18 );
-	if (FAILED(hr)) {
-		m_pD3DTexture->UnlockRect( 0 );
-		return hr;
-	}
+	CommitSubImageUpdates();
 
-	char filename[MAX_PATH];
-	_mkdir("dump");
-	sprintf_s(filename, "dump\\texture%i.tga", dumpCounter);
+	int numFaces = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+	DWORD numLevels = (D3DGlobal.settings.dumpTextures > 1) ? m_pD3DBaseTexture->GetLevelCount() : 1;
 
-	FILE *fp( nullptr );
-	if ( fopen_s( &fp, filename, "wb") )
-		return E_ACCESSDENIED;
+	for (int face = 0; face < numFaces; ++face) {
+		for (DWORD level = 0; level < numLevels; ++level) {
+			//anything but 32-bit BGRA is dumped from a converted copy
+			LPDIRECT3DSURFACE9 surface;
+			bool direct = (m_format == D3DFMT_A8R8G8B8 || m_format == D3DFMT_X8R8G8B8);
+			if (direct)
+				hr = GetLevelSurface( face, level, &surface );
+			else
+				hr = GetDecompressedLevel( face, level, &surface );
+			if (FAILED(hr)) return hr;
 
-	++dumpCounter;
-	
-	fwrite( dumpBuffer, 1, m_height*m_width*4+18 , fp );
-	fclose( fp );
+			D3DSURFACE_DESC desc;
+			D3DLOCKED_RECT lockrect;
+			surface->GetDesc( &desc );
+			hr = surface->LockRect( &lockrect, nullptr, D3DLOCK_READONLY );
+			if (FAILED(hr)) {
+				surface->Release();
+				return hr;
+			}
 
-	hr = m_pD3DTexture->UnlockRect( 0 );
-	return hr;
+			//TGA rows go bottom up
+			UINT rowBytes = desc.Width * 4;
+			std::vector<GLubyte> pixels( rowBytes * desc.Height );
+			const GLubyte *src = (const GLubyte*)lockrect.pBits + (desc.Height - 1) * lockrect.Pitch;
+			for (UINT y = 0; y < desc.Height; ++y, src -= lockrect.Pitch)
+				memcpy( pixels.data() + y * rowBytes, src, rowBytes );
+			if (m_format == D3DFMT_X8R8G8B8) {
+				for (size_t i = 3; i < pixels.size(); i += 4)
+					pixels[i] = 255;
+			}
+
+			surface->UnlockRect();
+			surface->Release();
+
+			D3DGlobal.pTextureDumper->Queue( pixels, desc.Width, desc.Height );
+		}
+	}
+
+	return S_OK;
 }
 
 void D3DTextureObject :: CheckMipmapAutogen()
@@ -941,6 +1572,419 @@ void D3DTextureObject :: CheckMipmapAutogen()
 	if (FAILED(hr)) {
 		logPrintf("WARNING: Mipmap generation failed with error '%s'\n", DXGetErrorString(hr));
 	}
+	//generated levels no longer match their shadows
+	FreeLevelShadows( -1, 1, INT_MAX );
+	InvalidateSubImageHashes( -1, 1, INT_MAX );
+}
+
+HRESULT D3DTextureObject :: LockLevel( GLint cubeface, GLint level, DWORD flags, GLubyte **data, GLint *pitch, GLint *pitch2, const RECT *rect )
+{
+	HRESULT hr;
+
+	if (m_target == GL_TEXTURE_3D_EXT) {
+		D3DLOCKED_BOX lockrect;
+		hr = m_pD3DVolumeTexture->LockBox( level, &lockrect, nullptr, flags );
+		if (FAILED(hr)) return hr;
+
+		*data = (GLubyte*)lockrect.pBits;
+		*pitch = lockrect.RowPitch;
+		*pitch2 = lockrect.SlicePitch;
+	} else if (m_target == GL_TEXTURE_CUBE_MAP_ARB) {
+		D3DLOCKED_RECT lockrect;
+		hr = m_pD3DCubeTexture->LockRect( (D3DCUBEMAP_FACES)cubeface, level, &lockrect, rect, flags );
+		if (FAILED(hr)) return hr;
+
+		*data = (GLubyte*)lockrect.pBits;
+		*pitch = lockrect.Pitch;
+		*pitch2 = 0;
+	} else {
+		D3DLOCKED_RECT lockrect;
+		hr = m_pD3DTexture->LockRect( level, &lockrect, rect, flags );
+		if (FAILED(hr)) return hr;
+
+		*data = (GLubyte*)lockrect.pBits;
+		*pitch = lockrect.Pitch;
+		*pitch2 = 0;
+	}
+
+	return hr;
+}
+
+HRESULT D3DTextureObject :: UnlockLevel( GLint cubeface, GLint level )
+{
+	if (m_target == GL_TEXTURE_3D_EXT)
+		return m_pD3DVolumeTexture->UnlockBox( level );
+	else if (m_target == GL_TEXTURE_CUBE_MAP_ARB)
+		return m_pD3DCubeTexture->UnlockRect( (D3DCUBEMAP_FACES)cubeface, level );
+	else
+		return m_pD3DTexture->UnlockRect( level );
+}
+
+HRESULT D3DTextureObject :: GetLevelSurface( GLint cubeface, GLint level, LPDIRECT3DSURFACE9 *ppSurface )
+{
+	if (m_target == GL_TEXTURE_3D_EXT)
+		return E_INVALID_OPERATION;
+	else if (m_target == GL_TEXTURE_CUBE_MAP_ARB)
+		return m_pD3DCubeTexture->GetCubeMapSurface( (D3DCUBEMAP_FACES)cubeface, level, ppSurface );
+	else
+		return m_pD3DTexture->GetSurfaceLevel( level, ppSurface );
+}
+
+HRESULT D3DTextureObject :: GetDecompressedLevel( GLint cubeface, GLint level, LPDIRECT3DSURFACE9 *ppSurface )
+{
+	LPDIRECT3DSURFACE9 srcsurf;
+	HRESULT hr = GetLevelSurface( cubeface, level, &srcsurf );
+	if (FAILED(hr)) return hr;
+
+	D3DSURFACE_DESC desc;
+	srcsurf->GetDesc( &desc );
+	hr = D3DGlobal.pDevice->CreateOffscreenPlainSurface( desc.Width, desc.Height, D3DFMT_A8R8G8B8, D3DPOOL_SCRATCH, ppSurface, NULL );
+	if (SUCCEEDED(hr)) {
+		hr = D3DXLoadSurfaceFromSurface( *ppSurface, NULL, NULL, srcsurf, NULL, NULL, D3DX_FILTER_NONE, 0 );
+		if (FAILED(hr)) {
+			(*ppSurface)->Release();
+			*ppSurface = nullptr;
+		}
+	}
+	srcsurf->Release();
+	return hr;
+}
+
+HRESULT D3DTextureObject :: UncompressD3DTexture()
+{
+	//once a texture is updated in place it stays uncompressed
+	m_compressionDisabled = GL_TRUE;
+	if (!IsRuntimeCompressed() || !m_pD3DBaseTexture)
+		return S_OK;
+
+	HRESULT hr;
+	LPDIRECT3DBASETEXTURE9 newTexture;
+	DWORD numLevels = m_pD3DBaseTexture->GetLevelCount();
+	int numFaces = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+
+	if (m_target == GL_TEXTURE_CUBE_MAP_ARB)
+		hr = D3DGlobal.pDevice->CreateCubeTexture( m_width, numLevels, 0, m_uncompressedFormat, D3DPOOL_MANAGED, (LPDIRECT3DCUBETEXTURE9*)&newTexture, NULL );
+	else
+		hr = D3DGlobal.pDevice->CreateTexture( m_width, m_height, numLevels, 0, m_uncompressedFormat, D3DPOOL_MANAGED, (LPDIRECT3DTEXTURE9*)&newTexture, NULL );
+	if (FAILED(hr)) return hr;
+
+	LPDIRECT3DSURFACE9 srcsurf, dstsurf;
+	for (int face = 0; face < numFaces && SUCCEEDED(hr); ++face) {
+		for (DWORD i = 0; i < numLevels && SUCCEEDED(hr); ++i) {
+			hr = GetLevelSurface( face, i, &srcsurf );
+			if (FAILED(hr)) break;
+			if (m_target == GL_TEXTURE_CUBE_MAP_ARB)
+				hr = ((LPDIRECT3DCUBETEXTURE9)newTexture)->GetCubeMapSurface( (D3DCUBEMAP_FACES)face, i, &dstsurf );
+			else
+				hr = ((LPDIRECT3DTEXTURE9)newTexture)->GetSurfaceLevel( i, &dstsurf );
+			if (SUCCEEDED(hr)) {
+				hr = D3DXLoadSurfaceFromSurface( dstsurf, NULL, NULL, srcsurf, NULL, NULL, D3DX_FILTER_NONE, 0 );
+				dstsurf->Release();
+			}
+			srcsurf->Release();
+		}
+	}
+	if (FAILED(hr)) {
+		newTexture->Release();
+		return hr;
+	}
+
+	m_pD3DBaseTexture->Release();
+	m_pD3DBaseTexture = newTexture;
+	m_pD3DBaseTexture->SetPriority( m_priority );
+	m_format = m_uncompressedFormat;
+	m_uncompressedFormat = D3DFMT_UNKNOWN;
+
+	if (m_managerIndex >= 0) D3DGlobal.pTextureManager->Resize( this );
+	return S_OK;
+}
+
+D3DTexLevelShadow *D3DTextureObject :: GetLevelShadow( GLint cubeface, GLint level )
+{
+	int numLevels = (int)m_pD3DBaseTexture->GetLevelCount();
+	int numShadows = numLevels * ((m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1);
+	if (level >= numLevels)
+		return nullptr;
+
+	//the level count changes when mipmaps are added later
+	if (m_numLevelShadows != numShadows) {
+		if (m_pLevelShadows) {
+			CommitSubImageUpdates();
+			FreeLevelShadows( -1, 0, m_numLevelShadows );
+			UTIL_Free( m_pLevelShadows );
+		}
+		m_pLevelShadows = (D3DTexLevelShadow*)UTIL_Alloc( numShadows * sizeof(D3DTexLevelShadow) );
+		m_numLevelShadows = m_pLevelShadows ? numShadows : 0;
+		if (!m_pLevelShadows)
+			return nullptr;
+	}
+
+	D3DTexLevelShadow *shadow = &m_pLevelShadows[cubeface * numLevels + level];
+	if (shadow->data)
+		return shadow;
+
+	//start from the current contents, coalesced rectangles may cover texels that were never updated
+	GLsizei w = QINDIEGL_MAX( 1, m_width >> level );
+	GLsizei h = QINDIEGL_MAX( 1, m_height >> level );
+	int pitch = w * m_dstbytes;
+	GLubyte *data = (GLubyte*)UTIL_Alloc( pitch * h );
+	if (!data)
+		return nullptr;
+
+	GLubyte *srcdata;
+	GLint srcpitch, srcpitch2;
+	if (FAILED(LockLevel( cubeface, level, D3DLOCK_READONLY, &srcdata, &srcpitch, &srcpitch2 ))) {
+		UTIL_Free( data );
+		return nullptr;
+	}
+	for (int i = 0; i < h; ++i)
+		memcpy( data + i * pitch, srcdata + i * srcpitch, pitch );
+	UnlockLevel( cubeface, level );
+
+	shadow->data = data;
+	shadow->pitch = pitch;
+	shadow->numDirty = 0;
+	return shadow;
+}
+
+void D3DTextureObject :: FreeLevelShadows( GLint cubeface, GLint firstLevel, GLint lastLevel )
+{
+	if (!m_pLevelShadows)
+		return;
+
+	int numFaces = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+	int numLevels = m_numLevelShadows / numFaces;
+	lastLevel = QINDIEGL_MIN( lastLevel, numLevels - 1 );
+
+	for (int face = 0; face < numFaces; ++face) {
+		if (cubeface >= 0 && face != cubeface)
+			continue;
+		for (int i = firstLevel; i <= lastLevel; ++i) {
+			D3DTexLevelShadow *shadow = &m_pLevelShadows[face * numLevels + i];
+			UTIL_Free( shadow->data );
+			shadow->data = nullptr;
+			shadow->numDirty = 0;
+		}
+	}
+}
+
+bool D3DTextureObject :: HasSubImageHash( GLint cubeface, GLint level, const D3DBOX &box, UINT64 hash ) const
+{
+	for (size_t i = 0; i < m_subImageHashes.size(); ++i) {
+		const D3DTexSubImageHash &entry = m_subImageHashes[i];
+		if (entry.face == cubeface && entry.level == level && entry.hash == hash && !memcmp( &entry.box, &box, sizeof(box) ))
+			return true;
+	}
+	return false;
+}
+
+void D3DTextureObject :: ForgetSubImageHashes( GLint cubeface, GLint level, const D3DBOX &box )
+{
+	for (size_t i = 0; i < m_subImageHashes.size(); ) {
+		const D3DTexSubImageHash &entry = m_subImageHashes[i];
+		if (entry.face == cubeface && entry.level == level &&
+			entry.box.Left < box.Right && box.Left < entry.box.Right &&
+			entry.box.Top < box.Bottom && box.Top < entry.box.Bottom &&
+			entry.box.Front < box.Back && box.Front < entry.box.Back)
+			m_subImageHashes.erase( m_subImageHashes.begin() + i );
+		else
+			++i;
+	}
+}
+
+void D3DTextureObject :: RecordSubImageHash( GLint cubeface, GLint level, const D3DBOX &box, UINT64 hash )
+{
+	//engines update a bounded set of rectangles, forget the oldest ones beyond that
+	if (m_subImageHashes.size() >= 256)
+		m_subImageHashes.erase( m_subImageHashes.begin() );
+
+	D3DTexSubImageHash entry;
+	entry.hash = hash;
+	entry.box = box;
+	entry.face = (GLshort)cubeface;
+	entry.level = (GLshort)level;
+	m_subImageHashes.push_back( entry );
+}
+
+void D3DTextureObject :: InvalidateSubImageHashes( GLint cubeface, GLint firstLevel, GLint lastLevel )
+{
+	for (size_t i = 0; i < m_subImageHashes.size(); ) {
+		const D3DTexSubImageHash &entry = m_subImageHashes[i];
+		if ((cubeface < 0 || entry.face == cubeface) && entry.level >= firstLevel && entry.level <= lastLevel)
+			m_subImageHashes.erase( m_subImageHashes.begin() + i );
+		else
+			++i;
+	}
+}
+
+void D3DTextureObject :: CommitSubImageUpdates()
+{
+	if (!m_updatesPending)
+		return;
+	m_updatesPending = false;
+
+	int numFaces = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+	int numLevels = m_numLevelShadows / numFaces;
+	bool baseLevelChanged = false;
+
+	for (int face = 0; face < numFaces; ++face) {
+		for (int i = 0; i < numLevels; ++i) {
+			D3DTexLevelShadow *shadow = &m_pLevelShadows[face * numLevels + i];
+			for (int j = 0; j < shadow->numDirty; ++j) {
+				const RECT &rect = shadow->dirty[j];
+				GLubyte *dstdata;
+				GLint pitch, pitch2;
+				HRESULT hr = LockLevel( face, i, 0, &dstdata, &pitch, &pitch2, &rect );
+				if (FAILED(hr)) {
+					logPrintf("WARNING: Failed to commit texture %u sub-image updates: '%s'\n", m_glIndex, DXGetErrorString(hr));
+					continue;
+				}
+				int rowBytes = (rect.right - rect.left) * m_dstbytes;
+				const GLubyte *srcdata = shadow->data + rect.top * shadow->pitch + rect.left * m_dstbytes;
+				for (int y = rect.top; y < rect.bottom; ++y, srcdata += shadow->pitch, dstdata += pitch)
+					memcpy( dstdata, srcdata, rowBytes );
+				UnlockLevel( face, i );
+			}
+			if (shadow->numDirty && !i)
+				baseLevelChanged = true;
+			shadow->numDirty = 0;
+		}
+	}
+
+	if (baseLevelChanged)
+		CheckMipmapAutogen();
+}
+
+void D3DTex_CommitSubImageUpdates()
+{
+	if (s_pendingTextures.empty())
+		return;
+
+	//committing clears the pending flag, so the list can simply be dropped afterwards
+	for (size_t i = 0; i < s_pendingTextures.size(); ++i)
+		s_pendingTextures[i]->CommitSubImageUpdates();
+	s_pendingTextures.clear();
+}
+
+void D3DTextureObject :: UpdateResidentBytes()
+{
+	m_residentBytes = 0;
+	if (!m_pD3DBaseTexture)
+		return;
+
+	UINT rowBytes, rowCount;
+	DWORD numLevels = m_pD3DBaseTexture->GetLevelCount();
+	UINT numFaces = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+
+	for (DWORD i = 0; i < numLevels; ++i) {
+		GLsizei w = QINDIEGL_MAX( 1, m_width >> i );
+		GLsizei h = QINDIEGL_MAX( 1, m_height >> i );
+		GLsizei d = (m_target == GL_TEXTURE_3D_EXT) ? QINDIEGL_MAX( 1, m_depth >> i ) : 1;
+		D3DTex_GetLevelLayout( m_format, w, h, rowBytes, rowCount );
+		m_residentBytes += rowBytes * rowCount * d * numFaces;
+	}
+}
+
+bool D3DTextureObject :: IsEvictable() const
+{
+	//depth and render target textures live in the default pool and cannot be locked
+	return m_pD3DBaseTexture && m_glIndex && !D3DTex_IsDepthFormat(m_format) && !m_renderTarget;
+}
+
+HRESULT D3DTextureObject :: EvictD3DTexture()
+{
+	if (!IsEvictable())
+		return E_INVALID_OPERATION;
+
+	CommitSubImageUpdates();
+	FreeLevelShadows( -1, 0, INT_MAX );
+
+	GLubyte *shadow = (GLubyte*)UTIL_Alloc( (int)m_residentBytes );
+	if (!shadow)
+		return E_OUTOFMEMORY;
+
+	HRESULT hr;
+	GLubyte *srcdata;
+	GLint pitch;
+	GLint pitch2;
+	UINT rowBytes, rowCount;
+	DWORD numLevels = m_pD3DBaseTexture->GetLevelCount();
+	int numFaces = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+	GLubyte *dst = shadow;
+
+	for (int face = 0; face < numFaces; ++face) {
+		for (DWORD i = 0; i < numLevels; ++i) {
+			GLsizei w = QINDIEGL_MAX( 1, m_width >> i );
+			GLsizei h = QINDIEGL_MAX( 1, m_height >> i );
+			GLsizei d = (m_target == GL_TEXTURE_3D_EXT) ? QINDIEGL_MAX( 1, m_depth >> i ) : 1;
+			D3DTex_GetLevelLayout( m_format, w, h, rowBytes, rowCount );
+
+			hr = LockLevel( face, i, D3DLOCK_READONLY, &srcdata, &pitch, &pitch2 );
+			if (FAILED(hr)) {
+				UTIL_Free( shadow );
+				return hr;
+			}
+			for (GLsizei z = 0; z < d; ++z) {
+				const GLubyte *src = srcdata + z * pitch2;
+				for (UINT y = 0; y < rowCount; ++y, src += pitch, dst += rowBytes)
+					memcpy( dst, src, rowBytes );
+			}
+			UnlockLevel( face, i );
+		}
+	}
+
+	m_pD3DTexture->Release();
+	m_pD3DTexture = nullptr;
+	m_pShadowCopy = shadow;
+	return S_OK;
+}
+
+HRESULT D3DTextureObject :: RestoreD3DTexture()
+{
+	if (!m_pShadowCopy)
+		return S_OK;
+
+	//CreateD3DTexture resets the pixel layout, which is still valid for the shadow copy
+	eTexTypeInternal internalFormat = m_internalFormat;
+	int dstbytes = m_dstbytes;
+	D3DFORMAT uncompressedFormat = m_uncompressedFormat;
+
+	HRESULT hr = CreateD3DTexture( m_target, m_width, m_height, m_depth, m_border, m_format, m_mipmaps );
+	if (FAILED(hr)) return hr;
+
+	m_internalFormat = internalFormat;
+	m_dstbytes = dstbytes;
+	m_uncompressedFormat = uncompressedFormat;
+
+	GLubyte *dstdata;
+	GLint pitch;
+	GLint pitch2;
+	UINT rowBytes, rowCount;
+	DWORD numLevels = m_pD3DBaseTexture->GetLevelCount();
+	int numFaces = (m_target == GL_TEXTURE_CUBE_MAP_ARB) ? 6 : 1;
+	const GLubyte *src = m_pShadowCopy;
+
+	for (int face = 0; face < numFaces; ++face) {
+		for (DWORD i = 0; i < numLevels; ++i) {
+			GLsizei w = QINDIEGL_MAX( 1, m_width >> i );
+			GLsizei h = QINDIEGL_MAX( 1, m_height >> i );
+			GLsizei d = (m_target == GL_TEXTURE_3D_EXT) ? QINDIEGL_MAX( 1, m_depth >> i ) : 1;
+			D3DTex_GetLevelLayout( m_format, w, h, rowBytes, rowCount );
+
+			hr = LockLevel( face, i, 0, &dstdata, &pitch, &pitch2 );
+			if (FAILED(hr)) return hr;
+			for (GLsizei z = 0; z < d; ++z) {
+				GLubyte *dst = dstdata + z * pitch2;
+				for (UINT y = 0; y < rowCount; ++y, dst += pitch, src += rowBytes)
+					memcpy( dst, src, rowBytes );
+			}
+			UnlockLevel( face, i );
+		}
+	}
+
+	UTIL_Free( m_pShadowCopy );
+	m_pShadowCopy = nullptr;
+	return S_OK;
 }
 
 void D3DTextureObject :: SetAddressMode( GLenum coord, GLenum mode ) 
@@ -1170,7 +2214,8 @@ static void D3DTex_LoadSubImage(GLenum target, GLint level, GLint xoffset, GLint
 			D3DGlobal.lastError = hr;
 			return;
 		}
-		if (level == 0) {
+		//buffered (S_FALSE) updates regenerate mipmaps when they are committed, skipped ones need none
+		if (level == 0 && hr == S_OK) {
 			D3DState.TextureState.currentTexture[currentTMU][targetIndex]->CheckMipmapAutogen();
 		}
 	}
@@ -1342,18 +2387,21 @@ OPENGL_API GLboolean WINAPI glAreTexturesResident( GLsizei n, const GLuint *text
 		return GL_FALSE;
 	}
 
-	//We assume all textures resident
-	//FIXME: query Direct3D? how?
+	//Textures are resident unless the texture manager has evicted them
+	//to a shadow copy; managed pool residency is not visible to us
+	GLboolean allResident = GL_TRUE;
 	for (int i = 0; i < n; ++i) {
 		residences[i] = GL_FALSE;
 		if (textures[i] <= 0) continue;
 		D3DTextureObject *pTexture = (D3DTextureObject*)D3DGlobal.pObjectBuffer->GetObjectData( D3D_OBJECT_TYPE_TEXTURE, textures[i] );
-		if (pTexture) {
+		if (pTexture && !pTexture->IsEvicted()) {
 			residences[i] = GL_TRUE;
+		} else {
+			allResident = GL_FALSE;
 		}
 	}
 
-	return GL_TRUE;
+	return allResident;
 }
 OPENGL_API void WINAPI glPrioritizeTextures( GLsizei n, const GLuint *textures, const GLclampf *priorities )
 {
@@ -1375,6 +2423,8 @@ OPENGL_API void WINAPI glPrioritizeTextures( GLsizei n, const GLuint *textures,
 }
 OPENGL_API void WINAPI glBindTexture( GLenum target, GLuint texture )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_BIND_TEXTURE, target, texture );
+
 	int targetIndex = UTIL_GLTextureTargettoInternalIndex( target );
 	if (targetIndex < 0 || targetIndex >= D3D_TEXTARGET_MAX) {
 		D3DGlobal.lastError = E_INVALIDARG;
@@ -1401,6 +2451,14 @@ OPENGL_API void WINAPI glBindTexture( GLenum target, GLuint texture )
 		D3DGlobal.lastError = E_OUTOFMEMORY;
 		return;
 	}
+	if (D3DGlobal.pTextureManager) {
+		HRESULT hr = D3DGlobal.pTextureManager->MakeResident( pTexture );
+		if (FAILED(hr)) {
+			D3DState.TextureState.currentTexture[currentTMU][targetIndex] = D3DGlobal.defaultTexture[targetIndex];
+			D3DGlobal.lastError = hr;
+			return;
+		}
+	}
 	if ((pTexture->GetD3DTexture() != nullptr) && (pTexture->GetTarget() != target)) {
 		D3DState.TextureState.currentTexture[currentTMU][targetIndex] = D3DGlobal.defaultTexture[targetIndex];
 		D3DGlobal.lastError = E_INVALIDARG;
@@ -1541,6 +2599,9 @@ OPENGL_API void WINAPI glGetCompressedTexImage( GLenum target, GLint level, GLvo
 
 OPENGL_API void WINAPI glTexParameterfv( GLenum target, GLenum pname, const GLfloat *params )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_PARAMETERFV, target, pname, params, (pname == GL_TEXTURE_BORDER_COLOR) ? 4 : 1 ))
+		return;
+
 	int targetIndex = UTIL_GLTextureTargettoInternalIndex( target );
 	if (targetIndex < 0 || targetIndex >= D3D_TEXTARGET_MAX) {
 		D3DGlobal.lastError = E_INVALIDARG;
@@ -1651,7 +2712,7 @@ OPENGL_API void WINAPI glGetTexParameterfv( GLenum target, GLenum pname, GLfloat
 		params[0] = (GLfloat)pTexture->GetPriority() / (GLfloat)INT_MAX;
 		break;
 	case GL_TEXTURE_RESIDENT:
-		params[0] = 1.0f;
+		params[0] = pTexture->IsEvicted() ? 0.0f : 1.0f;
 		break;
 	case GL_GENERATE_MIPMAP_SGIS:
 		params[0] = (GLfloat)pTexture->GetMipmapAutogen();
@@ -1700,6 +2761,9 @@ OPENGL_API void WINAPI glGetTexParameteriv( GLenum target, GLenum pname, GLint *
 
 OPENGL_API void WINAPI glTexEnvfv( GLenum target, GLenum pname, const GLfloat *params )
 {
+	if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_ENVFV, target, pname, params, (pname == GL_TEXTURE_ENV_COLOR) ? 4 : 1 ))
+		return;
+
 	switch (target) 
 	{
 	default:
@@ -1937,6 +3001,8 @@ OPENGL_API void WINAPI glTexEnviv( GLenum target, GLenum pname, const GLint *par
 {
 	if (target == GL_TEXTURE_ENV) {
 		if (pname == GL_TEXTURE_ENV_COLOR) {
+			if (D3DList_IsCompiling() && D3DList_RecordVector( D3DLIST_OP_TEX_ENVIV, target, pname, params, 4 ))
+				return;
 			D3DCOLOR envColor = D3DCOLOR_ARGB( QINDIEGL_CLAMP( (GLfloat)(params[3] / INT_MAX) * 255 ),
 											  QINDIEGL_CLAMP( (GLfloat)(params[0] / INT_MAX) * 255 ),
 											  QINDIEGL_CLAMP( (GLfloat)(params[1] / INT_MAX) * 255 ),
@@ -2118,6 +3184,8 @@ OPENGL_API void WINAPI glGetTexLevelParameteriv( GLenum target, GLint level, GLe
 
 OPENGL_API void WINAPI glActiveTexture( GLenum texture )
 {
+	D3DLIST_COMPILE( D3DLIST_OP_ACTIVE_TEXTURE, texture );
+
 	int stageIndex = texture - GL_TEXTURE0_ARB;
 	if (stageIndex < 0 || stageIndex >= D3DGlobal.maxActiveTMU) {
 		logPrintf("WARNING: glActiveTexture - bad stage %i\n", stageIndex);
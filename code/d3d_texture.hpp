@@ -21,6 +21,29 @@
 #ifndef QINDIEGL_D3D_TEXTURE_H
 #define QINDIEGL_D3D_TEXTURE_H
 
+#include <vector>
+
+#define D3D_TEX_MAX_DIRTY_RECTS	4
+
+// CPU copy of a texture level that buffers glTexSubImage updates until the
+// texture is next drawn with
+typedef struct D3DTexLevelShadow_s
+{
+	GLubyte		*data;
+	int			pitch;
+	int			numDirty;
+	RECT		dirty[D3D_TEX_MAX_DIRTY_RECTS];
+} D3DTexLevelShadow;
+
+// Content hash of the last glTexSubImage upload to a box of a level
+typedef struct D3DTexSubImageHash_s
+{
+	UINT64		hash;
+	D3DBOX		box;
+	GLshort		face;
+	GLshort		level;
+} D3DTexSubImageHash;
+
 class D3DTextureObject
 {
 public:
@@ -37,6 +60,10 @@ public:
 	HRESULT GetTexImage( GLint cubeface, GLint level, GLenum format,  GLenum type,  GLvoid *pixels );
 	HRESULT DumpTexture();
 	void CheckMipmapAutogen();
+	HRESULT EvictD3DTexture();
+	HRESULT RestoreD3DTexture();
+	HRESULT UncompressD3DTexture();
+	void CommitSubImageUpdates();
 
 	LPDIRECT3DBASETEXTURE9 GetD3DTexture() const { return m_pD3DBaseTexture; }
 	GLenum GetTarget() const { return m_target; }
@@ -66,6 +93,12 @@ public:
 	GLfloat GetLodBias() const { return m_lodBias; }
 	GLuint GetGLIndex() const { return m_glIndex; }
 	eTexTypeInternal GetInternalFormat() const { return m_internalFormat; }
+	bool IsEvictable() const;
+	bool IsEvicted() const { return m_pShadowCopy != nullptr; }
+	bool IsRuntimeCompressed() const { return m_uncompressedFormat != D3DFMT_UNKNOWN; }
+	bool IsRenderTarget() const { return m_renderTarget; }
+	UINT GetResidentBytes() const { return m_residentBytes; }
+	DWORD GetLastUsedFrame() const { return m_lastUsedFrame; }
 
 	void SetAddressMode( GLenum coord, GLenum mode );
 	void SetMagFilter( GLenum mode );
@@ -76,6 +109,27 @@ public:
 	void SetAnisotropy( GLuint value ) { m_anisotropy = QINDIEGL_MIN( D3DGlobal.hD3DCaps.MaxAnisotropy, QINDIEGL_MAX( 1, value ) ); }
 	void SetPriority( DWORD value ) { m_priority = value; }
 	void SetLodBias( GLfloat value ) { m_lodBias = value; }
+	void SetLastUsedFrame( DWORD value ) { m_lastUsedFrame = value; }
+
+private:
+	HRESULT LockLevel( GLint cubeface, GLint level, DWORD flags, GLubyte **data, GLint *pitch, GLint *pitch2, const RECT *rect = nullptr );
+	HRESULT UnlockLevel( GLint cubeface, GLint level );
+	void UpdateResidentBytes();
+	HRESULT GetLevelSurface( GLint cubeface, GLint level, LPDIRECT3DSURFACE9 *ppSurface );
+	HRESULT GetDecompressedLevel( GLint cubeface, GLint level, LPDIRECT3DSURFACE9 *ppSurface );
+	D3DTexLevelShadow *GetLevelShadow( GLint cubeface, GLint level );
+	void FreeLevelShadows( GLint cubeface, GLint firstLevel, GLint lastLevel );
+	bool HasSubImageHash( GLint cubeface, GLint level, const D3DBOX &box, UINT64 hash ) const;
+	void ForgetSubImageHashes( GLint cubeface, GLint level, const D3DBOX &box );
+	void RecordSubImageHash( GLint cubeface, GLint level, const D3DBOX &box, UINT64 hash );
+	HRESULT UploadTextureSubLevel( GLint cubeface, GLint level, GLint xoffset, GLint yoffset, GLint zoffset, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const GLvoid *pixels );
+	void InvalidateSubImageHashes( GLint cubeface, GLint firstLevel, GLint lastLevel );
+	HRESULT CopyTextureSubLevelGPU( GLint cubeface, GLint level, GLint xoffset, GLint yoffset, GLint x, GLint y, GLsizei width, GLsizei height );
+	HRESULT PromoteToRenderTarget( D3DFORMAT backBufferFormat );
+	HRESULT DemoteRenderTarget();
+	HRESULT EnsureLockable();
+
+	friend class D3DTextureManager;
 
 private:
 	union {
@@ -101,6 +155,23 @@ private:
 	int						m_dstbytes;
 	D3DCOLOR				m_borderColor;
 	DWORD					m_priority;
+	GLubyte					*m_pShadowCopy;
+	UINT					m_residentBytes;
+	DWORD					m_lastUsedFrame;
+	int						m_managerIndex;
+	DWORD					m_imageUploads;
+	D3DFORMAT				m_uncompressedFormat;
+	GLboolean				m_compressionDisabled;
+	D3DTexLevelShadow		*m_pLevelShadows;
+	int						m_numLevelShadows;
+	bool					m_updatesPending;
+	std::vector<D3DTexSubImageHash>	m_subImageHashes;
+	bool					m_renderTarget;
+	GLboolean				m_gpuCopyDisabled;
+	int						m_renderTargetDemotions;
 };
 
+extern void D3DTex_CommitSubImageUpdates();
+extern void D3DTex_LogStats();
+
 #endif //QINDIEGL_D3D_TEXTURE_H
\ No newline at end of file
@@ -0,0 +1,360 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include "d3d_wrapper.hpp"
+#include "d3d_global.hpp"
+#include "d3d_state.hpp"
+#include "d3d_utils.hpp"
+#include "d3d_pixels.hpp"
+#include "d3d_texture_cache.hpp"
+#include <vector>
+
+//==================================================================================
+// Texture cache
+//----------------------------------------------------------------------------------
+// Pack file layout: a file header followed by records, each record is a header
+// and the converted level with tightly packed rows. The file is only rewritten
+// on shutdown, when it has grown past its size limit.
+//==================================================================================
+
+#define TEXCACHE_MAGIC			0x43544751	//"QGTC"
+#define TEXCACHE_RECORD_MAGIC	0x52544751	//"QGTR"
+#define TEXCACHE_VERSION		1
+
+typedef struct D3DTexCacheFileHeader_s
+{
+	DWORD		magic;
+	DWORD		version;
+} D3DTexCacheFileHeader;
+
+typedef struct D3DTexCacheRecord_s
+{
+	DWORD		magic;
+	DWORD		payloadSize;
+	UINT64		key;
+	UINT64		checksum;
+	DWORD		width;
+	DWORD		height;
+	DWORD		depth;
+	DWORD		d3dFormat;
+	DWORD		internalFormat;
+	DWORD		dstbytes;
+} D3DTexCacheRecord;
+
+D3DTextureCache :: D3DTextureCache()
+{
+	m_filename = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pView = nullptr;
+	m_viewSize = 0;
+	m_fileSize = 0;
+	m_maxBytes = 0;
+	memset( &m_stats, 0, sizeof(m_stats) );
+}
+
+D3DTextureCache :: ~D3DTextureCache()
+{
+	Close();
+}
+
+bool D3DTextureCache :: MapFile()
+{
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx( m_hFile, &size ) || !size.QuadPart)
+		return false;
+
+	m_hMapping = CreateFileMappingA( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+	if (!m_hMapping)
+		return false;
+
+	m_pView = (const GLubyte*)MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 );
+	if (!m_pView) {
+		CloseHandle( m_hMapping );
+		m_hMapping = NULL;
+		return false;
+	}
+
+	m_viewSize = size.QuadPart;
+	return true;
+}
+
+void D3DTextureCache :: UnmapFile()
+{
+	if (m_pView) {
+		UnmapViewOfFile( m_pView );
+		m_pView = nullptr;
+	}
+	if (m_hMapping) {
+		CloseHandle( m_hMapping );
+		m_hMapping = NULL;
+	}
+	m_viewSize = 0;
+}
+
+bool D3DTextureCache :: Open( const char *filename, UINT64 maxBytes )
+{
+	Close();
+
+	m_hFile = CreateFileA( filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if (m_hFile == INVALID_HANDLE_VALUE) {
+		logPrintf("WARNING: Failed to open texture cache '%s'\n", filename);
+		return false;
+	}
+
+	m_filename = UTIL_AllocString( filename );
+	m_maxBytes = maxBytes;
+
+	//validate the records, anything past the last intact record is dropped
+	UINT64 validSize = 0;
+	if (MapFile()) {
+		const D3DTexCacheFileHeader *header = (const D3DTexCacheFileHeader*)m_pView;
+		if (m_viewSize >= sizeof(*header) && header->magic == TEXCACHE_MAGIC && header->version == TEXCACHE_VERSION) {
+			UINT64 offset = sizeof(*header);
+			while (offset + sizeof(D3DTexCacheRecord) <= m_viewSize) {
+				const D3DTexCacheRecord *rec = (const D3DTexCacheRecord*)(m_pView + offset);
+				if (rec->magic != TEXCACHE_RECORD_MAGIC || offset + sizeof(*rec) + rec->payloadSize > m_viewSize)
+					break;
+				if (m_entries.find( rec->key ) == m_entries.end()) {
+					Entry entry = { offset, true, false, false };
+					m_entries[rec->key] = entry;
+				}
+				offset += sizeof(*rec) + rec->payloadSize;
+			}
+			validSize = offset;
+			if (validSize < m_viewSize) {
+				logPrintf("WARNING: Texture cache '%s' is damaged, truncating\n", filename);
+				m_stats.corrupted++;
+			}
+		}
+	}
+
+	if (validSize < m_viewSize || !validSize) {
+		UnmapFile();
+
+		LARGE_INTEGER pos;
+		pos.QuadPart = validSize;
+		SetFilePointerEx( m_hFile, pos, NULL, FILE_BEGIN );
+		SetEndOfFile( m_hFile );
+
+		if (!validSize) {
+			m_entries.clear();
+			D3DTexCacheFileHeader header = { TEXCACHE_MAGIC, TEXCACHE_VERSION };
+			DWORD written;
+			WriteFile( m_hFile, &header, sizeof(header), &written, NULL );
+			validSize = sizeof(header);
+		} else {
+			MapFile();
+		}
+	}
+
+	LARGE_INTEGER pos;
+	pos.QuadPart = 0;
+	SetFilePointerEx( m_hFile, pos, NULL, FILE_END );
+	m_fileSize = validSize;
+
+	logPrintf("Texture cache '%s': %u entries, %u KB\n", filename, (DWORD)m_entries.size(), (DWORD)(m_fileSize >> 10));
+	return true;
+}
+
+void D3DTextureCache :: Close()
+{
+	if (!IsOpen())
+		return;
+
+	if (m_fileSize > m_maxBytes)
+		Compact();
+
+	UnmapFile();
+	if (m_hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle( m_hFile );
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+	UTIL_FreeString( m_filename );
+	m_filename = nullptr;
+	m_entries.clear();
+}
+
+void D3DTextureCache :: Compact()
+{
+	//remap to see the records appended in this session
+	UnmapFile();
+	if (!MapFile())
+		return;
+
+	typedef struct {
+		UINT64	offset;
+		UINT64	size;
+		bool	used;
+		bool	keep;
+	} Record;
+
+	std::vector<Record> records;
+	UINT64 offset = sizeof(D3DTexCacheFileHeader);
+	while (offset + sizeof(D3DTexCacheRecord) <= m_viewSize) {
+		const D3DTexCacheRecord *rec = (const D3DTexCacheRecord*)(m_pView + offset);
+		Record r = { offset, sizeof(*rec) + rec->payloadSize, false, true };
+		auto it = m_entries.find( rec->key );
+		r.used = (it != m_entries.end() && it->second.offset == offset && it->second.used);
+		records.push_back( r );
+		offset += r.size;
+	}
+
+	//drop records not used in this session first, oldest first
+	UINT64 total = offset;
+	for (int pass = 0; pass < 2; ++pass) {
+		for (size_t i = 0; i < records.size() && total > m_maxBytes; ++i) {
+			if (!records[i].keep || (records[i].used && !pass))
+				continue;
+			records[i].keep = false;
+			total -= records[i].size;
+		}
+	}
+
+	char tmpname[MAX_PATH];
+	sprintf_s( tmpname, "%s.tmp", m_filename );
+	HANDLE hTmp = CreateFileA( tmpname, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if (hTmp == INVALID_HANDLE_VALUE)
+		return;
+
+	DWORD written;
+	BOOL ok = WriteFile( hTmp, m_pView, sizeof(D3DTexCacheFileHeader), &written, NULL );
+	for (size_t i = 0; i < records.size() && ok; ++i) {
+		if (records[i].keep)
+			ok = WriteFile( hTmp, m_pView + records[i].offset, (DWORD)records[i].size, &written, NULL );
+	}
+	CloseHandle( hTmp );
+
+	UnmapFile();
+	CloseHandle( m_hFile );
+	m_hFile = INVALID_HANDLE_VALUE;
+
+	if (!ok || !MoveFileExA( tmpname, m_filename, MOVEFILE_REPLACE_EXISTING )) {
+		logPrintf("WARNING: Failed to compact texture cache '%s'\n", m_filename);
+		DeleteFileA( tmpname );
+		return;
+	}
+	logPrintf("Texture cache '%s' compacted from %u KB to %u KB\n", m_filename, (DWORD)(m_fileSize >> 10), (DWORD)(total >> 10));
+	m_fileSize = total;
+}
+
+UINT64 D3DTextureCache :: MakeKey( GLsizei width, GLsizei height, GLsizei depth, GLint internalformat, GLenum format, GLenum type, D3DFORMAT d3dFormat, const GLvoid *pixels ) const
+{
+	if (!IsOpen() || !pixels || !D3DPixels_IsDefaultUnpackState())
+		return 0;
+
+	int size = D3DPixels_GetUnpackedImageSize( width, height, depth, format, type );
+	if (size <= 0)
+		return 0;
+
+	DWORD params[8] = { (DWORD)width, (DWORD)height, (DWORD)depth, (DWORD)internalformat, format, type, (DWORD)d3dFormat, D3DState.ClientPixelStoreState.unpackAlignment };
+	UINT64 key = UTIL_HashBytes( pixels, size, UTIL_HashBytes( params, sizeof(params) ) );
+	return key ? key : 1;
+}
+
+const GLubyte *D3DTextureCache :: Find( UINT64 key, GLsizei width, GLsizei height, GLsizei depth, D3DFORMAT d3dFormat, eTexTypeInternal intfmt, int dstbytes )
+{
+	m_stats.lookups++;
+
+	auto it = m_entries.find( key );
+	if (it == m_entries.end() || !it->second.mapped)
+		return nullptr;
+
+	Entry &entry = it->second;
+	const D3DTexCacheRecord *rec = (const D3DTexCacheRecord*)(m_pView + entry.offset);
+	if (rec->width != (DWORD)width || rec->height != (DWORD)height || rec->depth != (DWORD)depth ||
+		rec->d3dFormat != (DWORD)d3dFormat || rec->internalFormat != (DWORD)intfmt || rec->dstbytes != (DWORD)dstbytes ||
+		rec->payloadSize != (DWORD)(width * height * depth * dstbytes))
+		return nullptr;
+
+	const GLubyte *payload = (const GLubyte*)(rec + 1);
+	if (!entry.verified) {
+		if (UTIL_HashBytes( payload, rec->payloadSize ) != rec->checksum) {
+			logPrintf("WARNING: Texture cache entry %08x%08x is corrupted\n", (DWORD)(key >> 32), (DWORD)key);
+			m_stats.corrupted++;
+			m_entries.erase( it );
+			return nullptr;
+		}
+		entry.verified = true;
+	}
+
+	entry.used = true;
+	m_stats.hits++;
+	m_stats.bytesLoaded += rec->payloadSize;
+	return payload;
+}
+
+void D3DTextureCache :: Store( UINT64 key, GLsizei width, GLsizei height, GLsizei depth, D3DFORMAT d3dFormat, eTexTypeInternal intfmt, int dstbytes, const GLubyte *data, int pitch, int pitch2 )
+{
+	if (!IsOpen() || m_entries.find( key ) != m_entries.end())
+		return;
+
+	int rowBytes = width * dstbytes;
+	DWORD payloadSize = rowBytes * height * depth;
+	UINT64 recordSize = sizeof(D3DTexCacheRecord) + payloadSize;
+
+	//allow the file to overshoot until the next compaction
+	if (m_fileSize + recordSize > m_maxBytes * 2) {
+		m_stats.rejected++;
+		return;
+	}
+
+	GLubyte *buffer = (GLubyte*)UTIL_Alloc( (int)recordSize );
+	if (!buffer)
+		return;
+
+	GLubyte *dst = buffer + sizeof(D3DTexCacheRecord);
+	for (int i = 0; i < depth; ++i) {
+		const GLubyte *src = data + i * pitch2;
+		for (int j = 0; j < height; ++j, src += pitch, dst += rowBytes)
+			memcpy( dst, src, rowBytes );
+	}
+
+	D3DTexCacheRecord *rec = (D3DTexCacheRecord*)buffer;
+	rec->magic = TEXCACHE_RECORD_MAGIC;
+	rec->payloadSize = payloadSize;
+	rec->key = key;
+	rec->checksum = UTIL_HashBytes( buffer + sizeof(D3DTexCacheRecord), payloadSize );
+	rec->width = width;
+	rec->height = height;
+	rec->depth = depth;
+	rec->d3dFormat = d3dFormat;
+	rec->internalFormat = intfmt;
+	rec->dstbytes = dstbytes;
+
+	DWORD written;
+	if (WriteFile( m_hFile, buffer, (DWORD)recordSize, &written, NULL ) && written == recordSize) {
+		Entry entry = { m_fileSize, false, true, true };
+		m_entries[key] = entry;
+		m_fileSize += recordSize;
+		m_stats.stores++;
+		m_stats.bytesStored += recordSize;
+	}
+	UTIL_Free( buffer );
+}
+
+void D3DTextureCache :: LogStats() const
+{
+	if (!m_stats.lookups)
+		return;
+
+	logPrintf("Texture cache: %u lookups, %u hits (%u KB loaded), %u stores (%u KB), %u rejected, %u corrupted\n",
+		m_stats.lookups, m_stats.hits, (DWORD)(m_stats.bytesLoaded >> 10), m_stats.stores, (DWORD)(m_stats.bytesStored >> 10), m_stats.rejected, m_stats.corrupted);
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_TEXTURE_CACHE_H
+#define QINDIEGL_D3D_TEXTURE_CACHE_H
+
+#include <unordered_map>
+
+typedef struct D3DTextureCacheStats_s
+{
+	DWORD		lookups;
+	DWORD		hits;
+	DWORD		stores;
+	DWORD		rejected;
+	DWORD		corrupted;
+	UINT64		bytesLoaded;
+	UINT64		bytesStored;
+} D3DTextureCacheStats;
+
+// Persistent cache of converted texture levels. Records are appended to a pack
+// file that is memory-mapped on startup, so a hit copies the stored level
+// straight from the mapping into the locked texture instead of converting it.
+// Records written in this session become visible on the next startup.
+class D3DTextureCache
+{
+public:
+	D3DTextureCache();
+	~D3DTextureCache();
+
+	bool Open( const char *filename, UINT64 maxBytes );
+	void Close();
+	bool IsOpen() const { return m_hFile != INVALID_HANDLE_VALUE; }
+	const D3DTextureCacheStats &GetStats() const { return m_stats; }
+
+	UINT64 MakeKey( GLsizei width, GLsizei height, GLsizei depth, GLint internalformat, GLenum format, GLenum type, D3DFORMAT d3dFormat, const GLvoid *pixels ) const;
+	const GLubyte *Find( UINT64 key, GLsizei width, GLsizei height, GLsizei depth, D3DFORMAT d3dFormat, eTexTypeInternal intfmt, int dstbytes );
+	void Store( UINT64 key, GLsizei width, GLsizei height, GLsizei depth, D3DFORMAT d3dFormat, eTexTypeInternal intfmt, int dstbytes, const GLubyte *data, int pitch, int pitch2 );
+	void LogStats() const;
+
+private:
+	typedef struct Entry_s {
+		UINT64		offset;
+		bool		mapped;
+		bool		used;
+		bool		verified;
+	} Entry;
+
+	bool MapFile();
+	void UnmapFile();
+	void Compact();
+
+private:
+	char								*m_filename;
+	HANDLE								m_hFile;
+	HANDLE								m_hMapping;
+	const GLubyte						*m_pView;
+	UINT64								m_viewSize;
+	UINT64								m_fileSize;
+	UINT64								m_maxBytes;
+	std::unordered_map<UINT64, Entry>	m_entries;
+	D3DTextureCacheStats				m_stats;
+};
+
+#endif //QINDIEGL_D3D_TEXTURE_CACHE_H
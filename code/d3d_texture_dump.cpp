@@ -0,0 +1,166 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include "d3d_wrapper.hpp"
+#include "d3d_global.hpp"
+#include "d3d_utils.hpp"
+#include "d3d_texture_dump.hpp"
+
+//==================================================================================
+// Background texture dumper
+//----------------------------------------------------------------------------------
+// Jobs are appended by the render thread and consumed in order by the worker.
+// m_queuedBytes counts the pixel data of all jobs that are not written yet,
+// including the one the worker is busy with.
+//==================================================================================
+
+D3DTextureDumper :: D3DTextureDumper()
+{
+	memset( &m_stats, 0, sizeof(m_stats) );
+	m_queuedBytes = 0;
+	m_busy = false;
+	m_shutdown = false;
+}
+
+D3DTextureDumper :: ~D3DTextureDumper()
+{
+	StopWorker();
+}
+
+void D3DTextureDumper :: Queue( std::vector<GLubyte> &pixels, GLsizei width, GLsizei height )
+{
+	StartWorker();
+
+	size_t size = pixels.size();
+	std::unique_lock<std::mutex> lock( m_mutex );
+	if (m_queuedBytes && m_queuedBytes + size > D3D_TEXDUMP_MAX_QUEUED_BYTES) {
+		m_stats.stalls++;
+		m_workDone.wait( lock, [this, size]{ return !m_queuedBytes || m_queuedBytes + size <= D3D_TEXDUMP_MAX_QUEUED_BYTES; } );
+	}
+
+	Job job;
+	job.width = width;
+	job.height = height;
+	job.pixels.swap( pixels );
+	m_jobs.push_back( std::move( job ) );
+	m_queuedBytes += size;
+	m_stats.queued++;
+	lock.unlock();
+
+	m_workReady.notify_one();
+}
+
+void D3DTextureDumper :: Flush()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	m_workDone.wait( lock, [this]{ return m_jobs.empty() && !m_busy; } );
+}
+
+void D3DTextureDumper :: LogStats()
+{
+	std::lock_guard<std::mutex> lock( m_mutex );
+	if (!m_stats.queued)
+		return;
+
+	logPrintf("Texture dump: %u queued, %u written, %u duplicates, %u failed, %u stalls\n", m_stats.queued, m_stats.written, m_stats.duplicates, m_stats.failed, m_stats.stalls);
+}
+
+bool D3DTextureDumper :: WriteTGA( const Job &job, UINT64 hash )
+{
+	GLubyte header[18];
+	memset( header, 0, sizeof(header) );
+	header[2] = 2;
+	header[12] = static_cast<GLubyte>( job.width & 255 );
+	header[13] = static_cast<GLubyte>( job.width >> 8 );
+	header[14] = static_cast<GLubyte>( job.height & 255 );
+	header[15] = static_cast<GLubyte>( job.height >> 8 );
+	header[16] = 32;
+	header[17] = 8;
+
+	char filename[MAX_PATH];
+	sprintf_s( filename, "dump\\%016llx.tga", hash );
+
+	FILE *fp( nullptr );
+	if (fopen_s( &fp, filename, "wb" ))
+		return false;
+
+	bool ok = fwrite( header, 1, sizeof(header), fp ) == sizeof(header) &&
+			  fwrite( job.pixels.data(), 1, job.pixels.size(), fp ) == job.pixels.size();
+	fclose( fp );
+	return ok;
+}
+
+//==================================================================================
+// Worker thread
+//==================================================================================
+void D3DTextureDumper :: StartWorker()
+{
+	if (m_worker.joinable())
+		return;
+
+	_mkdir("dump");
+	m_shutdown = false;
+	m_worker = std::thread( &D3DTextureDumper::WorkerMain, this );
+}
+
+void D3DTextureDumper :: StopWorker()
+{
+	if (!m_worker.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock( m_mutex );
+		m_shutdown = true;
+	}
+	m_workReady.notify_all();
+	m_worker.join();
+}
+
+void D3DTextureDumper :: WorkerMain()
+{
+	std::unique_lock<std::mutex> lock( m_mutex );
+	for (;;) {
+		//pending jobs are still written on shutdown
+		m_workReady.wait( lock, [this]{ return m_shutdown || !m_jobs.empty(); } );
+		if (m_jobs.empty())
+			break;
+
+		Job job = std::move( m_jobs.front() );
+		m_jobs.pop_front();
+		m_busy = true;
+		lock.unlock();
+
+		UINT64 hash = UTIL_HashBytes( job.pixels.data(), job.pixels.size(), ((UINT64)job.width << 32) | (UINT64)job.height );
+		bool duplicate = !m_written.insert( hash ).second;
+		bool written = !duplicate && WriteTGA( job, hash );
+		if (!duplicate && !written)
+			m_written.erase( hash );
+
+		lock.lock();
+		if (duplicate)
+			m_stats.duplicates++;
+		else if (written)
+			m_stats.written++;
+		else
+			m_stats.failed++;
+		m_queuedBytes -= job.pixels.size();
+		m_busy = false;
+		m_workDone.notify_all();
+	}
+}
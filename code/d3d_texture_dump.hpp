@@ -0,0 +1,83 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_TEXTURE_DUMP_H
+#define QINDIEGL_D3D_TEXTURE_DUMP_H
+
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define D3D_TEXDUMP_MAX_QUEUED_BYTES	(64 * 1024 * 1024)
+
+typedef struct D3DTextureDumpStats_s
+{
+	DWORD		queued;
+	DWORD		written;
+	DWORD		duplicates;
+	DWORD		failed;
+	DWORD		stalls;
+} D3DTextureDumpStats;
+
+// Writes texture images to dump\<content hash>.tga for asset replacement.
+// The render thread only copies the pixels into a queue entry, hashing, encoding
+// and writing happen on a worker thread. Images with the same content are written
+// once. The queue is bounded by size, a full queue makes the caller wait.
+class D3DTextureDumper
+{
+public:
+	D3DTextureDumper();
+	~D3DTextureDumper();
+
+	// pixels are 32-bit BGRA rows, bottom row first
+	void Queue( std::vector<GLubyte> &pixels, GLsizei width, GLsizei height );
+	void Flush();
+	void LogStats();
+
+private:
+	typedef struct Job_s {
+		GLsizei					width;
+		GLsizei					height;
+		std::vector<GLubyte>	pixels;
+	} Job;
+
+	bool WriteTGA( const Job &job, UINT64 hash );
+	void StartWorker();
+	void StopWorker();
+	void WorkerMain();
+
+private:
+	D3DTextureDumpStats			m_stats;
+	std::deque<Job>				m_jobs;
+	size_t						m_queuedBytes;
+	bool						m_busy;
+	std::unordered_set<UINT64>	m_written;
+
+	std::thread					m_worker;
+	std::mutex					m_mutex;
+	std::condition_variable		m_workReady;
+	std::condition_variable		m_workDone;
+	bool						m_shutdown;
+};
+
+#endif //QINDIEGL_D3D_TEXTURE_DUMP_H
@@ -0,0 +1,231 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#include "d3d_wrapper.hpp"
+#include "d3d_global.hpp"
+#include "d3d_state.hpp"
+#include "d3d_utils.hpp"
+#include "d3d_texture.hpp"
+#include "d3d_texture_manager.hpp"
+#include <algorithm>
+
+//==================================================================================
+// Texture residency manager
+//----------------------------------------------------------------------------------
+// Keeps the estimated size of all live textures under a configurable budget.
+// Textures bound to any TMU, or used in the current or previous frame, are
+// never evicted.
+//==================================================================================
+
+D3DTextureManager :: D3DTextureManager()
+{
+	m_budgetBytes = 0;
+	m_residentBytes = 0;
+	m_frame = 1;
+	memset( &m_stats, 0, sizeof(m_stats) );
+	m_pFlipTarget = nullptr;
+}
+
+D3DTextureManager :: ~D3DTextureManager()
+{
+	for (size_t i = 0; i < m_textures.size(); ++i)
+		m_textures[i]->m_managerIndex = -1;
+	if (m_pFlipTarget)
+		m_pFlipTarget->Release();
+}
+
+void D3DTextureManager :: Register( D3DTextureObject *pTexture )
+{
+	assert(pTexture->m_managerIndex < 0);
+	pTexture->m_managerIndex = (int)m_textures.size();
+	pTexture->m_lastUsedFrame = m_frame;
+	m_textures.push_back( pTexture );
+	if (!pTexture->IsEvicted()) {
+		m_residentBytes += pTexture->m_residentBytes;
+		m_stats.peakResidentBytes = QINDIEGL_MAX( m_stats.peakResidentBytes, m_residentBytes );
+	}
+}
+
+void D3DTextureManager :: Unregister( D3DTextureObject *pTexture )
+{
+	int index = pTexture->m_managerIndex;
+	if (index < 0)
+		return;
+
+	assert(m_textures[index] == pTexture);
+	if (!pTexture->IsEvicted())
+		m_residentBytes -= pTexture->m_residentBytes;
+
+	//swap with the last entry to keep removal O(1)
+	D3DTextureObject *pLast = m_textures.back();
+	m_textures[index] = pLast;
+	pLast->m_managerIndex = index;
+	m_textures.pop_back();
+	pTexture->m_managerIndex = -1;
+}
+
+void D3DTextureManager :: Resize( D3DTextureObject *pTexture )
+{
+	if (pTexture->m_managerIndex < 0 || pTexture->IsEvicted())
+		return;
+
+	m_residentBytes -= pTexture->m_residentBytes;
+	pTexture->UpdateResidentBytes();
+	m_residentBytes += pTexture->m_residentBytes;
+	m_stats.peakResidentBytes = QINDIEGL_MAX( m_stats.peakResidentBytes, m_residentBytes );
+}
+
+void D3DTextureManager :: Touch( D3DTextureObject *pTexture )
+{
+	pTexture->m_lastUsedFrame = m_frame;
+}
+
+HRESULT D3DTextureManager :: MakeResident( D3DTextureObject *pTexture )
+{
+	pTexture->m_lastUsedFrame = m_frame;
+	if (!pTexture->IsEvicted())
+		return S_OK;
+
+	HRESULT hr = pTexture->RestoreD3DTexture();
+	if (FAILED(hr)) {
+		logPrintf("WARNING: Failed to restore evicted texture %u: '%s'\n", pTexture->m_glIndex, DXGetErrorString(hr));
+		return hr;
+	}
+
+	m_residentBytes += pTexture->m_residentBytes;
+	m_stats.peakResidentBytes = QINDIEGL_MAX( m_stats.peakResidentBytes, m_residentBytes );
+	m_stats.restores++;
+	m_stats.bytesRestored += pTexture->m_residentBytes;
+	return S_OK;
+}
+
+bool D3DTextureManager :: IsBound( const D3DTextureObject *pTexture ) const
+{
+	for (int i = 0; i < MAX_D3D_TMU; ++i) {
+		for (int j = 0; j < D3D_TEXTARGET_MAX; ++j) {
+			if (D3DState.TextureState.currentTexture[i][j] == pTexture)
+				return true;
+		}
+	}
+	return false;
+}
+
+void D3DTextureManager :: EndFrame()
+{
+	//bound textures count as used even if the application did not rebind them
+	for (int i = 0; i < MAX_D3D_TMU; ++i) {
+		for (int j = 0; j < D3D_TEXTARGET_MAX; ++j) {
+			D3DTextureObject *pTexture = D3DState.TextureState.currentTexture[i][j];
+			if (pTexture) pTexture->m_lastUsedFrame = m_frame;
+		}
+	}
+
+	if (m_budgetBytes && m_residentBytes > m_budgetBytes)
+		EnforceBudget();
+
+	++m_frame;
+}
+
+//render target textures live in the default pool, they must be moved back before a device reset
+void D3DTextureManager :: ReleaseRenderTargets()
+{
+	for (size_t i = 0; i < m_textures.size(); ++i) {
+		D3DTextureObject *pTexture = m_textures[i];
+		if (pTexture->IsRenderTarget())
+			pTexture->DemoteRenderTarget();
+	}
+	if (m_pFlipTarget) {
+		m_pFlipTarget->Release();
+		m_pFlipTarget = nullptr;
+	}
+}
+
+//scratch render target glCopyTexSubImage copies the framebuffer into before drawing it flipped;
+//kept between copies and only grown, so a copy per frame does not create a texture per frame
+HRESULT D3DTextureManager :: GetFlipTarget( UINT width, UINT height, D3DFORMAT format, LPDIRECT3DTEXTURE9 *ppTexture )
+{
+	if (m_pFlipTarget) {
+		D3DSURFACE_DESC desc;
+		HRESULT hr = m_pFlipTarget->GetLevelDesc( 0, &desc );
+		if (SUCCEEDED(hr) && desc.Format == format && desc.Width >= width && desc.Height >= height) {
+			*ppTexture = m_pFlipTarget;
+			return S_OK;
+		}
+		if (SUCCEEDED(hr) && desc.Format == format) {
+			width = QINDIEGL_MAX( width, desc.Width );
+			height = QINDIEGL_MAX( height, desc.Height );
+		}
+		m_pFlipTarget->Release();
+		m_pFlipTarget = nullptr;
+	}
+
+	HRESULT hr = D3DGlobal.pDevice->CreateTexture( width, height, 1, D3DUSAGE_RENDERTARGET, format, D3DPOOL_DEFAULT, &m_pFlipTarget, nullptr );
+	if (FAILED(hr)) {
+		m_pFlipTarget = nullptr;
+		return hr;
+	}
+	*ppTexture = m_pFlipTarget;
+	return S_OK;
+}
+
+static bool D3DTextureManager_EvictionOrder( const D3DTextureObject *a, const D3DTextureObject *b )
+{
+	if (a->GetPriority() != b->GetPriority())
+		return a->GetPriority() < b->GetPriority();
+	return a->GetLastUsedFrame() < b->GetLastUsedFrame();
+}
+
+void D3DTextureManager :: EnforceBudget()
+{
+	m_candidates.clear();
+	for (size_t i = 0; i < m_textures.size(); ++i) {
+		D3DTextureObject *pTexture = m_textures[i];
+		if (pTexture->IsEvicted() || !pTexture->IsEvictable())
+			continue;
+		if (pTexture->m_lastUsedFrame + 1 >= m_frame)
+			continue;
+		if (IsBound( pTexture ))
+			continue;
+		m_candidates.push_back( pTexture );
+	}
+
+	std::sort( m_candidates.begin(), m_candidates.end(), D3DTextureManager_EvictionOrder );
+
+	for (size_t i = 0; i < m_candidates.size() && m_residentBytes > m_budgetBytes; ++i) {
+		D3DTextureObject *pTexture = m_candidates[i];
+		HRESULT hr = pTexture->EvictD3DTexture();
+		if (FAILED(hr)) {
+			logPrintf("WARNING: Failed to evict texture %u: '%s'\n", pTexture->m_glIndex, DXGetErrorString(hr));
+			continue;
+		}
+		m_residentBytes -= pTexture->m_residentBytes;
+		m_stats.evictions++;
+		m_stats.bytesEvicted += pTexture->m_residentBytes;
+	}
+}
+
+void D3DTextureManager :: LogStats() const
+{
+	if (!m_budgetBytes)
+		return;
+
+	logPrintf("Texture manager: budget %u KB, resident %u KB, peak %u KB\n", (DWORD)(m_budgetBytes >> 10), (DWORD)(m_residentBytes >> 10), (DWORD)(m_stats.peakResidentBytes >> 10));
+	logPrintf("Texture manager: %u evictions (%u KB), %u restores (%u KB)\n", m_stats.evictions, (DWORD)(m_stats.bytesEvicted >> 10), m_stats.restores, (DWORD)(m_stats.bytesRestored >> 10));
+}
@@ -0,0 +1,77 @@
+/***************************************************************************
+* Copyright (C) 2011-2016, Crystice Softworks.
+* 
+* This file is part of QindieGL source code.
+* Please note that QindieGL is not driver, it's emulator.
+* 
+* QindieGL source code is free software; you can redistribute it and/or 
+* modify it under the terms of the GNU General Public License as 
+* published by the Free Software Foundation; either version 2 of 
+* the License, or (at your option) any later version.
+* 
+* QindieGL source code is distributed in the hope that it will be 
+* useful, but WITHOUT ANY WARRANTY; without even the implied 
+* warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  
+* See the GNU General Public License for more details.
+* 
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, write to the Free Software 
+* Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+***************************************************************************/
+#ifndef QINDIEGL_D3D_TEXTURE_MANAGER_H
+#define QINDIEGL_D3D_TEXTURE_MANAGER_H
+
+#include <vector>
+
+class D3DTextureObject;
+
+typedef struct D3DTextureManagerStats_s
+{
+	DWORD		evictions;
+	DWORD		restores;
+	UINT64		bytesEvicted;
+	UINT64		bytesRestored;
+	UINT64		peakResidentBytes;
+} D3DTextureManagerStats;
+
+// Tracks every texture object with a D3D texture, its estimated size and the
+// frame it was last used in. When a budget is set, textures that were not used
+// recently are evicted to a CPU shadow copy at the end of the frame (lowest
+// priority first, then least recently used) and restored on the next bind.
+class D3DTextureManager
+{
+public:
+	D3DTextureManager();
+	~D3DTextureManager();
+
+	void SetBudget( UINT64 budgetBytes )		{ m_budgetBytes = budgetBytes; }
+	UINT64 GetBudget() const					{ return m_budgetBytes; }
+	UINT64 GetResidentBytes() const				{ return m_residentBytes; }
+	DWORD GetFrame() const						{ return m_frame; }
+	const D3DTextureManagerStats &GetStats() const { return m_stats; }
+
+	void Register( D3DTextureObject *pTexture );
+	void Unregister( D3DTextureObject *pTexture );
+	void Resize( D3DTextureObject *pTexture );
+	void Touch( D3DTextureObject *pTexture );
+	HRESULT MakeResident( D3DTextureObject *pTexture );
+	void EndFrame();
+	void ReleaseRenderTargets();
+	HRESULT GetFlipTarget( UINT width, UINT height, D3DFORMAT format, LPDIRECT3DTEXTURE9 *ppTexture );
+	void LogStats() const;
+
+private:
+	bool IsBound( const D3DTextureObject *pTexture ) const;
+	void EnforceBudget();
+
+private:
+	std::vector<D3DTextureObject*>	m_textures;
+	std::vector<D3DTextureObject*>	m_candidates;
+	UINT64							m_budgetBytes;
+	UINT64							m_residentBytes;
+	DWORD							m_frame;
+	D3DTextureManagerStats			m_stats;
+	LPDIRECT3DTEXTURE9				m_pFlipTarget;
+};
+
+#endif //QINDIEGL_D3D_TEXTURE_MANAGER_H
@@ -51,6 +51,23 @@ inline void UTIL_FreeString( char *s )
 	if(s) free(s); 
 }
 
+// 64-bit FNV-1a style hash over 8-byte words, not suitable for cryptography
+inline UINT64 UTIL_HashBytes( const void *data, size_t size, UINT64 seed = 14695981039346656037ULL )
+{
+	const UINT64 prime = 1099511628211ULL;
+	const GLubyte *p = (const GLubyte*)data;
+	UINT64 h = seed ^ size;
+	for ( ; size >= 8; size -= 8, p += 8) {
+		UINT64 w;
+		memcpy( &w, p, 8 );
+		h = (h ^ w) * prime;
+		h ^= h >> 29;
+	}
+	for ( ; size; --size, ++p)
+		h = (h ^ *p) * prime;
+	return h;
+}
+
 inline DWORD UTIL_GLtoD3DCmpFunc( GLenum func )
 {
 	//Fast GL to D3D conversion
@@ -20,8 +20,8 @@
 typedef float vec_t;
 typedef float vec3_t[3];
 
-#define LIGHTS_DYNAMIC_SZ 64
-typedef uint64_t iterdl_t;
+#define LIGHTS_DYNAMIC_MIN 16
+#define LIGHTS_DYNAMIC_MAX 65536
 
 typedef struct light_data
 {
@@ -48,6 +48,7 @@ struct color_override_data_s
  * Function definitions
  */
 static light_override_t* qdx_light_find_override( uint64_t hash );
+static light_data_t* qdx_dynamiclight_find( uint64_t hash );
 static vec_t Distance( const vec3_t p1, const vec3_t p2 );
 void AngleVectors(const vec3_t angles, vec3_t forward, vec3_t right, vec3_t up);
 
@@ -56,8 +57,18 @@ void AngleVectors(const vec3_t angles, vec3_t forward, vec3_t right, vec3_t up);
  */
 static int rmx_flashlight = 0;
 
-static light_data_t g_lights_dynamic[LIGHTS_DYNAMIC_SZ] = { 0 };
-static iterdl_t g_lights_dynamic_bitmap = 0;
+/**
+ * Dynamic lights are kept packed in g_lights_dynamic, so a frame only walks the
+ * live ones. They are found by hash through an open addressing table with linear
+ * probing; a bucket holds the index of its light plus one, 0 is empty. There are
+ * at least twice as many buckets as lights ("DynamicLightSlots"), and removed
+ * lights are taken out by shifting the following buckets back, so no tombstones
+ * build up while lights come and go every frame.
+ */
+static std::vector<light_data_t> g_lights_dynamic;
+static std::vector<uint32_t> g_lights_dynamic_buckets;
+static uint32_t g_lights_dynamic_capacity = 0;
+static bool g_lights_dynamic_full = false;
 static std::map<uint64_t, light_data_t> g_lights_flares;
 static remixapi_LightHandle g_flashlight_handle[NUM_FLASHLIGHT_HND] = { 0 };
 #define FLASHLIGHT_HASH 0xF1A581168700ULL
@@ -149,21 +160,12 @@ light_override_t* qdx_4imgui_light_get_override( uint64_t hash, light_type_e typ
 		local.color[2] = 1.0f;
 		if ( type == LIGHT_DYNAMIC )
 		{
-			iterdl_t keep_searching = g_lights_dynamic_bitmap;
-			light_data_t* l = &g_lights_dynamic[0];
-			iterdl_t bit = 1;
-			for ( int i = 0; keep_searching && i < LIGHTS_DYNAMIC_SZ; i++, l++, bit <<= 1 )
+			light_data_t* l = qdx_dynamiclight_find( hash );
+			if ( l )
 			{
-				if ( g_lights_dynamic_bitmap & bit )
-				{
-					if ( l->hash == hash )
-					{
-						local.color[0] = l->color[0];
-						local.color[1] = l->color[1];
-						local.color[2] = l->color[2];
-						break;
-					}
-				}
+				local.color[0] = l->color[0];
+				local.color[1] = l->color[1];
+				local.color[2] = l->color[2];
 			}
 			local.radiance_base = LIGHT_RADIANCE_DYNAMIC_BASE;
 			local.radiance_scale = LIGHT_RADIANCE_DYNAMIC_SCALE;
@@ -199,25 +201,18 @@ void qdx_light_scan_closest_lights(light_type_e type)
 
 	if ( type == LIGHT_DYNAMIC )
 	{
-		iterdl_t keep_searching = g_lights_dynamic_bitmap;
-		light_data_t* l = &g_lights_dynamic[0];
-		iterdl_t bit = 1;
-		for ( i = 0; keep_searching && i < LIGHTS_DYNAMIC_SZ; i++, l++, bit <<= 1 )
+		for ( auto l = g_lights_dynamic.begin(); l != g_lights_dynamic.end(); l++ )
 		{
-			if ( g_lights_dynamic_bitmap & bit )
+			vec3_t position = { l->pos[0], l->pos[1], l->pos[2] };
+			light_override_t* ovr = qdx_light_find_override( l->hash );
+			if ( ovr )
 			{
-				vec3_t position = { l->pos[0], l->pos[1], l->pos[2] };
-				light_override_t* ovr = qdx_light_find_override( l->hash );
-				if ( ovr )
-				{
-					position[0] += ovr->position_offset[0];
-					position[1] += ovr->position_offset[1];
-					position[2] += ovr->position_offset[2];
-				}
-				float dist = Distance( FLASHLIGHT_POSITION_CACHE, position ); //use the flashlight cache since we have it
-				distvhash.push_back( std::make_pair( dist, l->hash ) );
-				keep_searching &= ~bit;
+				position[0] += ovr->position_offset[0];
+				position[1] += ovr->position_offset[1];
+				position[2] += ovr->position_offset[2];
 			}
+			float dist = Distance( FLASHLIGHT_POSITION_CACHE, position ); //use the flashlight cache since we have it
+			distvhash.push_back( std::make_pair( dist, l->hash ) );
 		}
 	}
 	if ( type == LIGHT_CORONA )
@@ -589,46 +584,104 @@ void qdx_lights_dynamic_linger( int val )
 	g_dynamic_light_linger = val;
 }
 
-light_data_t* qdx_dynamiclight_get_slot( uint64_t hash )
+static void qdx_dynamiclight_init()
+{
+	uint32_t capacity = D3DGlobal.settings.dynamicLightSlots;
+	if ( capacity < LIGHTS_DYNAMIC_MIN )
+		capacity = LIGHTS_DYNAMIC_MIN;
+	if ( capacity > LIGHTS_DYNAMIC_MAX )
+		capacity = LIGHTS_DYNAMIC_MAX;
+
+	uint32_t numBuckets = 1;
+	while ( numBuckets < capacity * 2 )
+		numBuckets <<= 1;
+
+	g_lights_dynamic.clear();
+	g_lights_dynamic.reserve( capacity );
+	g_lights_dynamic_buckets.assign( numBuckets, 0 );
+	g_lights_dynamic_capacity = capacity;
+	g_lights_dynamic_full = false;
+}
+
+static inline uint32_t qdx_dynamiclight_home( uint64_t hash )
+{
+	//the hashes are fnv of positions; mix them so nearby values spread over the table
+	return (uint32_t)( ( hash * 0x9E3779B97F4A7C15ULL ) >> 32 ) & ( (uint32_t)g_lights_dynamic_buckets.size() - 1 );
+}
+
+//returns the bucket of the light, or the empty bucket where it would go
+static uint32_t qdx_dynamiclight_bucket( uint64_t hash )
+{
+	const uint32_t mask = (uint32_t)g_lights_dynamic_buckets.size() - 1;
+	uint32_t b = qdx_dynamiclight_home( hash );
+	while ( g_lights_dynamic_buckets[b] && g_lights_dynamic[g_lights_dynamic_buckets[b] - 1].hash != hash )
+		b = ( b + 1 ) & mask;
+	return b;
+}
+
+static light_data_t* qdx_dynamiclight_find( uint64_t hash )
 {
-	iterdl_t keep_searching = g_lights_dynamic_bitmap;
-	light_data_t* l = &g_lights_dynamic[0];
-	light_data_t* sto = NULL;
-	iterdl_t sto_bit = 0;
-	iterdl_t bit = 1;
-	for ( int i = 0; (keep_searching || sto == NULL) && i < LIGHTS_DYNAMIC_SZ; i++, l++, bit <<= 1 )
+	if ( g_lights_dynamic.empty() )
+		return NULL;
+	const uint32_t index = g_lights_dynamic_buckets[qdx_dynamiclight_bucket( hash )];
+	return index ? &g_lights_dynamic[index - 1] : NULL;
+}
+
+//removes the light at index; the last light is moved in its place
+static void qdx_dynamiclight_remove( uint32_t index )
+{
+	const uint32_t mask = (uint32_t)g_lights_dynamic_buckets.size() - 1;
+	uint32_t hole = qdx_dynamiclight_bucket( g_lights_dynamic[index].hash );
+	for ( uint32_t b = ( hole + 1 ) & mask; g_lights_dynamic_buckets[b]; b = ( b + 1 ) & mask )
 	{
-		if ( g_lights_dynamic_bitmap & bit )
-		{
-			if ( l->hash == hash )
-			{
-				l->updatedThisFrame = (uint8_t)g_dynamic_light_linger;
-				return l;
-			}
-			keep_searching &= ~bit;
-		}
-		else
+		//a light can fill the hole unless its home lies cyclically in (hole, b]
+		const uint32_t home = qdx_dynamiclight_home( g_lights_dynamic[g_lights_dynamic_buckets[b] - 1].hash );
+		if ( ( ( b - home ) & mask ) >= ( ( b - hole ) & mask ) )
 		{
-			if ( sto == NULL )
-			{
-				sto = l;
-				sto_bit = bit;
-			}
+			g_lights_dynamic_buckets[hole] = g_lights_dynamic_buckets[b];
+			hole = b;
 		}
 	}
-	if ( sto != NULL )
+	g_lights_dynamic_buckets[hole] = 0;
+
+	const uint32_t last = (uint32_t)g_lights_dynamic.size() - 1;
+	if ( index != last )
 	{
-		g_lights_dynamic_bitmap |= sto_bit;
-		sto->updatedThisFrame = (uint8_t)g_dynamic_light_linger;
-		sto->hash = hash;
-		sto->data_hash = 0;
-		return sto;
+		g_lights_dynamic_buckets[qdx_dynamiclight_bucket( g_lights_dynamic[last].hash )] = index + 1;
+		g_lights_dynamic[index] = g_lights_dynamic[last];
 	}
-	else
+	g_lights_dynamic.pop_back();
+	g_lights_dynamic_full = false;
+}
+
+light_data_t* qdx_dynamiclight_get_slot( uint64_t hash )
+{
+	if ( g_lights_dynamic_buckets.empty() )
+		qdx_dynamiclight_init();
+
+	const uint32_t b = qdx_dynamiclight_bucket( hash );
+	if ( g_lights_dynamic_buckets[b] )
 	{
-		qassert( 0 && "Not enough Dynamic light slots!" );
+		light_data_t* l = &g_lights_dynamic[g_lights_dynamic_buckets[b] - 1];
+		l->updatedThisFrame = (uint8_t)g_dynamic_light_linger;
+		return l;
 	}
-	return NULL;
+
+	if ( g_lights_dynamic.size() >= g_lights_dynamic_capacity )
+	{
+		if ( !g_lights_dynamic_full )
+			rmx_console_printf( PRINT_WARNING, "RMX out of dynamic light slots (%u), raise DynamicLightSlots\n", g_lights_dynamic_capacity );
+		g_lights_dynamic_full = true;
+		return NULL;
+	}
+
+	light_data_t sto;
+	ZeroMemory( &sto, sizeof( sto ) );
+	sto.updatedThisFrame = (uint8_t)g_dynamic_light_linger;
+	sto.hash = hash;
+	g_lights_dynamic.push_back( sto );
+	g_lights_dynamic_buckets[b] = (uint32_t)g_lights_dynamic.size();
+	return &g_lights_dynamic.back();
 }
 
 void qdx_lights_clear(unsigned int light_types)
@@ -637,22 +690,17 @@ void qdx_lights_clear(unsigned int light_types)
 	{
 		if (light_types & LIGHT_DYNAMIC)
 		{
-			light_data_t* l = &g_lights_dynamic[0];
-			iterdl_t keep_searching = g_lights_dynamic_bitmap;
-			iterdl_t bit = 1;
-			for (int i = 0; keep_searching && i < LIGHTS_DYNAMIC_SZ; i++, l++, bit <<= 1)
+			for (auto l = g_lights_dynamic.begin(); l != g_lights_dynamic.end(); l++)
 			{
-				if ( g_lights_dynamic_bitmap & bit )
+				if ( l->isRemix )
 				{
-					if ( l->isRemix )
-					{
-						if( l->handle )
-							remixInterface.DestroyLight( l->handle );
-					}
-					g_lights_dynamic_bitmap &= ~bit;
-					keep_searching &= ~bit;
+					if( l->handle )
+						remixInterface.DestroyLight( l->handle );
 				}
 			}
+			//rebuilt on the next light, with the current DynamicLightSlots
+			g_lights_dynamic.clear();
+			g_lights_dynamic_buckets.clear();
 		}
 		if (light_types & LIGHT_CORONA)
 		{
@@ -691,32 +739,27 @@ void qdx_lights_clear(unsigned int light_types)
 void qdx_lights_draw()
 {	
 	//draw dynamic lights, handle both DX9 case or remix
-	light_data_t* l = &g_lights_dynamic[0];
-	iterdl_t keep_searching = g_lights_dynamic_bitmap;
-	iterdl_t bit = 1;
-	for (int i = 0; keep_searching && i < LIGHTS_DYNAMIC_SZ; i++, l++, bit <<= 1)
+	//walk backwards, expired lights are replaced by the last one which was already drawn
+	for (uint32_t i = (uint32_t)g_lights_dynamic.size(); i-- > 0; )
 	{
-		if ( g_lights_dynamic_bitmap & bit )
+		light_data_t* l = &g_lights_dynamic[i];
+		if ( l->updatedThisFrame )
 		{
-			if ( l->updatedThisFrame )
+			l->updatedThisFrame--;
+			if ( l->isRemix )
 			{
-				l->updatedThisFrame--;
-				if ( l->isRemix )
-				{
-					if( l->handle )
-						remixInterface.DrawLightInstance( l->handle );
-				}
+				if( l->handle )
+					remixInterface.DrawLightInstance( l->handle );
 			}
-			else
+		}
+		else
+		{
+			if ( l->isRemix )
 			{
-				g_lights_dynamic_bitmap &= ~bit;
-				if ( l->isRemix )
-				{
-					if( l->handle )
-						remixInterface.DestroyLight( l->handle );
-				}
+				if( l->handle )
+					remixInterface.DestroyLight( l->handle );
 			}
-			keep_searching &= ~bit;
+			qdx_dynamiclight_remove( i );
 		}
 	}
 
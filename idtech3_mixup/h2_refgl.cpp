@@ -471,6 +471,7 @@ static cvarq2_t* r_nocull;
 static cvarq2_t* gl_dynamic;
 static cvarq2_t* quake_amount;
 static cvarq2_t* rmx_skiplightmaps;
+static cvarq2_t* rmx_lightmapatlas;
 static cvarq2_t* rmx_novis;
 static cvarq2_t* rmx_normals;
 static cvarq2_t* rmx_coronas;
@@ -596,6 +597,7 @@ void h2_refgl_init()
 			gl_dynamic = riCVAR_GET("gl_dynamic", "1", 0);
 			quake_amount = riCVAR_GET("quake_amount", "0", 0);
 			rmx_skiplightmaps = riCVAR_GET("rmx_skiplightmaps", "0", 0);
+			rmx_lightmapatlas = riCVAR_GET("rmx_lightmapatlas", "0", 1);
 			rmx_novis = riCVAR_GET("rmx_novis", "1", 0);
 			rmx_normals = riCVAR_GET("rmx_normals", "0", 0);
 			rmx_generic = riCVAR_GET("rmx_generic", "-1", 0);
@@ -1147,6 +1149,7 @@ static void R_RecursiveWorldNodeEx(mnode_t* node, BOOL inpvs)
 #define RENDER_TWOTEXTURES 1u
 #define RENDER_NORMALS     2u
 #define RECALC_NORMALS     4u
+#define ATLAS_LIGHTMAP     8u
 
 union sort_pack_u
 {
@@ -1161,6 +1164,95 @@ union sort_pack_u
 
 static bool h2_should_compute_normals(const image_t* image);
 
+/*
+ * Lightmap atlas
+ * The game uploads its lightmaps as 128x128 pages, one texture each, so world
+ * batches get split every time the lightmap page changes. With rmx_lightmapatlas
+ * enabled the pages are copied into a few large atlas textures the first time a
+ * surface references them, and the lightmap texcoords are remapped when the
+ * surface is written into g_drawBuff. Pages are re-read after every map load.
+ */
+#define LM_BLOCK_WIDTH        128
+#define LM_BLOCK_HEIGHT       128
+#define LM_ATLAS_SIZE         1024
+#define LM_ATLAS_COLUMNS      (LM_ATLAS_SIZE / LM_BLOCK_WIDTH)
+#define LM_ATLAS_ROWS         (LM_ATLAS_SIZE / LM_BLOCK_HEIGHT)
+#define LM_ATLAS_PAGES        (LM_ATLAS_COLUMNS * LM_ATLAS_ROWS)
+#define LM_ATLAS_MAX_ATLASES  4
+#define LM_ATLAS_MAX_PAGES    (LM_ATLAS_PAGES * LM_ATLAS_MAX_ATLASES)
+//texture names past the range used by the game (TEXNUM_IMAGES + MAX_GLTEXTURES)
+#define LM_ATLAS_TEXNUM       4096
+
+OPENGL_API void WINAPI glTexImage2D( GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid* pixels );
+OPENGL_API void WINAPI glTexSubImage2D( GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid* pixels );
+OPENGL_API void WINAPI glGetTexImage( GLenum target, GLint level, GLenum format, GLenum type, GLvoid* pixels );
+OPENGL_API void WINAPI glTexParameteri( GLenum target, GLenum pname, GLint param );
+
+static struct lightmapAtlas_s
+{
+	qboolean created[LM_ATLAS_MAX_ATLASES];
+	byte loaded[LM_ATLAS_MAX_PAGES];
+} g_lmAtlas;
+
+static void R_LightmapAtlasReset()
+{
+	//atlas textures are kept, only the page contents are invalidated
+	memset( g_lmAtlas.loaded, 0, sizeof( g_lmAtlas.loaded ) );
+}
+
+static inline int R_LightmapAtlasTexnum( int page )
+{
+	return LM_ATLAS_TEXNUM + page / LM_ATLAS_PAGES;
+}
+
+static void R_LightmapAtlasPageOffset( int page, int* x, int* y )
+{
+	const int slot = page % LM_ATLAS_PAGES;
+	*x = ( slot % LM_ATLAS_COLUMNS ) * LM_BLOCK_WIDTH;
+	*y = ( slot / LM_ATLAS_COLUMNS ) * LM_BLOCK_HEIGHT;
+}
+
+static void R_LightmapAtlasUpload( int page, int xoffset, int yoffset, int width, int height, const void* pixels )
+{
+	const int atlas = page / LM_ATLAS_PAGES;
+	int x, y;
+
+	GL_MBind( GL_TEXTURE1, R_LightmapAtlasTexnum( page ) );
+	if ( !g_lmAtlas.created[atlas] )
+	{
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, LM_ATLAS_SIZE, LM_ATLAS_SIZE, 0, GL_LIGHTMAP_FORMAT, GL_UNSIGNED_BYTE, NULL );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+		g_lmAtlas.created[atlas] = qtrue;
+	}
+	R_LightmapAtlasPageOffset( page, &x, &y );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, x + xoffset, y + yoffset, width, height, GL_LIGHTMAP_FORMAT, GL_UNSIGNED_BYTE, pixels );
+}
+
+//returns false if the page can't be placed into an atlas
+static qboolean R_LightmapAtlasLoadPage( int page )
+{
+	static unsigned pagedata[LM_BLOCK_WIDTH * LM_BLOCK_HEIGHT];
+
+	if ( page < 0 || page >= LM_ATLAS_MAX_PAGES )
+		return qfalse;
+	if ( g_lmAtlas.loaded[page] )
+		return qtrue;
+
+	const int oldtmu = currenttmu;
+
+	//read the page back from the game's lightmap texture
+	GL_MBind( GL_TEXTURE1, gl_state_lightmap_textures + page );
+	glGetTexImage( GL_TEXTURE_2D, 0, GL_LIGHTMAP_FORMAT, GL_UNSIGNED_BYTE, pagedata );
+	R_LightmapAtlasUpload( page, 0, 0, LM_BLOCK_WIDTH, LM_BLOCK_HEIGHT, pagedata );
+
+	//leave the game's active texture unit as it was
+	GL_MBind( GL_TEXTURE0 + oldtmu, currenttexture[oldtmu] );
+
+	g_lmAtlas.loaded[page] = 1;
+	return qtrue;
+}
+
 static void R_AddDrawSurf(msurface_t *surf)
 {
 	int index;
@@ -1204,6 +1296,12 @@ static void R_AddDrawSurf(msurface_t *surf)
 		sort.bits.flowing = 0;// surf->texinfo->flags& SURF_FLOWING;
 		if ( rmx_skiplightmaps->value )
 			sort.bits.lightmap = SKIP_LIGHTMAP;
+		else if ( rmx_lightmapatlas->value && R_LightmapAtlasLoadPage( surf->lightmaptexturenum ) )
+		{
+			//surfaces sharing an atlas now sort into the same batch
+			sort.bits.lightmap = surf->lightmaptexturenum / LM_ATLAS_PAGES;
+			surflags |= ATLAS_LIGHTMAP;
+		}
 		else
 			sort.bits.lightmap = surf->lightmaptexturenum;
 
@@ -1218,11 +1316,9 @@ static void R_AddDrawSurf(msurface_t *surf)
 }
 
 static void R_RenderSurfs( int flags );
-static void R_PopulateDrawBuffer( msurface_t* surf, int is_dynamic, int is_flowing, uint32_t flags );
+static void R_PopulateDrawBuffer( msurface_t* surf, int lightmap, int is_dynamic, int is_flowing, uint32_t flags );
 static int h2_surfaces_compare( const void* arg1, const void* arg2 );
 
-OPENGL_API void WINAPI glTexSubImage2D( GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const GLvoid* pixels );
-
 static void R_SortAndDrawSurfaces( drawSurf_t* surfs, int numSurfs )
 {
 	qsort( surfs, numSurfs, sizeof( drawSurf_t ), h2_surfaces_compare );
@@ -1232,6 +1328,7 @@ static void R_SortAndDrawSurfaces( drawSurf_t* surfs, int numSurfs )
 	int oldTexnum = -1;
 	//int oldFlowing = -1;
 	int oldLightmap = -1;
+	int lightmap = 0;
 	uint32_t flags = 0;
 
 	union sort_pack_u sort = { 0 };
@@ -1252,6 +1349,7 @@ static void R_SortAndDrawSurfaces( drawSurf_t* surfs, int numSurfs )
 		}
 
 		flags = s->flags;
+		lightmap = s->surface->lightmaptexturenum;
 
 		//check if new textures need to be bound
 		if ( sort.bits.dynamic )
@@ -1289,15 +1387,30 @@ static void R_SortAndDrawSurfaces( drawSurf_t* surfs, int numSurfs )
 				smax, tmax, 
 				GL_LIGHTMAP_FORMAT, 
 				GL_UNSIGNED_BYTE, temp );
+			lightmap = lmtex;
 
 			GL_MBind( /*GL_TEXTURE0_SGIS*/GL_TEXTURE0, sort.bits.texnum/*image->texnum*/ );
-			GL_MBind( /*GL_TEXTURE1_SGIS*/GL_TEXTURE1, /*gl_state.lightmap_textures*/gl_state_lightmap_textures + lmtex );
+			if ( (flags & ATLAS_LIGHTMAP) && R_LightmapAtlasLoadPage( lmtex ) )
+			{
+				//keep the atlas copy of the page in sync
+				R_LightmapAtlasUpload( lmtex, surf->light_s, surf->light_t, smax, tmax, temp );
+			}
+			else
+			{
+				flags &= ~ATLAS_LIGHTMAP;
+				GL_MBind( /*GL_TEXTURE1_SGIS*/GL_TEXTURE1, /*gl_state.lightmap_textures*/gl_state_lightmap_textures + lmtex );
+			}
 			flags |= RENDER_TWOTEXTURES;
 		}
 		else if( oldTexnum != sort.bits.texnum || oldLightmap != sort.bits.lightmap )
 		{
 			GL_MBind( /*GL_TEXTURE0_SGIS*/GL_TEXTURE0, sort.bits.texnum/*image->texnum*/ );
-			if ( sort.bits.lightmap != SKIP_LIGHTMAP )
+			if ( flags & ATLAS_LIGHTMAP )
+			{
+				GL_MBind( /*GL_TEXTURE1_SGIS*/GL_TEXTURE1, LM_ATLAS_TEXNUM + sort.bits.lightmap );
+				flags |= RENDER_TWOTEXTURES;
+			}
+			else if ( sort.bits.lightmap != SKIP_LIGHTMAP )
 			{
 				GL_MBind( /*GL_TEXTURE1_SGIS*/GL_TEXTURE1, /*gl_state.lightmap_textures*/gl_state_lightmap_textures + sort.bits.lightmap/*lmtex*/ );
 				flags |= RENDER_TWOTEXTURES;
@@ -1307,7 +1420,7 @@ static void R_SortAndDrawSurfaces( drawSurf_t* surfs, int numSurfs )
 		oldTexnum = sort.bits.texnum;
 		oldLightmap = sort.bits.lightmap;
 
-		R_PopulateDrawBuffer( s->surface, sort.bits.dynamic, sort.bits.flowing, flags );
+		R_PopulateDrawBuffer( s->surface, lightmap, sort.bits.dynamic, sort.bits.flowing, flags );
 #endif
 	}
 
@@ -1349,12 +1462,24 @@ static void R_CheckDrawBufferSpace( int vertexes, int indexes, uint32_t flags )
 	}
 }
 
-static void R_PopulateDrawBuffer( msurface_t* surf, int is_dynamic, int is_flowing, uint32_t flags )
+static void R_PopulateDrawBuffer( msurface_t* surf, int lightmap, int is_dynamic, int is_flowing, uint32_t flags )
 {
 	int i;
 	float *v;
 	glpoly_t *p;
 	float scroll = 0;
+	float lmscale = 1.0f;
+	float lmoffset[2] = { 0.0f, 0.0f };
+
+	if ( flags & ATLAS_LIGHTMAP )
+	{
+		//page texcoords are normalized, move them into the page's atlas slot
+		int x, y;
+		R_LightmapAtlasPageOffset( lightmap, &x, &y );
+		lmscale = (float)LM_BLOCK_WIDTH / LM_ATLAS_SIZE;
+		lmoffset[0] = (float)x / LM_ATLAS_SIZE;
+		lmoffset[1] = (float)y / LM_ATLAS_SIZE;
+	}
 
 	//c_brush_polys++;
 
@@ -1388,8 +1513,8 @@ static void R_PopulateDrawBuffer( msurface_t* surf, int is_dynamic, int is_flowi
 			draw->clr.all = 0xffffffff;
 			draw->tex0[0] = v[3]+scroll;
 			draw->tex0[1] = v[4];
-			draw->tex1[0] = v[5];
-			draw->tex1[1] = v[6];
+			draw->tex1[0] = v[5] * lmscale + lmoffset[0];
+			draw->tex1[1] = v[6] * lmscale + lmoffset[1];
 			draw++;
 			ibuf++;
 		}
@@ -2668,6 +2793,7 @@ static void hk_R_BeginRegistration( const char* model )
 		//do some cleaning
 		g_halosvalidation.clear();
 		qdx_begin_loading_map( model );
+		R_LightmapAtlasReset();
 
 		//mapname.assign( model );
 	}
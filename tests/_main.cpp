@@ -2,6 +2,7 @@
 //
 
 #include <iostream>
+#include <math.h>
 #include "tests.h"
 
 static int tests_total = 0;
@@ -9,6 +10,11 @@ static int tests_ok = 0;
 
 extern void do_texgen_tests();
 extern void do_buffer_multitex_tests();
+extern void do_matrix_tests();
+extern void do_texgen_batch_tests();
+extern void do_list_optimizer_tests();
+extern void do_eval_batch_tests();
+extern void do_feedback_batch_tests();
 
 int main()
 {
@@ -16,6 +22,11 @@ int main()
 
     do_texgen_tests();
     do_buffer_multitex_tests();
+    do_matrix_tests();
+    do_texgen_batch_tests();
+    do_list_optimizer_tests();
+    do_eval_batch_tests();
+    do_feedback_batch_tests();
 
     printf("Tests results: %d/%d\n", tests_ok, tests_total);
     system("pause");
@@ -109,3 +120,20 @@ void random_text(uc8_t* out, int size)
         }
     }
 }
+
+float random_float(float limit)
+{
+    return (float)(rand() % 2001 - 1000) * (limit / 1000.0f);
+}
+
+int floats_near(const float* a, const float* b, int count, float tolerance)
+{
+    for (int i = 0; i < count; i++)
+    {
+        float scale = fabsf(a[i]) > fabsf(b[i]) ? fabsf(a[i]) : fabsf(b[i]);
+        if (scale < 1.0f) scale = 1.0f;
+        if (!(fabsf(a[i] - b[i]) <= tolerance * scale))
+            return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "tests.h"
+
+#include "../code/d3d_eval_batch.hpp"
+
+#define EVAL_BATCH_MAX_POINTS	17
+
+// Bernstein weight straight from the definition
+static double eval_bernstein(int i, int n, double t)
+{
+	if (i < 0 || i > n)
+		return 0.0;
+	double c = 1.0;
+	for (int k = 1; k <= i; k++)
+		c = c * (n - i + k) / k;
+	return c * pow(t, i) * pow(1.0 - t, n - i);
+}
+
+static double eval_bernstein_deriv(int i, int n, double t)
+{
+	if (n == 0)
+		return 0.0;
+	return n * (eval_bernstein(i - 1, n - 1, t) - eval_bernstein(i, n - 1, t));
+}
+
+static void get_eval_map(D3DEvalMap *map, int uorder, int vorder)
+{
+	map->uorder = uorder;
+	map->vorder = vorder;
+	map->u1 = 0.0f;
+	map->u2 = 1.0f;
+	map->v1 = 0.0f;
+	map->v2 = 1.0f;
+	map->points.resize(uorder * vorder * 4);
+	for (size_t i = 0; i < map->points.size(); i++)
+		map->points[i] = random_float(10.0f);
+}
+
+// the map at (s, t) and its derivatives, in double precision
+static void eval_map_ref(const D3DEvalMap *map, double s, double t, double *out, double *du, double *dv)
+{
+	for (int c = 0; c < 4; c++)
+	{
+		out[c] = du[c] = dv[c] = 0.0;
+		for (int i = 0; i < map->uorder; i++)
+		{
+			for (int j = 0; j < map->vorder; j++)
+			{
+				const double p = map->points[(i * map->vorder + j) * 4 + c];
+				out[c] += eval_bernstein(i, map->uorder - 1, s) * eval_bernstein(j, map->vorder - 1, t) * p;
+				du[c] += eval_bernstein_deriv(i, map->uorder - 1, s) * eval_bernstein(j, map->vorder - 1, t) * p;
+				dv[c] += eval_bernstein(i, map->uorder - 1, s) * eval_bernstein_deriv(j, map->vorder - 1, t) * p;
+			}
+		}
+	}
+}
+
+static void do_eval_batch_basis_tests()
+{
+	float weights[QINDIEGL_EVAL_MAX_ORDER], derivs[QINDIEGL_EVAL_MAX_ORDER];
+
+	// constant map
+	D3DEval_Basis(1, 0.3f, 1.0f, weights, derivs);
+	assert(weights[0] == 1.0f && derivs[0] == 0.0f);
+
+	// the weights sum to one and their derivatives to zero, up to the maximum order
+	bool unity = true, flat = true, exact = true;
+	for (int order = 1; order <= QINDIEGL_EVAL_MAX_ORDER; order++)
+	{
+		for (int k = 0; k <= 8; k++)
+		{
+			const float t = (float)k / 8.0f;
+			D3DEval_Basis(order, t, 1.0f, weights, derivs);
+			double sum = 0.0, sumDerivs = 0.0;
+			for (int i = 0; i < order; i++)
+			{
+				sum += weights[i];
+				sumDerivs += derivs[i];
+				if (order <= 12)
+				{
+					exact = exact && fabs(weights[i] - eval_bernstein(i, order - 1, t)) < 1e-5;
+					exact = exact && fabs(derivs[i] - eval_bernstein_deriv(i, order - 1, t)) < 1e-3 * order;
+				}
+			}
+			unity = unity && fabs(sum - 1.0) < 1e-5;
+			flat = flat && fabs(sumDerivs) < 1e-3 * order;
+		}
+	}
+	assert(unity);
+	assert(flat);
+	assert(exact);
+
+	// derivatives are scaled, the weights are not
+	float scaled[QINDIEGL_EVAL_MAX_ORDER];
+	D3DEval_Basis(4, 0.25f, 1.0f, weights, derivs);
+	D3DEval_Basis(4, 0.25f, -0.5f, weights, scaled);
+	bool halved = true;
+	for (int i = 0; i < 4; i++)
+		halved = halved && scaled[i] == -0.5f * derivs[i];
+	assert(halved);
+}
+
+static void do_eval_batch_known_tests()
+{
+	// quadratic curve through (0,0), (1,2), (2,0): the middle is at (1,1), heading along x
+	D3DEvalMap map;
+	map.uorder = 3;
+	map.vorder = 1;
+	map.u1 = 0.0f;
+	map.u2 = 1.0f;
+	map.v1 = map.v2 = 0.0f;
+	const float points[12] = { 0, 0, 0, 1,  1, 2, 0, 1,  2, 0, 0, 1 };
+	map.points.assign(points, points + 12);
+
+	D3DEvalBasisCache cache;
+	const D3DEvalBasis *basis = cache.Get(3, 3, 0.0f, 0.5f, 1.0f);
+	for (int sse = 0; sse < 2; sse++)
+	{
+		float out[3 * 4], du[3 * 4];
+		D3DMatrix_UseSSE(sse != 0);
+		D3DEval_Row(&map, &basis->weights[0], &basis->derivs[0], 3, nullptr, nullptr, out, du, nullptr);
+		const float expected[12] = { 0, 0, 0, 1,  1, 1, 0, 1,  2, 0, 0, 1 };
+		const float expectedDu[12] = { 2, 4, 0, 0,  2, 0, 0, 0,  2, -4, 0, 0 };
+		assert(floats_near(out, expected, 12, 1e-6f));
+		assert(floats_near(du, expectedDu, 12, 1e-6f));
+	}
+
+	// a bilinear patch in the xy plane faces +z, also when all of it is scaled by w
+	D3DEvalMap patch;
+	patch.uorder = 2;
+	patch.vorder = 2;
+	patch.u1 = patch.v1 = 0.0f;
+	patch.u2 = patch.v2 = 1.0f;
+	const float corners[16] = { 0, 0, 0, 1,  0, 1, 0, 1,  1, 0, 0, 1,  1, 1, 0, 1 };
+	patch.points.assign(corners, corners + 16);
+	const D3DEvalBasis *ubasis = cache.Get(2, 2, 0.0f, 1.0f, 1.0f);
+	for (int rational = 0; rational < 2; rational++)
+	{
+		if (rational)
+		{
+			for (int i = 0; i < 16; i++)
+				patch.points[i] *= 2.0f;
+		}
+		float vweights[2], vderivs[2];
+		D3DEval_Basis(2, 0.5f, 1.0f, vweights, vderivs);
+		float out[2 * 4], du[2 * 4], dv[2 * 4], normals[2 * 3];
+		D3DEval_Row(&patch, &ubasis->weights[0], &ubasis->derivs[0], 2, vweights, vderivs, out, du, dv);
+		D3DEval_Normals(out, du, dv, 2, rational != 0, normals);
+		const float up[6] = { 0, 0, 1,  0, 0, 1 };
+		assert(floats_near(normals, up, 6, 1e-6f));
+	}
+
+	// the same patch on the plane z = x + 1 with a different w at every corner
+	const float weights[4] = { 1.0f, 2.0f, 3.0f, 1.5f };
+	for (int i = 0; i < 4; i++)
+	{
+		const float x = corners[i * 4 + 0], y = corners[i * 4 + 1];
+		patch.points[i * 4 + 0] = x * weights[i];
+		patch.points[i * 4 + 1] = y * weights[i];
+		patch.points[i * 4 + 2] = (x + 1.0f) * weights[i];
+		patch.points[i * 4 + 3] = weights[i];
+	}
+	float vweights[2], vderivs[2];
+	D3DEval_Basis(2, 0.25f, 1.0f, vweights, vderivs);
+	float out[2 * 4], du[2 * 4], dv[2 * 4], normals[2 * 3];
+	D3DEval_Row(&patch, &ubasis->weights[0], &ubasis->derivs[0], 2, vweights, vderivs, out, du, dv);
+	D3DEval_Normals(out, du, dv, 2, true, normals);
+	const float tilted[6] = { -0.70710678f, 0, 0.70710678f,  -0.70710678f, 0, 0.70710678f };
+	assert(floats_near(normals, tilted, 6, 1e-5f));
+	D3DMatrix_UseSSE(false);
+}
+
+static void do_eval_batch_cache_tests()
+{
+	D3DEvalBasisCache cache;
+
+	const D3DEvalBasis *a = cache.Get(4, 9, 0.0f, 0.125f, 1.0f);
+	assert(a->order == 4 && a->count == 9);
+	assert(a->weights.size() == 36 && a->derivs.size() == 36);
+	assert(cache.Get(4, 9, 0.0f, 0.125f, 1.0f) == a);
+
+	// any key difference is another table
+	assert(cache.Get(4, 9, 0.0f, 0.125f, 2.0f) != a);
+	assert(cache.Get(3, 9, 0.0f, 0.125f, 1.0f) != a);
+
+	// an entry used between other lookups is never the one replaced
+	bool kept = true;
+	for (int i = 0; i < 40; i++)
+	{
+		cache.Get(2 + i % 5, 3 + i, 0.0f, 0.5f, 1.0f);
+		kept = kept && cache.Get(4, 9, 0.0f, 0.125f, 1.0f) == a;
+	}
+	assert(kept);
+
+	// tables match the weights at every point
+	float weights[4], derivs[4];
+	D3DEval_Basis(4, 0.0f + 5 * 0.125f, 1.0f, weights, derivs);
+	assert(memcmp(&a->weights[5 * 4], weights, sizeof(weights)) == 0);
+	assert(memcmp(&a->derivs[5 * 4], derivs, sizeof(derivs)) == 0);
+
+	cache.Clear();
+	const D3DEvalBasis *b = cache.Get(4, 9, 0.0f, 0.125f, 1.0f);
+	assert(b->order == 4 && b->weights.size() == 36);
+}
+
+static void do_eval_batch_random_tests()
+{
+	float out_ref[EVAL_BATCH_MAX_POINTS * 4], du_ref[EVAL_BATCH_MAX_POINTS * 4], dv_ref[EVAL_BATCH_MAX_POINTS * 4];
+	float out_sse[EVAL_BATCH_MAX_POINTS * 4], du_sse[EVAL_BATCH_MAX_POINTS * 4], dv_sse[EVAL_BATCH_MAX_POINTS * 4];
+	D3DEvalBasisCache cache;
+
+	for (int iter = 0; iter < 300; iter++)
+	{
+		const bool surface = (iter & 1) != 0;
+		D3DEvalMap map;
+		get_eval_map(&map, 1 + rand() % 8, surface ? 1 + rand() % 8 : 1);
+
+		const int count = 1 + rand() % EVAL_BATCH_MAX_POINTS;
+		const float t0 = (float)(rand() % 5) / 8.0f - 0.25f;
+		const float dt = 1.0f / (float)(count + rand() % 8);
+		const D3DEvalBasis *ubasis = cache.Get(map.uorder, count, t0, dt, 1.0f);
+
+		const float t = (float)(rand() % 9) / 8.0f;
+		float vweights[QINDIEGL_EVAL_MAX_ORDER], vderivs[QINDIEGL_EVAL_MAX_ORDER];
+		D3DEval_Basis(map.vorder, t, 1.0f, vweights, vderivs);
+
+		D3DEval_Row_Ref(&map, &ubasis->weights[0], &ubasis->derivs[0], count,
+			surface ? vweights : nullptr, vderivs, out_ref, du_ref, dv_ref);
+
+		bool matches = true;
+		for (int k = 0; k < count; k++)
+		{
+			double out[4], du[4], dv[4];
+			float fout[4], fdu[4], fdv[4];
+			eval_map_ref(&map, t0 + k * dt, surface ? t : 0.0, out, du, dv);
+			for (int c = 0; c < 4; c++)
+			{
+				fout[c] = (float)out[c];
+				fdu[c] = (float)du[c];
+				fdv[c] = (float)dv[c];
+			}
+			matches = matches && floats_near(&out_ref[k * 4], fout, 4, 1e-3f);
+			matches = matches && floats_near(&du_ref[k * 4], fdu, 4, 1e-2f);
+			if (surface)
+				matches = matches && floats_near(&dv_ref[k * 4], fdv, 4, 1e-2f);
+		}
+		assertloop(matches, iter);
+
+#if QINDIEGL_MATRIX_SSE
+		D3DEval_Row_SSE(&map, &ubasis->weights[0], &ubasis->derivs[0], count,
+			surface ? vweights : nullptr, vderivs, out_sse, du_sse, dv_sse);
+		bool same = floats_near(out_sse, out_ref, count * 4, 1e-4f) && floats_near(du_sse, du_ref, count * 4, 1e-4f);
+		if (surface)
+			same = same && floats_near(dv_sse, dv_ref, count * 4, 1e-4f);
+		assertloop(same, iter);
+#endif
+	}
+}
+
+void do_eval_batch_tests()
+{
+	random_init();
+
+	do_eval_batch_basis_tests();
+	do_eval_batch_known_tests();
+	do_eval_batch_cache_tests();
+	do_eval_batch_random_tests();
+}
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "tests.h"
+
+#include "../code/d3d_feedback_batch.hpp"
+
+#define FEEDBACK_BATCH_MAX_POINTS	37
+
+// inside the view volume, with some slack for the clipped vertices
+static bool feedback_inside(const float *v, float slack)
+{
+	float w = v[3] * (1.0f + slack) + slack;
+	return v[0] >= -w && v[0] <= w && v[1] >= -w && v[1] <= w && v[2] >= -slack && v[2] <= w;
+}
+
+static void set_feedback_vertex(float *v, float x, float y, float z, float w, float attr)
+{
+	v[0] = x;
+	v[1] = y;
+	v[2] = z;
+	v[3] = w;
+	v[4] = attr;
+}
+
+static void do_feedback_batch_transform_tests()
+{
+	float m[16];
+	D3DMatrix_Identity(m);
+
+	const float in[6][3] = {
+		{  0.0f,  0.0f,  0.5f },
+		{ -2.0f,  0.0f,  0.5f },
+		{  0.0f, -2.0f,  0.5f },
+		{  0.0f,  0.0f, -0.5f },
+		{  2.0f,  2.0f,  0.5f },
+		{  0.0f,  0.0f,  1.5f },
+	};
+	const unsigned char expected[6] = {
+		0,
+		D3DFEEDBACK_CLIP_LEFT,
+		D3DFEEDBACK_CLIP_BOTTOM,
+		D3DFEEDBACK_CLIP_NEAR,
+		D3DFEEDBACK_CLIP_RIGHT | D3DFEEDBACK_CLIP_TOP,
+		D3DFEEDBACK_CLIP_FAR,
+	};
+	float out[6][4];
+	unsigned char codes[6];
+	unsigned int clipAnd, clipOr;
+
+	D3DFeedback_Transform_Ref(m, in[0], 3, sizeof(in[0]), 6, out[0], 4, codes, &clipAnd, &clipOr);
+	assert(memcmp(codes, expected, sizeof(codes)) == 0);
+	assert(clipAnd == 0);
+	assert(clipOr == 0x3F);
+	assert(out[1][0] == -2.0f && out[1][3] == 1.0f);
+
+#if QINDIEGL_MATRIX_SSE
+	memset(codes, 0, sizeof(codes));
+	D3DFeedback_Transform_SSE(m, in[0], 3, sizeof(in[0]), 6, out[0], 4, codes, &clipAnd, &clipOr);
+	assert(memcmp(codes, expected, sizeof(codes)) == 0);
+	assert(clipAnd == 0);
+	assert(clipOr == 0x3F);
+#endif
+
+	// a batch completely to the right
+	const float right[3][2] = { { 1.5f, 0.0f }, { 3.0f, -4.0f }, { 2.0f, 4.0f } };
+	D3DFeedback_Transform(m, right[0], 2, sizeof(right[0]), 3, out[0], 4, codes, &clipAnd, &clipOr);
+	assert(clipAnd == D3DFEEDBACK_CLIP_RIGHT);
+	assert(out[0][2] == 0.0f && out[0][3] == 1.0f);
+
+	// perspective: w is the distance along -z
+	float proj[16];
+	D3DMatrix_FrustumRH(proj, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 100.0f);
+	const float eye[2][3] = { { 0.0f, 0.0f, -10.0f }, { 0.0f, 0.0f, 10.0f } };
+	D3DFeedback_Transform(proj, eye[0], 3, sizeof(eye[0]), 2, out[0], 4, codes, &clipAnd, &clipOr);
+	assert(codes[0] == 0);
+	assert(fabsf(out[0][3] - 10.0f) < 1e-4f);
+	assert(codes[1] & D3DFEEDBACK_CLIP_NEAR);
+}
+
+static void do_feedback_batch_random_tests()
+{
+	float in[FEEDBACK_BATCH_MAX_POINTS][5];
+	float out_ref[FEEDBACK_BATCH_MAX_POINTS * 6];
+	float out_sse[FEEDBACK_BATCH_MAX_POINTS * 6];
+	unsigned char codes_ref[FEEDBACK_BATCH_MAX_POINTS];
+	unsigned char codes_sse[FEEDBACK_BATCH_MAX_POINTS];
+	float m[16];
+
+	for (int iter = 0; iter < 500; iter++)
+	{
+		for (int i = 0; i < 16; i++)
+			m[i] = random_float(4.0f);
+		for (int i = 0; i < FEEDBACK_BATCH_MAX_POINTS; i++)
+			for (int j = 0; j < 5; j++)
+				in[i][j] = random_float(4.0f);
+
+		const int size = 2 + iter % 3;
+		const int count = 1 + rand() % FEEDBACK_BATCH_MAX_POINTS;
+		unsigned int and_ref, or_ref;
+		D3DFeedback_Transform_Ref(m, in[0], size, sizeof(in[0]), count, out_ref, 6, codes_ref, &and_ref, &or_ref);
+
+		bool matches = true;
+		unsigned int and_check = 0xFF, or_check = 0;
+		for (int i = 0; i < count; i++)
+		{
+			float v[4] = { in[i][0], in[i][1], size > 2 ? in[i][2] : 0.0f, size > 3 ? in[i][3] : 1.0f };
+			float expected[4];
+			D3DMatrix_TransformVec4_Ref(expected, m, v);
+			matches = matches && floats_near(&out_ref[i * 6], expected, 4, 1e-5f);
+			matches = matches && codes_ref[i] == D3DFeedback_ClipCode(&out_ref[i * 6]);
+			and_check &= codes_ref[i];
+			or_check |= codes_ref[i];
+		}
+		assertloop(matches, iter);
+		assertloop(and_ref == and_check && or_ref == or_check, iter);
+
+#if QINDIEGL_MATRIX_SSE
+		unsigned int and_sse, or_sse;
+		D3DFeedback_Transform_SSE(m, in[0], size, sizeof(in[0]), count, out_sse, 6, codes_sse, &and_sse, &or_sse);
+		bool same = true;
+		for (int i = 0; i < count; i++)
+			same = same && floats_near(&out_sse[i * 6], &out_ref[i * 6], 4, 1e-5f) && codes_sse[i] == D3DFeedback_ClipCode(&out_sse[i * 6]);
+		assertloop(same, iter);
+#endif
+	}
+}
+
+static void do_feedback_batch_bounds_tests()
+{
+	float m[16];
+	D3DMatrix_Identity(m);
+
+	const float points[4][3] = {
+		{ 0.5f, 2.0f, -1.0f },
+		{ -3.0f, 1.0f, 0.0f },
+		{ 1.0f, -1.0f, 4.0f },
+		{ 0.0f, 0.0f, 0.0f },
+	};
+	float mins[3], maxs[3];
+	D3DFeedback_Bounds(points[0], 3, sizeof(points[0]), 4, mins, maxs);
+	assert(mins[0] == -3.0f && mins[1] == -1.0f && mins[2] == -1.0f);
+	assert(maxs[0] == 1.0f && maxs[1] == 2.0f && maxs[2] == 4.0f);
+	assert(!D3DFeedback_CullBox(m, mins, maxs));
+
+	D3DFeedback_Bounds(points[0], 2, sizeof(points[0]), 4, mins, maxs);
+	assert(mins[2] == 0.0f && maxs[2] == 0.0f);
+
+	// a box around the volume is kept, boxes beside it are not
+	const float around_mins[3] = { -5.0f, -5.0f, -5.0f };
+	const float around_maxs[3] = { 5.0f, 5.0f, 5.0f };
+	assert(!D3DFeedback_CullBox(m, around_mins, around_maxs));
+
+	const float left_mins[3] = { -5.0f, -5.0f, 0.0f };
+	const float left_maxs[3] = { -1.5f, 5.0f, 1.0f };
+	assert(D3DFeedback_CullBox(m, left_mins, left_maxs));
+
+	const float behind_mins[3] = { -0.5f, -0.5f, -3.0f };
+	const float behind_maxs[3] = { 0.5f, 0.5f, -1.0f };
+	assert(D3DFeedback_CullBox(m, behind_mins, behind_maxs));
+}
+
+static void do_feedback_batch_clip_tests()
+{
+	float verts[4 + QINDIEGL_FEEDBACK_CLIP_PLANES][5];
+	float out[4 + QINDIEGL_FEEDBACK_CLIP_PLANES][5];
+	float temp[4 + QINDIEGL_FEEDBACK_CLIP_PLANES][5];
+	float minZ, maxZ;
+
+	// a square twice the size of the volume is clipped to its x and y bounds;
+	// the attribute is x, so it must stay equal to x
+	set_feedback_vertex(verts[0], -2.0f, -2.0f, 0.25f, 1.0f, -2.0f);
+	set_feedback_vertex(verts[1],  2.0f, -2.0f, 0.25f, 1.0f,  2.0f);
+	set_feedback_vertex(verts[2],  2.0f,  2.0f, 0.75f, 1.0f,  2.0f);
+	set_feedback_vertex(verts[3], -2.0f,  2.0f, 0.75f, 1.0f, -2.0f);
+	unsigned int clipOr = 0;
+	for (int i = 0; i < 4; i++)
+		clipOr |= D3DFeedback_ClipCode(verts[i]);
+	int count = D3DFeedback_ClipPolygon(verts[0], 4, 5, clipOr, out[0], temp[0]);
+	assert(count == 4);
+	bool inside = true;
+	for (int i = 0; i < count; i++)
+		inside = inside && feedback_inside(out[i], 1e-5f) && fabsf(out[i][4] - out[i][0]) < 1e-5f;
+	assert(inside);
+	assert(fabsf(D3DFeedback_PolygonArea(out[0], count, 5) - 8.0f) < 1e-4f);
+	D3DFeedback_DepthRange(out[0], count, 5, &minZ, &maxZ);
+	assert(fabsf(minZ - 0.375f) < 1e-5f && fabsf(maxZ - 0.625f) < 1e-5f);
+
+	// clockwise polygons have a negative area
+	set_feedback_vertex(verts[0], 0.0f, 0.0f, 0.5f, 1.0f, 0.0f);
+	set_feedback_vertex(verts[1], 0.0f, 0.5f, 0.5f, 1.0f, 0.0f);
+	set_feedback_vertex(verts[2], 0.5f, 0.0f, 0.5f, 1.0f, 0.0f);
+	assert(D3DFeedback_PolygonArea(verts[0], 3, 5) < 0.0f);
+
+	// a triangle with one corner in front of the near plane: the clipped
+	// polygon keeps the depth range of the volume
+	set_feedback_vertex(verts[0], -0.5f, -0.5f, -1.0f, 1.0f, 0.0f);
+	set_feedback_vertex(verts[1],  0.5f, -0.5f,  0.5f, 1.0f, 0.0f);
+	set_feedback_vertex(verts[2],  0.0f,  0.5f,  0.5f, 1.0f, 0.0f);
+	count = D3DFeedback_ClipPolygon(verts[0], 3, 5, D3DFeedback_ClipCode(verts[0]), verts[0], temp[0]);
+	assert(count == 4);
+	D3DFeedback_DepthRange(verts[0], count, 5, &minZ, &maxZ);
+	assert(minZ == 0.0f && fabsf(maxZ - 0.5f) < 1e-6f);
+
+	// a triangle beside a corner of the volume: no plane has all of its
+	// vertices outside, so only clipping finds that nothing is left
+	set_feedback_vertex(verts[0], 0.0f, 3.0f, 0.5f, 1.0f, 0.0f);
+	set_feedback_vertex(verts[1], 3.0f, 0.0f, 0.5f, 1.0f, 0.0f);
+	set_feedback_vertex(verts[2], 3.0f, 3.0f, 0.5f, 1.0f, 0.0f);
+	unsigned int clipAnd = 0xFF;
+	clipOr = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		clipAnd &= D3DFeedback_ClipCode(verts[i]);
+		clipOr |= D3DFeedback_ClipCode(verts[i]);
+	}
+	assert(clipAnd == 0);
+	assert(D3DFeedback_ClipPolygon(verts[0], 3, 5, clipOr, out[0], temp[0]) == 0);
+
+	// lines
+	float a[5], b[5];
+	set_feedback_vertex(a, -2.0f, 0.0f, 0.5f, 1.0f, -2.0f);
+	set_feedback_vertex(b,  2.0f, 0.0f, 0.5f, 1.0f,  2.0f);
+	assert(D3DFeedback_ClipLine(a, b, 5, D3DFeedback_ClipCode(a) | D3DFeedback_ClipCode(b)));
+	assert(fabsf(a[0] + 1.0f) < 1e-6f && fabsf(b[0] - 1.0f) < 1e-6f);
+	assert(fabsf(a[4] + 1.0f) < 1e-6f && fabsf(b[4] - 1.0f) < 1e-6f);
+
+	set_feedback_vertex(a, 1.5f, -2.0f, 0.5f, 1.0f, 0.0f);
+	set_feedback_vertex(b, 2.0f,  1.5f, 0.5f, 1.0f, 0.0f);
+	assert(!D3DFeedback_ClipLine(a, b, 5, D3DFeedback_ClipCode(a) | D3DFeedback_ClipCode(b)));
+
+	// a diagonal passing beside a corner of the volume
+	set_feedback_vertex(a, 0.0f, 3.0f, 0.5f, 1.0f, 0.0f);
+	set_feedback_vertex(b, 3.0f, 0.0f, 0.5f, 1.0f, 0.0f);
+	assert(!D3DFeedback_ClipLine(a, b, 5, D3DFeedback_ClipCode(a) | D3DFeedback_ClipCode(b)));
+}
+
+static void do_feedback_batch_random_clip_tests()
+{
+	float verts[3][5];
+	float out[3 + QINDIEGL_FEEDBACK_CLIP_PLANES][5];
+	float temp[3 + QINDIEGL_FEEDBACK_CLIP_PLANES][5];
+
+	for (int iter = 0; iter < 1000; iter++)
+	{
+		unsigned int clipAnd = 0xFF, clipOr = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			float w = 0.5f + (float)(rand() % 1000) / 500.0f;
+			set_feedback_vertex(verts[i], random_float(4.0f), random_float(4.0f), random_float(4.0f) * 0.5f + 0.5f, w, 0.0f);
+			verts[i][4] = verts[i][1];
+			unsigned int code = D3DFeedback_ClipCode(verts[i]);
+			clipAnd &= code;
+			clipOr |= code;
+		}
+
+		int count = D3DFeedback_ClipPolygon(verts[0], 3, 5, clipOr, out[0], temp[0]);
+		bool valid = count == 0 || (count >= 3 && count <= 3 + QINDIEGL_FEEDBACK_CLIP_PLANES);
+		if (clipAnd)
+			valid = valid && count == 0;
+		if (!clipOr)
+			valid = valid && count == 3 && memcmp(out, verts, sizeof(verts)) == 0;
+		for (int i = 0; i < count; i++)
+			valid = valid && feedback_inside(out[i], 1e-4f) && floats_near(&out[i][4], &out[i][1], 1, 1e-4f);
+		assertloop(valid, iter);
+
+		// the clipped polygon keeps the winding of the triangle
+		if (count >= 3)
+		{
+			float before = D3DFeedback_PolygonArea(verts[0], 3, 5);
+			float after = D3DFeedback_PolygonArea(out[0], count, 5);
+			assertloop(after == 0.0f || (before > 0.0f) == (after > 0.0f), iter);
+		}
+	}
+}
+
+static void do_feedback_batch_viewport_tests()
+{
+	// 640x480 viewport at (10, 20) with depth range 0.25..0.75
+	const float scale[4] = { 320.0f, 240.0f, 0.5f, 0.0f };
+	const float offset[4] = { 330.0f, 260.0f, 0.25f, 0.0f };
+
+	float verts[4][5];
+	set_feedback_vertex(verts[0], 0.0f, 0.0f, 0.0f, 1.0f, 7.0f);
+	set_feedback_vertex(verts[1], -2.0f, 2.0f, 2.0f, 2.0f, 7.0f);
+	set_feedback_vertex(verts[2], 1.0f, -1.0f, 0.5f, 1.0f, 7.0f);
+	set_feedback_vertex(verts[3], 0.0f, 0.0f, 0.0f, 0.0f, 7.0f);
+	const float expected[4][4] = {
+		{  330.0f, 260.0f, 0.25f, 1.0f },
+		{   10.0f, 500.0f, 0.75f, 2.0f },
+		{  650.0f,  20.0f, 0.5f,  1.0f },
+		{  330.0f, 260.0f, 0.25f, 0.0f },
+	};
+
+	float out[4][4];
+	D3DFeedback_ViewportMap_Ref(verts[0], 4, 5, scale, offset, out[0]);
+	assert(floats_near(out[0], expected[0], 16, 1e-6f));
+
+	float random_verts[FEEDBACK_BATCH_MAX_POINTS][6];
+	float out_ref[FEEDBACK_BATCH_MAX_POINTS][4];
+	float out_sse[FEEDBACK_BATCH_MAX_POINTS][4];
+	for (int iter = 0; iter < 200; iter++)
+	{
+		for (int i = 0; i < FEEDBACK_BATCH_MAX_POINTS; i++)
+		{
+			for (int j = 0; j < 6; j++)
+				random_verts[i][j] = random_float(4.0f);
+			random_verts[i][3] = fabsf(random_verts[i][3]);
+		}
+		const int count = 1 + rand() % FEEDBACK_BATCH_MAX_POINTS;
+		D3DFeedback_ViewportMap_Ref(random_verts[0], count, 6, scale, offset, out_ref[0]);
+
+		bool matches = true;
+		for (int i = 0; i < count; i++)
+		{
+			const float *v = random_verts[i];
+			float rw = v[3] > 0.0f ? 1.0f / v[3] : 0.0f;
+			float check[4] = { v[0] * rw * scale[0] + offset[0], v[1] * rw * scale[1] + offset[1], v[2] * rw * scale[2] + offset[2], v[3] };
+			matches = matches && floats_near(out_ref[i], check, 4, 1e-5f);
+		}
+		assertloop(matches, iter);
+
+#if QINDIEGL_MATRIX_SSE
+		D3DFeedback_ViewportMap_SSE(random_verts[0], count, 6, scale, offset, out_sse[0]);
+		assertloop(floats_near(out_sse[0], out_ref[0], count * 4, 1e-5f), iter);
+#else
+		(void)out_sse;
+#endif
+	}
+}
+
+void do_feedback_batch_tests()
+{
+	random_init();
+
+	do_feedback_batch_transform_tests();
+	do_feedback_batch_random_tests();
+	do_feedback_batch_bounds_tests();
+	do_feedback_batch_clip_tests();
+	do_feedback_batch_random_clip_tests();
+	do_feedback_batch_viewport_tests();
+}
@@ -0,0 +1,987 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+#include <map>
+#include <vector>
+
+#include "tests.h"
+
+#include "../code/d3d_matrix_math.hpp"
+#include "../code/d3d_list_optimizer.hpp"
+
+// GL values used by the recorded lists
+#define LT_POINTS					0x0000
+#define LT_LINES					0x0001
+#define LT_TRIANGLES				0x0004
+#define LT_ONE						1
+#define LT_SRC_ALPHA				0x0302
+#define LT_ONE_MINUS_SRC_ALPHA		0x0303
+#define LT_FRONT					0x0404
+#define LT_BACK						0x0405
+#define LT_FRONT_AND_BACK			0x0408
+#define LT_CULL_FACE				0x0B44
+#define LT_DEPTH_TEST				0x0B71
+#define LT_BLEND					0x0BE2
+#define LT_TEXTURE_2D				0x0DE1
+#define LT_LESS						0x0201
+#define LT_LEQUAL					0x0203
+#define LT_AMBIENT					0x1200
+#define LT_DIFFUSE					0x1201
+#define LT_AMBIENT_AND_DIFFUSE		0x1602
+#define LT_POSITION					0x1203
+#define LT_LIGHT0					0x4000
+#define LT_COLOR_BUFFER_BIT			0x4000
+#define LT_TEXTURE_MIN_FILTER		0x2801
+#define LT_NEAREST					0x2600
+#define LT_LINEAR					0x2601
+#define LT_LINE						0x1B01
+#define LT_MODELVIEW				0x1700
+#define LT_PROJECTION				0x1701
+#define LT_TEXTURE					0x1702
+#define LT_MODULATE					0x2100
+#define LT_REPLACE					0x1E01
+#define LT_TEXTURE_ENV_MODE			0x2200
+#define LT_TEXTURE_ENV				0x2300
+#define LT_TEXTURE0					0x84C0
+
+static unsigned lt_float(float f)
+{
+	unsigned u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+static float lt_unfloat(unsigned u)
+{
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+
+//==================================================================================
+// Recording: builds programs the way d3d_lists.cpp records them
+//==================================================================================
+
+struct list_builder
+{
+	D3DListProgram program;
+	unsigned color;
+	unsigned inherit;
+	bool normal;
+
+	list_builder() : color(0xFFFFFFFF), inherit(D3DLIST_INHERIT_ALL), normal(false) {}
+
+	void cmd(D3DListOp op, const unsigned *args, int numArgs)
+	{
+		program.commands.push_back(D3DList_CommandHeader(op, numArgs));
+		for (int i = 0; i < numArgs; i++)
+			program.commands.push_back(args[i]);
+	}
+	void cmd(D3DListOp op)
+	{
+		cmd(op, nullptr, 0);
+	}
+	void cmd(D3DListOp op, unsigned a)
+	{
+		cmd(op, &a, 1);
+	}
+	void cmd(D3DListOp op, unsigned a, unsigned b)
+	{
+		const unsigned args[2] = { a, b };
+		cmd(op, args, 2);
+	}
+	void cmdf(D3DListOp op, float a, float b, float c)
+	{
+		const unsigned args[3] = { lt_float(a), lt_float(b), lt_float(c) };
+		cmd(op, args, 3);
+	}
+	void cmdf(D3DListOp op, float a, float b, float c, float d)
+	{
+		const unsigned args[4] = { lt_float(a), lt_float(b), lt_float(c), lt_float(d) };
+		cmd(op, args, 4);
+	}
+	void vector(D3DListOp op, unsigned e0, unsigned e1, float a, float b, float c, float d)
+	{
+		const unsigned args[6] = { e0, e1, lt_float(a), lt_float(b), lt_float(c), lt_float(d) };
+		cmd(op, args, 6);
+	}
+	void matrix(D3DListOp op, const float *m)
+	{
+		unsigned args[16];
+		for (int i = 0; i < 16; i++)
+			args[i] = lt_float(m[i]);
+		cmd(op, args, 16);
+	}
+	void current(unsigned mask, unsigned c)
+	{
+		unsigned args[D3DLIST_CURRENT_ARGS];
+		memset(args, 0, sizeof(args));
+		args[0] = mask;
+		args[1] = c;
+		cmd(D3DLIST_OP_CURRENT, args, D3DLIST_CURRENT_ARGS);
+		// vertices from here on have their color set by the list
+		inherit &= ~mask;
+	}
+
+	void vertex(float x, float y, float z)
+	{
+		D3DListVertex v;
+		memset(&v, 0, sizeof(v));
+		v.position[0] = x;
+		v.position[1] = y;
+		v.position[2] = z;
+		v.position[3] = 1.0f;
+		v.normal[2] = 1.0f;
+		v.color = color;
+		v.color2 = 0;
+		v.inherit = inherit;
+		v.texCoord[0][0] = x * 0.5f;
+		v.texCoord[0][1] = y * 0.5f;
+		v.texCoord[0][3] = 1.0f;
+		program.vertices.push_back(v);
+	}
+
+	// one primitive in a run of its own, as recorded after any other command
+	void begin_run(D3DListPrimClass primClass)
+	{
+		D3DListRun run;
+		memset(&run, 0, sizeof(run));
+		run.primClass = primClass;
+		run.normal = normal;
+		run.texCoordBits = 1;
+		run.firstVertex = (int)program.vertices.size();
+		run.firstIndex = (int)program.indices.size();
+		cmd(D3DLIST_OP_DRAW, (unsigned)program.runs.size());
+		program.runs.push_back(run);
+	}
+	void end_run()
+	{
+		D3DListRun *run = &program.runs.back();
+		run->numVertices = (int)program.vertices.size() - run->firstVertex;
+		run->numIndices = (int)program.indices.size() - run->firstIndex;
+		for (int i = run->firstVertex; i < (int)program.vertices.size(); i++)
+			run->inherit |= program.vertices[i].inherit;
+	}
+	void index(int i)
+	{
+		program.indices.push_back((unsigned)(program.vertices.size() - program.runs.back().firstVertex + i));
+	}
+
+	// quad as (0,1,2),(0,2,3), the last quad of the run can be extended
+	void quad(float x, float y, float size, bool newRun = true)
+	{
+		if (newRun)
+			begin_run(D3DLIST_PRIM_TRIANGLES);
+		index(0); index(1); index(2);
+		index(0); index(2); index(3);
+		vertex(x, y, 0.0f);
+		vertex(x + size, y, 0.0f);
+		vertex(x + size, y + size, 0.0f);
+		vertex(x, y + size, 0.0f);
+		end_run();
+	}
+	void line(float x, float y)
+	{
+		begin_run(D3DLIST_PRIM_LINES);
+		index(0); index(1);
+		vertex(x, y, 0.0f);
+		vertex(x + 1.0f, y, 0.0f);
+		end_run();
+	}
+	void point(float x, float y)
+	{
+		begin_run(D3DLIST_PRIM_POINTS);
+		vertex(x, y, 0.0f);
+		end_run();
+	}
+};
+
+//==================================================================================
+// Reference interpreter: executes a program against a simple model of the GL
+// state and traces everything a draw or a nested list can see
+//==================================================================================
+
+typedef std::vector<unsigned> lt_key;
+typedef std::map<lt_key, std::vector<unsigned> > lt_state_map;
+
+struct list_trace
+{
+	std::vector<unsigned> exact;
+	std::vector<float> approx;
+};
+
+struct list_interpreter
+{
+	lt_state_map state;
+	unsigned unit;
+	unsigned mode;
+	unsigned listBase;
+	std::map<unsigned, std::vector<std::vector<float> > > stacks;
+	std::vector<lt_state_map> attribStack;
+	std::vector<unsigned> attribUnit;
+	unsigned color;
+	list_trace trace;
+
+	list_interpreter(unsigned initialUnit, unsigned initialMode)
+	{
+		unit = initialUnit;
+		mode = initialMode;
+		listBase = 0;
+		color = 0xFF808080;
+	}
+
+	std::vector<float> &top(unsigned stackMode, unsigned stackUnit)
+	{
+		unsigned id = stackMode * 64 + (stackMode == LT_TEXTURE ? stackUnit - LT_TEXTURE0 : 0);
+		std::vector<std::vector<float> > &stack = stacks[id];
+		if (stack.empty())
+		{
+			stack.push_back(std::vector<float>(16));
+			D3DMatrix_Identity(stack.back().data());
+		}
+		return stack.back();
+	}
+	std::vector<float> &top()
+	{
+		return top(mode, unit);
+	}
+	void multiply(const float *m)
+	{
+		float *t = top().data();
+		D3DMatrix_Multiply_Ref(t, m, t);
+	}
+
+	void set(unsigned cls, unsigned u, unsigned k0, unsigned k1, const unsigned *args, int numArgs, unsigned op)
+	{
+		lt_key key;
+		key.push_back(cls);
+		key.push_back(u);
+		key.push_back(k0);
+		key.push_back(k1);
+		std::vector<unsigned> value(args, args + numArgs);
+		value.push_back(op);
+		state[key] = value;
+	}
+
+	void trace_state()
+	{
+		trace.exact.push_back(unit);
+		trace.exact.push_back(mode);
+		trace.exact.push_back(listBase);
+		trace.exact.push_back((unsigned)state.size());
+		for (lt_state_map::const_iterator it = state.begin(); it != state.end(); ++it)
+		{
+			trace.exact.insert(trace.exact.end(), it->first.begin(), it->first.end());
+			trace.exact.push_back((unsigned)it->second.size());
+			trace.exact.insert(trace.exact.end(), it->second.begin(), it->second.end());
+		}
+	}
+	void trace_matrices()
+	{
+		for (std::map<unsigned, std::vector<std::vector<float> > >::const_iterator it = stacks.begin(); it != stacks.end(); ++it)
+		{
+			trace.exact.push_back(it->first);
+			trace.exact.push_back((unsigned)it->second.size());
+			trace.approx.insert(trace.approx.end(), it->second.back().begin(), it->second.back().end());
+		}
+	}
+
+	// draws may be merged, so every vertex carries the state it is drawn with
+	void trace_vertex(const D3DListVertex *v, const D3DListRun *run, unsigned digest)
+	{
+		float eye[4], clip[4], tc[4];
+		D3DMatrix_TransformVec4_Ref(eye, top(LT_MODELVIEW, 0).data(), v->position);
+		D3DMatrix_TransformVec4_Ref(clip, top(LT_PROJECTION, 0).data(), eye);
+		D3DMatrix_TransformVec4_Ref(tc, top(LT_TEXTURE, LT_TEXTURE0).data(), v->texCoord[0]);
+		trace.approx.insert(trace.approx.end(), clip, clip + 4);
+		trace.approx.insert(trace.approx.end(), tc, tc + 4);
+		trace.exact.push_back(run->primClass);
+		trace.exact.push_back(run->normal);
+		trace.exact.push_back(run->xyzw);
+		trace.exact.push_back(run->texCoordBits);
+		trace.exact.push_back(digest);
+		trace.exact.push_back((v->inherit & D3DLIST_INHERIT_COLOR) ? color : v->color);
+		trace.exact.push_back(lt_float(v->normal[2]));
+	}
+
+	void draw(const D3DListProgram *program, const D3DListRun *run)
+	{
+		list_trace saved;
+		saved.exact.swap(trace.exact);
+		trace_state();
+		unsigned digest = 2166136261u;
+		for (size_t i = 0; i < trace.exact.size(); i++)
+			digest = (digest ^ trace.exact[i]) * 16777619u;
+		saved.exact.swap(trace.exact);
+
+		if (run->primClass == D3DLIST_PRIM_POINTS)
+		{
+			for (int i = 0; i < run->numVertices; i++)
+				trace_vertex(&program->vertices[run->firstVertex + i], run, digest);
+			return;
+		}
+		for (int i = 0; i < run->numIndices; i++)
+			trace_vertex(&program->vertices[run->firstVertex + program->indices[run->firstIndex + i]], run, digest);
+	}
+
+	void execute(const D3DListProgram *program)
+	{
+		const unsigned *cmd = program->commands.data();
+		const unsigned *end = cmd + program->commands.size();
+		while (cmd < end)
+		{
+			const D3DListOp op = D3DList_CommandOp(cmd[0]);
+			const int numArgs = D3DList_CommandNumArgs(cmd[0]);
+			const unsigned *args = cmd + 1;
+			float m[16];
+			cmd = args + numArgs;
+
+			switch (op)
+			{
+			case D3DLIST_OP_DRAW:
+				draw(program, &program->runs[args[0]]);
+				break;
+			case D3DLIST_OP_CURRENT:
+				if (args[0] & D3DLIST_INHERIT_COLOR)
+					color = args[1];
+				break;
+			case D3DLIST_OP_CALL_LIST:
+			case D3DLIST_OP_CALL_LISTS:
+				// a nested list sees all the state, and its effects are unknown
+				trace.exact.push_back(0xCA11u);
+				trace.exact.insert(trace.exact.end(), args, args + numArgs);
+				trace_state();
+				trace_matrices();
+				state.clear();
+				unit = LT_TEXTURE0 + 3;
+				break;
+			case D3DLIST_OP_LIST_BASE:
+				listBase = args[0];
+				break;
+			case D3DLIST_OP_ENABLE:
+			case D3DLIST_OP_DISABLE:
+				// only the texture caps are per unit
+				set(D3DLIST_OP_ENABLE, args[0] == LT_TEXTURE_2D ? unit : 0, args[0], 0, nullptr, 0, op);
+				break;
+			case D3DLIST_OP_PUSH_ATTRIB:
+				attribStack.push_back(state);
+				attribUnit.push_back(unit);
+				break;
+			case D3DLIST_OP_POP_ATTRIB:
+				if (!attribStack.empty())
+				{
+					state = attribStack.back();
+					unit = attribUnit.back();
+					attribStack.pop_back();
+					attribUnit.pop_back();
+				}
+				break;
+			case D3DLIST_OP_BIND_TEXTURE:
+				set(op, unit, args[0], 0, args + 1, 1, 0);
+				break;
+			case D3DLIST_OP_ACTIVE_TEXTURE:
+				unit = args[0];
+				break;
+			case D3DLIST_OP_TEX_ENVFV:
+			case D3DLIST_OP_TEX_ENVIV:
+				set(D3DLIST_OP_TEX_ENVFV, unit, args[0], args[1], args + 2, numArgs - 2, op);
+				break;
+			case D3DLIST_OP_LIGHTFV:
+				set(op, 0, args[0], args[1], args + 2, numArgs - 2, 0);
+				break;
+			case D3DLIST_OP_TEX_GENFV:
+			case D3DLIST_OP_TEX_GENIV:
+				set(D3DLIST_OP_TEX_GENFV, unit, args[0], args[1], args + 2, numArgs - 2, op);
+				break;
+			case D3DLIST_OP_TEX_PARAMETERFV:
+			case D3DLIST_OP_CLEAR:
+			case D3DLIST_OP_EVAL_MESH1:
+			case D3DLIST_OP_EVAL_MESH2:
+			case D3DLIST_OP_VIEWPORT:
+				// changes the bound texture or draws with the state as it is
+				trace.exact.push_back(op);
+				trace.exact.insert(trace.exact.end(), args, args + numArgs);
+				trace_state();
+				break;
+			case D3DLIST_OP_MATERIALFV:
+				for (int face = 0; face < 2; face++)
+				{
+					if (args[0] != LT_FRONT_AND_BACK && args[0] != (face ? LT_BACK : LT_FRONT))
+						continue;
+					if (args[1] == LT_AMBIENT_AND_DIFFUSE)
+					{
+						set(op, 0, face, LT_AMBIENT, args + 2, numArgs - 2, 0);
+						set(op, 0, face, LT_DIFFUSE, args + 2, numArgs - 2, 0);
+					}
+					else
+						set(op, 0, face, args[1], args + 2, numArgs - 2, 0);
+				}
+				break;
+			case D3DLIST_OP_MATRIX_MODE:
+				mode = args[0];
+				break;
+			case D3DLIST_OP_LOAD_IDENTITY:
+				D3DMatrix_Identity(top().data());
+				break;
+			case D3DLIST_OP_LOAD_MATRIX:
+				for (int i = 0; i < 16; i++)
+					top()[i] = lt_unfloat(args[i]);
+				break;
+			case D3DLIST_OP_MULT_MATRIX:
+				for (int i = 0; i < 16; i++)
+					m[i] = lt_unfloat(args[i]);
+				multiply(m);
+				break;
+			case D3DLIST_OP_PUSH_MATRIX:
+				{
+					std::vector<float> copy = top();
+					stacks[mode * 64 + (mode == LT_TEXTURE ? unit - LT_TEXTURE0 : 0)].push_back(copy);
+				}
+				break;
+			case D3DLIST_OP_POP_MATRIX:
+				{
+					top();
+					std::vector<std::vector<float> > &stack = stacks[mode * 64 + (mode == LT_TEXTURE ? unit - LT_TEXTURE0 : 0)];
+					if (stack.size() > 1)
+						stack.pop_back();
+				}
+				break;
+			case D3DLIST_OP_ROTATE:
+				D3DMatrix_RotationAxis(m, lt_unfloat(args[0]) * (3.141592654f / 180.0f), lt_unfloat(args[1]), lt_unfloat(args[2]), lt_unfloat(args[3]));
+				multiply(m);
+				break;
+			case D3DLIST_OP_SCALE:
+				D3DMatrix_Scaling(m, lt_unfloat(args[0]), lt_unfloat(args[1]), lt_unfloat(args[2]));
+				multiply(m);
+				break;
+			case D3DLIST_OP_TRANSLATE:
+				D3DMatrix_Translation(m, lt_unfloat(args[0]), lt_unfloat(args[1]), lt_unfloat(args[2]));
+				multiply(m);
+				break;
+			case D3DLIST_OP_FRUSTUM:
+				D3DMatrix_FrustumRH(m, lt_unfloat(args[0]), lt_unfloat(args[1]), lt_unfloat(args[2]), lt_unfloat(args[3]), lt_unfloat(args[4]), lt_unfloat(args[5]));
+				multiply(m);
+				break;
+			case D3DLIST_OP_ORTHO:
+				D3DMatrix_OrthoRH(m, lt_unfloat(args[0]), lt_unfloat(args[1]), lt_unfloat(args[2]), lt_unfloat(args[3]), lt_unfloat(args[4]), lt_unfloat(args[5]));
+				multiply(m);
+				break;
+			case D3DLIST_OP_STENCIL_FUNC:
+			case D3DLIST_OP_STENCIL_OP:
+			case D3DLIST_OP_ACTIVE_STENCIL_FACE:
+				// which face these set depends on state the list does not track
+				trace.exact.push_back(op);
+				trace.exact.insert(trace.exact.end(), args, args + numArgs);
+				break;
+			default:
+				set(op, 0, 0, 0, args, numArgs, 0);
+				break;
+			}
+		}
+
+		// the state a list leaves behind is seen by whatever comes next
+		trace.exact.push_back(0xE4Du);
+		trace_state();
+		trace_matrices();
+	}
+};
+
+static bool list_traces_match(const list_trace &a, const list_trace &b)
+{
+	if (a.exact != b.exact || a.approx.size() != b.approx.size())
+		return false;
+	for (size_t i = 0; i < a.approx.size(); i++)
+	{
+		float scale = fabsf(a.approx[i]) > 1.0f ? fabsf(a.approx[i]) : 1.0f;
+		if (!(fabsf(a.approx[i] - b.approx[i]) <= 1e-4f * scale))
+			return false;
+	}
+	return true;
+}
+
+// Runs the original and the optimized program from a few different starting
+// states; the optimizer must not depend on any of them
+static bool list_output_matches(const D3DListProgram &original, const D3DListProgram &optimized)
+{
+	static const unsigned c_units[2] = { LT_TEXTURE0, LT_TEXTURE0 + 1 };
+	static const unsigned c_modes[3] = { LT_MODELVIEW, LT_PROJECTION, LT_TEXTURE };
+
+	for (int u = 0; u < 2; u++)
+	{
+		for (int m = 0; m < 3; m++)
+		{
+			list_interpreter a(c_units[u], c_modes[m]), b(c_units[u], c_modes[m]);
+			a.execute(&original);
+			b.execute(&optimized);
+			if (!list_traces_match(a.trace, b.trace))
+				return false;
+		}
+	}
+	return true;
+}
+
+static int list_count_ops(const D3DListProgram &program, D3DListOp op)
+{
+	int count = 0;
+	for (size_t i = 0; i < program.commands.size(); i += 1 + D3DList_CommandNumArgs(program.commands[i]))
+	{
+		if (D3DList_CommandOp(program.commands[i]) == op)
+			count++;
+	}
+	return count;
+}
+
+static D3DListProgram list_optimize(const D3DListProgram &program, D3DListOptimizeStats *stats)
+{
+	D3DListOptimizeParams params;
+	D3DList_DefaultOptimizeParams(&params, LT_PROJECTION);
+	D3DListProgram optimized = program;
+	D3DList_Optimize(&optimized, &params, stats);
+	return optimized;
+}
+
+//==================================================================================
+// Corpus
+//==================================================================================
+
+// the same texture bound before each quad of a strip of quads
+static void do_list_optimizer_bind_tests()
+{
+	list_builder lb;
+	for (int i = 0; i < 4; i++)
+	{
+		lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 5);
+		lb.quad((float)i, 0.0f, 1.0f);
+	}
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	assert(stats.commandsBefore == 8 && stats.commandsAfter == 2);
+	assert(stats.drawsBefore == 4 && stats.drawsAfter == 1);
+	assert(stats.verticesBefore == 16 && stats.verticesAfter == 10);
+	assert(optimized.runs.size() == 1 && optimized.runs[0].numIndices == 24);
+}
+
+// state set and overwritten before the draws read it
+static void do_list_optimizer_state_tests()
+{
+	list_builder lb;
+	lb.cmd(D3DLIST_OP_ENABLE, LT_BLEND);
+	lb.cmd(D3DLIST_OP_BLEND_FUNC, LT_ONE, LT_ONE);
+	lb.cmd(D3DLIST_OP_DISABLE, LT_BLEND);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_BLEND);
+	lb.cmd(D3DLIST_OP_BLEND_FUNC, LT_SRC_ALPHA, LT_ONE_MINUS_SRC_ALPHA);
+	lb.cmd(D3DLIST_OP_DEPTH_MASK, 0);
+	lb.quad(0.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_DEPTH_MASK, 0);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_BLEND);
+	lb.quad(2.0f, 0.0f, 1.0f);
+	// the last value set is the state the list leaves behind
+	lb.cmd(D3DLIST_OP_DEPTH_FUNC, LT_LESS);
+	lb.cmd(D3DLIST_OP_DEPTH_FUNC, LT_LEQUAL);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	assert(stats.commandsAfter == 5);
+	assert(list_count_ops(optimized, D3DLIST_OP_ENABLE) == 1);
+	assert(list_count_ops(optimized, D3DLIST_OP_DISABLE) == 0);
+	assert(list_count_ops(optimized, D3DLIST_OP_BLEND_FUNC) == 1);
+	assert(list_count_ops(optimized, D3DLIST_OP_DEPTH_FUNC) == 1);
+	assert(stats.drawsAfter == 1);
+}
+
+// texture units: redundant unit switches, and state of a unit not known yet
+static void do_list_optimizer_unit_tests()
+{
+	list_builder lb;
+	lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 9);
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0 + 1);
+	lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 3);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_TEXTURE_2D);
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0);
+	lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 9);
+	lb.quad(0.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0 + 1);
+	lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 3);
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0);
+	lb.vector(D3DLIST_OP_TEX_ENVFV, LT_TEXTURE_ENV, LT_TEXTURE_ENV_MODE, (float)LT_MODULATE, 0.0f, 0.0f, 0.0f);
+	lb.quad(1.0f, 0.0f, 1.0f);
+	lb.vector(D3DLIST_OP_TEX_ENVFV, LT_TEXTURE_ENV, LT_TEXTURE_ENV_MODE, (float)LT_MODULATE, 0.0f, 0.0f, 0.0f);
+	lb.quad(2.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	// the first bind may have gone to unit 1, so the second one stays
+	assert(list_count_ops(optimized, D3DLIST_OP_BIND_TEXTURE) == 3);
+	assert(list_count_ops(optimized, D3DLIST_OP_ACTIVE_TEXTURE) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_TEX_ENVFV) == 1);
+	assert(stats.drawsAfter == 2);
+}
+
+// matrix calls folded into one, except where they may go to the projection matrix
+static void do_list_optimizer_matrix_tests()
+{
+	float m[16];
+	D3DMatrix_RotationAxis(m, 0.3f, 1.0f, 2.0f, 3.0f);
+	m[3] = 0.01f;
+
+	list_builder lb;
+	lb.cmdf(D3DLIST_OP_TRANSLATE, 1.0f, 2.0f, 3.0f);
+	lb.cmdf(D3DLIST_OP_TRANSLATE, -4.0f, 0.5f, 0.0f);
+	lb.cmdf(D3DLIST_OP_ROTATE, 30.0f, 0.0f, 0.0f, 1.0f);
+	lb.cmdf(D3DLIST_OP_ROTATE, 15.0f, 0.0f, 0.0f, 1.0f);
+	lb.cmdf(D3DLIST_OP_SCALE, 2.0f, 2.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_MATRIX_MODE, LT_MODELVIEW);
+	lb.cmd(D3DLIST_OP_PUSH_MATRIX);
+	lb.cmdf(D3DLIST_OP_TRANSLATE, 1.0f, 2.0f, 3.0f);
+	lb.cmdf(D3DLIST_OP_ROTATE, 45.0f, 1.0f, 1.0f, 0.0f);
+	lb.cmdf(D3DLIST_OP_SCALE, 0.5f, 2.0f, 1.0f);
+	lb.matrix(D3DLIST_OP_MULT_MATRIX, m);
+	lb.quad(0.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_POP_MATRIX);
+	lb.cmd(D3DLIST_OP_MATRIX_MODE, LT_PROJECTION);
+	lb.cmdf(D3DLIST_OP_SCALE, 1.0f, -1.0f, 1.0f);
+	lb.cmdf(D3DLIST_OP_TRANSLATE, 0.0f, 0.0f, -1.0f);
+	lb.cmd(D3DLIST_OP_MATRIX_MODE, LT_MODELVIEW);
+	lb.quad(0.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	// translate + rotate + scale in an unknown mode, one of each kind after folding
+	assert(list_count_ops(optimized, D3DLIST_OP_TRANSLATE) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_ROTATE) == 1);
+	assert(list_count_ops(optimized, D3DLIST_OP_SCALE) == 2);
+	// the modelview group became one glMultMatrix
+	assert(list_count_ops(optimized, D3DLIST_OP_MULT_MATRIX) == 1);
+	assert(stats.commandsAfter == stats.commandsBefore - 5);
+}
+
+// current attributes between draws keep them apart
+static void do_list_optimizer_current_tests()
+{
+	list_builder lb;
+	lb.quad(0.0f, 0.0f, 1.0f);
+	lb.quad(1.0f, 0.0f, 1.0f);
+	lb.current(D3DLIST_INHERIT_COLOR, 0xFFFF0000);
+	lb.color = 0xFFFF0000;
+	lb.quad(2.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	assert(stats.drawsAfter == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_CURRENT) == 1);
+	assert(optimized.runs[0].inherit & D3DLIST_INHERIT_COLOR);
+	assert(!(optimized.runs[1].inherit & D3DLIST_INHERIT_COLOR));
+}
+
+// selection names and feedback tokens between draws keep them apart and are never dropped
+static void do_list_optimizer_name_tests()
+{
+	list_builder lb;
+	lb.cmd(D3DLIST_OP_INIT_NAMES);
+	lb.cmd(D3DLIST_OP_PUSH_NAME, 1);
+	lb.quad(0.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_LOAD_NAME, 2);
+	lb.quad(1.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_LOAD_NAME, 2);
+	lb.quad(2.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_PASS_THROUGH, lt_float(5.0f));
+	lb.cmd(D3DLIST_OP_PASS_THROUGH, lt_float(5.0f));
+	lb.quad(3.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_POP_NAME);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	assert(stats.drawsAfter == 4);
+	assert(stats.commandsAfter == stats.commandsBefore);
+	assert(list_count_ops(optimized, D3DLIST_OP_LOAD_NAME) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_PASS_THROUGH) == 2);
+}
+
+// only the texture caps are set per unit, blending is the same on every unit
+static void do_list_optimizer_cap_tests()
+{
+	list_builder lb;
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_BLEND);
+	lb.quad(0.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0 + 1);
+	lb.cmd(D3DLIST_OP_DISABLE, LT_BLEND);
+	lb.quad(1.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_BLEND);
+	lb.quad(2.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_TEXTURE_2D);
+	lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0 + 1);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_TEXTURE_2D);
+	lb.quad(3.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	assert(stats.commandsAfter == stats.commandsBefore);
+	assert(list_count_ops(optimized, D3DLIST_OP_ENABLE) == 4);
+}
+
+// nested lists, attribute stacks and aliased material parameters
+static void do_list_optimizer_barrier_tests()
+{
+	list_builder lb;
+	lb.cmd(D3DLIST_OP_BLEND_FUNC, LT_ONE, LT_ONE);
+	lb.cmd(D3DLIST_OP_CALL_LIST, 7);
+	lb.cmd(D3DLIST_OP_BLEND_FUNC, LT_ONE, LT_ONE);
+	lb.quad(0.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_CULL_FACE);
+	lb.cmd(D3DLIST_OP_PUSH_ATTRIB, 0xFFFFFFFF);
+	lb.cmd(D3DLIST_OP_DISABLE, LT_CULL_FACE);
+	lb.cmd(D3DLIST_OP_POP_ATTRIB);
+	lb.cmd(D3DLIST_OP_ENABLE, LT_CULL_FACE);
+	lb.vector(D3DLIST_OP_MATERIALFV, LT_FRONT_AND_BACK, LT_AMBIENT, 0.1f, 0.2f, 0.3f, 1.0f);
+	lb.vector(D3DLIST_OP_MATERIALFV, LT_FRONT_AND_BACK, LT_AMBIENT_AND_DIFFUSE, 0.5f, 0.5f, 0.5f, 1.0f);
+	lb.vector(D3DLIST_OP_MATERIALFV, LT_FRONT_AND_BACK, LT_AMBIENT, 0.1f, 0.2f, 0.3f, 1.0f);
+	lb.quad(0.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	// only the first ambient, which the third one overwrites, goes
+	assert(stats.commandsAfter == stats.commandsBefore - 1);
+	assert(list_count_ops(optimized, D3DLIST_OP_BLEND_FUNC) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_ENABLE) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_MATERIALFV) == 2);
+}
+
+// glClear, glTexParameter and glEvalMesh see the state set before them, lights set again are kept
+static void do_list_optimizer_read_tests()
+{
+	const unsigned grid4[3] = { 4, lt_float(0.0f), lt_float(1.0f) };
+	const unsigned grid8[3] = { 8, lt_float(0.0f), lt_float(1.0f) };
+	const unsigned mesh[3] = { LT_LINE, 0, 4 };
+
+	list_builder lb;
+	lb.cmd(D3DLIST_OP_MAP_GRID1, grid4, 3);
+	lb.cmd(D3DLIST_OP_EVAL_MESH1, mesh, 3);
+	lb.cmd(D3DLIST_OP_MAP_GRID1, grid8, 3);
+	lb.cmd(D3DLIST_OP_EVAL_MESH1, mesh, 3);
+	lb.cmdf(D3DLIST_OP_CLEAR_COLOR, 1.0f, 0.0f, 0.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_CLEAR, LT_COLOR_BUFFER_BIT);
+	lb.cmdf(D3DLIST_OP_CLEAR_COLOR, 0.0f, 0.0f, 1.0f, 1.0f);
+	lb.cmd(D3DLIST_OP_CLEAR, LT_COLOR_BUFFER_BIT);
+	lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 1);
+	lb.vector(D3DLIST_OP_TEX_PARAMETERFV, LT_TEXTURE_2D, LT_TEXTURE_MIN_FILTER, (float)LT_NEAREST, 0.0f, 0.0f, 0.0f);
+	lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 2);
+	lb.vector(D3DLIST_OP_TEX_PARAMETERFV, LT_TEXTURE_2D, LT_TEXTURE_MIN_FILTER, (float)LT_LINEAR, 0.0f, 0.0f, 0.0f);
+	lb.vector(D3DLIST_OP_LIGHTFV, LT_LIGHT0, LT_POSITION, 0.0f, 0.0f, 1.0f, 0.0f);
+	lb.cmdf(D3DLIST_OP_TRANSLATE, 1.0f, 0.0f, 0.0f);
+	lb.vector(D3DLIST_OP_LIGHTFV, LT_LIGHT0, LT_POSITION, 0.0f, 0.0f, 1.0f, 0.0f);
+	lb.quad(0.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	// the first light position is overwritten before the draw
+	assert(stats.commandsAfter == stats.commandsBefore - 1);
+	assert(list_count_ops(optimized, D3DLIST_OP_CLEAR_COLOR) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_BIND_TEXTURE) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_LIGHTFV) == 1);
+	assert(list_count_ops(optimized, D3DLIST_OP_MAP_GRID1) == 2);
+}
+
+// glFrustum and glOrtho end a fold, glViewport reads the state, stencil funcs and ops are all kept
+static void do_list_optimizer_view_tests()
+{
+	const unsigned frustum[6] = { lt_float(-1.0f), lt_float(1.0f), lt_float(-1.0f), lt_float(1.0f), lt_float(1.0f), lt_float(100.0f) };
+	const unsigned viewport[4] = { 0, 0, 640, 480 };
+	const unsigned scissor1[4] = { 0, 0, 320, 240 };
+	const unsigned scissor2[4] = { 320, 240, 320, 240 };
+	const unsigned stencilFunc1[3] = { LT_LESS, 1, 0xFF };
+	const unsigned stencilFunc2[3] = { LT_LEQUAL, 1, 0xFF };
+
+	list_builder lb;
+	lb.cmdf(D3DLIST_OP_TRANSLATE, 1.0f, 0.0f, 0.0f);
+	lb.cmd(D3DLIST_OP_FRUSTUM, frustum, 6);
+	lb.cmdf(D3DLIST_OP_TRANSLATE, 0.0f, 1.0f, 0.0f);
+	lb.cmd(D3DLIST_OP_DEPTH_RANGE, lt_float(0.0f), lt_float(0.5f));
+	lb.cmd(D3DLIST_OP_VIEWPORT, viewport, 4);
+	lb.cmd(D3DLIST_OP_DEPTH_RANGE, lt_float(0.5f), lt_float(1.0f));
+	lb.cmd(D3DLIST_OP_SCISSOR, scissor1, 4);
+	lb.cmd(D3DLIST_OP_SCISSOR, scissor2, 4);
+	lb.cmd(D3DLIST_OP_STENCIL_MASK, 0xFF);
+	lb.cmd(D3DLIST_OP_STENCIL_MASK, 0xFF);
+	lb.cmd(D3DLIST_OP_STENCIL_FUNC, stencilFunc1, 3);
+	lb.cmd(D3DLIST_OP_ACTIVE_STENCIL_FACE, LT_BACK);
+	lb.cmd(D3DLIST_OP_STENCIL_FUNC, stencilFunc2, 3);
+	lb.quad(0.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	// the first scissor box is overwritten, the second stencil mask changes nothing
+	assert(stats.commandsAfter == stats.commandsBefore - 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_TRANSLATE) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_DEPTH_RANGE) == 2);
+	assert(list_count_ops(optimized, D3DLIST_OP_SCISSOR) == 1);
+	assert(list_count_ops(optimized, D3DLIST_OP_STENCIL_FUNC) == 2);
+}
+
+// lines and points merge like triangles, points are not welded
+static void do_list_optimizer_prim_tests()
+{
+	list_builder lb;
+	lb.cmd(D3DLIST_OP_LINE_WIDTH, lt_float(2.0f));
+	lb.line(0.0f, 0.0f);
+	lb.cmd(D3DLIST_OP_LINE_WIDTH, lt_float(2.0f));
+	lb.line(1.0f, 0.0f);
+	lb.cmd(D3DLIST_OP_POINT_SIZE, lt_float(4.0f));
+	lb.point(0.0f, 0.0f);
+	lb.cmd(D3DLIST_OP_POINT_SIZE, lt_float(4.0f));
+	lb.point(0.0f, 0.0f);
+	lb.quad(0.0f, 0.0f, 1.0f);
+
+	D3DListOptimizeStats stats;
+	D3DListProgram optimized = list_optimize(lb.program, &stats);
+	assert(list_output_matches(lb.program, optimized));
+	assert(stats.drawsAfter == 3);
+	assert(optimized.runs[0].primClass == D3DLIST_PRIM_LINES && optimized.runs[0].numVertices == 3);
+	assert(optimized.runs[1].primClass == D3DLIST_PRIM_POINTS && optimized.runs[1].numVertices == 2);
+}
+
+// random lists over a small set of values, so that state repeats often
+static void do_list_optimizer_random_tests()
+{
+	static const unsigned c_caps[3] = { LT_BLEND, LT_DEPTH_TEST, LT_TEXTURE_2D };
+	static const unsigned c_modes[3] = { LT_MODELVIEW, LT_PROJECTION, LT_TEXTURE };
+
+	random_init();
+
+	for (int iter = 0; iter < 300; iter++)
+	{
+		list_builder lb;
+		const int length = 4 + rand() % 40;
+		for (int i = 0; i < length; i++)
+		{
+			const float v = (float)(rand() % 3 - 1);
+			switch (rand() % 23)
+			{
+			case 0: case 1: case 2:
+				lb.quad((float)(rand() % 3), (float)(rand() % 2), 1.0f);
+				break;
+			case 3:
+				if (rand() % 2)
+					lb.line((float)(rand() % 3), 0.0f);
+				else
+					lb.point((float)(rand() % 3), 0.0f);
+				break;
+			case 4:
+				lb.cmd((rand() % 2) ? D3DLIST_OP_ENABLE : D3DLIST_OP_DISABLE, c_caps[rand() % 3]);
+				break;
+			case 5:
+				lb.cmd(D3DLIST_OP_BIND_TEXTURE, LT_TEXTURE_2D, 1 + rand() % 2);
+				break;
+			case 6:
+				lb.cmd(D3DLIST_OP_ACTIVE_TEXTURE, LT_TEXTURE0 + rand() % 2);
+				break;
+			case 7:
+				lb.cmd(D3DLIST_OP_BLEND_FUNC, LT_ONE, (rand() % 2) ? LT_ONE : LT_SRC_ALPHA);
+				break;
+			case 8:
+				lb.vector(D3DLIST_OP_TEX_ENVFV, LT_TEXTURE_ENV, LT_TEXTURE_ENV_MODE, (float)((rand() % 2) ? LT_MODULATE : LT_REPLACE), 0.0f, 0.0f, 0.0f);
+				break;
+			case 9:
+				lb.vector(D3DLIST_OP_MATERIALFV, (rand() % 2) ? LT_FRONT : LT_FRONT_AND_BACK, (rand() % 2) ? LT_AMBIENT : LT_AMBIENT_AND_DIFFUSE, v, 0.5f, 0.5f, 1.0f);
+				break;
+			case 10:
+				lb.cmd(D3DLIST_OP_MATRIX_MODE, c_modes[rand() % 3]);
+				break;
+			case 11:
+				lb.cmdf(D3DLIST_OP_TRANSLATE, v, 1.0f, -v);
+				break;
+			case 12:
+				lb.cmdf(D3DLIST_OP_ROTATE, 30.0f * (float)(rand() % 4), 0.0f, (float)(rand() % 2), 1.0f);
+				break;
+			case 13:
+				lb.cmdf(D3DLIST_OP_SCALE, 2.0f, 0.5f + (float)(rand() % 2), 1.0f);
+				break;
+			case 14:
+				lb.cmd((rand() % 2) ? D3DLIST_OP_PUSH_MATRIX : D3DLIST_OP_POP_MATRIX);
+				break;
+			case 15:
+				if (rand() % 2)
+					lb.cmd(D3DLIST_OP_LOAD_IDENTITY);
+				else
+				{
+					float m[16];
+					D3DMatrix_Translation(m, v, 0.0f, 2.0f);
+					lb.matrix(D3DLIST_OP_MULT_MATRIX, m);
+				}
+				break;
+			case 16:
+				if (rand() % 2)
+					lb.cmd(D3DLIST_OP_PUSH_ATTRIB, 0xFFFFFFFF);
+				else
+					lb.cmd(D3DLIST_OP_POP_ATTRIB);
+				break;
+			case 17:
+				lb.cmd(D3DLIST_OP_CALL_LIST, 1 + rand() % 3);
+				break;
+			case 18:
+				lb.color = (rand() % 2) ? 0xFF00FF00 : 0xFF0000FF;
+				lb.current(D3DLIST_INHERIT_COLOR, lb.color);
+				break;
+			case 19:
+				// draws with and without glNormal must not merge
+				lb.normal = !lb.normal;
+				break;
+			case 20:
+				if (rand() % 2)
+					lb.cmdf(D3DLIST_OP_CLEAR_COLOR, v, 0.0f, 0.0f, 1.0f);
+				else
+					lb.cmd(D3DLIST_OP_CLEAR, LT_COLOR_BUFFER_BIT);
+				break;
+			case 21:
+				lb.vector(D3DLIST_OP_TEX_PARAMETERFV, LT_TEXTURE_2D, LT_TEXTURE_MIN_FILTER, (float)((rand() % 2) ? LT_NEAREST : LT_LINEAR), 0.0f, 0.0f, 0.0f);
+				break;
+			default:
+				lb.cmd(D3DLIST_OP_DEPTH_MASK, rand() % 2);
+				break;
+			}
+		}
+
+		D3DListOptimizeStats stats;
+		D3DListProgram optimized = list_optimize(lb.program, &stats);
+		assertloop(list_output_matches(lb.program, optimized), iter);
+		assertloop(stats.commandsAfter <= stats.commandsBefore, iter);
+		assertloop(stats.verticesAfter <= stats.verticesBefore, iter);
+		assertloop(stats.drawsAfter <= stats.drawsBefore, iter);
+
+		// optimizing again finds nothing more to merge
+		D3DListOptimizeStats again;
+		D3DListProgram twice = list_optimize(optimized, &again);
+		assertloop(list_output_matches(lb.program, twice), iter);
+		assertloop(again.drawsAfter == again.drawsBefore, iter);
+		assertloop(again.verticesAfter == again.verticesBefore, iter);
+	}
+}
+
+void do_list_optimizer_tests()
+{
+	do_list_optimizer_bind_tests();
+	do_list_optimizer_state_tests();
+	do_list_optimizer_unit_tests();
+	do_list_optimizer_matrix_tests();
+	do_list_optimizer_current_tests();
+	do_list_optimizer_name_tests();
+	do_list_optimizer_cap_tests();
+	do_list_optimizer_barrier_tests();
+	do_list_optimizer_read_tests();
+	do_list_optimizer_view_tests();
+	do_list_optimizer_prim_tests();
+	do_list_optimizer_random_tests();
+}
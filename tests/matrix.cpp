@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "tests.h"
+
+#include "../code/d3d_matrix_math.hpp"
+
+static void get_matrix(float *m)
+{
+	for (int i = 0; i < 16; i++)
+		m[i] = random_float(10.0f);
+}
+
+// strictly diagonally dominant, so it has an inverse that float precision can reach
+static void get_invertible_matrix(float *m)
+{
+	get_matrix(m);
+	for (int i = 0; i < 4; i++)
+	{
+		float sum = 1.0f;
+		for (int j = 0; j < 4; j++)
+			if (j != i)
+				sum += fabsf(m[i * 4 + j]);
+		m[i * 5] = m[i * 5] < 0.0f ? m[i * 5] - sum : m[i * 5] + sum;
+	}
+}
+
+static void get_affine_matrix(float *m)
+{
+	float r[16], s[16], t[16];
+	D3DMatrix_RotationAxis(r, random_float(10.0f), random_float(10.0f), random_float(10.0f), random_float(10.0f));
+	D3DMatrix_Scaling(s, 0.5f + fabsf(random_float(10.0f)), 0.5f + fabsf(random_float(10.0f)), 0.5f + fabsf(random_float(10.0f)));
+	D3DMatrix_Translation(t, random_float(10.0f), random_float(10.0f), random_float(10.0f));
+	D3DMatrix_Multiply_Ref(m, s, r);
+	D3DMatrix_Multiply_Ref(m, m, t);
+}
+
+static bool matrix_is_near_identity(const float *m, float tolerance)
+{
+	float identity[16];
+	D3DMatrix_Identity(identity);
+	return floats_near(m, identity, 16, tolerance);
+}
+
+static void do_matrix_builder_tests()
+{
+	float m[16], v[4];
+	const float x[3] = { 1.0f, 0.0f, 0.0f };
+	const float p[3] = { 1.0f, 2.0f, 3.0f };
+
+	// glRotatef(90, 0, 0, 1) takes +X to +Y
+	D3DMatrix_RotationAxis(m, 3.14159265f * 0.5f, 0.0f, 0.0f, 2.0f);
+	D3DMatrix_TransformNormal(v, m, x);
+	assert(fabsf(v[0]) < 1e-6f && fabsf(v[1] - 1.0f) < 1e-6f && fabsf(v[2]) < 1e-6f);
+
+	D3DMatrix_Translation(m, 10.0f, 20.0f, 30.0f);
+	D3DMatrix_TransformPoint(v, m, p);
+	assert(v[0] == 11.0f && v[1] == 22.0f && v[2] == 33.0f && v[3] == 1.0f);
+	D3DMatrix_TransformNormal(v, m, p);
+	assert(v[0] == 1.0f && v[1] == 2.0f && v[2] == 3.0f);
+
+	D3DMatrix_Scaling(m, 2.0f, 3.0f, 4.0f);
+	D3DMatrix_TransformCoord(v, m, p);
+	assert(v[0] == 2.0f && v[1] == 6.0f && v[2] == 12.0f);
+
+	// near plane maps to z = 0 and far plane to z = 1 in D3D clip space
+	const float zn[3] = { 0.0f, 0.0f, -1.0f };
+	const float zf[3] = { 0.0f, 0.0f, -100.0f };
+	D3DMatrix_FrustumRH(m, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 100.0f);
+	D3DMatrix_TransformCoord(v, m, zn);
+	assert(fabsf(v[2]) < 1e-6f);
+	D3DMatrix_TransformCoord(v, m, zf);
+	assert(fabsf(v[2] - 1.0f) < 1e-5f);
+
+	D3DMatrix_OrthoRH(m, 0.0f, 640.0f, 0.0f, 480.0f, -1.0f, 1.0f);
+	const float corner[3] = { 640.0f, 480.0f, 1.0f };
+	D3DMatrix_TransformCoord(v, m, corner);
+	assert(fabsf(v[0] - 1.0f) < 1e-6f && fabsf(v[1] - 1.0f) < 1e-6f && fabsf(v[2]) < 1e-6f);
+	assert(D3DMatrix_IsAffine(m));
+
+	D3DMatrix_Identity(m);
+	assert(D3DMatrix_IsIdentity(m));
+	m[14] = 1.0f;
+	assert(!D3DMatrix_IsIdentity(m));
+
+	float singular[16];
+	memset(singular, 0, sizeof(singular));
+	D3DMatrix_Identity(m);
+	assert(!D3DMatrix_Inverse_Ref(m, singular));
+	assert(!D3DMatrix_InverseAffine_Ref(m, singular));
+	assert(D3DMatrix_IsIdentity(m));
+}
+
+static void do_matrix_kernel_tests()
+{
+	const float tolerance = 1e-4f;
+
+	for (int iter = 0; iter < 1000; iter++)
+	{
+		float a[16], b[16], ref[16], out[16], tmp[16];
+		get_invertible_matrix(a);
+		get_matrix(b);
+
+		// multiply, also in place as D3DMatrixStack does it
+		D3DMatrix_Multiply_Ref(ref, a, b);
+		for (int i = 0; i < 4; i++)
+		{
+			float sum = a[4 + 0] * b[0 + i] + a[4 + 1] * b[4 + i] + a[4 + 2] * b[8 + i] + a[4 + 3] * b[12 + i];
+			assertloop(fabsf(ref[4 + i] - sum) <= tolerance * (1.0f + fabsf(sum)), iter);
+		}
+		memcpy(tmp, b, sizeof(tmp));
+		D3DMatrix_Multiply_Ref(tmp, a, tmp);
+		assertloop(memcmp(tmp, ref, sizeof(ref)) == 0, iter);
+
+		// transpose
+		D3DMatrix_Transpose_Ref(out, a);
+		D3DMatrix_Transpose_Ref(out, out);
+		assertloop(memcmp(out, a, sizeof(out)) == 0, iter);
+
+		// general inverse
+		if (D3DMatrix_Inverse_Ref(out, a))
+		{
+			D3DMatrix_Multiply_Ref(tmp, a, out);
+			assertloop(matrix_is_near_identity(tmp, 1e-3f), iter);
+		}
+
+		// affine inverse agrees with the general one
+		float affine[16], inv_affine[16];
+		get_affine_matrix(affine);
+		assertloop(D3DMatrix_IsAffine(affine), iter);
+		float affine_prod[16];
+		D3DMatrix_Multiply_Ref(affine_prod, affine, b);
+		D3DMatrix_MultiplyAffine_Ref(out, affine, b);
+		assertloop(floats_near(out, affine_prod, 16, tolerance), iter);
+		assertloop(D3DMatrix_Inverse_Ref(out, affine), iter);
+		assertloop(D3DMatrix_InverseAffine_Ref(inv_affine, affine), iter);
+		assertloop(floats_near(out, inv_affine, 16, tolerance), iter);
+
+#if QINDIEGL_MATRIX_SSE
+		D3DMatrix_Multiply_SSE(out, a, b);
+		assertloop(floats_near(out, ref, 16, tolerance), iter);
+		memcpy(tmp, a, sizeof(tmp));
+		D3DMatrix_Multiply_SSE(tmp, tmp, b);
+		assertloop(floats_near(tmp, ref, 16, tolerance), iter);
+
+		D3DMatrix_Transpose_Ref(ref, a);
+		D3DMatrix_Transpose_SSE(out, a);
+		assertloop(memcmp(out, ref, sizeof(out)) == 0, iter);
+
+		bool ok_ref = D3DMatrix_Inverse_Ref(ref, a);
+		bool ok_sse = D3DMatrix_Inverse_SSE(out, a);
+		assertloop(ok_ref == ok_sse, iter);
+		if (ok_ref && ok_sse)
+		{
+			D3DMatrix_Multiply_Ref(tmp, a, out);
+			assertloop(matrix_is_near_identity(tmp, 1e-3f), iter);
+		}
+
+		memcpy(tmp, b, sizeof(tmp));
+		D3DMatrix_MultiplyAffine_SSE(tmp, affine, tmp);
+		assertloop(floats_near(tmp, affine_prod, 16, tolerance), iter);
+
+		assertloop(D3DMatrix_InverseAffine_SSE(out, affine), iter);
+		assertloop(floats_near(out, inv_affine, 16, tolerance), iter);
+
+		float v[4] = { random_float(10.0f), random_float(10.0f), random_float(10.0f), random_float(10.0f) };
+		float v_ref[4], v_sse[4];
+		D3DMatrix_TransformVec4_Ref(v_ref, a, v);
+		D3DMatrix_TransformVec4_SSE(v_sse, a, v);
+		assertloop(floats_near(v_sse, v_ref, 4, tolerance), iter);
+#endif
+	}
+}
+
+static void do_matrix_type_tests()
+{
+	float m[16], a[16], inv[16], ref[16];
+
+	D3DMatrix_Identity(m);
+	assert(D3DMatrix_Classify(m) == D3DMT_IDENTITY);
+	D3DMatrix_Translation(m, 1.0f, 2.0f, 3.0f);
+	assert(D3DMatrix_Classify(m) == D3DMT_TRANSLATION);
+	D3DMatrix_Scaling(m, 1.0f, 2.0f, 3.0f);
+	assert(D3DMatrix_Classify(m) == D3DMT_SCALE);
+	D3DMatrix_RotationAxis(m, 0.7f, 1.0f, 2.0f, 3.0f);
+	assert(D3DMatrix_Classify(m) == D3DMT_RIGID);
+	D3DMatrix_OrthoRH(m, 0.0f, 640.0f, 0.0f, 480.0f, -1.0f, 1.0f);
+	assert(D3DMatrix_Classify(m) == D3DMT_SCALE);
+	m[15] = 2.0f;
+	assert(D3DMatrix_Classify(m) == D3DMT_ORTHO);
+	D3DMatrix_FrustumRH(m, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 100.0f);
+	assert(D3DMatrix_Classify(m) == D3DMT_PROJECTIVE);
+
+	assert(D3DMatrix_CombineTypes(D3DMT_IDENTITY, D3DMT_RIGID) == D3DMT_RIGID);
+	assert(D3DMatrix_CombineTypes(D3DMT_TRANSLATION, D3DMT_SCALE) == D3DMT_SCALE);
+	assert(D3DMatrix_CombineTypes(D3DMT_SCALE, D3DMT_RIGID) == D3DMT_AFFINE);
+	assert(D3DMatrix_CombineTypes(D3DMT_AFFINE, D3DMT_ORTHO) == D3DMT_ORTHO);
+	assert(D3DMatrix_CombineTypes(D3DMT_RIGID, D3DMT_PROJECTIVE) == D3DMT_PROJECTIVE);
+
+	for (int iter = 0; iter < 200; iter++)
+	{
+		float t[3] = { random_float(10.0f), random_float(10.0f), random_float(10.0f) };
+		float s[3] = { 0.5f + fabsf(random_float(10.0f)), 0.5f + fabsf(random_float(10.0f)), 0.5f + fabsf(random_float(10.0f)) };
+
+		for (int type = D3DMT_IDENTITY; type <= D3DMT_PROJECTIVE; type++)
+		{
+			switch (type)
+			{
+			case D3DMT_IDENTITY: D3DMatrix_Identity(m); break;
+			case D3DMT_TRANSLATION: D3DMatrix_Translation(m, t[0], t[1], t[2]); break;
+			case D3DMT_SCALE: D3DMatrix_Scaling(m, s[0], s[1], s[2]); m[12] = t[0]; m[13] = t[1]; m[14] = t[2]; break;
+			case D3DMT_RIGID: D3DMatrix_RotationAxis(m, random_float(10.0f), t[0], t[1], t[2] + 0.01f); m[12] = t[2]; m[13] = t[0]; m[14] = t[1]; break;
+			case D3DMT_AFFINE: get_affine_matrix(m); break;
+			case D3DMT_ORTHO: get_affine_matrix(m); m[15] = s[0]; break;
+			default: get_invertible_matrix(m); break;
+			}
+
+			int classified = D3DMatrix_Classify(m);
+			assertloop(classified <= type, iter * 16 + type);
+			if (D3DMatrix_Inverse_Ref(ref, m))
+			{
+				assertloop(D3DMatrix_InverseTyped(inv, m, (D3DMatrixType)classified), iter * 16 + type);
+				assertloop(floats_near(inv, ref, 16, 1e-3f), iter * 16 + type);
+				memcpy(a, m, sizeof(a));
+				assertloop(D3DMatrix_InverseTyped(a, a, (D3DMatrixType)classified), iter * 16 + type);
+				assertloop(memcmp(a, inv, sizeof(a)) == 0, iter * 16 + type);
+			}
+		}
+	}
+}
+
+void do_matrix_tests()
+{
+	random_init();
+
+	do_matrix_builder_tests();
+	do_matrix_kernel_tests();
+	do_matrix_type_tests();
+}
@@ -25,6 +25,11 @@ extern "C" {
     void random_init();
     void random_text(uc8_t* out, int size);
     void random_bytes(uc8_t* out, int size);
+    // -limit..limit in 2001 steps
+    float random_float(float limit);
+
+    // true if a and b differ by at most tolerance, relative to the larger magnitude above 1
+    int floats_near(const float* a, const float* b, int count, float tolerance);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "tests.h"
+
+#include "../code/d3d_texgen_batch.hpp"
+
+#define TEXGEN_BATCH_MAX_VERTS	13
+
+static void get_batch_modelview(float *m, bool affine)
+{
+	float r[16], t[16];
+	D3DMatrix_RotationAxis(r, random_float(10.0f), random_float(10.0f), random_float(10.0f), random_float(10.0f));
+	D3DMatrix_Translation(t, random_float(10.0f), random_float(10.0f), random_float(10.0f) - 20.0f);
+	D3DMatrix_Multiply_Ref(m, r, t);
+	if (!affine)
+	{
+		// small perspective terms, w stays well away from zero
+		m[3] = random_float(10.0f) * 0.001f;
+		m[7] = random_float(10.0f) * 0.001f;
+		m[11] = random_float(10.0f) * 0.001f;
+		m[15] = 1.0f;
+	}
+}
+
+static void do_texgen_batch_known_tests()
+{
+	D3DTexGenBatch batch;
+	float mv[16], out[2][4];
+	const float pos[4] = { 1.0f, 2.0f, 3.0f, 1.0f };
+	const float nrm[3] = { 0.0f, 0.0f, 1.0f };
+
+	memset(&batch, 0, sizeof(batch));
+	D3DMatrix_Translation(mv, 0.0f, 0.0f, -10.0f);
+	batch.modelview = mv;
+	batch.modelviewAffine = true;
+	batch.numStages = 2;
+
+	// object-linear on s, eye-linear on t; q untouched
+	batch.stages[0].enabled = 0x3;
+	batch.stages[0].mode[0] = D3DTGB_OBJECT_LINEAR;
+	batch.stages[0].mode[1] = D3DTGB_EYE_LINEAR;
+	batch.stages[0].plane[0][0] = 1.0f;
+	batch.stages[0].plane[0][3] = 0.5f;
+	batch.stages[0].plane[1][2] = 1.0f;
+	batch.stages[0].output = out[0];
+
+	// normal map on s, t, r, q
+	batch.stages[1].enabled = 0xF;
+	for (int j = 0; j < 4; j++)
+		batch.stages[1].mode[j] = D3DTGB_NORMAL_MAP;
+	batch.stages[1].output = out[1];
+
+	for (int sse = 0; sse < 2; sse++)
+	{
+		for (int i = 0; i < 4; i++)
+			out[0][i] = out[1][i] = -1.0f;
+		D3DMatrix_UseSSE(sse != 0);
+		D3DTexGen_Batch(&batch, pos, nrm, 1);
+		assert(out[0][0] == 1.5f);
+		assert(out[0][1] == -7.0f);
+		assert(out[0][2] == -1.0f && out[0][3] == -1.0f);
+		assert(out[1][0] == 0.0f && out[1][1] == 0.0f && out[1][2] == 1.0f && out[1][3] == 1.0f);
+	}
+
+	// looking straight at a surface facing the viewer reflects back at it
+	const float front[4] = { 0.0f, 0.0f, -5.0f, 1.0f };
+	D3DMatrix_Identity(mv);
+	batch.numStages = 1;
+	batch.stages[0].enabled = 0xF;
+	for (int j = 0; j < 4; j++)
+		batch.stages[0].mode[j] = D3DTGB_REFLECTION_MAP;
+	for (int sse = 0; sse < 2; sse++)
+	{
+		D3DMatrix_UseSSE(sse != 0);
+		D3DTexGen_Batch(&batch, front, nrm, 1);
+		assert(fabsf(out[0][0]) < 1e-6f && fabsf(out[0][1]) < 1e-6f && fabsf(out[0][2] - 1.0f) < 1e-6f && out[0][3] == 1.0f);
+	}
+	D3DMatrix_UseSSE(false);
+}
+
+static void do_texgen_batch_random_tests()
+{
+	static const D3DTexGenBatchMode modes[] = {
+		D3DTGB_NONE, D3DTGB_OBJECT_LINEAR, D3DTGB_EYE_LINEAR,
+		D3DTGB_SPHERE_MAP, D3DTGB_REFLECTION_MAP, D3DTGB_NORMAL_MAP
+	};
+	float positions[TEXGEN_BATCH_MAX_VERTS * 4];
+	float normals[TEXGEN_BATCH_MAX_VERTS * 3];
+	float out_ref[QINDIEGL_TEXGEN_BATCH_STAGES][TEXGEN_BATCH_MAX_VERTS * 4];
+	float out_sse[QINDIEGL_TEXGEN_BATCH_STAGES][TEXGEN_BATCH_MAX_VERTS * 4];
+	float mv[16], nm[16];
+
+	for (int iter = 0; iter < 500; iter++)
+	{
+		D3DTexGenBatch batch;
+		memset(&batch, 0, sizeof(batch));
+
+		get_batch_modelview(mv, (iter & 1) == 0);
+		batch.modelview = mv;
+		batch.modelviewAffine = (iter & 1) == 0;
+		if (iter & 2)
+		{
+			get_batch_modelview(nm, true);
+			batch.normalMatrix = nm;
+		}
+		batch.numStages = 1 + rand() % QINDIEGL_TEXGEN_BATCH_STAGES;
+		for (int i = 0; i < batch.numStages; i++)
+		{
+			batch.stages[i].enabled = rand() % 16;
+			for (int j = 0; j < 4; j++)
+			{
+				batch.stages[i].mode[j] = modes[rand() % (sizeof(modes) / sizeof(modes[0]))];
+				for (int k = 0; k < 4; k++)
+					batch.stages[i].plane[j][k] = random_float(10.0f);
+			}
+		}
+
+		const int count = 1 + iter % TEXGEN_BATCH_MAX_VERTS;
+		for (int v = 0; v < count; v++)
+		{
+			positions[v * 4 + 0] = random_float(10.0f);
+			positions[v * 4 + 1] = random_float(10.0f);
+			positions[v * 4 + 2] = random_float(10.0f);
+			positions[v * 4 + 3] = (iter & 4) ? random_float(10.0f) : 1.0f;
+			normals[v * 3 + 0] = random_float(10.0f);
+			normals[v * 3 + 1] = random_float(10.0f);
+			normals[v * 3 + 2] = random_float(10.0f);
+			float len = sqrtf(normals[v * 3 + 0] * normals[v * 3 + 0] + normals[v * 3 + 1] * normals[v * 3 + 1] + normals[v * 3 + 2] * normals[v * 3 + 2]);
+			for (int k = 0; k < 3; k++)
+				normals[v * 3 + k] = (len > 0.0f) ? normals[v * 3 + k] / len : 0.0f;
+		}
+
+		// coordinates that are not generated must be left alone
+		for (int i = 0; i < batch.numStages; i++)
+		{
+			for (int k = 0; k < count * 4; k++)
+				out_ref[i][k] = out_sse[i][k] = 12345.0f;
+		}
+
+		for (int i = 0; i < batch.numStages; i++)
+			batch.stages[i].output = out_ref[i];
+		D3DTexGen_Batch_Ref(&batch, positions, normals, count);
+
+#if QINDIEGL_MATRIX_SSE
+		for (int i = 0; i < batch.numStages; i++)
+			batch.stages[i].output = out_sse[i];
+		D3DTexGen_Batch_SSE(&batch, positions, normals, count);
+
+		bool same = true;
+		for (int i = 0; i < batch.numStages; i++)
+			same = same && floats_near(out_ref[i], out_sse[i], count * 4, 1e-3f);
+		assertloop(same, iter);
+#endif
+
+		bool untouched = true;
+		for (int i = 0; i < batch.numStages; i++)
+		{
+			for (int v = 0; v < count; v++)
+			{
+				for (int j = 0; j < 4; j++)
+				{
+					if (!(batch.stages[i].enabled & (1 << j)))
+						untouched = untouched && out_ref[i][v * 4 + j] == 12345.0f;
+				}
+			}
+		}
+		assertloop(untouched, iter);
+	}
+}
+
+void do_texgen_batch_tests()
+{
+	random_init();
+
+	do_texgen_batch_known_tests();
+	do_texgen_batch_random_tests();
+}